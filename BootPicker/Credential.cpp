@@ -4,12 +4,13 @@
 #endif
 #include <unknwn.h>
 #include "Credential.h"
+#include "BitmapCache.h"
+#include "Log.h"
 #include "guid.h"
+#include "Trace.h"
 #include <Windows.h>
 #include <ShlObj.h>
 #pragma warning(disable:4995)
-#include <string>
-#include <fstream>
 #include <strsafe.h>
 
 #pragma comment(lib, "user32.lib")
@@ -18,69 +19,38 @@
 // Credential ////////////////////////////////////////////////////////
 
 Credential::Credential():
-    _cRef(1),
+    _punkOwner(NULL),
+    _ptile(NULL),
+    _pStringPool(NULL),
+    _dwLabel(0),
     _pCredProvCredentialEvents(NULL)
 {
     DllAddRef();
-
-    ZeroMemory(_rgCredProvFieldDescriptors, sizeof(_rgCredProvFieldDescriptors));
-    ZeroMemory(_rgFieldStatePairs, sizeof(_rgFieldStatePairs));
-    ZeroMemory(_rgFieldStrings, sizeof(_rgFieldStrings));
-
-	// build the path to the log file based on this dll's name
-	wchar_t* pwszDllPath = new wchar_t[260];
-	GetModuleFileName(HINST_THISDLL, pwszDllPath, 260);
-	std::wstring logPath(pwszDllPath);
-	delete[]pwszDllPath;
-	logPath.replace(logPath.end()-3,logPath.end(),L"log");
-
-	debug = std::wofstream(logPath);
 }
 
 Credential::~Credential()
 {
-	if (debug.is_open()) debug.close();
-
-    for (int i = 0; i < ARRAYSIZE(_rgFieldStrings); i++)
-    {
-        CoTaskMemFree(_rgFieldStrings[i]);
-        CoTaskMemFree(_rgCredProvFieldDescriptors[i].pszLabel);
-    }
-
     DllRelease();
 }
 
 
-// Initializes one credential with the field information passed in.
-HRESULT Credential::Initialize(
+// Initializes one credential with its row of the tile table and its label in the
+// string pool, both of which the owner keeps.
+void Credential::Initialize(
+    __in IUnknown* punkOwner,
     __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
-    __in const CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR* rgcpfd,
-    __in const FIELD_STATE_PAIR* rgfsp
+    __in const TILE* ptile,
+    __in const StringPool* pStringPool,
+    __in DWORD dwLabel
     )
 {
-    HRESULT hr = S_OK;
-
+    _punkOwner = punkOwner;
     _cpus = cpus;
+    _ptile = ptile;
+    _pStringPool = pStringPool;
+    _dwLabel = dwLabel;
 
-    // Copy the field descriptors for each field. This is useful if you want to vary the field
-    // descriptors based on what Usage scenario the credential was created for.
-    for (DWORD i = 0; SUCCEEDED(hr) && i < ARRAYSIZE(_rgCredProvFieldDescriptors); i++)
-    {
-        _rgFieldStatePairs[i] = rgfsp[i];
-        hr = FieldDescriptorCopy(rgcpfd[i], &_rgCredProvFieldDescriptors[i]);
-    }
-
-    // Initialize the String value of all the fields.
-    if (SUCCEEDED(hr))
-    {
-        hr = SHStrDupW(L"Reboot to Mac OS X", &_rgFieldStrings[SFI_LARGE_TEXT]);
-    }
-    if (SUCCEEDED(hr))
-    {
-        hr = SHStrDupW(L"Reboot to Mac OS X", &_rgFieldStrings[SFI_COMMAND_LINK]);
-    }
-
-    return S_OK;
+    _bootSwitch.Initialize(this, SFI_LARGE_TEXT, BootSwitchGetDefaultSteps(), ptile->bHasPartition ? &ptile->sp : NULL);
 }
 
 // LogonUI calls this in order to give us a callback in case we need to notify it of anything.
@@ -88,24 +58,34 @@ HRESULT Credential::Advise(
     __in ICredentialProviderCredentialEvents* pcpce
     )
 {
+    HRESULT hr = S_OK;
+    CTraceScope trace(TM_CREDENTIAL_ADVISE, TRACE_NO_FIELD, &hr);
+
     if (_pCredProvCredentialEvents != NULL)
     {
         _pCredProvCredentialEvents->Release();
     }
     _pCredProvCredentialEvents = pcpce;
     _pCredProvCredentialEvents->AddRef();
-    return S_OK;
+
+    _bootSwitch.Advise(pcpce);
+    return hr;
 }
 
 // LogonUI calls this to tell us to release the callback.
 HRESULT Credential::UnAdvise()
 {
+    HRESULT hr = S_OK;
+    CTraceScope trace(TM_CREDENTIAL_UNADVISE, TRACE_NO_FIELD, &hr);
+
     if (_pCredProvCredentialEvents)
     {
         _pCredProvCredentialEvents->Release();
     }
     _pCredProvCredentialEvents = NULL;
-    return S_OK;
+
+    _bootSwitch.UnAdvise();
+    return hr;
 }
 
 // LogonUI calls this function when our tile is selected (zoomed)
@@ -116,12 +96,15 @@ HRESULT Credential::UnAdvise()
 // selected, you would do it here.
 HRESULT Credential::SetSelected(__out BOOL* pbAutoLogon)
 {
+    HRESULT hr = S_OK;
+    CTraceScope trace(TM_CREDENTIAL_SETSELECTED, TRACE_NO_FIELD, &hr);
+
     *pbAutoLogon = FALSE;
-	if (SetMacDefaultBoot())
-	{
-		Reboot();
-	}
-    return S_OK;
+
+    // Switch to the Mac in the background. How that goes, failures included,
+    // shows up in SFI_LARGE_TEXT rather than in what we return to LogonUI.
+    _bootSwitch.Start();
+    return hr;
 }
 
 // Similarly to SetSelected, LogonUI calls this when your tile was selected
@@ -130,6 +113,7 @@ HRESULT Credential::SetSelected(__out BOOL* pbAutoLogon)
 HRESULT Credential::SetDeselected()
 {
     HRESULT hr = S_OK;
+    CTraceScope trace(TM_CREDENTIAL_SETDESELECTED, TRACE_NO_FIELD, &hr);
     return hr;
 }
 
@@ -142,12 +126,13 @@ HRESULT Credential::GetFieldState(
     )
 {
     HRESULT hr;
+    CTraceScope trace(TM_CREDENTIAL_GETFIELDSTATE, dwFieldID, &hr);
 
     // Validate our parameters.
-    if ((dwFieldID < ARRAYSIZE(_rgFieldStatePairs)) && pcpfs && pcpfis)
+    if ((dwFieldID < ARRAYSIZE(s_rgFieldStatePairs)) && pcpfs && pcpfis)
     {
-        *pcpfs = _rgFieldStatePairs[dwFieldID].cpfs;
-        *pcpfis = _rgFieldStatePairs[dwFieldID].cpfis;
+        *pcpfs = s_rgFieldStatePairs[dwFieldID].cpfs;
+        *pcpfis = s_rgFieldStatePairs[dwFieldID].cpfis;
         hr = S_OK;
     }
     else
@@ -164,13 +149,20 @@ HRESULT Credential::GetStringValue(
     )
 {
     HRESULT hr;
+    CTraceScope trace(TM_CREDENTIAL_GETSTRINGVALUE, dwFieldID, &hr);
 
-    // Check to make sure dwFieldID is a legitimate index
-    if (dwFieldID < ARRAYSIZE(_rgCredProvFieldDescriptors) && ppwsz)
+    // Both of our text fields show the tile's label.
+    if (((SFI_LARGE_TEXT == dwFieldID) || (SFI_COMMAND_LINK == dwFieldID)) && ppwsz)
     {
+        // Once a switch has started, the large text shows its status instead.
+        hr = (SFI_LARGE_TEXT == dwFieldID) ? _bootSwitch.GetStatusText(ppwsz) : S_FALSE;
+
         // Make a copy of the string and return that. The caller
         // is responsible for freeing it.
-        hr = SHStrDupW(_rgFieldStrings[dwFieldID], ppwsz);
+        if (S_FALSE == hr)
+        {
+            hr = _pStringPool->CoTaskMemDup(_dwLabel, ppwsz);
+        }
     }
     else
     {
@@ -187,38 +179,16 @@ HRESULT Credential::GetBitmapValue(
     )
 {
     HRESULT hr;
+    CTraceScope trace(TM_CREDENTIAL_GETBITMAPVALUE, dwFieldID, &hr);
     if ((SFI_TILEIMAGE == dwFieldID) && phbmp)
     {
-		// Build the path to the bmp in this dll's folder
-		wchar_t* pwszDllPath = new wchar_t[260];
-		GetModuleFileName(HINST_THISDLL, pwszDllPath, 260);
-		std::wstring bmpPath(pwszDllPath);
-		delete[]pwszDllPath;
-		bmpPath.replace(bmpPath.end()-3,bmpPath.end(),L"bmp");
-
-		// Look for the filesystem bitmap first
-		HBITMAP hbmp = (HBITMAP)LoadImage( NULL, bmpPath.c_str(), IMAGE_BITMAP, 0, 0, LR_DEFAULTSIZE | LR_LOADFROMFILE );
-        if (hbmp != NULL)
-        {
-			debug << "using filesystem bitmap" << std::endl;
-            hr = S_OK;
-            *phbmp = hbmp;
-        }
-        else
-        {
-			// Use the resource bitmap as a backup
-	        hbmp = LoadBitmap(HINST_THISDLL, MAKEINTRESOURCE(IDB_BITMAP1));
-			if (hbmp != NULL)
-			{
-				debug << "using default bitmap" << std::endl;
-				hr = S_OK;
-				*phbmp = hbmp;
-			}
-			else
-			{
-	            hr = HRESULT_FROM_WIN32(GetLastError());
-			}
-        }
+		// The cache prefers the filesystem bitmap and falls back to the resource bitmap
+		BOOL bFromFile;
+		hr = TileBitmapCacheGet(IDB_BITMAP1, phbmp, &bFromFile);
+		if (SUCCEEDED(hr))
+		{
+			LogWrite(L"using %s bitmap", bFromFile ? L"filesystem" : L"default");
+		}
     }
     else
     {
@@ -237,9 +207,11 @@ HRESULT Credential::GetSubmitButtonValue(
     __out DWORD* pdwAdjacentTo
     )
 {
-	UNREFERENCED_PARAMETER(dwFieldID);
+	HRESULT hr = E_NOTIMPL;
+	CTraceScope trace(TM_CREDENTIAL_GETSUBMITBUTTONVALUE, dwFieldID, &hr);
+
 	UNREFERENCED_PARAMETER(pdwAdjacentTo);
-	return E_NOTIMPL;
+	return hr;
 }
 
 // Sets the value of a field which can accept a string as a value.
@@ -250,49 +222,30 @@ HRESULT Credential::SetStringValue(
     )
 {
     HRESULT hr;
+    CTraceScope trace(TM_CREDENTIAL_SETSTRINGVALUE, dwFieldID, &hr);
 
-    // Validate parameters.
-    if (dwFieldID < ARRAYSIZE(_rgCredProvFieldDescriptors) &&
-        (CPFT_EDIT_TEXT == _rgCredProvFieldDescriptors[dwFieldID].cpft ||
-        CPFT_PASSWORD_TEXT == _rgCredProvFieldDescriptors[dwFieldID].cpft))
-    {
-        PWSTR* ppwszStored = &_rgFieldStrings[dwFieldID];
-        CoTaskMemFree(*ppwszStored);
-        hr = SHStrDupW(pwz, ppwszStored);
-    }
-    else
-    {
-        hr = E_INVALIDARG;
-    }
+    // Our tiles have no fields to type into.
+    UNREFERENCED_PARAMETER(dwFieldID);
+    UNREFERENCED_PARAMETER(pwz);
+    hr = E_INVALIDARG;
 
     return hr;
 }
 
-// Called when the user clicks a command link.  Theoretically, the user
-// should never make it here because RebootToMac() is called during
-// SetSelected
+// Called when the user clicks a command link.  Selecting the tile already
+// starts a switch, so this only gets somewhere after that one failed.
 HRESULT Credential::CommandLinkClicked(__in DWORD dwFieldID)
 {
     HRESULT hr;
+    CTraceScope trace(TM_CREDENTIAL_COMMANDLINKCLICKED, dwFieldID, &hr);
 
     // Validate parameter.
-    if (dwFieldID < ARRAYSIZE(_rgCredProvFieldDescriptors) &&
-        (CPFT_COMMAND_LINK == _rgCredProvFieldDescriptors[dwFieldID].cpft))
+    if (dwFieldID < ARRAYSIZE(s_rgCredProvFieldDescriptors) &&
+        (CPFT_COMMAND_LINK == s_rgCredProvFieldDescriptors[dwFieldID].cpft))
     {
-        HWND hwndOwner = NULL;
-
-        if (_pCredProvCredentialEvents)
-        {
-            _pCredProvCredentialEvents->OnCreatingWindow(&hwndOwner);
-        }
-
-		// Set Mac as default boot volume and reboot.
-		if (SetMacDefaultBoot())
-		{
-			Reboot();
-		}
-
-		hr = S_OK;
+        // Set Mac as default boot volume and reboot, unless that's already under way.
+        _bootSwitch.Start();
+        hr = S_OK;
     }
     else
     {
@@ -302,112 +255,6 @@ HRESULT Credential::CommandLinkClicked(__in DWORD dwFieldID)
     return hr;
 }
 
-BOOL Credential::SetMacDefaultBoot()
-{
-	// get the filesystem location of %ProgramFiles%
-	// http://msdn.microsoft.com/en-us/library/bb762188.aspx
-	wchar_t* pathProgramFiles = 0;
-	SHGetKnownFolderPath(FOLDERID_ProgramFiles, 0, NULL, &pathProgramFiles);
-
-	// build the path to bootcamp.exe
-	// http://msdn.microsoft.com/en-us/library/ms647527.aspx
-	std::wstring pathBootCamp(pathProgramFiles);
-	pathBootCamp += L"\\Boot Camp\\BootCamp.exe";
-
-	// free the memory like the docs tell us
-	CoTaskMemFree(static_cast<void*>(pathProgramFiles));
-
-	// Make sure the executable exists
-	DWORD attr = GetFileAttributes(pathBootCamp.c_str());
-	if (attr == INVALID_FILE_ATTRIBUTES || (attr & FILE_ATTRIBUTE_DIRECTORY))
-	{
-		debug << "BootCamp.exe not found at " << pathBootCamp.c_str() << std::endl;
-	    return FALSE;
-	}
-
-	// Finish building the complete command line to set the Mac startup volume
-	// http://support.apple.com/kb/HT3802
-	// "%ProgramFiles%\Boot Camp\BootCamp.exe" -StartupDisk
-	std::wstring fullCmd(L"\"" + pathBootCamp + L"\" -StartupDisk");
-
-	debug << fullCmd.c_str() << std::endl;
-
-	// CreateProcess
-	//http://msdn.microsoft.com/en-us/library/ms682425.aspx
-	STARTUPINFO si;
-    PROCESS_INFORMATION pi;
-    ZeroMemory( &si, sizeof(si) );
-    si.cb = sizeof(si);
-    ZeroMemory( &pi, sizeof(pi) );
-
-	wchar_t * pwszCmd = new wchar_t[fullCmd.length() + 1];
-	StringCchCopy(pwszCmd, fullCmd.length() + 1, fullCmd.c_str());
-
-	if (!CreateProcessW(NULL,   // No module name (use command line)
-        pwszCmd,        // Command line
-        NULL,           // Process handle not inheritable
-        NULL,           // Thread handle not inheritable
-        FALSE,          // Set handle inheritance to FALSE
-        0,              // No creation flags
-        NULL,           // Use parent's environment block
-        NULL,           // Use parent's starting directory
-        &si,            // Pointer to STARTUPINFO structure
-        &pi )           // Pointer to PROCESS_INFORMATION structure
-    )
-    {
-        debug << L"CreateProcess failed with error " << GetLastError() << std::endl;
-		/* Free memory */
-	    delete[]pwszCmd;
-		pwszCmd = 0;
-		return FALSE;
-    }
-
-    // Wait until child process exits.
-    WaitForSingleObject( pi.hProcess, 5000 );
-
-	debug << L"BootCamp.exe finished or timeout elapsed" << std::endl;
-
-    // Close process and thread handles.
-    CloseHandle( pi.hProcess );
-    CloseHandle( pi.hThread );
-
-	/* Free memory */
-	delete[]pwszCmd;
-	pwszCmd = 0;
-
-	return TRUE;
-}
-
-BOOL Credential::Reboot()
-{
-	HANDLE hToken;
-	TOKEN_PRIVILEGES tkp;
-
-	// Get a token for this process.
-	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
-		return( FALSE );
-
-	// Get the LUID for the shutdown privilege.
-	LookupPrivilegeValue(NULL, SE_SHUTDOWN_NAME, &tkp.Privileges[0].Luid);
-
-	tkp.PrivilegeCount = 1;  // one privilege to set
-	tkp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
-
-	// Get the shutdown privilege for this process.
-	AdjustTokenPrivileges(hToken, FALSE, &tkp, 0, (PTOKEN_PRIVILEGES)NULL, 0);
-
-	if (GetLastError() != ERROR_SUCCESS)
-		return FALSE;
-
-	// Reboot the system and force all applications to close.
-	if (!ExitWindowsEx(EWX_REBOOT | EWX_FORCE,
-			SHTDN_REASON_MAJOR_OPERATINGSYSTEM | SHTDN_REASON_MINOR_UPGRADE | SHTDN_REASON_FLAG_PLANNED))
-		return FALSE;
-
-	//shutdown was successful
-	return TRUE;
-}
-
 //-------------
 // The following methods are for logonUI to get the values of various UI elements and then communicate
 // to the credential about what the user did in that field.  However, these methods are not implemented
@@ -418,11 +265,14 @@ HRESULT Credential::GetCheckboxValue(
     __deref_out PWSTR* ppwszLabel
     )
 {
+    HRESULT hr = E_NOTIMPL;
+    CTraceScope trace(TM_CREDENTIAL_GETCHECKBOXVALUE, dwFieldID, &hr);
+
     UNREFERENCED_PARAMETER(dwFieldID);
     UNREFERENCED_PARAMETER(pbChecked);
     UNREFERENCED_PARAMETER(ppwszLabel);
 
-    return E_NOTIMPL;
+    return hr;
 }
 
 HRESULT Credential::GetComboBoxValueCount(
@@ -431,10 +281,13 @@ HRESULT Credential::GetComboBoxValueCount(
     __out_range(<,*pcItems) DWORD* pdwSelectedItem
     )
 {
+    HRESULT hr = E_NOTIMPL;
+    CTraceScope trace(TM_CREDENTIAL_GETCOMBOBOXVALUECOUNT, dwFieldID, &hr);
+
     UNREFERENCED_PARAMETER(dwFieldID);
     UNREFERENCED_PARAMETER(pcItems);
     UNREFERENCED_PARAMETER(pdwSelectedItem);
-    return E_NOTIMPL;
+    return hr;
 }
 
 HRESULT Credential::GetComboBoxValueAt(
@@ -443,10 +296,13 @@ HRESULT Credential::GetComboBoxValueAt(
     __deref_out PWSTR* ppwszItem
     )
 {
+    HRESULT hr = E_NOTIMPL;
+    CTraceScope trace(TM_CREDENTIAL_GETCOMBOBOXVALUEAT, dwFieldID, &hr);
+
     UNREFERENCED_PARAMETER(dwFieldID);
     UNREFERENCED_PARAMETER(dwItem);
     UNREFERENCED_PARAMETER(ppwszItem);
-    return E_NOTIMPL;
+    return hr;
 }
 
 HRESULT Credential::SetCheckboxValue(
@@ -454,10 +310,13 @@ HRESULT Credential::SetCheckboxValue(
     __in BOOL bChecked
     )
 {
+    HRESULT hr = E_NOTIMPL;
+    CTraceScope trace(TM_CREDENTIAL_SETCHECKBOXVALUE, dwFieldID, &hr);
+
     UNREFERENCED_PARAMETER(dwFieldID);
     UNREFERENCED_PARAMETER(bChecked);
 
-    return E_NOTIMPL;
+    return hr;
 }
 
 HRESULT Credential::SetComboBoxSelectedValue(
@@ -465,9 +324,12 @@ HRESULT Credential::SetComboBoxSelectedValue(
     __in DWORD dwSelectedItem
     )
 {
+    HRESULT hr = E_NOTIMPL;
+    CTraceScope trace(TM_CREDENTIAL_SETCOMBOBOXSELECTEDVALUE, dwFieldId, &hr);
+
     UNREFERENCED_PARAMETER(dwFieldId);
     UNREFERENCED_PARAMETER(dwSelectedItem);
-    return E_NOTIMPL;
+    return hr;
 }
 //------ end of methods for controls we don't have in our tile ----//
 
@@ -481,11 +343,14 @@ HRESULT Credential::GetSerialization(
     __in CREDENTIAL_PROVIDER_STATUS_ICON* pcpsiOptionalStatusIcon
     )
 {
+	HRESULT hr = E_NOTIMPL;
+	CTraceScope trace(TM_CREDENTIAL_GETSERIALIZATION, TRACE_NO_FIELD, &hr);
+
 	UNREFERENCED_PARAMETER(pcpgsr);
 	UNREFERENCED_PARAMETER(pcpcs);
     UNREFERENCED_PARAMETER(ppwszOptionalStatusText);
     UNREFERENCED_PARAMETER(pcpsiOptionalStatusIcon);
-	return E_NOTIMPL;
+	return hr;
 }
 
 struct REPORT_RESULT_STATUS_INFO
@@ -513,6 +378,9 @@ HRESULT Credential::ReportResult(
     __out CREDENTIAL_PROVIDER_STATUS_ICON* pcpsiOptionalStatusIcon
     )
 {
+    HRESULT hr = S_OK;
+    CTraceScope trace(TM_CREDENTIAL_REPORTRESULT, TRACE_NO_FIELD, &hr);
+
     *ppwszOptionalStatusText = NULL;
     *pcpsiOptionalStatusIcon = CPSI_NONE;
 
@@ -537,5 +405,5 @@ HRESULT Credential::ReportResult(
     }
     // Since NULL is a valid value for *ppwszOptionalStatusText and *pcpsiOptionalStatusIcon
     // this function can't fail.
-    return S_OK;
+    return hr;
 }
@@ -12,43 +12,33 @@
 #include "common.h"
 #include "dll.h"
 #include "resource.h"
-
-#pragma warning(disable:4995)
-#include <fstream>
+#include "BootSwitch.h"
+#include "TileTable.h"
+#include "StringPool.h"
+#include "ComObject.h"
 
 EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 #ifndef HINST_THISDLL
 #define HINST_THISDLL ((HINSTANCE)&__ImageBase)
 #endif
 
-class Credential : public ICredentialProviderCredential
+// Our credentials live in an array inside the provider, one per row of its
+// tile table, so they share the provider's reference count: a reference on a
+// credential keeps the provider, and with it the whole array, alive.
+class Credential : public ComInterface<Credential, ICredentialProviderCredential>
 {
 public:
     // IUnknown
     IFACEMETHODIMP_(ULONG) AddRef()
     {
-        return ++_cRef;
+        return _punkOwner->AddRef();
     }
     
     IFACEMETHODIMP_(ULONG) Release()
     {
-        LONG cRef = --_cRef;
-        if (!cRef)
-        {
-            delete this;
-        }
-        return cRef;
+        return _punkOwner->Release();
     }
 
-    IFACEMETHODIMP QueryInterface(__in REFIID riid, __deref_out void** ppv)
-    {
-        static const QITAB qit[] =
-        {
-            QITABENT(Credential, ICredentialProviderCredential), // IID_ICredentialProviderCredential
-            {0},
-        };
-        return QISearch(this, qit, riid, ppv);
-    }
   public:
     // ICredentialProviderCredential
     IFACEMETHODIMP Advise(__in ICredentialProviderCredentialEvents* pcpce);
@@ -83,37 +73,31 @@ public:
                                 __out CREDENTIAL_PROVIDER_STATUS_ICON* pcpsiOptionalStatusIcon);
 
   public:
-    HRESULT Initialize(__in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
-                       __in const CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR* rgcpfd,
-                       __in const FIELD_STATE_PAIR* rgfsp);
+    void Initialize(__in IUnknown* punkOwner,
+                    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                    __in const TILE* ptile,
+                    __in const StringPool* pStringPool,
+                    __in DWORD dwLabel);
     Credential();
 
     virtual ~Credential();
 
   private:
-    LONG                                    _cRef;
+    IUnknown*                               _punkOwner;                                     // The provider. Not a
+                                                                                            // reference; it owns us.
 
     CREDENTIAL_PROVIDER_USAGE_SCENARIO      _cpus; // The usage scenario for which we were enumerated.
 
-    CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR    _rgCredProvFieldDescriptors[SFI_NUM_FIELDS];    // An array holding the 
-                                                                                            // type and name of each 
-                                                                                            // field in the tile.
+    const TILE*                             _ptile;                                         // Our row of the
+                                                                                            // provider's tile table.
 
-    FIELD_STATE_PAIR                        _rgFieldStatePairs[SFI_NUM_FIELDS];             // An array holding the 
-                                                                                            // state of each field in 
-                                                                                            // the tile.
-
-    PWSTR                                    _rgFieldStrings[SFI_NUM_FIELDS];               // An array holding the 
-                                                                                            // string value of each 
-                                                                                            // field. This is different 
-                                                                                            // from the name of the 
-                                                                                            // field held in 
-                                                                                            // _rgCredProvFieldDescriptors.
+    const StringPool*                       _pStringPool;                                   // The provider's strings,
+    DWORD                                   _dwLabel;                                       // and our label's index
+                                                                                            // among them.
 
     ICredentialProviderCredentialEvents*    _pCredProvCredentialEvents;                     // Used to update fields.
 
-	BOOL SetMacDefaultBoot();
-	BOOL Reboot();
-
-	std::wofstream debug;
+    BootSwitch                              _bootSwitch;                                    // Switches to the Mac and
+                                                                                            // shows how that's going
+                                                                                            // in SFI_LARGE_TEXT.
 };
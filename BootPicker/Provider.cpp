@@ -1,32 +1,54 @@
 // Provider implements ICredentialProvider, which is the main
 // interface that logonUI uses to decide which tiles to display.
-// We will display one tile with the Apple icon that users will
-// use to reboot back into Mac OS X.
+// We display a tile with the Apple icon for each macOS volume and
+// recovery partition the GPT scan finds, which users use to reboot
+// into it. Until the scan is done, or if it finds nothing, there is
+// a single tile that leaves the choice of partition to StartupDiskSetMac,
+// which only picks a blessed HFS+ volume itself and otherwise asks Boot Camp.
 
 #include <credentialprovider.h>
 #include "Provider.h"
 #include "Credential.h"
 #include "guid.h"
+#include "Trace.h"
+#include "GptScanner.h"
+
+// How long LogonUI's thread waits for a GPT scan that's nearly done, rather than show
+// the early tile only to replace it straight away.
+#define PROVIDER_INDEX_WAIT_MS      200
+
+// The index of a scan that found nothing, which gets the tile that leaves the choice to StartupDiskSetMac.
+static const GPT_INDEX s_giEmpty = { 0 };
 
 // Provider ////////////////////////////////////////////////////////
 
-Provider::Provider():
-    _cRef(1)
+Provider::Provider()
 {
-    DllAddRef();
-
-    _pCredential = NULL;
+    _pts = NULL;
+    _ptsEarly = NULL;
+    _pStringPool = NULL;
+    _pcpe = NULL;
+    _upAdviseContext = 0;
+    _hIndexWait = NULL;
 }
 
+// Our credentials hold no references of their own, so by the time we get here
+// LogonUI is done with all of them.
 Provider::~Provider()
 {
-    if (_pCredential != NULL)
+    _UnwatchIndex();
+    if (_pcpe != NULL)
     {
-        _pCredential->Release();
-        _pCredential = NULL;
+        _pcpe->Release();
     }
 
-    DllRelease();
+    delete _pts;
+    delete _ptsEarly;
+
+    if (_pStringPool != NULL)
+    {
+        _pStringPool->Release();
+    }
 }
 
 // SetUsageScenario is the provider's cue that it's going to be asked for tiles
@@ -38,6 +60,7 @@ HRESULT Provider::SetUsageScenario(
 {
     UNREFERENCED_PARAMETER(dwFlags);
     HRESULT hr;
+    CTraceScope trace(TM_PROVIDER_SETUSAGESCENARIO, TRACE_NO_FIELD, &hr);
 
     // Decide which scenarios to support here. Returning E_NOTIMPL simply tells the caller
     // that we're not designed for that scenario.
@@ -47,23 +70,10 @@ HRESULT Provider::SetUsageScenario(
     case CPUS_UNLOCK_WORKSTATION:       
         _cpus = cpus;
 
-        // Create and initialize our credential.
-        // A more advanced credprov might only enumerate tiles for the user whose owns the locked
-        // session, since those are the only creds that wil work
-        _pCredential = new Credential();
-        if (_pCredential != NULL)
-        {
-            hr = _pCredential->Initialize(_cpus, s_rgCredProvFieldDescriptors, s_rgFieldStatePairs);
-            if (FAILED(hr))
-            {
-                _pCredential->Release();
-                _pCredential = NULL;
-            }
-        }
-        else
-        {
-            hr = E_OUTOFMEMORY;
-        }
+        // Start looking for the Mac partitions now. We need them once LogonUI asks
+        // how many tiles we have, which gives the scan a head start.
+        GptIndexPrefetch();
+        hr = S_OK;
         break;
 
     case CPUS_CHANGE_PASSWORD:
@@ -101,26 +111,55 @@ HRESULT Provider::SetSerialization(
     __in const CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION* pcpcs
     )
 {
+    HRESULT hr = E_NOTIMPL;
+    CTraceScope trace(TM_PROVIDER_SETSERIALIZATION, TRACE_NO_FIELD, &hr);
+
     UNREFERENCED_PARAMETER(pcpcs);
-    return E_NOTIMPL;
+    return hr;
 }
 
 // Called by LogonUI to give you a callback.  Providers often use the callback if they
 // some event would cause them to need to change the set of tiles that they enumerated.
+// We use it to swap the early tile for the real ones once the GPT scan is done.
 HRESULT Provider::Advise(
     __in ICredentialProviderEvents* pcpe,
     __in UINT_PTR upAdviseContext
     )
 {
-    UNREFERENCED_PARAMETER(pcpe);
-    UNREFERENCED_PARAMETER(upAdviseContext);
-    return E_NOTIMPL;
+    HRESULT hr = S_OK;
+    CTraceScope trace(TM_PROVIDER_ADVISE, TRACE_NO_FIELD, &hr);
+
+    // The wait callback reads _pcpe, so it only changes while there's no wait.
+    _UnwatchIndex();
+    if (_pcpe != NULL)
+    {
+        _pcpe->Release();
+    }
+    _pcpe = pcpe;
+    _pcpe->AddRef();
+    _upAdviseContext = upAdviseContext;
+
+    // If LogonUI already has the early tile, keep watching for the scan on its behalf.
+    if ((_ptsEarly != NULL) && (_pts == NULL))
+    {
+        _WatchIndex();
+    }
+    return hr;
 }
 
 // Called by LogonUI when the ICredentialProviderEvents callback is no longer valid.
 HRESULT Provider::UnAdvise()
 {
-    return E_NOTIMPL;
+    HRESULT hr = S_OK;
+    CTraceScope trace(TM_PROVIDER_UNADVISE, TRACE_NO_FIELD, &hr);
+
+    _UnwatchIndex();
+    if (_pcpe != NULL)
+    {
+        _pcpe->Release();
+        _pcpe = NULL;
+    }
+    return hr;
 }
 
 // Called by LogonUI to determine the number of fields in your tiles.  This
@@ -133,8 +172,11 @@ HRESULT Provider::GetFieldDescriptorCount(
     __out DWORD* pdwCount
     )
 {
+    HRESULT hr = S_OK;
+    CTraceScope trace(TM_PROVIDER_GETFIELDDESCRIPTORCOUNT, TRACE_NO_FIELD, &hr);
+
     *pdwCount = SFI_NUM_FIELDS;
-    return S_OK;
+    return hr;
 }
 
 // Gets the field descriptor for a particular field.
@@ -144,6 +186,7 @@ HRESULT Provider::GetFieldDescriptorAt(
     )
 {    
     HRESULT hr;
+    CTraceScope trace(TM_PROVIDER_GETFIELDDESCRIPTORAT, dwIndex, &hr);
 
     // Verify dwIndex is a valid field.
     if ((dwIndex < SFI_NUM_FIELDS) && ppcpfd)
@@ -171,12 +214,17 @@ HRESULT Provider::GetCredentialCount(
     __out BOOL* pbAutoLogonWithDefault
     )
 {
-    *pdwCount = 1;
-	// Make sure we're never the default by setting it to an index that doesn't exist.
-	// Otherwise it might go into a reboot loop.
-    *pdwDefault = 2;
+    HRESULT hr;
+    CTraceScope trace(TM_PROVIDER_GETCREDENTIALCOUNT, TRACE_NO_FIELD, &hr);
+
+    hr = _EnumerateCredentials();
+    const TILE_SET* pts = _GetShownTiles();
+    *pdwCount = (SUCCEEDED(hr) && (pts != NULL)) ? pts->tt.cTiles : 0;
+	// Make sure we're never the default. Selecting one of our tiles reboots,
+	// so otherwise it might go into a reboot loop.
+    *pdwDefault = CREDENTIAL_PROVIDER_NO_DEFAULT;
     *pbAutoLogonWithDefault = FALSE;
-    return S_OK;
+    return hr;
 }
 
 // Returns the credential at the index specified by dwIndex. This function is called by logonUI to enumerate
@@ -187,9 +235,11 @@ HRESULT Provider::GetCredentialAt(
     )
 {
     HRESULT hr;
-    if((dwIndex == 0) && ppcpc)
+    CTraceScope trace(TM_PROVIDER_GETCREDENTIALAT, dwIndex, &hr);
+    const TILE_SET* pts = _GetShownTiles();
+    if ((pts != NULL) && (dwIndex < pts->tt.cTiles) && ppcpc)
     {
-        hr = _pCredential->QueryInterface(IID_ICredentialProviderCredential, reinterpret_cast<void**>(ppcpc));
+        hr = pts->rgCredentials[dwIndex].QueryInterface(IID_ICredentialProviderCredential, reinterpret_cast<void**>(ppcpc));
     }
     else
     {
@@ -199,6 +249,119 @@ HRESULT Provider::GetCredentialAt(
     return hr;
 }
 
+// The tiles LogonUI was last told about: the real ones once we have them, the early one before.
+const TILE_SET* Provider::_GetShownTiles()
+{
+    return (_pts != NULL) ? _pts : _ptsEarly;
+}
+
+// Builds the tiles the first time LogonUI asks for them. LogonUI's thread mustn't wait
+// on the disks, so if the GPT scan is still running we show the early tile, and have
+// LogonUI ask again once the scan is done.
+HRESULT Provider::_EnumerateCredentials()
+{
+    if (_pts != NULL)
+    {
+        return S_OK;
+    }
+
+    const GPT_INDEX* pgi;
+    HRESULT hr = GptIndexTryGet(PROVIDER_INDEX_WAIT_MS, &pgi);
+    if (hr == E_PENDING)
+    {
+        _WatchIndex();
+        return (_ptsEarly != NULL) ? S_OK : _BuildTileSet(&s_giEmpty, &_ptsEarly);
+    }
+
+    // An index that failed to build is empty, which still gets us the tile that
+    // leaves the choice to StartupDiskSetMac.
+    return _BuildTileSet(pgi, &_pts);
+}
+
+// Builds a tile table from the index, and a credential for each of its rows. The labels
+// go in the string pool, so tiles that share a label share one copy of it.
+HRESULT Provider::_BuildTileSet(
+    __in const GPT_INDEX* pgi,
+    __deref_out TILE_SET** ppts
+    )
+{
+    *ppts = NULL;
+    TILE_SET* pts = new TILE_SET;
+    if (pts == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+    TileTableBuild(pgi, &pts->tt);
+
+    DWORD rgdwLabels[ARRAYSIZE(pts->tt.rgTiles)];
+    HRESULT hr = (_pStringPool != NULL) ? S_OK : StringPool::Create(&_pStringPool);
+    for (DWORD i = 0; SUCCEEDED(hr) && i < pts->tt.cTiles; i++)
+    {
+        hr = _pStringPool->Intern(pts->tt.rgTiles[i].wszLabel, &rgdwLabels[i]);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        pts->rgCredentials = new Credential[pts->tt.cTiles];
+        if (pts->rgCredentials == NULL)
+        {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        delete pts;
+        return hr;
+    }
+
+    for (DWORD i = 0; i < pts->tt.cTiles; i++)
+    {
+        pts->rgCredentials[i].Initialize(this, _cpus, &pts->tt.rgTiles[i], _pStringPool, rgdwLabels[i]);
+    }
+    *ppts = pts;
+    return S_OK;
+}
+
+// Runs on a thread pool thread once the GPT scan is done.
+VOID CALLBACK Provider::_IndexReadyCallback(
+    __in PVOID pv,
+    __in BOOLEAN bTimedOut
+    )
+{
+    UNREFERENCED_PARAMETER(bTimedOut);
+    Provider* pProvider = static_cast<Provider*>(pv);
+
+    // LogonUI lets providers call this from any thread. It answers by asking for
+    // our tiles again, which now finds the index built.
+    pProvider->_pcpe->CredentialsChanged(pProvider->_upAdviseContext);
+}
+
+// Calls CredentialsChanged once the GPT scan is done, if LogonUI gave us somewhere to
+// call and we aren't already waiting. Without that, the early tile stays.
+void Provider::_WatchIndex()
+{
+    HANDLE hev = GptIndexGetReadyEvent();
+    if ((_pcpe != NULL) && (_hIndexWait == NULL) && (hev != NULL))
+    {
+        if (!RegisterWaitForSingleObject(&_hIndexWait, hev, _IndexReadyCallback, this, INFINITE, WT_EXECUTEONLYONCE))
+        {
+            _hIndexWait = NULL;
+        }
+    }
+}
+
+// Cancels the wait, and waits for the callback if it's running, so that it never
+// sees _pcpe change or the provider go away.
+void Provider::_UnwatchIndex()
+{
+    if (_hIndexWait != NULL)
+    {
+        UnregisterWaitEx(_hIndexWait, INVALID_HANDLE_VALUE);
+        _hIndexWait = NULL;
+    }
+}
+
 // Boilerplate code to create our provider.
 HRESULT CSample_CreateInstance(__in REFIID riid, __deref_out void** ppv)
 {
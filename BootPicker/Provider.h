@@ -2,36 +2,21 @@
 #include <windows.h>
 #include "Credential.h"
 #include "helpers.h"
+#include "ComObject.h"
 
-class Provider : public ICredentialProvider
+// A tile table and a credential for each of its rows. The credentials point at
+// their rows, so the two are made and freed together.
+struct TILE_SET
 {
-  public:
-    // IUnknown
-    IFACEMETHODIMP_(ULONG) AddRef()
-    {
-        return ++_cRef;
-    }
-    
-    IFACEMETHODIMP_(ULONG) Release()
-    {
-        LONG cRef = --_cRef;
-        if (!cRef)
-        {
-            delete this;
-        }
-        return cRef;
-    }
-
-    IFACEMETHODIMP QueryInterface(__in REFIID riid, __deref_out void** ppv)
-    {
-        static const QITAB qit[] =
-        {
-            QITABENT(Provider, ICredentialProvider), // IID_ICredentialProvider
-            {0},
-        };
-        return QISearch(this, qit, riid, ppv);
-    }
+    TILE_TABLE      tt;
+    Credential     *rgCredentials;
+
+    TILE_SET() : rgCredentials(NULL) {}
+    ~TILE_SET() { delete[] rgCredentials; }
+};
 
+class Provider : public ComObject<Provider, ICredentialProvider>
+{
   public:
     IFACEMETHODIMP SetUsageScenario(__in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus, __in DWORD dwFlags);
     IFACEMETHODIMP SetSerialization(__in const CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION* pcpcs);
@@ -49,15 +34,29 @@ class Provider : public ICredentialProvider
                                    __deref_out ICredentialProviderCredential** ppcpc);
 
     friend HRESULT CSample_CreateInstance(__in REFIID riid, __deref_out void** ppv);
+    friend class ComObject<Provider, ICredentialProvider>;
 
   protected:
     Provider();
     __override ~Provider();
     
   private:
+    HRESULT _EnumerateCredentials();
+    HRESULT _BuildTileSet(__in const GPT_INDEX* pgi, __deref_out TILE_SET** ppts);
+    const TILE_SET* _GetShownTiles();
+    void _WatchIndex();
+    void _UnwatchIndex();
+    static VOID CALLBACK _IndexReadyCallback(__in PVOID pv, __in BOOLEAN bTimedOut);
     
 private:
-    LONG                                    _cRef;            // Used for reference counting.
-    Credential                       *_pCredential;    // Our credential.
+    TILE_SET                               *_pts;             // The tiles for the Mac partitions, or NULL
+                                                              // until the scan is done and LogonUI has asked.
+    TILE_SET                               *_ptsEarly;        // The tile we showed while the scan was still
+                                                              // running. Kept, since LogonUI may still hold it.
+    StringPool                             *_pStringPool;     // The tiles' labels.
     CREDENTIAL_PROVIDER_USAGE_SCENARIO      _cpus;
+
+    ICredentialProviderEvents              *_pcpe;            // Tells LogonUI to ask for our tiles again.
+    UINT_PTR                                _upAdviseContext; // What to tell it we are.
+    HANDLE                                  _hIndexWait;      // Our wait on the scan finishing, if any.
 };
@@ -5,13 +5,29 @@
 #pragma once
 #include <helpers.h>
 
+// Every field in our credential provider's tiles, in the order LogonUI
+// numbers them. Each row is
+//
+//     X(field id, field type, field name, field state, interactive state)
+//
+// The field name is NOT the value which will appear in the field. The field
+// state says whether the field shows in the selected tile, the deselected tile
+// or both; the interactive state says whether it is enabled, has focus, etc.
+//
+// MY_FIELD_ID and both tables below are generated from this list, so they
+// can't get out of step with each other. To add a field, add a row.
+#define MY_FIELDS(X) \
+    X(SFI_TILEIMAGE,        CPFT_TILE_IMAGE,        L"Image",           CPFS_DISPLAY_IN_BOTH,           CPFIS_NONE) \
+    X(SFI_LARGE_TEXT,       CPFT_LARGE_TEXT,        L"LargeText",       CPFS_DISPLAY_IN_BOTH,           CPFIS_NONE) \
+    X(SFI_COMMAND_LINK,     CPFT_COMMAND_LINK,      L"CommandLink",     CPFS_DISPLAY_IN_SELECTED_TILE,  CPFIS_NONE)
+
 // The indexes of each of the fields in our credential provider's tiles.
 enum MY_FIELD_ID 
 {
-    SFI_TILEIMAGE       = 0,
-    SFI_LARGE_TEXT      = 1,
-    SFI_COMMAND_LINK    = 2,
-    SFI_NUM_FIELDS      = 3,  // Note: if new fields are added, keep NUM_FIELDS last.  This is used as a count of the number of fields
+#define MY_FIELD_ID_ROW(id, cpft, label, cpfs, cpfis)   id,
+    MY_FIELDS(MY_FIELD_ID_ROW)
+#undef MY_FIELD_ID_ROW
+    SFI_NUM_FIELDS,     // The number of fields; always last.
 };
 
 // The first value indicates when the tile is displayed (selected, not selected)
@@ -24,25 +40,21 @@ struct FIELD_STATE_PAIR
 
 // These two arrays are seperate because a credential provider might
 // want to set up a credential with various combinations of field state pairs 
-// and field descriptors.
-
-// The field state value indicates whether the field is displayed
-// in the selected tile, the deselected tile, or both.
-// The Field interactive state indicates when 
+// and field descriptors. Both are read-only and shared by every tile.
 static const FIELD_STATE_PAIR s_rgFieldStatePairs[] = 
 {
-    { CPFS_DISPLAY_IN_BOTH, CPFIS_NONE },                   // SFI_TILEIMAGE
-    { CPFS_DISPLAY_IN_BOTH, CPFIS_NONE },                   // SFI_LARGE_TEXT
-    { CPFS_DISPLAY_IN_SELECTED_TILE, CPFIS_NONE },          // SFI_COMMAND_LINK   
+#define MY_FIELD_STATE_ROW(id, cpft, label, cpfs, cpfis)    { cpfs, cpfis },
+    MY_FIELDS(MY_FIELD_STATE_ROW)
+#undef MY_FIELD_STATE_ROW
 };
 
 // Field descriptors for unlock and logon.
-// The first field is the index of the field.
-// The second is the type of the field.
-// The third is the name of the field, NOT the value which will appear in the field.
 static const CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR s_rgCredProvFieldDescriptors[] =
 {
-    { SFI_TILEIMAGE, CPFT_TILE_IMAGE, L"Image" },
-    { SFI_LARGE_TEXT, CPFT_LARGE_TEXT, L"LargeText" },
-    { SFI_COMMAND_LINK, CPFT_COMMAND_LINK, L"CommandLink" },
+#define MY_FIELD_DESCRIPTOR_ROW(id, cpft, label, cpfs, cpfis)   { id, cpft, label },
+    MY_FIELDS(MY_FIELD_DESCRIPTOR_ROW)
+#undef MY_FIELD_DESCRIPTOR_ROW
 };
+
+C_ASSERT(ARRAYSIZE(s_rgFieldStatePairs) == SFI_NUM_FIELDS);
+C_ASSERT(ARRAYSIZE(s_rgCredProvFieldDescriptors) == SFI_NUM_FIELDS);
@@ -5,66 +5,117 @@
 #include <unknwn.h>
 #include "Credential.h"
 #include "WrappedCredentialEvents.h"
+#include "RewriteRules.h"
+#include "StringKernels.h"
+#include "BitmapCache.h"
+#include "Log.h"
 #include "guid.h"
+#include "Trace.h"
 #include <Windows.h>
 #include <ShlObj.h>
 
 // Credential ////////////////////////////////////////////////////////
 
+// Room for this many credentials is set aside when the dll loads, so that wrapping
+// the tiles LogonUI shows first doesn't have to go to the heap. Any more than that
+// come from the heap as usual.
+#define CREDENTIAL_SLAB_SIZE    16
+
+union CREDENTIAL_BLOCK
+{
+    SLIST_ENTRY     sle;            // While it's free.
+    DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) BYTE rgb[sizeof(Credential)];
+};
+
+static CREDENTIAL_BLOCK s_rgSlab[CREDENTIAL_SLAB_SIZE];
+static SLIST_HEADER s_slhFreeBlocks;
+static INIT_ONCE s_ioSlab = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK _InitCredentialSlab(__inout PINIT_ONCE, __in PVOID, __out PVOID*)
+{
+    InitializeSListHead(&s_slhFreeBlocks);
+    for (DWORD i = 0; i < ARRAYSIZE(s_rgSlab); i++)
+    {
+        InterlockedPushEntrySList(&s_slhFreeBlocks, &s_rgSlab[i].sle);
+    }
+    return TRUE;
+}
+
+void* Credential::operator new(__in size_t cb) throw()
+{
+    InitOnceExecuteOnce(&s_ioSlab, _InitCredentialSlab, NULL, NULL);
+
+    void* pv = (cb <= sizeof(CREDENTIAL_BLOCK)) ? InterlockedPopEntrySList(&s_slhFreeBlocks) : NULL;
+    if (pv == NULL)
+    {
+        pv = HeapAlloc(GetProcessHeap(), 0, cb);
+    }
+    return pv;
+}
+
+void Credential::operator delete(__in_opt void* pv) throw()
+{
+    if (pv >= s_rgSlab && pv < s_rgSlab + ARRAYSIZE(s_rgSlab))
+    {
+        InterlockedPushEntrySList(&s_slhFreeBlocks, static_cast<PSLIST_ENTRY>(pv));
+    }
+    else if (pv != NULL)
+    {
+        HeapFree(GetProcessHeap(), 0, pv);
+    }
+}
+
 // NOTE: Please read the readme.txt file to understand when it's appropriate to
 // wrap an another credential provider and when it's not.  If you have questions
 // about whether your scenario is an appropriate use of wrapping another credprov,
 // please contact credprov@microsoft.com
-Credential::Credential():
-    _cRef(1)
+Credential::Credential()
 {
-    DllAddRef();
-
-    ZeroMemory(_rgCredProvFieldDescriptors, sizeof(_rgCredProvFieldDescriptors));
-    ZeroMemory(_rgFieldStatePairs, sizeof(_rgFieldStatePairs));
-    ZeroMemory(_rgFieldStrings, sizeof(_rgFieldStrings));
-
     _pWrappedCredential = NULL;
+    _punkWrappedIdentity = NULL;
     _pWrappedCredentialEvents = NULL;
     _pCredProvCredentialEvents = NULL;
 
-    _dwWrappedDescriptorCount = 0;
+    _pFieldMap = NULL;
+    _pStringPool = NULL;
+    _rgMemos = NULL;
+    _cMemos = 0;
+    _bTouched = FALSE;
 }
 
 Credential::~Credential()
 {
-    for (int i = 0; i < ARRAYSIZE(_rgFieldStrings); i++)
-    {
-        CoTaskMemFree(_rgFieldStrings[i]);
-        CoTaskMemFree(_rgCredProvFieldDescriptors[i].pszLabel);
-    }
-
     _CleanupEvents();
 
+    _ForgetStrings();
+    delete [] _rgMemos;
+
     if (_pWrappedCredential)
     {
         _pWrappedCredential->Release();
     }
 
-    DllRelease();
-}
+    if (_pFieldMap)
+    {
+        _pFieldMap->Release();
+    }
 
-std::wstring Credential::GetDebugText()
-{
-	return debug.str();
+    if (_pStringPool)
+    {
+        _pStringPool->Release();
+    }
 }
 
-// Initializes one credential with the field information passed in. We also keep track
-// of our wrapped credential and how many fields it has.
+// Initializes one credential. Our own fields are described by the shared tables
+// in common.h, so all we need is the credential we're wrapping, the map of which
+// field is whose, and where our fields' values are in the provider's string pool.
 HRESULT Credential::Initialize(
-    __in const CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR* rgcpfd,
-    __in const FIELD_STATE_PAIR* rgfsp,
     __in ICredentialProviderCredential *pWrappedCredential,
-    __in DWORD dwWrappedDescriptorCount
+    __in FieldMap *pFieldMap,
+    __in StringPool *pStringPool,
+    __in_ecount(SFI_NUM_FIELDS) const DWORD *rgdwFieldStrings
     )
 {
-    HRESULT hr = S_OK;
-
     // Grab the credential we're wrapping for future reference.
     if (_pWrappedCredential != NULL)
     {
@@ -73,27 +124,58 @@ HRESULT Credential::Initialize(
     _pWrappedCredential = pWrappedCredential;
     _pWrappedCredential->AddRef();
 
-    // We also need to remember how many fields the inner credential has.
-    _dwWrappedDescriptorCount = dwWrappedDescriptorCount;
+    // The provider finds us again by the object we wrap, and only IUnknown is sure
+    // to give the same pointer every time it's asked for. We don't need a reference
+    // of our own, since _pWrappedCredential keeps the object alive.
+    IUnknown *punk;
+    if (SUCCEEDED(_pWrappedCredential->QueryInterface(IID_PPV_ARGS(&punk))))
+    {
+        _punkWrappedIdentity = punk;
+        punk->Release();
+    }
+    else
+    {
+        _punkWrappedIdentity = _pWrappedCredential;
+    }
+
+    // We also need to know where the inner credential's fields and ours are on the tile.
+    if (_pFieldMap != NULL)
+    {
+        _pFieldMap->Release();
+    }
+    _pFieldMap = pFieldMap;
+    _pFieldMap->AddRef();
 
-    // Copy the field descriptors for each field. This is useful if you want to vary the field
-    // descriptors based on what Usage scenario the credential was created for.
-    for (DWORD i = 0; SUCCEEDED(hr) && i < ARRAYSIZE(_rgCredProvFieldDescriptors); i++)
+    // The provider reuses us across enumerations, and we may still be advised, with the
+    // wrapped credential's events translating ids through the map we just let go of.
+    if (_pWrappedCredentialEvents != NULL)
     {
-        _rgFieldStatePairs[i] = rgfsp[i];
-        hr = FieldDescriptorCopy(rgcpfd[i], &_rgCredProvFieldDescriptors[i]);
+        _pWrappedCredentialEvents->SetFieldMap(_pFieldMap);
     }
 
-    // Initialize the String value of all of our fields.
-    if (SUCCEEDED(hr))
+    // One memo for each of the inner credential's fields.
+    _ForgetStrings();
+    delete [] _rgMemos;
+    _cMemos = _pFieldMap->GetWrappedCount();
+    _rgMemos = new FIELD_MEMO[_cMemos];
+    if (_rgMemos == NULL)
     {
-        hr = SHStrDupW(L" ", &_rgFieldStrings[SFI_BLANK_LINE]);
+        _cMemos = 0;
+        return E_OUTOFMEMORY;
     }
-    if (SUCCEEDED(hr))
+    ZeroMemory(_rgMemos, _cMemos * sizeof(*_rgMemos));
+
+    if (_pStringPool != NULL)
     {
-        hr = SHStrDupW(L"Reboot to Mac OS X", &_rgFieldStrings[SFI_BOOT_MAC_COMMAND]);
+        _pStringPool->Release();
     }
-    return hr;
+    _pStringPool = pStringPool;
+    _pStringPool->AddRef();
+    CopyMemory(_rgdwFieldStrings, rgdwFieldStrings, sizeof(_rgdwFieldStrings));
+
+    // LogonUI knows our fields by their outer ids.
+    _bootSwitch.Initialize(this, _pFieldMap->OursToOuter(SFI_BOOT_MAC_COMMAND), BootSwitchGetDefaultSteps(), NULL);
+    return S_OK;
 }
 
 // LogonUI calls this in order to give us a callback in case we need to notify it of
@@ -103,23 +185,29 @@ HRESULT Credential::Advise(
     )
 {
     HRESULT hr = S_OK;
+    CTraceScope trace(TM_CREDENTIAL_ADVISE, TRACE_NO_FIELD, &hr);
 
     _CleanupEvents();
 
+    // The wrapped credential tells us about changes to its strings through the events
+    // we're about to give it, but nothing told us about any before now.
+    _ForgetStrings();
+
     // We keep a strong reference on the real ICredentialProviderCredentialEvents
     // to ensure that the weak reference held by the WrappedCredentialEvents is valid.
     _pCredProvCredentialEvents = pcpce;
     _pCredProvCredentialEvents->AddRef();
+    _bootSwitch.Advise(pcpce);
 
     _pWrappedCredentialEvents = new WrappedCredentialEvents();
 
     if (_pWrappedCredentialEvents != NULL)
     {
-        _pWrappedCredentialEvents->Initialize(this, pcpce);
+        _pWrappedCredentialEvents->Initialize(this, pcpce, _pFieldMap);
 
         if (_pWrappedCredential != NULL)
         {
-            hr = _pWrappedCredential->Advise(_pWrappedCredentialEvents);
+            TRACE_WRAPPED_CALL(TM_CREDENTIAL_ADVISE, TRACE_NO_FIELD, hr, _pWrappedCredential->Advise(_pWrappedCredentialEvents));
         }
     }
     else
@@ -135,6 +223,7 @@ HRESULT Credential::Advise(
 HRESULT Credential::UnAdvise()
 {
     HRESULT hr = S_OK;
+    CTraceScope trace(TM_CREDENTIAL_UNADVISE, TRACE_NO_FIELD, &hr);
 
     if (_pWrappedCredential != NULL)
     {
@@ -154,10 +243,14 @@ HRESULT Credential::UnAdvise()
 HRESULT Credential::SetSelected(__out BOOL* pbAutoLogon)
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_SETSELECTED, TRACE_NO_FIELD, &hr);
 
     if (_pWrappedCredential != NULL)
     {
-        hr = _pWrappedCredential->SetSelected(pbAutoLogon);
+        // From here on the wrapped credential may hold what the user typed, so its
+        // provider mustn't go to the next wrapper.
+        _bTouched = TRUE;
+        TRACE_WRAPPED_CALL(TM_CREDENTIAL_SETSELECTED, TRACE_NO_FIELD, hr, _pWrappedCredential->SetSelected(pbAutoLogon));
     }
 
     return hr;
@@ -168,10 +261,11 @@ HRESULT Credential::SetSelected(__out BOOL* pbAutoLogon)
 HRESULT Credential::SetDeselected()
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_SETDESELECTED, TRACE_NO_FIELD, &hr);
 
     if (_pWrappedCredential != NULL)
     {
-        hr = _pWrappedCredential->SetDeselected();
+        TRACE_WRAPPED_CALL(TM_CREDENTIAL_SETDESELECTED, TRACE_NO_FIELD, hr, _pWrappedCredential->SetDeselected());
     }
 
     return hr;
@@ -187,6 +281,7 @@ HRESULT Credential::GetFieldState(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_GETFIELDSTATE, dwFieldID, &hr);
 
     // Make sure we have a wrapped credential.
     if (_pWrappedCredential != NULL)
@@ -194,27 +289,25 @@ HRESULT Credential::GetFieldState(
         // Validate parameters.
         if ((pcpfs != NULL) && (pcpfis != NULL))
         {
+            DWORD dwInnerID;
+            FIELD_OWNER fo = _pFieldMap->ToInner(dwFieldID, &dwInnerID);
+
             // If the field is in the wrapped credential, hand it off.
-            if (_IsFieldInWrappedCredential(dwFieldID))
+            if (FO_WRAPPED == fo)
             {
-                hr = _pWrappedCredential->GetFieldState(dwFieldID, pcpfs, pcpfis);
+                TRACE_WRAPPED_CALL(TM_CREDENTIAL_GETFIELDSTATE, dwInnerID, hr, _pWrappedCredential->GetFieldState(dwInnerID, pcpfs, pcpfis));
             }
             // Otherwise, we need to see if it's one of ours.
+            else if (FO_OURS == fo)
+            {
+                *pcpfs = s_rgFieldStatePairs[dwInnerID].cpfs;
+                *pcpfis = s_rgFieldStatePairs[dwInnerID].cpfis;
+
+                hr = S_OK;
+            }
             else
             {
-                FIELD_STATE_PAIR *pfsp = _LookupLocalFieldStatePair(dwFieldID);
-                // If the field ID is valid, give it info it needs.
-                if (pfsp != NULL)
-                {
-                    *pcpfs = pfsp->cpfs;
-                    *pcpfis = pfsp->cpfis;
-
-                    hr = S_OK;
-                }
-                else
-                {
-                    hr = E_INVALIDARG;
-                }
+                hr = E_INVALIDARG;
             }
         }
         else
@@ -233,50 +326,42 @@ HRESULT Credential::GetStringValue(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_GETSTRINGVALUE, dwFieldID, &hr);
 
     // Make sure we have a wrapped credential.
     if (_pWrappedCredential != NULL)
     {
-        // If this field belongs to the wrapped credential, hand it off.
-        if (_IsFieldInWrappedCredential(dwFieldID))
-        {
-			// Hijack the normal value for the text field that displays "Other User" and replace
-			// it with "Login to Windows"
-			// WARNING: The dwFieldID == 0 we're testing against was found by trial and error since we
-			// don't have access to the source for the PasswordProvider we're wrapping.  If for some
-			// reason it changes in the future, this may break.
-			if (dwFieldID == 0)
-			{
-				// inspect the wrapped value
-				wchar_t* pwszWrappedValue = new wchar_t[260];
-				hr = _pWrappedCredential->GetStringValue(dwFieldID, &pwszWrappedValue);
-				if (hr == S_OK)
-				{
-					if (_wcsicmp(pwszWrappedValue, L"Other User") == 0)
-					{
-						debug << L"Found \"Other User\"\n";
-						hr = SHStrDupW(L"Login to Windows", ppwsz);
-						return hr;
-					}
-				}
-				else debug << L"GetStringValue failed with " << hr << std::endl;
-			}
+        DWORD dwInnerID;
+        FIELD_OWNER fo = _pFieldMap->ToInner(dwFieldID, &dwInnerID);
 
-			hr = _pWrappedCredential->GetStringValue(dwFieldID, ppwsz);
-        }
-        // Otherwise determine if we need to handle it.
-        else
+        // If this field belongs to the wrapped credential, hand it off.
+        if (FO_WRAPPED == fo)
         {
-            FIELD_STATE_PAIR *pfsp = _LookupLocalFieldStatePair(dwFieldID);
-            if (pfsp != NULL)
+            // Text the user can't edit goes through the rewrite rules, and is remembered
+            // until the wrapped credential says it has changed.
+            if (RewriteIsTextField(_pFieldMap->GetWrappedType(dwInnerID)))
             {
-                hr = SHStrDupW(_rgFieldStrings[dwFieldID - _dwWrappedDescriptorCount], ppwsz);
+                hr = _GetRewrittenString(dwInnerID, ppwsz);
             }
             else
             {
-                hr = E_INVALIDARG;
+                TRACE_WRAPPED_CALL(TM_CREDENTIAL_GETSTRINGVALUE, dwInnerID, hr, _pWrappedCredential->GetStringValue(dwInnerID, ppwsz));
             }
         }
+        // Otherwise determine if we need to handle it.
+        else if (FO_OURS == fo)
+        {
+            // Once a switch has started, the command link shows its status instead.
+            hr = (SFI_BOOT_MAC_COMMAND == dwInnerID) ? _bootSwitch.GetStatusText(ppwsz) : S_FALSE;
+            if (S_FALSE == hr)
+            {
+                hr = _pStringPool->CoTaskMemDup(_rgdwFieldStrings[dwInnerID], ppwsz);
+            }
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+        }
     }
     return hr;
 }
@@ -288,10 +373,20 @@ HRESULT Credential::GetComboBoxValueCount(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_GETCOMBOBOXVALUECOUNT, dwFieldID, &hr);
 
     if (_pWrappedCredential != NULL)
     {
-        hr = _pWrappedCredential->GetComboBoxValueCount(dwFieldID, pcItems, pdwSelectedItem);
+        DWORD dwInnerID;
+        // We don't have any of these ourselves.
+        if (FO_WRAPPED == _pFieldMap->ToInner(dwFieldID, &dwInnerID))
+        {
+            TRACE_WRAPPED_CALL(TM_CREDENTIAL_GETCOMBOBOXVALUECOUNT, dwInnerID, hr, _pWrappedCredential->GetComboBoxValueCount(dwInnerID, pcItems, pdwSelectedItem));
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+        }
     }
 
     return hr;
@@ -304,10 +399,20 @@ HRESULT Credential::GetComboBoxValueAt(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_GETCOMBOBOXVALUEAT, dwFieldID, &hr);
 
     if (_pWrappedCredential != NULL)
     {
-        hr = _pWrappedCredential->GetComboBoxValueAt(dwFieldID, dwItem, ppwszItem);
+        DWORD dwInnerID;
+        // We don't have any of these ourselves.
+        if (FO_WRAPPED == _pFieldMap->ToInner(dwFieldID, &dwInnerID))
+        {
+            TRACE_WRAPPED_CALL(TM_CREDENTIAL_GETCOMBOBOXVALUEAT, dwInnerID, hr, _pWrappedCredential->GetComboBoxValueAt(dwInnerID, dwItem, ppwszItem));
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+        }
     }
 
     return hr;
@@ -319,10 +424,21 @@ HRESULT Credential::SetComboBoxSelectedValue(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_SETCOMBOBOXSELECTEDVALUE, dwFieldID, &hr);
 
     if (_pWrappedCredential != NULL)
     {
-        hr = _pWrappedCredential->SetComboBoxSelectedValue(dwFieldID, dwSelectedItem);
+        DWORD dwInnerID;
+        // We don't have any of these ourselves.
+        if (FO_WRAPPED == _pFieldMap->ToInner(dwFieldID, &dwInnerID))
+        {
+            _bTouched = TRUE;
+            TRACE_WRAPPED_CALL(TM_CREDENTIAL_SETCOMBOBOXSELECTEDVALUE, dwInnerID, hr, _pWrappedCredential->SetComboBoxSelectedValue(dwInnerID, dwSelectedItem));
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+        }
     }
 
     return hr;
@@ -342,33 +458,16 @@ HRESULT Credential::GetBitmapValue(
     __out HBITMAP* phbmp
     )
 {
-	UNREFERENCED_PARAMETER(dwFieldID);
-
 	HRESULT hr;
+	CTraceScope trace(TM_CREDENTIAL_GETBITMAPVALUE, dwFieldID, &hr);
 
-	// Look for the filesystem bitmap first
-	HBITMAP hbmp = (HBITMAP)LoadImage( NULL, bmpPath.c_str(), IMAGE_BITMAP, 0, 0, LR_DEFAULTSIZE | LR_LOADFROMFILE );
-    if (hbmp != NULL)
-    {
-		debug << "using filesystem bitmap" << std::endl;
-        hr = S_OK;
-        *phbmp = hbmp;
-    }
-    else
-    {
-		// Use the resource bitmap as a backup
-		hbmp = LoadBitmap(HINST_THISDLL, MAKEINTRESOURCE(IDB_BITMAP1));
-		if (hbmp != NULL)
-		{
-			debug << "using default bitmap" << std::endl;
-			hr = S_OK;
-			*phbmp = hbmp;
-		}
-		else
-		{
-			hr = HRESULT_FROM_WIN32(GetLastError());
-		}
-    }
+	// The cache prefers the filesystem bitmap and falls back to the resource bitmap
+	BOOL bFromFile;
+	hr = TileBitmapCacheGet(IDB_BITMAP1, phbmp, &bFromFile);
+	if (SUCCEEDED(hr))
+	{
+		LogWrite(L"using %s bitmap", bFromFile ? L"filesystem" : L"default");
+	}
 
     return hr;
 }
@@ -379,10 +478,24 @@ HRESULT Credential::GetSubmitButtonValue(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_GETSUBMITBUTTONVALUE, dwFieldID, &hr);
 
     if (_pWrappedCredential != NULL)
     {
-        hr = _pWrappedCredential->GetSubmitButtonValue(dwFieldID, pdwAdjacentTo);
+        DWORD dwInnerID;
+        // The submit button and the field it's next to are both the wrapped credential's.
+        if (FO_WRAPPED == _pFieldMap->ToInner(dwFieldID, &dwInnerID))
+        {
+            TRACE_WRAPPED_CALL(TM_CREDENTIAL_GETSUBMITBUTTONVALUE, dwInnerID, hr, _pWrappedCredential->GetSubmitButtonValue(dwInnerID, pdwAdjacentTo));
+            if (SUCCEEDED(hr))
+            {
+                *pdwAdjacentTo = _pFieldMap->WrappedToOuter(*pdwAdjacentTo);
+            }
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+        }
     }
 
     return hr;
@@ -394,10 +507,21 @@ HRESULT Credential::SetStringValue(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_SETSTRINGVALUE, dwFieldID, &hr);
 
     if (_pWrappedCredential != NULL)
     {
-        hr = _pWrappedCredential->SetStringValue(dwFieldID, pwz);
+        DWORD dwInnerID;
+        // We don't have any of these ourselves.
+        if (FO_WRAPPED == _pFieldMap->ToInner(dwFieldID, &dwInnerID))
+        {
+            _bTouched = TRUE;
+            TRACE_WRAPPED_CALL(TM_CREDENTIAL_SETSTRINGVALUE, dwInnerID, hr, _pWrappedCredential->SetStringValue(dwInnerID, pwz));
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+        }
     }
 
     return hr;
@@ -411,12 +535,14 @@ HRESULT Credential::GetCheckboxValue(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_GETCHECKBOXVALUE, dwFieldID, &hr);
 
     if (_pWrappedCredential != NULL)
     {
-        if (_IsFieldInWrappedCredential(dwFieldID))
+        DWORD dwInnerID;
+        if (FO_WRAPPED == _pFieldMap->ToInner(dwFieldID, &dwInnerID))
         {
-            hr = _pWrappedCredential->GetCheckboxValue(dwFieldID, pbChecked, ppwszLabel);
+            TRACE_WRAPPED_CALL(TM_CREDENTIAL_GETCHECKBOXVALUE, dwInnerID, hr, _pWrappedCredential->GetCheckboxValue(dwInnerID, pbChecked, ppwszLabel));
         }
     }
 
@@ -429,10 +555,21 @@ HRESULT Credential::SetCheckboxValue(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_SETCHECKBOXVALUE, dwFieldID, &hr);
 
     if (_pWrappedCredential != NULL)
     {
-        hr = _pWrappedCredential->SetCheckboxValue(dwFieldID, bChecked);
+        DWORD dwInnerID;
+        // We don't have any of these ourselves.
+        if (FO_WRAPPED == _pFieldMap->ToInner(dwFieldID, &dwInnerID))
+        {
+            _bTouched = TRUE;
+            TRACE_WRAPPED_CALL(TM_CREDENTIAL_SETCHECKBOXVALUE, dwInnerID, hr, _pWrappedCredential->SetCheckboxValue(dwInnerID, bChecked));
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+        }
     }
 
     return hr;
@@ -442,25 +579,28 @@ HRESULT Credential::SetCheckboxValue(
 HRESULT Credential::CommandLinkClicked(__in DWORD dwFieldID)
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_COMMANDLINKCLICKED, dwFieldID, &hr);
 
     if (_pWrappedCredential != NULL)
     {
+        DWORD dwInnerID;
+        FIELD_OWNER fo = _pFieldMap->ToInner(dwFieldID, &dwInnerID);
+
         // If this field belongs to the wrapped credential, hand it off.
-        if (_IsFieldInWrappedCredential(dwFieldID))
+        if (FO_WRAPPED == fo)
         {
-	        hr = _pWrappedCredential->CommandLinkClicked(dwFieldID);
+            _bTouched = TRUE;
+	        TRACE_WRAPPED_CALL(TM_CREDENTIAL_COMMANDLINKCLICKED, dwInnerID, hr, _pWrappedCredential->CommandLinkClicked(dwInnerID));
         }
         // Otherwise determine if we need to handle it.
         else
         {
-			// make sure the normalized dwFieldID is our command link ID
-			if (SFI_BOOT_MAC_COMMAND == (dwFieldID - _dwWrappedDescriptorCount))
+			// make sure the field is our command link
+			if (FO_OURS == fo && SFI_BOOT_MAC_COMMAND == dwInnerID)
 			{
-				// Set Mac as default boot volume and reboot.
-				if (SetMacDefaultBoot())
-				{
-					Reboot();
-				}
+				// Set Mac as default boot volume and reboot in the background, unless
+				// that's already under way. The link shows how it goes.
+				_bootSwitch.Start();
 				hr = S_OK;
 			}
             else
@@ -473,112 +613,6 @@ HRESULT Credential::CommandLinkClicked(__in DWORD dwFieldID)
     return hr;
 }
 
-BOOL Credential::SetMacDefaultBoot()
-{
-	// get the filesystem location of %ProgramFiles%
-	// http://msdn.microsoft.com/en-us/library/bb762188.aspx
-	wchar_t* pathProgramFiles = 0;
-	SHGetKnownFolderPath(FOLDERID_ProgramFiles, 0, NULL, &pathProgramFiles);
-
-	// build the path to bootcamp.exe
-	// http://msdn.microsoft.com/en-us/library/ms647527.aspx
-	std::wstring pathBootCamp(pathProgramFiles);
-	pathBootCamp += L"\\Boot Camp\\BootCamp.exe";
-
-	// free the memory like the docs tell us
-	CoTaskMemFree(static_cast<void*>(pathProgramFiles));
-
-	// Make sure the executable exists
-	DWORD attr = GetFileAttributes(pathBootCamp.c_str());
-	if (attr == INVALID_FILE_ATTRIBUTES || (attr & FILE_ATTRIBUTE_DIRECTORY))
-	{
-		debug << "BootCamp.exe not found at " << pathBootCamp.c_str() << std::endl;
-	    return FALSE;
-	}
-
-	// Finish building the complete command line to set the Mac startup volume
-	// http://support.apple.com/kb/HT3802
-	// "%ProgramFiles%\Boot Camp\BootCamp.exe" -StartupDisk
-	std::wstring fullCmd(L"\"" + pathBootCamp + L"\" -StartupDisk");
-
-	debug << fullCmd.c_str() << std::endl;
-
-	// CreateProcess
-	//http://msdn.microsoft.com/en-us/library/ms682425.aspx
-	STARTUPINFO si;
-    PROCESS_INFORMATION pi;
-    ZeroMemory( &si, sizeof(si) );
-    si.cb = sizeof(si);
-    ZeroMemory( &pi, sizeof(pi) );
-
-	wchar_t * pwszCmd = new wchar_t[fullCmd.length() + 1];
-	StringCchCopy(pwszCmd, fullCmd.length() + 1, fullCmd.c_str());
-
-	if (!CreateProcessW(NULL,   // No module name (use command line)
-        pwszCmd,        // Command line
-        NULL,           // Process handle not inheritable
-        NULL,           // Thread handle not inheritable
-        FALSE,          // Set handle inheritance to FALSE
-        0,              // No creation flags
-        NULL,           // Use parent's environment block
-        NULL,           // Use parent's starting directory
-        &si,            // Pointer to STARTUPINFO structure
-        &pi )           // Pointer to PROCESS_INFORMATION structure
-    )
-    {
-        debug << L"CreateProcess failed with error " << GetLastError() << std::endl;
-		/* Free memory */
-	    delete[]pwszCmd;
-		pwszCmd = 0;
-		return FALSE;
-    }
-
-    // Wait until child process exits.
-    WaitForSingleObject( pi.hProcess, 5000 );
-
-	debug << L"BootCamp.exe finished or timeout elapsed" << std::endl;
-
-    // Close process and thread handles.
-    CloseHandle( pi.hProcess );
-    CloseHandle( pi.hThread );
-
-	/* Free memory */
-	delete[]pwszCmd;
-	pwszCmd = 0;
-
-	return TRUE;
-}
-
-BOOL Credential::Reboot()
-{
-	HANDLE hToken;
-	TOKEN_PRIVILEGES tkp;
-
-	// Get a token for this process.
-	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
-		return( FALSE );
-
-	// Get the LUID for the shutdown privilege.
-	LookupPrivilegeValue(NULL, SE_SHUTDOWN_NAME, &tkp.Privileges[0].Luid);
-
-	tkp.PrivilegeCount = 1;  // one privilege to set
-	tkp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
-
-	// Get the shutdown privilege for this process.
-	AdjustTokenPrivileges(hToken, FALSE, &tkp, 0, (PTOKEN_PRIVILEGES)NULL, 0);
-
-	if (GetLastError() != ERROR_SUCCESS)
-		return FALSE;
-
-	// Reboot the system and force all applications to close.
-	if (!ExitWindowsEx(EWX_REBOOT | EWX_FORCE,
-			SHTDN_REASON_MAJOR_OPERATINGSYSTEM | SHTDN_REASON_MINOR_UPGRADE | SHTDN_REASON_FLAG_PLANNED))
-		return FALSE;
-
-	//shutdown was successful
-	return TRUE;
-}
-
 //------ end of methods for controls we don't have ourselves ----//
 
 
@@ -595,10 +629,12 @@ HRESULT Credential::GetSerialization(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_GETSERIALIZATION, TRACE_NO_FIELD, &hr);
 
     if (_pWrappedCredential != NULL)
     {
-        hr = _pWrappedCredential->GetSerialization(pcpgsr, pcpcs, ppwszOptionalStatusText, pcpsiOptionalStatusIcon);
+        _bTouched = TRUE;
+        TRACE_WRAPPED_CALL(TM_CREDENTIAL_GETSERIALIZATION, TRACE_NO_FIELD, hr, _pWrappedCredential->GetSerialization(pcpgsr, pcpcs, ppwszOptionalStatusText, pcpsiOptionalStatusIcon));
     }
 
     return hr;
@@ -614,36 +650,108 @@ HRESULT Credential::ReportResult(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_CREDENTIAL_REPORTRESULT, TRACE_NO_FIELD, &hr);
 
     if (_pWrappedCredential != NULL)
     {
-        hr = _pWrappedCredential->ReportResult(ntsStatus, ntsSubstatus, ppwszOptionalStatusText, pcpsiOptionalStatusIcon);
+        _bTouched = TRUE;
+        TRACE_WRAPPED_CALL(TM_CREDENTIAL_REPORTRESULT, TRACE_NO_FIELD, hr, _pWrappedCredential->ReportResult(ntsStatus, ntsSubstatus, ppwszOptionalStatusText, pcpsiOptionalStatusIcon));
     }
 
     return hr;
 }
 
-BOOL Credential::_IsFieldInWrappedCredential(
-    __in DWORD dwFieldID
+// Remembers pwszValue, which the wrapped credential gave us for field dwInnerID, and
+// which rule rewrites it. Takes ownership of pwszValue.
+void Credential::_RememberString(
+    __in DWORD dwInnerID,
+    __in PWSTR pwszValue
     )
 {
-    return (dwFieldID < _dwWrappedDescriptorCount);
+    FIELD_MEMO& rfm = _rgMemos[dwInnerID];
+    CoTaskMemFree(rfm.pwszValue);
+    rfm.pwszValue = pwszValue;
+    rfm.cch = StrLenW(pwszValue, STRSAFE_MAX_CCH);
+    rfm.iRule = RewriteRulesFind(RewriteRulesGet(), dwInnerID, _pFieldMap->GetWrappedType(dwInnerID), pwszValue, rfm.cch);
 }
 
-FIELD_STATE_PAIR *Credential::_LookupLocalFieldStatePair(
-    __in DWORD dwFieldID
+// Drops everything we remember about the wrapped credential's strings.
+void Credential::_ForgetStrings()
+{
+    for (DWORD i = 0; i < _cMemos; i++)
+    {
+        CoTaskMemFree(_rgMemos[i].pwszValue);
+        _rgMemos[i].pwszValue = NULL;
+    }
+}
+
+// Copies the value of the wrapped credential's text field dwInnerID, or what a rule
+// replaces it with, asking the wrapped credential only if we don't remember it.
+HRESULT Credential::_GetRewrittenString(
+    __in DWORD dwInnerID,
+    __deref_out PWSTR* ppwsz
     )
 {
-    // Offset into the ID to account for the wrapped fields.
-    dwFieldID -= _dwWrappedDescriptorCount;
+    HRESULT hr = S_OK;
+    FIELD_MEMO& rfm = _rgMemos[dwInnerID];
+    if (rfm.pwszValue == NULL)
+    {
+        PWSTR pwszValue = NULL;
+        TRACE_WRAPPED_CALL(TM_CREDENTIAL_GETSTRINGVALUE, dwInnerID, hr, _pWrappedCredential->GetStringValue(dwInnerID, &pwszValue));
+        if (SUCCEEDED(hr) && pwszValue == NULL)
+        {
+            hr = SHStrDupW(L"", &pwszValue);
+        }
+        if (FAILED(hr))
+        {
+            LogWrite(L"GetStringValue failed with 0x%08x", hr);
+            return hr;
+        }
+        _RememberString(dwInnerID, pwszValue);
+    }
 
-    // If the index if valid, give it the info it wants.
-    if (dwFieldID < SFI_NUM_FIELDS)
+    if (rfm.iRule != REWRITE_NO_RULE)
     {
-        return &(_rgFieldStatePairs[dwFieldID]);
+        const REWRITE_RULES* prr = RewriteRulesGet();
+        hr = prr->pStrings->CoTaskMemDup(prr->rgRules[rfm.iRule].dwReplacement, ppwsz);
     }
+    else
+    {
+        hr = CoTaskMemDupCch(rfm.pwszValue, rfm.cch, ppwsz);
+    }
+    return hr;
+}
 
-    return NULL;
+// WrappedCredentialEvents calls this when the wrapped credential changes the string in
+// its field dwInnerID to pwszValue. Returns what LogonUI should show instead, which
+// stays valid until the field changes again.
+PCWSTR Credential::WrappedStringChanged(
+    __in DWORD dwInnerID,
+    __in PCWSTR pwszValue
+    )
+{
+    if (dwInnerID >= _cMemos || !RewriteIsTextField(_pFieldMap->GetWrappedType(dwInnerID)))
+    {
+        return pwszValue;
+    }
+
+    PWSTR pwszCopy;
+    if (FAILED(SHStrDupW(pwszValue, &pwszCopy)))
+    {
+        // We'll ask the wrapped credential next time instead.
+        CoTaskMemFree(_rgMemos[dwInnerID].pwszValue);
+        _rgMemos[dwInnerID].pwszValue = NULL;
+        return pwszValue;
+    }
+    _RememberString(dwInnerID, pwszCopy);
+
+    const FIELD_MEMO& rfm = _rgMemos[dwInnerID];
+    if (rfm.iRule != REWRITE_NO_RULE)
+    {
+        const REWRITE_RULES* prr = RewriteRulesGet();
+        return prr->pStrings->GetString(prr->rgRules[rfm.iRule].dwReplacement);
+    }
+    return rfm.pwszValue;
 }
 
 void Credential::_CleanupEvents()
@@ -663,4 +771,6 @@ void Credential::_CleanupEvents()
         _pCredProvCredentialEvents->Release();
         _pCredProvCredentialEvents = NULL;
     }
+
+    _bootSwitch.UnAdvise();
 }
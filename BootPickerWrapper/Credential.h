@@ -12,46 +12,31 @@
 #include "dll.h"
 #include "resource.h"
 #include "WrappedCredentialEvents.h"
+#include "FieldMap.h"
+#include "StringPool.h"
+#include "BootSwitch.h"
+#include "ComObject.h"
 
 #pragma warning(push)
 #pragma warning(disable : 4995)
 #include <string>
 #pragma warning(pop)
-#include <sstream>
 
 EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 #ifndef HINST_THISDLL
 #define HINST_THISDLL ((HINSTANCE)&__ImageBase)
 #endif
 
-class Credential : public ICredentialProviderCredential
+// What a credential remembers about one of the wrapped credential's text fields.
+struct FIELD_MEMO
 {
-    public:
-    // IUnknown
-    IFACEMETHODIMP_(ULONG) AddRef()
-    {
-        return ++_cRef;
-    }
-    
-    IFACEMETHODIMP_(ULONG) Release()
-    {
-        LONG cRef = --_cRef;
-        if (!cRef)
-        {
-            delete this;
-        }
-        return cRef;
-    }
+    PWSTR   pwszValue;      // The wrapped credential's value, or NULL if we have to ask for it.
+    size_t  cch;
+    DWORD   iRule;          // The rewrite rule that replaces it, or REWRITE_NO_RULE.
+};
 
-    IFACEMETHODIMP QueryInterface(__in REFIID riid, __deref_out void** ppv)
-    {
-        static const QITAB qit[] =
-        {
-            QITABENT(Credential, ICredentialProviderCredential), // IID_ICredentialProviderCredential
-            {0},
-        };
-        return QISearch(this, qit, riid, ppv);
-    }
+class Credential : public ComObject<Credential, ICredentialProviderCredential>
+{
   public:
     // ICredentialProviderCredential
     IFACEMETHODIMP Advise(__in ICredentialProviderCredentialEvents* pcpce);
@@ -86,37 +71,47 @@ class Credential : public ICredentialProviderCredential
                                 __out CREDENTIAL_PROVIDER_STATUS_ICON* pcpsiOptionalStatusIcon);
 
   public:
-    HRESULT Initialize(__in const CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR* rgcpfd,
-                       __in const FIELD_STATE_PAIR* rgfsp,
-                       __in ICredentialProviderCredential *pWrappedCredential,
-                       __in DWORD dwWrappedDescriptorCount);
+    HRESULT Initialize(__in ICredentialProviderCredential *pWrappedCredential,
+                       __in FieldMap *pFieldMap,
+                       __in StringPool *pStringPool,
+                       __in_ecount(SFI_NUM_FIELDS) const DWORD *rgdwFieldStrings);
     Credential();
 
     virtual ~Credential();
 
-	std::wstring GetDebugText();
-	std::wstring bmpPath;
+    //credentials come from a small slab before they come from the heap
+    static void* operator new(__in size_t cb) throw();
+    static void operator delete(__in_opt void* pv) throw();
+
+    //the COM identity of the credential we wrap, which the provider matches us on when it enumerates again
+    IUnknown* GetWrappedIdentity() const
+    {
+        return _punkWrappedIdentity;
+    }
+
+    //the map we were initialized with
+    const FieldMap* GetFieldMap() const
+    {
+        return _pFieldMap;
+    }
+
+    //whether LogonUI has selected us, or passed the wrapped credential anything the user did,
+    //since we were made. Initialize doesn't reset it
+    BOOL WasTouched() const
+    {
+        return _bTouched;
+    }
+
+    //remembers a new value the wrapped credential set on one of its fields, and returns what to show
+    PCWSTR WrappedStringChanged(__in DWORD dwInnerID, __in PCWSTR pwszValue);
 
   private:
-    BOOL                                  _IsFieldInWrappedCredential(__in DWORD dwFieldID);
-    FIELD_STATE_PAIR                     *_LookupLocalFieldStatePair(__in DWORD dwFieldID);
     void                                  _CleanupEvents(); 
+    void                                  _RememberString(__in DWORD dwInnerID, __in PWSTR pwszValue);
+    void                                  _ForgetStrings();
+    HRESULT                               _GetRewrittenString(__in DWORD dwInnerID, __deref_out PWSTR* ppwsz);
 
   private:
-    LONG                                  _cRef;
-    CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR  _rgCredProvFieldDescriptors[SFI_NUM_FIELDS];  // An array holding the type 
-                                                                                        // and name of each field in 
-                                                                                        // the tile.
-
-    FIELD_STATE_PAIR                      _rgFieldStatePairs[SFI_NUM_FIELDS];           // An array holding the state 
-                                                                                        // of each field in the tile.
-
-    PWSTR                                 _rgFieldStrings[SFI_NUM_FIELDS];              // An array holding the string 
-                                                                                        // value of each field. This is 
-                                                                                        // different from the name of 
-                                                                                        // the field held in 
-                                                                                        // _rgCredProvFieldDescriptors.
-    
     WrappedCredentialEvents            *_pWrappedCredentialEvents;                     // Translate from the wrapped
                                                                                         // credential to wrapper credential.
 
@@ -125,11 +120,22 @@ class Credential : public ICredentialProviderCredential
                                                                                         // changed.
 
     ICredentialProviderCredential        *_pWrappedCredential;                           // Our wrapped credential.
-    DWORD                                _dwWrappedDescriptorCount;                      // The number of fields in our
-                                                                                         // wrapped credential.
+    IUnknown                            *_punkWrappedIdentity;                           // Its IUnknown, not AddRef'd.
+    FieldMap                            *_pFieldMap;                                     // Which of our fields are the
+                                                                                         // wrapped credential's, and
+                                                                                         // which are ours.
+
+    StringPool                          *_pStringPool;                                   // The provider's strings, and
+    DWORD                                _rgdwFieldStrings[SFI_NUM_FIELDS];              // the index of each of our
+                                                                                         // fields' values among them.
+
+    FIELD_MEMO                          *_rgMemos;                                       // What we remember about each
+    DWORD                                _cMemos;                                        // of the wrapped credential's
+                                                                                         // text fields.
 
-	BOOL SetMacDefaultBoot();
-	BOOL Reboot();
+    BOOL                                 _bTouched;                                      // See WasTouched.
 
-	std::wostringstream debug;
+    BootSwitch                           _bootSwitch;                                    // Switches to the Mac and
+                                                                                         // shows how that's going
+                                                                                         // in SFI_BOOT_MAC_COMMAND.
 };
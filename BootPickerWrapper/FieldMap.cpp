@@ -0,0 +1,130 @@
+#include "FieldMap.h"
+#include <intsafe.h>
+
+FieldMap::FieldMap() :
+    _cRef(1),
+    _cFields(0),
+    _cWrapped(0),
+    _rgfr(NULL),
+    _rgdwOuter(NULL),
+    _rgcpftWrapped(NULL)
+{
+}
+
+FieldMap::~FieldMap()
+{
+    delete [] _rgfr;
+    delete [] _rgdwOuter;
+    delete [] _rgcpftWrapped;
+}
+
+ULONG FieldMap::AddRef()
+{
+    return InterlockedIncrement(&_cRef);
+}
+
+ULONG FieldMap::Release()
+{
+    LONG cRef = InterlockedDecrement(&_cRef);
+    if (!cRef)
+    {
+        delete this;
+    }
+    return cRef;
+}
+
+DWORD FieldMap::FindInsertBefore(
+    __in DWORD cWrapped,
+    __in_ecount(cWrapped) const CREDENTIAL_PROVIDER_FIELD_TYPE* rgcpftWrapped,
+    __in CREDENTIAL_PROVIDER_FIELD_TYPE cpftInsertBefore
+    )
+{
+    // A field whose descriptor the provider couldn't get is CPFT_INVALID, and mustn't
+    // match a CPFT_INVALID that means "at the end".
+    if (cpftInsertBefore != CPFT_INVALID)
+    {
+        for (DWORD i = 0; i < cWrapped; i++)
+        {
+            if (rgcpftWrapped[i] == cpftInsertBefore)
+            {
+                return i;
+            }
+        }
+    }
+    return cWrapped;
+}
+
+HRESULT FieldMap::Create(
+    __in DWORD cWrapped,
+    __in_ecount(cWrapped) const CREDENTIAL_PROVIDER_FIELD_TYPE* rgcpftWrapped,
+    __in DWORD cOurs,
+    __in DWORD dwInsertBefore,
+    __deref_out FieldMap** ppfm
+    )
+{
+    *ppfm = NULL;
+
+    DWORD cFields;
+    HRESULT hr = DWordAdd(cWrapped, cOurs, &cFields);
+    if (SUCCEEDED(hr) && cFields == MAXDWORD)
+    {
+        // The out of range entry needs an id of its own.
+        hr = E_INVALIDARG;
+    }
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    FieldMap* pfm = new FieldMap();
+    if (pfm == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    pfm->_rgfr = new FIELD_ROUTE[cFields + 1];
+    pfm->_rgdwOuter = new DWORD[cFields];
+    pfm->_rgcpftWrapped = new CREDENTIAL_PROVIDER_FIELD_TYPE[cWrapped];
+    if (pfm->_rgfr == NULL || pfm->_rgdwOuter == NULL || pfm->_rgcpftWrapped == NULL)
+    {
+        pfm->Release();
+        return E_OUTOFMEMORY;
+    }
+    CopyMemory(pfm->_rgcpftWrapped, rgcpftWrapped, cWrapped * sizeof(*rgcpftWrapped));
+    pfm->_cFields = cFields;
+    pfm->_cWrapped = cWrapped;
+
+    if (dwInsertBefore > cWrapped)
+    {
+        dwInsertBefore = cWrapped;
+    }
+
+    // Wrapped fields up to the insertion point, then ours, then the rest of the wrapped ones.
+    for (DWORD dwOuterID = 0; dwOuterID < cFields; dwOuterID++)
+    {
+        FIELD_ROUTE& rfr = pfm->_rgfr[dwOuterID];
+        if (dwOuterID < dwInsertBefore)
+        {
+            rfr.fo = FO_WRAPPED;
+            rfr.dwInnerID = dwOuterID;
+        }
+        else if (dwOuterID < dwInsertBefore + cOurs)
+        {
+            rfr.fo = FO_OURS;
+            rfr.dwInnerID = dwOuterID - dwInsertBefore;
+        }
+        else
+        {
+            rfr.fo = FO_WRAPPED;
+            rfr.dwInnerID = dwOuterID - cOurs;
+        }
+
+        pfm->_rgdwOuter[(rfr.fo == FO_WRAPPED) ? rfr.dwInnerID : cWrapped + rfr.dwInnerID] = dwOuterID;
+    }
+
+    pfm->_rgfr[cFields].fo = FO_NONE;
+    pfm->_rgfr[cFields].dwInnerID = FIELD_MAP_NO_FIELD;
+
+    *ppfm = pfm;
+    return S_OK;
+}
@@ -0,0 +1,111 @@
+// A FieldMap says where every field of a wrapper tile comes from. LogonUI
+// numbers the fields of our tiles 0..n-1; some of them are the wrapped
+// credential's fields, under the ids it gave them, and the rest are ours
+// (MY_FIELD_ID). The provider builds one map whenever it learns how many fields
+// the wrapped provider has, and every credential and WrappedCredentialEvents
+// translates ids through it: outer to inner for LogonUI's calls, and inner to
+// outer for the wrapped credential's events. Each translation is one load from
+// a table.
+//
+// Our fields don't have to come last. They can sit in front of any of the
+// wrapped fields, and the wrapped fields after them move down.
+//
+// The map also remembers the type of each wrapped field, for the rewrite rules.
+//
+// A map never changes once it's built, and it is reference counted, so a
+// credential can keep using the one it was made with after the provider has
+// built a new one.
+
+#pragma once
+#include <windows.h>
+#include <credentialprovider.h>
+
+// What WrappedToOuter and OursToOuter return for an id they don't know.
+#define FIELD_MAP_NO_FIELD  ((DWORD)-1)
+
+enum FIELD_OWNER
+{
+    FO_NONE     = 0,    // Not a field of ours or of the wrapped credential.
+    FO_WRAPPED  = 1,
+    FO_OURS     = 2,
+};
+
+struct FIELD_ROUTE
+{
+    FIELD_OWNER fo;
+    DWORD       dwInnerID;      // The field's id to its owner.
+};
+
+class FieldMap
+{
+  public:
+    //builds a map of cWrapped wrapped fields of the given types and cOurs of ours, with ours in
+    //front of wrapped field dwInsertBefore. dwInsertBefore of cWrapped or more puts ours at the end
+    static HRESULT Create(
+        __in DWORD cWrapped,
+        __in_ecount(cWrapped) const CREDENTIAL_PROVIDER_FIELD_TYPE* rgcpftWrapped,
+        __in DWORD cOurs,
+        __in DWORD dwInsertBefore,
+        __deref_out FieldMap** ppfm
+        );
+
+    //where ours go for MY_FIELDS_INSERT_BEFORE: the first wrapped field of type cpftInsertBefore,
+    //or cWrapped if there's none or cpftInsertBefore is CPFT_INVALID
+    static DWORD FindInsertBefore(
+        __in DWORD cWrapped,
+        __in_ecount(cWrapped) const CREDENTIAL_PROVIDER_FIELD_TYPE* rgcpftWrapped,
+        __in CREDENTIAL_PROVIDER_FIELD_TYPE cpftInsertBefore
+        );
+
+    ULONG AddRef();
+    ULONG Release();
+
+    //the number of fields LogonUI sees
+    DWORD GetCount() const
+    {
+        return _cFields;
+    }
+
+    DWORD GetWrappedCount() const
+    {
+        return _cWrapped;
+    }
+
+    //who owns outer field dwOuterID, and its id to them. FO_NONE if it's out of range
+    FIELD_OWNER ToInner(__in DWORD dwOuterID, __out DWORD* pdwInnerID) const
+    {
+        const FIELD_ROUTE& rfr = _rgfr[(dwOuterID < _cFields) ? dwOuterID : _cFields];
+        *pdwInnerID = rfr.dwInnerID;
+        return rfr.fo;
+    }
+
+    //the type of the wrapped credential's field dwInnerID, or CPFT_INVALID if it doesn't have one
+    CREDENTIAL_PROVIDER_FIELD_TYPE GetWrappedType(__in DWORD dwInnerID) const
+    {
+        return (dwInnerID < _cWrapped) ? _rgcpftWrapped[dwInnerID] : CPFT_INVALID;
+    }
+
+    //the outer id of the wrapped credential's field dwInnerID, or FIELD_MAP_NO_FIELD
+    DWORD WrappedToOuter(__in DWORD dwInnerID) const
+    {
+        return (dwInnerID < _cWrapped) ? _rgdwOuter[dwInnerID] : FIELD_MAP_NO_FIELD;
+    }
+
+    //the outer id of our field dwInnerID, or FIELD_MAP_NO_FIELD
+    DWORD OursToOuter(__in DWORD dwInnerID) const
+    {
+        return (dwInnerID < _cFields - _cWrapped) ? _rgdwOuter[_cWrapped + dwInnerID] : FIELD_MAP_NO_FIELD;
+    }
+
+  private:
+    FieldMap();
+    ~FieldMap();
+
+  private:
+    LONG            _cRef;
+    DWORD           _cFields;
+    DWORD           _cWrapped;
+    FIELD_ROUTE*    _rgfr;          // By outer id, with an FO_NONE entry at _cFields for ids out of range.
+    DWORD*          _rgdwOuter;     // Outer ids of the wrapped fields, then of ours.
+    CREDENTIAL_PROVIDER_FIELD_TYPE* _rgcpftWrapped;
+};
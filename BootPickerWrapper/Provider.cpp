@@ -10,68 +10,167 @@
 #include "Provider.h"
 #include "Credential.h"
 #include "guid.h"
+#include "Trace.h"
+#include "GptScanner.h"
+#include "ProviderCache.h"
 
 // Provider ////////////////////////////////////////////////////////
 
-Provider::Provider():
-    _cRef(1)
+Provider::Provider()
 {
-    DllAddRef();
-
     _rgpCredentials = NULL;
     _dwCredentialCount = 0;
+    _dwUnwrappedCount = 0;
+    _rgpStaleCredentials = NULL;
+    _dwStaleCount = 0;
 
     _pWrappedProvider = NULL;
-    _dwWrappedDescriptorCount = 0;
-
-	// build the path to the log file based on this dll's name
-	wchar_t* pwszDllPath = new wchar_t[260];
-	GetModuleFileName(HINST_THISDLL, pwszDllPath, 260);
-	std::wstring logPath(pwszDllPath);
-	bmpPath = std::wstring(pwszDllPath);
-	delete[]pwszDllPath;
-	logPath.replace(logPath.end()-3,logPath.end(),L"log");
-	bmpPath.replace(bmpPath.end()-3,logPath.end(),L"bmp");
-
-	// open the log file for writing
-	debug = std::wofstream(logPath);
+    _cpus = CPUS_INVALID;
+    _dwFlags = 0;
+    _bWrappedReusable = FALSE;
+    _bWrappedAdvised = FALSE;
+    _pFieldMap = NULL;
+    _pStringPool = NULL;
 }
 
 Provider::~Provider()
+{
+    _ReleaseWrappedProvider();
+
+    if (_pStringPool)
+    {
+        _pStringPool->Release();
+    }
+}
+
+// Releases our credentials, which wrap the wrapped provider's, and the field map,
+// which was worked out from its fields for its usage scenario, and gives the
+// wrapped provider back to the cache. The cache only keeps it for the next
+// wrapper if nothing we did to it would show through: it wasn't given a
+// serialization, and LogonUI didn't touch any of its credentials, whose fields
+// would otherwise still have what the user typed in them.
+void Provider::_ReleaseWrappedProvider()
 {
     _CleanUpAllCredentials();
-    
-    if (_pWrappedProvider)
+
+    if (_pFieldMap != NULL)
     {
-        _pWrappedProvider->Release();
+        _pFieldMap->Release();
+        _pFieldMap = NULL;
     }
 
-	// close the log file
-	if (debug.is_open()) debug.close();
+    if (_pWrappedProvider != NULL)
+    {
+        ProviderCacheGiveBack(CLSID_PasswordCredentialProvider, _cpus, _dwFlags, _bWrappedReusable && !_bWrappedAdvised, _pWrappedProvider);
+        _pWrappedProvider = NULL;
+    }
+    _cpus = CPUS_INVALID;
+    _dwFlags = 0;
+    _bWrappedReusable = FALSE;
+    _bWrappedAdvised = FALSE;
+}
 
-    DllRelease();
+// Releases each credential in rgpCredentials, then the array itself. Returns TRUE if
+// LogonUI touched any of them, in which case what they wrap may still hold what the
+// user typed.
+static BOOL _ReleaseCredentials(
+    __inout_ecount_opt(dwCount) Credential **rgpCredentials,
+    __in DWORD dwCount
+    )
+{
+    BOOL bTouched = FALSE;
+    if (rgpCredentials != NULL)
+    {
+        for (DWORD lcv = 0; lcv < dwCount; lcv++)
+        {
+            if (rgpCredentials[lcv] != NULL)
+            {
+                bTouched |= rgpCredentials[lcv]->WasTouched();
+                rgpCredentials[lcv]->Release();
+            }
+        }
+        delete [] rgpCredentials;
+    }
+    return bTouched;
 }
 
-// Cleans up all credentials, including the memory used to allocate the array.
+// Cleans up all credentials, stale ones too, including the memory used to allocate the arrays.
 void Provider::_CleanUpAllCredentials()
 {
-    // Iterate and clean up the array, if it exists.
-    if (_rgpCredentials != NULL)
+    if (_ReleaseCredentials(_rgpCredentials, _dwCredentialCount))
+    {
+        _bWrappedReusable = FALSE;
+    }
+    _rgpCredentials = NULL;
+    _dwCredentialCount = 0;
+    _dwUnwrappedCount = 0;
+    _ReleaseStaleCredentials();
+}
+
+// Builds the map of which fields on our tiles are the wrapped provider's and which are
+// ours, putting ours where MY_FIELDS_INSERT_BEFORE says, and notes the type of each
+// wrapped field. Credentials made with the old map keep it until they go away, or
+// until GetCredentialAt reuses them and gives them the new one.
+HRESULT Provider::_BuildFieldMap(
+    __in DWORD dwWrappedDescriptorCount
+    )
+{
+    CREDENTIAL_PROVIDER_FIELD_TYPE* rgcpft = new CREDENTIAL_PROVIDER_FIELD_TYPE[dwWrappedDescriptorCount];
+    if (rgcpft == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    // A field whose descriptor we can't get is left as CPFT_INVALID, which nothing matches.
+    for (DWORD i = 0; i < dwWrappedDescriptorCount; i++)
     {
-        for (DWORD lcv = 0; lcv < _dwCredentialCount; lcv++)
+        HRESULT hr;
+        CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR* pcpfd;
+        rgcpft[i] = CPFT_INVALID;
+        TRACE_WRAPPED_CALL(TM_PROVIDER_GETFIELDDESCRIPTORAT, i, hr, _pWrappedProvider->GetFieldDescriptorAt(i, &pcpfd));
+        if (SUCCEEDED(hr))
         {
-            if (_rgpCredentials[lcv] != NULL)
-            {
-				// extract the debug text
-				debug << L"Credential " << lcv << L":" << std::endl << _rgpCredentials[lcv]->GetDebugText();
+            rgcpft[i] = pcpfd->cpft;
+            CoTaskMemFree(pcpfd->pszLabel);
+            CoTaskMemFree(pcpfd);
+        }
+    }
 
-                _rgpCredentials[lcv]->Release();
-                _rgpCredentials[lcv] = NULL;
-            }
+    FieldMap* pfm;
+    DWORD dwInsertBefore = FieldMap::FindInsertBefore(dwWrappedDescriptorCount, rgcpft, MY_FIELDS_INSERT_BEFORE);
+    HRESULT hr = FieldMap::Create(dwWrappedDescriptorCount, rgcpft, SFI_NUM_FIELDS, dwInsertBefore, &pfm);
+    if (SUCCEEDED(hr))
+    {
+        if (_pFieldMap != NULL)
+        {
+            _pFieldMap->Release();
         }
-        delete [] _rgpCredentials;
-        _rgpCredentials = NULL;
+        _pFieldMap = pfm;
     }
+
+    delete [] rgcpft;
+    return hr;
+}
+
+// Puts the values of our fields in the string pool that every credential shares.
+HRESULT Provider::_BuildStringPool()
+{
+    StringPool* psp;
+    HRESULT hr = StringPool::Create(&psp);
+    for (DWORD i = 0; SUCCEEDED(hr) && i < SFI_NUM_FIELDS; i++)
+    {
+        hr = psp->Intern(s_rgpwszFieldValues[i], &_rgdwFieldStrings[i]);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        _pStringPool = psp;
+    }
+    else if (psp != NULL)
+    {
+        psp->Release();
+    }
+    return hr;
 }
 
 // Ordinarily we would look at the CPUS and decide whether or not we support this scenario.
@@ -83,28 +182,23 @@ HRESULT Provider::SetUsageScenario(
     )
 {
     HRESULT hr;
+    CTraceScope trace(TM_PROVIDER_SETUSAGESCENARIO, TRACE_NO_FIELD, &hr);
+
+    // Start looking for the Mac partitions now, so that the command link doesn't wait on the disks.
+    GptIndexPrefetch();
 
-    // Create the password credential provider and query its interface for an
-    // ICredentialProvider we can use. Once it's up and running, ask it about the 
-    // usage scenario being provided.
-    IUnknown *pUnknown = NULL;
-    hr = CoCreateInstance(CLSID_PasswordCredentialProvider, NULL, CLSCTX_ALL, IID_PPV_ARGS(&pUnknown));
+    // Give back whatever we were wrapping before, and any wrappers for its credentials.
+    _ReleaseWrappedProvider();
+
+    // Get a password credential provider that's been told about the usage scenario being
+    // provided: warm from the last wrapper if there's one for the same scenario, or else new.
+    BOOL bWarm;
+    hr = ProviderCacheAcquire(CLSID_PasswordCredentialProvider, cpus, dwFlags, &(_pWrappedProvider), &(bWarm));
     if (SUCCEEDED(hr))
     {
-        hr = pUnknown->QueryInterface(IID_PPV_ARGS(&(_pWrappedProvider)));
-        if (SUCCEEDED(hr))
-        {
-            hr = _pWrappedProvider->SetUsageScenario(cpus, dwFlags);
-        }
-        pUnknown->Release();
-    }
-    if (FAILED(hr))
-    {
-        if (_pWrappedProvider != NULL)
-        {
-            _pWrappedProvider->Release();
-            _pWrappedProvider = NULL;
-        }
+        _cpus = cpus;
+        _dwFlags = dwFlags;
+        _bWrappedReusable = TRUE;
     }
 
     return hr;
@@ -116,10 +210,14 @@ HRESULT Provider::SetSerialization(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_PROVIDER_SETSERIALIZATION, TRACE_NO_FIELD, &hr);
     
     if (_pWrappedProvider != NULL)
     {
-        hr = _pWrappedProvider->SetSerialization(pcpcs);
+        TRACE_WRAPPED_CALL(TM_PROVIDER_SETSERIALIZATION, TRACE_NO_FIELD, hr, _pWrappedProvider->SetSerialization(pcpcs));
+
+        // It may hold on to what it was given, which isn't for the next wrapper to see.
+        _bWrappedReusable = FALSE;
     }
 
     return hr;
@@ -132,9 +230,11 @@ HRESULT Provider::Advise(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_PROVIDER_ADVISE, TRACE_NO_FIELD, &hr);
     if (_pWrappedProvider != NULL)
     {
-        hr = _pWrappedProvider->Advise(pcpe, upAdviseContext);
+        TRACE_WRAPPED_CALL(TM_PROVIDER_ADVISE, TRACE_NO_FIELD, hr, _pWrappedProvider->Advise(pcpe, upAdviseContext));
+        _bWrappedAdvised = SUCCEEDED(hr);
     }
     return hr;
 }
@@ -144,9 +244,11 @@ HRESULT Provider::Advise(
 HRESULT Provider::UnAdvise()
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_PROVIDER_UNADVISE, TRACE_NO_FIELD, &hr);
     if (_pWrappedProvider != NULL)
     {
-        hr = _pWrappedProvider->UnAdvise();
+        TRACE_WRAPPED_CALL(TM_PROVIDER_UNADVISE, TRACE_NO_FIELD, hr, _pWrappedProvider->UnAdvise());
+        _bWrappedAdvised = FALSE;
     }
     return hr;
 }
@@ -156,22 +258,29 @@ HRESULT Provider::UnAdvise()
 // This number must include both visible and invisible fields. If you want a tile
 // to have different fields from the other tiles you enumerate for a given usage
 // scenario you must include them all in this count and then hide/show them as desired 
-// using the field descriptors. We pass this along to the wrapped provider and then append
-// our own credential count.
+// using the field descriptors. We pass this along to the wrapped provider and then add
+// our own field count.
 HRESULT Provider::GetFieldDescriptorCount(
     __out DWORD* pdwCount
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_PROVIDER_GETFIELDDESCRIPTORCOUNT, TRACE_NO_FIELD, &hr);
 
     if (_pWrappedProvider != NULL)
     {
-        hr = _pWrappedProvider->GetFieldDescriptorCount(&(_dwWrappedDescriptorCount));
+        DWORD dwWrappedDescriptorCount;
+        TRACE_WRAPPED_CALL(TM_PROVIDER_GETFIELDDESCRIPTORCOUNT, TRACE_NO_FIELD, hr, _pWrappedProvider->GetFieldDescriptorCount(&dwWrappedDescriptorCount));
+
+        // Work out where everyone's fields go the first time, and again if the wrapped
+        // provider's fields change.
+        if (SUCCEEDED(hr) && (_pFieldMap == NULL || _pFieldMap->GetWrappedCount() != dwWrappedDescriptorCount))
+        {
+            hr = _BuildFieldMap(dwWrappedDescriptorCount);
+        }
         if (SUCCEEDED(hr))
         {
-            // Note that we need to add our own credential count to the wrapped credential's
-            // total count.
-            *pdwCount = _dwWrappedDescriptorCount + SFI_NUM_FIELDS;
+            *pdwCount = _pFieldMap->GetCount();
         }
     }
 
@@ -186,32 +295,35 @@ HRESULT Provider::GetFieldDescriptorAt(
     )
 {    
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_PROVIDER_GETFIELDDESCRIPTORAT, dwIndex, &hr);
 
-    if (_pWrappedProvider != NULL)
+    // LogonUI asks for the count, which builds the map, before any of the descriptors.
+    if (_pWrappedProvider != NULL && _pFieldMap != NULL)
     {
         if (ppcpfd != NULL)
         {
+            DWORD dwInnerID;
+            FIELD_OWNER fo = _pFieldMap->ToInner(dwIndex, &dwInnerID);
+
             // If this field maps to one in the wrapped provider, hand it off.
-            if (dwIndex < _dwWrappedDescriptorCount)
+            if (FO_WRAPPED == fo)
             {
-                hr = _pWrappedProvider->GetFieldDescriptorAt(dwIndex, ppcpfd);
+                TRACE_WRAPPED_CALL(TM_PROVIDER_GETFIELDDESCRIPTORAT, dwInnerID, hr, _pWrappedProvider->GetFieldDescriptorAt(dwInnerID, ppcpfd));
             }
             // Otherwise, check to see if it's ours and then handle it here.
+            else if (FO_OURS == fo)
+            {
+                hr = FieldDescriptorCoAllocCopy(s_rgCredProvFieldDescriptors[dwInnerID], ppcpfd);
+            }
             else
+            { 
+                hr = E_INVALIDARG;
+            }
+
+            // Either way LogonUI knows the field by its outer id.
+            if (SUCCEEDED(hr))
             {
-                // Offset into the descriptor count so we can index our own fields.
-                dwIndex -= _dwWrappedDescriptorCount;
-
-                // Verify dwIndex is still a valid field.
-                if (dwIndex < SFI_NUM_FIELDS)
-                {
-                    hr = FieldDescriptorCoAllocCopy(s_rgCredProvFieldDescriptors[dwIndex], ppcpfd);
-                    (*ppcpfd)->dwFieldID += _dwWrappedDescriptorCount;
-                }
-                else
-                { 
-                    hr = E_INVALIDARG;
-                }
+                (*ppcpfd)->dwFieldID = dwIndex;
             }
         }
         else
@@ -223,6 +335,150 @@ HRESULT Provider::GetFieldDescriptorAt(
     return hr;
 }
 
+// Takes the wrapper of the wrapped credential whose IUnknown is punk out of
+// _rgpStaleCredentials, leaving NULL in its place, or returns NULL if there isn't
+// one. Providers mostly hand back their credentials in the same order, so we look
+// where it was last time before looking anywhere else.
+Credential* Provider::_TakeStaleCredential(
+    __in IUnknown *punk,
+    __in DWORD dwHint
+    )
+{
+    if (dwHint >= _dwStaleCount)
+    {
+        dwHint = 0;
+    }
+
+    // Look at dwHint, then everything before it, then everything after it.
+    for (DWORD lcv = 0; lcv < _dwStaleCount; lcv++)
+    {
+        DWORD dwIndex = (lcv == 0) ? dwHint : (lcv <= dwHint) ? lcv - 1 : lcv;
+        if (_rgpStaleCredentials[dwIndex] != NULL &&
+            _rgpStaleCredentials[dwIndex]->GetWrappedIdentity() == punk)
+        {
+            Credential *pCredential = _rgpStaleCredentials[dwIndex];
+            _rgpStaleCredentials[dwIndex] = NULL;
+            return pCredential;
+        }
+    }
+    return NULL;
+}
+
+// Starts a new enumeration of dwWrappedCount credentials, none of them wrapped yet.
+// The last enumeration's wrappers become stale: GetCredentialAt takes them back for
+// the wrapped credentials they wrap as LogonUI asks for them, along with everything
+// LogonUI and the wrapped credential have told them. Stale wrappers from before that
+// are released, so a wrapper outlives at most one enumeration that doesn't ask for it.
+HRESULT Provider::_ResetCredentials(
+    __in DWORD dwWrappedCount
+    )
+{
+    HRESULT hr = S_OK;
+
+    Credential **rgpCredentials = new Credential*[dwWrappedCount];
+    if (rgpCredentials != NULL)
+    {
+        ZeroMemory(rgpCredentials, dwWrappedCount * sizeof(*rgpCredentials));
+
+        // The last enumeration's wrappers stay where they were, so that
+        // _TakeStaleCredential finds them quickly.
+        _ReleaseStaleCredentials();
+        _rgpStaleCredentials = _rgpCredentials;
+        _dwStaleCount = _dwCredentialCount;
+
+        _rgpCredentials = rgpCredentials;
+        _dwCredentialCount = dwWrappedCount;
+        _dwUnwrappedCount = dwWrappedCount;
+        if (_dwUnwrappedCount == 0)
+        {
+            _ReleaseStaleCredentials();
+        }
+    }
+    else
+    {
+        _CleanUpAllCredentials();
+        hr = E_OUTOFMEMORY;
+    }
+
+    return hr;
+}
+
+// The stale wrappers left over wrap credentials that have gone away. This runs once
+// every credential has its wrapper, and when the next enumeration starts.
+void Provider::_ReleaseStaleCredentials()
+{
+    if (_ReleaseCredentials(_rgpStaleCredentials, _dwStaleCount))
+    {
+        _bWrappedReusable = FALSE;
+    }
+    _rgpStaleCredentials = NULL;
+    _dwStaleCount = 0;
+}
+
+// Makes the wrapper for the wrapped provider's credential at dwIndex, the first
+// time LogonUI asks for it. If we had one for the same wrapped credential last
+// time, we use it again, and it only starts over if the field map has changed.
+HRESULT Provider::_WrapCredentialAt(
+    __in DWORD dwIndex
+    )
+{
+    HRESULT hr;
+    ICredentialProviderCredential *pCredential;
+    TRACE_WRAPPED_CALL(TM_PROVIDER_GETCREDENTIALAT, dwIndex, hr, _pWrappedProvider->GetCredentialAt(dwIndex, &(pCredential)));
+    if (SUCCEEDED(hr))
+    {
+        IUnknown *punk;
+        if (SUCCEEDED(pCredential->QueryInterface(IID_PPV_ARGS(&punk))))
+        {
+            // pCredential keeps the object alive, so the pointer is enough to compare.
+            punk->Release();
+        }
+        else
+        {
+            punk = pCredential;
+        }
+
+        Credential *pWrapper = _TakeStaleCredential(punk, dwIndex);
+        if (pWrapper != NULL)
+        {
+            if (pWrapper->GetFieldMap() != _pFieldMap)
+            {
+                hr = pWrapper->Initialize(pCredential, _pFieldMap, _pStringPool, _rgdwFieldStrings);
+            }
+        }
+        else
+        {
+            pWrapper = new Credential();
+            if (pWrapper != NULL)
+            {
+                // Our own fields come from the shared tables in common.h
+                // and the string pool, so the credential only needs to
+                // know what it wraps and where everyone's fields are.
+                hr = pWrapper->Initialize(pCredential, _pFieldMap, _pStringPool, _rgdwFieldStrings);
+            }
+            else
+            {
+                hr = E_OUTOFMEMORY;
+            }
+        }
+        pCredential->Release();
+
+        if (SUCCEEDED(hr))
+        {
+            _rgpCredentials[dwIndex] = pWrapper;
+            if (--_dwUnwrappedCount == 0)
+            {
+                _ReleaseStaleCredentials();
+            }
+        }
+        else if (pWrapper != NULL)
+        {
+            pWrapper->Release();
+        }
+    }
+    return hr;
+}
+
 // Sets pdwCount to the number of tiles that we wish to show at this time.
 // Sets pdwDefault to the index of the tile which should be used as the default.
 // The default tile is the tile which will be shown in the zoomed view by default. If 
@@ -231,8 +487,9 @@ HRESULT Provider::GetFieldDescriptorAt(
 // If *pbAutoLogonWithDefault is TRUE, LogonUI will immediately call GetSerialization
 // on the credential you've specified as the default and will submit that credential
 // for authentication without showing any further UI.
-// While we're here, we'll create credentials to wrap each of the credentials created by
-// our wrapped provider. The key is to make everything transparent to the owner.
+// We have one tile for each of the wrapped provider's credentials, but we don't wrap
+// any of them until GetCredentialAt asks for it, so this doesn't take any longer
+// however many accounts there are.
 HRESULT Provider::GetCredentialCount(
     __out DWORD* pdwCount,
     __out_range(<,*pdwCount) DWORD* pdwDefault,
@@ -240,95 +497,38 @@ HRESULT Provider::GetCredentialCount(
     )
 {
     HRESULT hr = E_UNEXPECTED;
+    CTraceScope trace(TM_PROVIDER_GETCREDENTIALCOUNT, TRACE_NO_FIELD, &hr);
     DWORD dwDefault = 0;
     BOOL bAutoLogonWithDefault = FALSE;
 
     // Make sure we've created the provider.
     if (_pWrappedProvider != NULL)
     {
-        // This probably shouldn't happen, but in the event that this gets called after
-        // we've already been through once, we want to clean up everything before 
-        // allocating new stuff all over again.
-        if (_rgpCredentials != NULL)
-        {
-            _CleanUpAllCredentials();
-        }
-
         // We need to know how many fields each credential has in order to initialize
         // our wrapper credentials, so we might as well do that here before anything else.
         DWORD count;
         hr = GetFieldDescriptorCount(&(count));
 
+        // The values of our fields don't change, so the pool is only built once.
+        if (SUCCEEDED(hr) && _pStringPool == NULL)
+        {
+            hr = _BuildStringPool();
+        }
+
         if (SUCCEEDED(hr))
         {
             // Grab the credential count of the wrapped provider. We'll simply wrap each.
-            hr = _pWrappedProvider->GetCredentialCount(&(_dwCredentialCount), &(dwDefault), &(bAutoLogonWithDefault));
+            DWORD dwWrappedCount = 0;
+            TRACE_WRAPPED_CALL(TM_PROVIDER_GETCREDENTIALCOUNT, TRACE_NO_FIELD, hr, _pWrappedProvider->GetCredentialCount(&(dwWrappedCount), &(dwDefault), &(bAutoLogonWithDefault)));
 
             if (SUCCEEDED(hr))
             {
-                // Create an array of credentials for use.
-                _rgpCredentials = new Credential*[_dwCredentialCount];
-                if (_rgpCredentials != NULL)
-                {
-                    // Iterate each credential and make a wrapper.
-                    for (DWORD lcv = 0; SUCCEEDED(hr) && (lcv < _dwCredentialCount); lcv++)
-                    {
-                        // Allocate memory for the new credential.
-                        _rgpCredentials[lcv] = new Credential();
-                        if (_rgpCredentials[lcv] != NULL)
-                        {
-							// set the internal bmpPath
-							_rgpCredentials[lcv]->bmpPath = bmpPath;
-
-                            ICredentialProviderCredential *pCredential;
-                            hr = _pWrappedProvider->GetCredentialAt(lcv, &(pCredential));
-                            if (SUCCEEDED(hr))
-                            {
-                                // Set the Field State Pair and Field Descriptors for ppc's 
-                                // fields to the defaults (s_rgCredProvFieldDescriptors, 
-                                // and s_rgFieldStatePairs) and the value of SFI_USERNAME
-                                // to pwzUsername.
-                                hr = _rgpCredentials[lcv]->Initialize(s_rgCredProvFieldDescriptors, s_rgFieldStatePairs, pCredential, _dwWrappedDescriptorCount);
-                                if (FAILED(hr))
-                                {
-                                    // If initialization failed, clean everything up.
-                                    for (lcv = 0; lcv < _dwCredentialCount; lcv++)
-                                    {
-                                        if (_rgpCredentials[lcv] != NULL)
-                                        {
-                                            // Release the pointer to account for the local reference.
-                                            _rgpCredentials[lcv]->Release();
-                                            _rgpCredentials[lcv] = NULL;
-                                        }
-                                    }
-                                }
-                                pCredential->Release();
-                            } // (End if _pWrappedProvider->GetCredentialAt succeeded.)
-                        } // (End if allocating _rgpCredentials[lcv] succeeded.)
-                        else
-                        {
-                            hr = E_OUTOFMEMORY;
-                        } 
-                    } // (End of _rgpCredentials allocation loop.)
-                } // (End if for allocating _rgpCredentials succeeded.)
-                else
-                {
-                    hr = E_OUTOFMEMORY;
-                }
-            } // (End if _pWrappedProvider->GetCredentialCount succeeded.)
-        } // (End if GetFieldDescriptorCount succeeded.)
-    }
-
-    if (FAILED(hr))
-    {
-        // Clean up.
-        if (_rgpCredentials != NULL)
-        {
-            delete _rgpCredentials;
-            _rgpCredentials = NULL;
+                hr = _ResetCredentials(dwWrappedCount);
+            }
         }
     }
-    else
+
+    if (SUCCEEDED(hr))
     {
         *pdwCount = _dwCredentialCount;
         *pdwDefault = dwDefault;
@@ -339,21 +539,31 @@ HRESULT Provider::GetCredentialCount(
 }
 
 // Returns the credential at the index specified by dwIndex. This function is called by 
-// logonUI to enumerate the tiles.
+// logonUI to enumerate the tiles. This is where we wrap each of the wrapped provider's
+// credentials, the first time it's asked for.
 HRESULT Provider::GetCredentialAt(
     __in DWORD dwIndex, 
     __in ICredentialProviderCredential** ppcpc
     )
 {
     HRESULT hr;
+    CTraceScope trace(TM_PROVIDER_GETCREDENTIALAT, dwIndex, &hr);
 
     // Validate parameters.
     if ((dwIndex < _dwCredentialCount) && 
         (ppcpc != NULL) &&
-        (_rgpCredentials != NULL) &&
-        (_rgpCredentials[dwIndex] != NULL))
+        (_rgpCredentials != NULL))
     {
-        hr = _rgpCredentials[dwIndex]->QueryInterface(IID_ICredentialProviderCredential, reinterpret_cast<void**>(ppcpc));
+        hr = S_OK;
+        if (_rgpCredentials[dwIndex] == NULL)
+        {
+            hr = _WrapCredentialAt(dwIndex);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = _rgpCredentials[dwIndex]->QueryInterface(IID_ICredentialProviderCredential, reinterpret_cast<void**>(ppcpc));
+        }
     }
     else
     {
@@ -5,40 +5,15 @@
 #include <strsafe.h>
 
 #include "Credential.h"
+#include "FieldMap.h"
+#include "StringPool.h"
 #include "helpers.h"
+#include "ComObject.h"
 
 #include <string>
-#include <fstream>
 
-class Provider : public ICredentialProvider
+class Provider : public ComObject<Provider, ICredentialProvider>
 {
-  public:
-    // IUnknown
-    IFACEMETHODIMP_(ULONG) AddRef()
-    {
-        return ++_cRef;
-    }
-    
-    IFACEMETHODIMP_(ULONG) Release()
-    {
-        LONG cRef = --_cRef;
-        if (!cRef)
-        {
-            delete this;
-        }
-        return cRef;
-    }
-
-    IFACEMETHODIMP QueryInterface(__in REFIID riid, __deref_out void** ppv)
-    {
-        static const QITAB qit[] =
-        {
-            QITABENT(Provider, ICredentialProvider), // IID_ICredentialProvider
-            {0},
-        };
-        return QISearch(this, qit, riid, ppv);
-    }
-
   public:
     IFACEMETHODIMP SetUsageScenario(__in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus, __in DWORD dwFlags);
     IFACEMETHODIMP SetSerialization(__in const CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION* pcpcs);
@@ -56,6 +31,7 @@ class Provider : public ICredentialProvider
                                    __deref_out ICredentialProviderCredential** ppcpc);
 
     friend HRESULT CSample_CreateInstance(__in REFIID riid, __deref_out void** ppv);
+    friend class ComObject<Provider, ICredentialProvider>;
 
   protected:
     Provider();
@@ -63,18 +39,30 @@ class Provider : public ICredentialProvider
     
   private:
       void _CleanUpAllCredentials();
+      void _ReleaseWrappedProvider();
+      HRESULT _BuildFieldMap(__in DWORD dwWrappedDescriptorCount);
+      HRESULT _BuildStringPool();
+      Credential* _TakeStaleCredential(__in IUnknown *punk, __in DWORD dwHint);
+      HRESULT _ResetCredentials(__in DWORD dwWrappedCount);
+      void _ReleaseStaleCredentials();
+      HRESULT _WrapCredentialAt(__in DWORD dwIndex);
     
 private:
-    LONG                _cRef;
     Credential   **_rgpCredentials;          // Pointers to the credentials which will be enumerated by this 
                                                     // Provider.
 
-    ICredentialProvider *_pWrappedProvider;         // Our wrapped provider.
+    ICredentialProvider *_pWrappedProvider;         // Our wrapped provider, from the provider cache.
+    CREDENTIAL_PROVIDER_USAGE_SCENARIO _cpus;       // What it was set up for,
+    DWORD               _dwFlags;                   // and with which flags.
+    BOOL                _bWrappedReusable;          // Whether the next wrapper could use it after us,
+    BOOL                _bWrappedAdvised;           // and whether it's advised, which it mustn't be.
     DWORD               _dwCredentialCount;         // The number of credentials provided by our wrapped provider.
-    DWORD               _dwWrappedDescriptorCount;  // The number of fields on each tile of our wrapped provider's 
-                                                    // credentials.
+    DWORD               _dwUnwrappedCount;          // How many of them GetCredentialAt hasn't wrapped yet.
+    Credential        **_rgpStaleCredentials;       // Wrappers from the last enumeration, which haven't been
+    DWORD               _dwStaleCount;              // asked for again yet.
+    FieldMap           *_pFieldMap;                 // Where the wrapped provider's fields and ours are on
+                                                    // each tile.
+    StringPool         *_pStringPool;               // The values of our fields, shared by every credential,
+    DWORD               _rgdwFieldStrings[SFI_NUM_FIELDS];  // and where each field's value is in it.
     bool                _bEnumeratedSetSerialization;
-
-	std::wstring bmpPath;
-	std::wofstream debug;
 };
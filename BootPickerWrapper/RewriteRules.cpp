@@ -0,0 +1,311 @@
+#include "RewriteRules.h"
+#include "Dll.h"
+#include "Log.h"
+#include "StringKernels.h"
+#include <strsafe.h>
+
+// A .rewrite file bigger than this is ignored.
+#define REWRITE_MAX_FILE_BYTES  (64 * 1024)
+
+static REWRITE_RULES g_rr;
+static INIT_ONCE g_ioRules = INIT_ONCE_STATIC_INIT;
+
+static const struct
+{
+    PCWSTR                          pwszName;
+    CREDENTIAL_PROVIDER_FIELD_TYPE  cpft;
+} s_rgFieldTypeNames[] =
+{
+    { L"LargeText",     CPFT_LARGE_TEXT },
+    { L"SmallText",     CPFT_SMALL_TEXT },
+    { L"CommandLink",   CPFT_COMMAND_LINK },
+};
+
+// Folds one character to upper case the way StrEqualIW compares it: ASCII letters
+// directly, and everything else through the file system casing table, which is the
+// one CompareStringOrdinal uses. towupper only folds ASCII in the C locale.
+static WCHAR _RewriteFold(__in WCHAR wch)
+{
+    if (wch < 0x80)
+    {
+        return (wch >= L'a' && wch <= L'z') ? (WCHAR)(wch - 0x20) : wch;
+    }
+
+    WCHAR wchUpper;
+    return (LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, &wch, 1, &wchUpper, 1, NULL, NULL, 0) == 1) ? wchUpper : wch;
+}
+
+// FNV-1a over the field and the value with its case folded, so that values that
+// StrEqualIW calls equal land in the same slot.
+static DWORD _RewriteHash(
+    __in DWORD dwField,
+    __in PCWSTR pwszValue
+    )
+{
+    DWORD dwHash = 2166136261;
+    for (int i = 0; i < 4; i++)
+    {
+        dwHash = (dwHash ^ ((dwField >> (i * 8)) & 0xff)) * 16777619;
+    }
+    for (PCWSTR pwch = pwszValue; *pwch != L'\0'; pwch++)
+    {
+        dwHash = (dwHash ^ (DWORD)_RewriteFold(*pwch)) * 16777619;
+    }
+    return dwHash;
+}
+
+HRESULT RewriteRulesInit(__out REWRITE_RULES* prr)
+{
+    ZeroMemory(prr, sizeof(*prr));
+    return StringPool::Create(&prr->pStrings);
+}
+
+void RewriteRulesCleanup(__inout REWRITE_RULES* prr)
+{
+    if (prr->pStrings != NULL)
+    {
+        prr->pStrings->Release();
+    }
+    ZeroMemory(prr, sizeof(*prr));
+}
+
+HRESULT RewriteRulesAdd(
+    __inout REWRITE_RULES* prr,
+    __in DWORD dwField,
+    __in PCWSTR pwszMatch,
+    __in PCWSTR pwszReplacement
+    )
+{
+    if (prr->cRules == ARRAYSIZE(prr->rgRules))
+    {
+        return S_FALSE;
+    }
+
+    REWRITE_RULE& rr = prr->rgRules[prr->cRules];
+    rr.dwField = dwField;
+    HRESULT hr = prr->pStrings->Intern(pwszMatch, &rr.dwMatch);
+    if (SUCCEEDED(hr))
+    {
+        hr = prr->pStrings->Intern(pwszReplacement, &rr.dwReplacement);
+    }
+    if (SUCCEEDED(hr))
+    {
+        // There are twice as many slots as rules, so there's always an empty one.
+        DWORD iSlot = _RewriteHash(dwField, pwszMatch) % ARRAYSIZE(prr->rgbSlots);
+        while (prr->rgbSlots[iSlot] != 0)
+        {
+            iSlot = (iSlot + 1) % ARRAYSIZE(prr->rgbSlots);
+        }
+        prr->rgbSlots[iSlot] = (BYTE)(++prr->cRules);
+    }
+    return hr;
+}
+
+// Looks for the rule for pwszValue in one field, by number or by type.
+static DWORD _RewriteRulesFindField(
+    __in const REWRITE_RULES* prr,
+    __in DWORD dwField,
+    __in PCWSTR pwszValue,
+    __in size_t cchValue
+    )
+{
+    DWORD iSlot = _RewriteHash(dwField, pwszValue) % ARRAYSIZE(prr->rgbSlots);
+    while (prr->rgbSlots[iSlot] != 0)
+    {
+        DWORD iRule = prr->rgbSlots[iSlot] - 1;
+        const REWRITE_RULE& rr = prr->rgRules[iRule];
+        if (rr.dwField == dwField &&
+            StrEqualIW(prr->pStrings->GetString(rr.dwMatch), prr->pStrings->GetLength(rr.dwMatch), pwszValue, cchValue))
+        {
+            return iRule;
+        }
+        iSlot = (iSlot + 1) % ARRAYSIZE(prr->rgbSlots);
+    }
+    return REWRITE_NO_RULE;
+}
+
+DWORD RewriteRulesFind(
+    __in const REWRITE_RULES* prr,
+    __in DWORD dwInnerID,
+    __in CREDENTIAL_PROVIDER_FIELD_TYPE cpft,
+    __in PCWSTR pwszValue,
+    __in size_t cchValue
+    )
+{
+    if (prr->cRules == 0 || !RewriteIsTextField(cpft) || (dwInnerID & REWRITE_FIELD_TYPE))
+    {
+        return REWRITE_NO_RULE;
+    }
+
+    DWORD iRule = _RewriteRulesFindField(prr, dwInnerID, pwszValue, cchValue);
+    if (iRule == REWRITE_NO_RULE)
+    {
+        iRule = _RewriteRulesFindField(prr, REWRITE_FIELD_FOR_TYPE(cpft), pwszValue, cchValue);
+    }
+    return iRule;
+}
+
+// Reads the field a rule applies to: a field number or one of the type names.
+static BOOL _RewriteParseField(
+    __in PCWSTR pwsz,
+    __out DWORD* pdwField
+    )
+{
+    for (DWORD i = 0; i < ARRAYSIZE(s_rgFieldTypeNames); i++)
+    {
+        if (_wcsicmp(pwsz, s_rgFieldTypeNames[i].pwszName) == 0)
+        {
+            *pdwField = REWRITE_FIELD_FOR_TYPE(s_rgFieldTypeNames[i].cpft);
+            return TRUE;
+        }
+    }
+
+    DWORD dwField = 0;
+    for (PCWSTR pwch = pwsz; *pwch != L'\0'; pwch++)
+    {
+        if (*pwch < L'0' || *pwch > L'9')
+        {
+            return FALSE;
+        }
+
+        // A field number can't have the bit that marks a type.
+        DWORD dwDigit = *pwch - L'0';
+        if (dwField > (REWRITE_FIELD_TYPE - 1 - dwDigit) / 10)
+        {
+            return FALSE;
+        }
+        dwField = dwField * 10 + dwDigit;
+    }
+    *pdwField = dwField;
+    return (*pwsz != L'\0');
+}
+
+void RewriteRulesParse(
+    __inout REWRITE_RULES* prr,
+    __inout PWSTR pwszText
+    )
+{
+    DWORD dwLine = 0;
+    PWSTR pwszNext = pwszText;
+    while (pwszNext != NULL)
+    {
+        PWSTR pwszLine = pwszNext;
+        pwszNext = wcschr(pwszLine, L'\n');
+        if (pwszNext != NULL)
+        {
+            *pwszNext++ = L'\0';
+        }
+        dwLine++;
+
+        size_t cch = wcslen(pwszLine);
+        if (cch > 0 && pwszLine[cch - 1] == L'\r')
+        {
+            pwszLine[--cch] = L'\0';
+        }
+        if (cch == 0 || pwszLine[0] == L'#')
+        {
+            continue;
+        }
+
+        PWSTR pwszMatch = wcschr(pwszLine, L'\t');
+        PWSTR pwszReplacement = (pwszMatch != NULL) ? wcschr(pwszMatch + 1, L'\t') : NULL;
+        DWORD dwField;
+        if (pwszReplacement == NULL)
+        {
+            LogWrite(L"rewrite: line %lu needs a field, a value and a replacement", dwLine);
+            continue;
+        }
+        *pwszMatch++ = L'\0';
+        *pwszReplacement++ = L'\0';
+        if (!_RewriteParseField(pwszLine, &dwField))
+        {
+            LogWrite(L"rewrite: line %lu has an unknown field \"%s\"", dwLine, pwszLine);
+            continue;
+        }
+
+        HRESULT hr = RewriteRulesAdd(prr, dwField, pwszMatch, pwszReplacement);
+        if (hr != S_OK)
+        {
+            LogWrite(L"rewrite: stopped at line %lu (0x%08x)", dwLine, hr);
+            break;
+        }
+    }
+}
+
+// Loads the .rewrite file next to the dll into prr. Returns FALSE if there isn't one.
+static BOOL _RewriteRulesLoad(__inout REWRITE_RULES* prr)
+{
+    WCHAR wszPath[MAX_PATH];
+    DWORD cch = GetModuleFileName(HINST_THISDLL, wszPath, ARRAYSIZE(wszPath));
+    if ((cch <= 3) || (cch >= ARRAYSIZE(wszPath)) ||
+        FAILED(StringCchCopyW(wszPath + cch - 3, ARRAYSIZE(wszPath) - (cch - 3), L"rewrite")))
+    {
+        return FALSE;
+    }
+
+    HANDLE hFile = CreateFile(wszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return FALSE;
+    }
+
+    LARGE_INTEGER liSize;
+    BYTE* pb = NULL;
+    DWORD cb = 0;
+    if (GetFileSizeEx(hFile, &liSize) && liSize.QuadPart <= REWRITE_MAX_FILE_BYTES)
+    {
+        pb = (BYTE*)HeapAlloc(GetProcessHeap(), 0, (SIZE_T)liSize.QuadPart + 1);
+        if (pb != NULL && !ReadFile(hFile, pb, (DWORD)liSize.QuadPart, &cb, NULL))
+        {
+            cb = 0;
+        }
+    }
+    else
+    {
+        LogWrite(L"rewrite: %s is too big", wszPath);
+    }
+    CloseHandle(hFile);
+
+    // The file is UTF-8, with or without a byte order mark.
+    BYTE* pbText = pb;
+    if (cb >= 3 && pb[0] == 0xef && pb[1] == 0xbb && pb[2] == 0xbf)
+    {
+        pbText += 3;
+        cb -= 3;
+    }
+
+    int cchText = (cb > 0) ? MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)pbText, cb, NULL, 0) : 0;
+    PWSTR pwszText = (cchText > 0) ? (PWSTR)HeapAlloc(GetProcessHeap(), 0, (cchText + 1) * sizeof(WCHAR)) : NULL;
+    if (pwszText != NULL)
+    {
+        MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)pbText, cb, pwszText, cchText);
+        pwszText[cchText] = L'\0';
+        RewriteRulesParse(prr, pwszText);
+        HeapFree(GetProcessHeap(), 0, pwszText);
+    }
+
+    if (pb != NULL)
+    {
+        HeapFree(GetProcessHeap(), 0, pb);
+    }
+
+    LogWrite(L"rewrite: %lu rules from %s", prr->cRules, wszPath);
+    return TRUE;
+}
+
+static BOOL CALLBACK _InitRewriteRules(__inout PINIT_ONCE, __in PVOID, __out PVOID*)
+{
+    if (SUCCEEDED(RewriteRulesInit(&g_rr)) && !_RewriteRulesLoad(&g_rr))
+    {
+        // The password provider's deselected tile says "Other User" on domain joined
+        // machines. Field 0 was found by trial and error, since we don't have its source.
+        RewriteRulesAdd(&g_rr, 0, L"Other User", L"Login to Windows");
+    }
+    return TRUE;
+}
+
+const REWRITE_RULES* RewriteRulesGet()
+{
+    InitOnceExecuteOnce(&g_ioRules, _InitRewriteRules, NULL, NULL);
+    return &g_rr;
+}
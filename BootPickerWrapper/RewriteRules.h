@@ -0,0 +1,87 @@
+// Rewrite rules replace what the wrapped credential shows in one of its text
+// fields with something else, such as "Other User" with "Login to Windows".
+// Each rule names the fields it applies to, either by field number or by field
+// type, the value it matches (ignoring case) and what to show instead.
+//
+// The rules come from a .rewrite file next to the dll, one per line:
+//
+//     <field> <tab> <value> <tab> <replacement>
+//
+// where <field> is a wrapped field number or one of LargeText, SmallText and
+// CommandLink. Blank lines and lines starting with # are skipped. Without the
+// file there is one rule, turning "Other User" in wrapped field 0 into
+// "Login to Windows". Only fields that just show text can be rewritten, never
+// ones the user types into.
+//
+// The rules are loaded once, the first time they're needed, and are found
+// through a small hash table keyed on the field and the value.
+
+#pragma once
+#include <windows.h>
+#include <credentialprovider.h>
+#include "StringPool.h"
+
+// More rules than this are ignored.
+#define REWRITE_MAX_RULES       32
+
+// What RewriteRulesFind returns when no rule matches.
+#define REWRITE_NO_RULE         ((DWORD)-1)
+
+// A rule's field is either a wrapped field number or, with this bit set, a field type.
+#define REWRITE_FIELD_TYPE      0x80000000
+#define REWRITE_FIELD_FOR_TYPE(cpft)    (REWRITE_FIELD_TYPE | (DWORD)(cpft))
+
+struct REWRITE_RULE
+{
+    DWORD   dwField;                // A wrapped field number, or REWRITE_FIELD_FOR_TYPE.
+    DWORD   dwMatch;                // The value to replace, in pStrings.
+    DWORD   dwReplacement;          // What to show instead, in pStrings.
+};
+
+struct REWRITE_RULES
+{
+    DWORD           cRules;
+    REWRITE_RULE    rgRules[REWRITE_MAX_RULES];
+    BYTE            rgbSlots[REWRITE_MAX_RULES * 2];    // Rule index + 1 by hash, or 0; probed linearly.
+    StringPool*     pStrings;
+};
+
+//whether a wrapped field of this type can be rewritten
+inline BOOL RewriteIsTextField(__in CREDENTIAL_PROVIDER_FIELD_TYPE cpft)
+{
+    return (cpft == CPFT_LARGE_TEXT) || (cpft == CPFT_SMALL_TEXT) || (cpft == CPFT_COMMAND_LINK);
+}
+
+//sets up an empty set of rules
+HRESULT RewriteRulesInit(__out REWRITE_RULES* prr);
+
+//frees what RewriteRulesInit set up
+void RewriteRulesCleanup(__inout REWRITE_RULES* prr);
+
+//adds a rule. Returns S_FALSE if the set is full
+HRESULT RewriteRulesAdd(
+    __inout REWRITE_RULES* prr,
+    __in DWORD dwField,
+    __in PCWSTR pwszMatch,
+    __in PCWSTR pwszReplacement
+    );
+
+//adds a rule for each line of pwszText, which is a .rewrite file's text, writing over the
+//line ends and tabs as it goes. Lines that don't parse are logged and skipped
+void RewriteRulesParse(
+    __inout REWRITE_RULES* prr,
+    __inout PWSTR pwszText
+    );
+
+//the index of the rule for pwszValue, cchValue characters long, in wrapped field dwInnerID of type
+//cpft, or REWRITE_NO_RULE. A rule for the field number wins over one for its type
+DWORD RewriteRulesFind(
+    __in const REWRITE_RULES* prr,
+    __in DWORD dwInnerID,
+    __in CREDENTIAL_PROVIDER_FIELD_TYPE cpft,
+    __in PCWSTR pwszValue,
+    __in size_t cchValue
+    );
+
+//the dll's rules, loaded from the .rewrite file the first time they're asked for
+const REWRITE_RULES* RewriteRulesGet();
@@ -3,21 +3,26 @@
 // but a credential provider that wraps another (as this sample does) must.
 // The wrapped credential will pass its "this" pointer into any calls to ICPCE,
 // but LogonUI will not recognize the wrapped "this" pointer as a valid credential.
-// Our implementation translates from the wrapped "this" pointer to the wrapper "this".
+// Our implementation translates from the wrapped "this" pointer to the wrapper "this",
+// and from the wrapped credential's field ids to the ones LogonUI knows.
 
 #include <unknwn.h>
 
 #include "WrappedCredentialEvents.h"
+#include "Credential.h"
+#include "Trace.h"
 
 HRESULT WrappedCredentialEvents::SetFieldState(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in CREDENTIAL_PROVIDER_FIELD_STATE cpfs)
 {
     UNREFERENCED_PARAMETER(pcpc);
 
     HRESULT hr = E_FAIL;
+    CTraceScope trace(TM_EVENTS_SETFIELDSTATE, dwFieldID, &hr);
 
     if (_pWrapperCredential && _pEvents)
     {
-        hr = _pEvents->SetFieldState(_pWrapperCredential, dwFieldID, cpfs);
+        DWORD dwOuterID = _pFieldMap->WrappedToOuter(dwFieldID);
+        hr = (dwOuterID != FIELD_MAP_NO_FIELD) ? _pEvents->SetFieldState(_pWrapperCredential, dwOuterID, cpfs) : E_INVALIDARG;
     }
 
     return hr;
@@ -28,10 +33,12 @@ HRESULT WrappedCredentialEvents::SetFieldInteractiveState(__in ICredentialProvid
     UNREFERENCED_PARAMETER(pcpc);
 
     HRESULT hr = E_FAIL;
+    CTraceScope trace(TM_EVENTS_SETFIELDINTERACTIVESTATE, dwFieldID, &hr);
 
     if (_pWrapperCredential && _pEvents)
     {
-        hr = _pEvents->SetFieldInteractiveState(_pWrapperCredential, dwFieldID, cpfis);
+        DWORD dwOuterID = _pFieldMap->WrappedToOuter(dwFieldID);
+        hr = (dwOuterID != FIELD_MAP_NO_FIELD) ? _pEvents->SetFieldInteractiveState(_pWrapperCredential, dwOuterID, cpfis) : E_INVALIDARG;
     }
 
     return hr;
@@ -42,10 +49,20 @@ HRESULT WrappedCredentialEvents::SetFieldString(__in ICredentialProviderCredenti
     UNREFERENCED_PARAMETER(pcpc);
 
     HRESULT hr = E_FAIL;
+    CTraceScope trace(TM_EVENTS_SETFIELDSTRING, dwFieldID, &hr);
 
     if (_pWrapperCredential && _pEvents)
     {
-        hr = _pEvents->SetFieldString(_pWrapperCredential, dwFieldID, psz);
+        DWORD dwOuterID = _pFieldMap->WrappedToOuter(dwFieldID);
+        if (dwOuterID != FIELD_MAP_NO_FIELD)
+        {
+            // The wrapper credential remembers the new value, and may rewrite it.
+            hr = _pEvents->SetFieldString(_pWrapperCredential, dwOuterID, _pWrapperCredential->WrappedStringChanged(dwFieldID, psz));
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+        }
     }
 
     return hr;
@@ -56,10 +73,12 @@ HRESULT WrappedCredentialEvents::SetFieldBitmap(__in ICredentialProviderCredenti
     UNREFERENCED_PARAMETER(pcpc);
 
     HRESULT hr = E_FAIL;
+    CTraceScope trace(TM_EVENTS_SETFIELDBITMAP, dwFieldID, &hr);
 
     if (_pWrapperCredential && _pEvents)
     {
-        hr = _pEvents->SetFieldBitmap(_pWrapperCredential, dwFieldID, hbmp);
+        DWORD dwOuterID = _pFieldMap->WrappedToOuter(dwFieldID);
+        hr = (dwOuterID != FIELD_MAP_NO_FIELD) ? _pEvents->SetFieldBitmap(_pWrapperCredential, dwOuterID, hbmp) : E_INVALIDARG;
     }
 
     return hr;
@@ -70,10 +89,12 @@ HRESULT WrappedCredentialEvents::SetFieldCheckbox(__in ICredentialProviderCreden
     UNREFERENCED_PARAMETER(pcpc);
 
     HRESULT hr = E_FAIL;
+    CTraceScope trace(TM_EVENTS_SETFIELDCHECKBOX, dwFieldID, &hr);
 
     if (_pWrapperCredential && _pEvents)
     {
-        hr = _pEvents->SetFieldCheckbox(_pWrapperCredential, dwFieldID, bChecked, pszLabel);
+        DWORD dwOuterID = _pFieldMap->WrappedToOuter(dwFieldID);
+        hr = (dwOuterID != FIELD_MAP_NO_FIELD) ? _pEvents->SetFieldCheckbox(_pWrapperCredential, dwOuterID, bChecked, pszLabel) : E_INVALIDARG;
     }
 
     return hr;
@@ -84,10 +105,12 @@ HRESULT WrappedCredentialEvents::SetFieldComboBoxSelectedItem(__in ICredentialPr
     UNREFERENCED_PARAMETER(pcpc);
 
     HRESULT hr = E_FAIL;
+    CTraceScope trace(TM_EVENTS_SETFIELDCOMBOBOXSELECTEDITEM, dwFieldID, &hr);
 
     if (_pWrapperCredential && _pEvents)
     {
-        hr = _pEvents->SetFieldComboBoxSelectedItem(_pWrapperCredential, dwFieldID, dwSelectedItem);
+        DWORD dwOuterID = _pFieldMap->WrappedToOuter(dwFieldID);
+        hr = (dwOuterID != FIELD_MAP_NO_FIELD) ? _pEvents->SetFieldComboBoxSelectedItem(_pWrapperCredential, dwOuterID, dwSelectedItem) : E_INVALIDARG;
     }
 
     return hr;
@@ -98,10 +121,12 @@ HRESULT WrappedCredentialEvents::DeleteFieldComboBoxItem(__in ICredentialProvide
     UNREFERENCED_PARAMETER(pcpc);
 
     HRESULT hr = E_FAIL;
+    CTraceScope trace(TM_EVENTS_DELETEFIELDCOMBOBOXITEM, dwFieldID, &hr);
 
     if (_pWrapperCredential && _pEvents)
     {
-        hr = _pEvents->DeleteFieldComboBoxItem(_pWrapperCredential, dwFieldID, dwItem);
+        DWORD dwOuterID = _pFieldMap->WrappedToOuter(dwFieldID);
+        hr = (dwOuterID != FIELD_MAP_NO_FIELD) ? _pEvents->DeleteFieldComboBoxItem(_pWrapperCredential, dwOuterID, dwItem) : E_INVALIDARG;
     }
 
     return hr;
@@ -112,10 +137,12 @@ HRESULT WrappedCredentialEvents::AppendFieldComboBoxItem(__in ICredentialProvide
     UNREFERENCED_PARAMETER(pcpc);
 
     HRESULT hr = E_FAIL;
+    CTraceScope trace(TM_EVENTS_APPENDFIELDCOMBOBOXITEM, dwFieldID, &hr);
 
     if (_pWrapperCredential && _pEvents)
     {
-        hr = _pEvents->AppendFieldComboBoxItem(_pWrapperCredential, dwFieldID, pszItem);
+        DWORD dwOuterID = _pFieldMap->WrappedToOuter(dwFieldID);
+        hr = (dwOuterID != FIELD_MAP_NO_FIELD) ? _pEvents->AppendFieldComboBoxItem(_pWrapperCredential, dwOuterID, pszItem) : E_INVALIDARG;
     }
 
     return hr;
@@ -126,10 +153,14 @@ HRESULT WrappedCredentialEvents::SetFieldSubmitButton(__in ICredentialProviderCr
     UNREFERENCED_PARAMETER(pcpc);
 
     HRESULT hr = E_FAIL;
+    CTraceScope trace(TM_EVENTS_SETFIELDSUBMITBUTTON, dwFieldID, &hr);
 
     if (_pWrapperCredential && _pEvents)
     {
-        hr = _pEvents->SetFieldSubmitButton(_pWrapperCredential, dwFieldID, dwAdjacentTo);
+        DWORD dwOuterID = _pFieldMap->WrappedToOuter(dwFieldID);
+        DWORD dwOuterAdjacentTo = _pFieldMap->WrappedToOuter(dwAdjacentTo);
+        hr = (dwOuterID != FIELD_MAP_NO_FIELD && dwOuterAdjacentTo != FIELD_MAP_NO_FIELD) ?
+             _pEvents->SetFieldSubmitButton(_pWrapperCredential, dwOuterID, dwOuterAdjacentTo) : E_INVALIDARG;
     }
 
     return hr;
@@ -138,6 +169,7 @@ HRESULT WrappedCredentialEvents::SetFieldSubmitButton(__in ICredentialProviderCr
 HRESULT WrappedCredentialEvents::OnCreatingWindow(__out HWND* phwndOwner)
 {
     HRESULT hr = E_FAIL;
+    CTraceScope trace(TM_EVENTS_ONCREATINGWINDOW, TRACE_NO_FIELD, &hr);
 
     if (_pWrapperCredential && _pEvents)
     {
@@ -148,9 +180,14 @@ HRESULT WrappedCredentialEvents::OnCreatingWindow(__out HWND* phwndOwner)
 }
 
 WrappedCredentialEvents::WrappedCredentialEvents() :
-    _cRef(1), _pWrapperCredential(NULL), _pEvents(NULL)
+    _pWrapperCredential(NULL), _pEvents(NULL), _pFieldMap(NULL)
 {}
 
+WrappedCredentialEvents::~WrappedCredentialEvents()
+{
+    SetFieldMap(NULL);
+}
+
 // 
 // Save a copy of LogonUI's ICredentialProviderCredentialEvents pointer for doing callbacks
 // and the "this" pointer of the wrapper credential to specify events as coming from.
@@ -162,18 +199,41 @@ WrappedCredentialEvents::WrappedCredentialEvents() :
 // the lifetime of our weak references through calls to Initialize and Uninitialize to
 // prevent our weak references from becoming invalid.
 //
-void WrappedCredentialEvents::Initialize(__in ICredentialProviderCredential* pWrapperCredential, __in ICredentialProviderCredentialEvents* pEvents)
+// The field map is different: we hold a reference on it, since the provider can hand the
+// wrapper credential a new one while the wrapped credential still has us.
+//
+void WrappedCredentialEvents::Initialize(__in Credential* pWrapperCredential, __in ICredentialProviderCredentialEvents* pEvents, __in FieldMap* pFieldMap)
 {
     _pWrapperCredential = pWrapperCredential;
     _pEvents = pEvents;
+    SetFieldMap(pFieldMap);
+}
+
+//
+// Translate field ids through pFieldMap from now on. The wrapper credential calls this when
+// it's given a new map while advised. Both it and the wrapped credential's events run on
+// LogonUI's thread, so no event can be using the old map while we swap it.
+//
+void WrappedCredentialEvents::SetFieldMap(__in FieldMap* pFieldMap)
+{
+    if (pFieldMap != NULL)
+    {
+        pFieldMap->AddRef();
+    }
+    if (_pFieldMap != NULL)
+    {
+        _pFieldMap->Release();
+    }
+    _pFieldMap = pFieldMap;
 }
 
 //
 // Erase our weak references on the wrapper credential and LogonUI's
-// ICredentialProviderCredentialEvents pointer.
+// ICredentialProviderCredentialEvents pointer, and let go of the field map.
 //
 void WrappedCredentialEvents::Uninitialize()
 {
     _pWrapperCredential = NULL;
     _pEvents = NULL;
+    SetFieldMap(NULL);
 }
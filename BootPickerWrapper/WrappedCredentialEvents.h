@@ -3,7 +3,8 @@
 // but a credential provider that wraps another (as this sample does) must.
 // The wrapped credential will pass its "this" pointer into any calls to ICPCE,
 // but LogonUI will not recognize the wrapped "this" pointer as a valid credential.
-// Our implementation translates from the wrapped "this" pointer to the wrapper "this".
+// Our implementation translates from the wrapped "this" pointer to the wrapper "this",
+// and from the wrapped credential's field ids to the ones LogonUI knows.
 
 #pragma once
 
@@ -13,36 +14,14 @@
 #include "helpers.h"
 #include "dll.h"
 #include "resource.h"
+#include "FieldMap.h"
+#include "ComObject.h"
 
-class WrappedCredentialEvents : public ICredentialProviderCredentialEvents
+class Credential;
+
+class WrappedCredentialEvents : public ComObject<WrappedCredentialEvents, ICredentialProviderCredentialEvents>
 {
 public:
-    // IUnknown
-    IFACEMETHODIMP_(ULONG) AddRef()
-    {
-        return ++_cRef;
-    }
-
-    IFACEMETHODIMP_(ULONG) Release()
-    {
-        LONG cRef = --_cRef;
-        if (!cRef)
-        {
-            delete this;
-        }
-        return cRef;
-    }
-
-    IFACEMETHODIMP QueryInterface(__in REFIID riid, __in void** ppv)
-    {
-        static const QITAB qit[] =
-        {
-            QITABENT(WrappedCredentialEvents, ICredentialProviderCredentialEvents), // IID_ICredentialProviderCredentialEvents
-            {0},
-        };
-        return QISearch(this, qit, riid, ppv);
-    }
-    
     // ICredentialProviderCredentialEvents
     IFACEMETHODIMP SetFieldState(__in ICredentialProviderCredential *pcpc, __in DWORD dwFieldID, __in CREDENTIAL_PROVIDER_FIELD_STATE cpfs);
     IFACEMETHODIMP SetFieldInteractiveState(__in ICredentialProviderCredential *pcpc, __in DWORD dwFieldID, __in CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE cpfis);
@@ -57,12 +36,14 @@ public:
 
     // Local
     WrappedCredentialEvents();
+    ~WrappedCredentialEvents();
 
-    void Initialize(__in ICredentialProviderCredential* pWrapperCredential, __in ICredentialProviderCredentialEvents* pEvents);
+    void Initialize(__in Credential* pWrapperCredential, __in ICredentialProviderCredentialEvents* pEvents, __in FieldMap* pFieldMap);
+    void SetFieldMap(__in FieldMap* pFieldMap);
     void Uninitialize();
 
 private:
-    LONG                                 _cRef;
-    ICredentialProviderCredential*       _pWrapperCredential;
+    Credential*                          _pWrapperCredential;
     ICredentialProviderCredentialEvents* _pEvents;
+    FieldMap*                            _pFieldMap;
 };
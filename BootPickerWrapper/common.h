@@ -11,13 +11,34 @@
 
 #define MAX_ULONG  ((ULONG)(-1))
 
+// Every field we add to the wrapped credential's tiles, in order. Our field
+// ids count from zero; LogonUI knows them by the ids the provider's FieldMap
+// gives them. Each row is
+//
+//     X(field id, field type, field name, field value, field state, interactive state)
+//
+// The field name is NOT the value which will appear in the field; the value
+// is what the field shows until something replaces it. The field state says
+// whether the field shows in the selected tile, the deselected tile or both;
+// the interactive state says whether it is enabled, has focus, etc.
+//
+// MY_FIELD_ID and the tables below are generated from this list, so they
+// can't get out of step with each other. To add a field, add a row.
+#define MY_FIELDS(X) \
+    X(SFI_BLANK_LINE,       CPFT_SMALL_TEXT,    L"BlankLine",   L" ",                   CPFS_DISPLAY_IN_SELECTED_TILE,  CPFIS_NONE) \
+    X(SFI_BOOT_MAC_COMMAND, CPFT_COMMAND_LINK,  L"CommandLink", L"Reboot to Mac OS X",  CPFS_DISPLAY_IN_SELECTED_TILE,  CPFIS_NONE)
+
+// Our fields go in front of the wrapped provider's first field of this type, or
+// after all of its fields if it has none. CPFT_INVALID always puts them last.
+#define MY_FIELDS_INSERT_BEFORE     CPFT_INVALID
+
 // The indexes of each of the fields in our credential provider's appended tiles.
 enum MY_FIELD_ID 
 {
-	//SFI_LOGIN_WINDOWS       = 0,
-	SFI_BLANK_LINE          = 0,
-    SFI_BOOT_MAC_COMMAND    = 1,
-    SFI_NUM_FIELDS          = 2,  // Note: if new fields are added, keep NUM_FIELDS last.  This is used as a count of the number of fields
+#define MY_FIELD_ID_ROW(id, cpft, label, value, cpfs, cpfis)    id,
+    MY_FIELDS(MY_FIELD_ID_ROW)
+#undef MY_FIELD_ID_ROW
+    SFI_NUM_FIELDS,     // The number of fields; always last.
 };
 
 // The first value indicates when the tile is displayed (selected, not selected)
@@ -28,27 +49,32 @@ struct FIELD_STATE_PAIR
     CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE cpfis;
 };
 
-// These two arrays are seperate because a credential provider might
+// These arrays are seperate because a credential provider might
 // want to set up a credential with various combinations of field state pairs 
-// and field descriptors.
-
-// The field state value indicates whether the field is displayed
-// in the selected tile, the deselected tile, or both.
-// The Field interactive state indicates when 
+// and field descriptors. All of them are read-only and shared by every tile.
 static const FIELD_STATE_PAIR s_rgFieldStatePairs[] = 
 {
-    //{ CPFS_DISPLAY_IN_DESELECTED_TILE, CPFIS_NONE },         // SFI_LOGIN_WINDOWS
-    { CPFS_DISPLAY_IN_SELECTED_TILE, CPFIS_NONE },           // SFI_BLANK_LINE
-    { CPFS_DISPLAY_IN_SELECTED_TILE, CPFIS_NONE },           // SFI_BOOT_MAC_COMMAND
+#define MY_FIELD_STATE_ROW(id, cpft, label, value, cpfs, cpfis) { cpfs, cpfis },
+    MY_FIELDS(MY_FIELD_STATE_ROW)
+#undef MY_FIELD_STATE_ROW
 };
 
 // Field descriptors for unlock and logon.
-// The first field is the index of the field.
-// The second is the type of the field.
-// The third is the name of the field, NOT the value which will appear in the field.
 static const CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR s_rgCredProvFieldDescriptors[] =
 {
-	//{ SFI_LOGIN_WINDOWS, CPFT_SMALL_TEXT, L"LoginWindows" },
-	{ SFI_BLANK_LINE, CPFT_SMALL_TEXT, L"BlankLine" },
-    { SFI_BOOT_MAC_COMMAND, CPFT_COMMAND_LINK, L"CommandLink" },
+#define MY_FIELD_DESCRIPTOR_ROW(id, cpft, label, value, cpfs, cpfis)    { id, cpft, label },
+    MY_FIELDS(MY_FIELD_DESCRIPTOR_ROW)
+#undef MY_FIELD_DESCRIPTOR_ROW
 };
+
+// What each field shows until something replaces it.
+static const PCWSTR s_rgpwszFieldValues[] =
+{
+#define MY_FIELD_VALUE_ROW(id, cpft, label, value, cpfs, cpfis) value,
+    MY_FIELDS(MY_FIELD_VALUE_ROW)
+#undef MY_FIELD_VALUE_ROW
+};
+
+C_ASSERT(ARRAYSIZE(s_rgFieldStatePairs) == SFI_NUM_FIELDS);
+C_ASSERT(ARRAYSIZE(s_rgCredProvFieldDescriptors) == SFI_NUM_FIELDS);
+C_ASSERT(ARRAYSIZE(s_rgpwszFieldValues) == SFI_NUM_FIELDS);
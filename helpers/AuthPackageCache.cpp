@@ -0,0 +1,181 @@
+#include "AuthPackageCache.h"
+#include "Log.h"
+#include <intsafe.h>
+#include <strsafe.h>
+
+static UntrustedLsaClient g_lcUntrusted;
+static AuthPackageCache g_apc(&g_lcUntrusted);
+
+NTSTATUS UntrustedLsaClient::Connect(__out HANDLE* phLsa)
+{
+    return LsaConnectUntrusted(phLsa);
+}
+
+NTSTATUS UntrustedLsaClient::LookupAuthenticationPackage(
+    __in HANDLE hLsa,
+    __in PLSA_STRING plsaszName,
+    __out ULONG* pulAuthPackage
+    )
+{
+    return LsaLookupAuthenticationPackage(hLsa, plsaszName, pulAuthPackage);
+}
+
+NTSTATUS UntrustedLsaClient::Deregister(__in HANDLE hLsa)
+{
+    return LsaDeregisterLogonProcess(hLsa);
+}
+
+// Packs pszSourceString in pszDestinationString for LsaLookupAuthenticationPackage.
+static HRESULT _LsaInitString(
+    __out PSTRING pszDestinationString,
+    __in PCSTR pszSourceString
+    )
+{
+    size_t cchLength = lstrlenA(pszSourceString);
+    USHORT usLength;
+    HRESULT hr = SizeTToUShort(cchLength, &usLength);
+    if (SUCCEEDED(hr))
+    {
+        pszDestinationString->Buffer = (PCHAR)pszSourceString;
+        pszDestinationString->Length = usLength;
+        pszDestinationString->MaximumLength = pszDestinationString->Length+1;
+        hr = S_OK;
+    }
+    return hr;
+}
+
+AuthPackageCache::AuthPackageCache(__in LsaClient* plc) :
+    _plc(plc),
+    _cPackages(0),
+    _hLsa(NULL),
+    _cLookups(0),
+    _cHits(0)
+{
+    InitializeSRWLock(&_srw);
+    ZeroMemory(_rgPackages, sizeof(_rgPackages));
+}
+
+// Looks for pszName among the packages already looked up. The caller holds _srw.
+BOOL AuthPackageCache::_Find(
+    __in PCSTR pszName,
+    __out ULONG* pulAuthPackage
+    )
+{
+    for (DWORD i = 0; i < _cPackages; i++)
+    {
+        if (lstrcmpA(_rgPackages[i].szName, pszName) == 0)
+        {
+            *pulAuthPackage = _rgPackages[i].ulAuthPackage;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Closes the connection to the LSA. The caller holds _srw exclusively.
+void AuthPackageCache::_Disconnect()
+{
+    if (_hLsa != NULL)
+    {
+        _plc->Deregister(_hLsa);
+        _hLsa = NULL;
+    }
+}
+
+HRESULT AuthPackageCache::Lookup(
+    __in PCSTR pszName,
+    __out ULONG* pulAuthPackage
+    )
+{
+    *pulAuthPackage = 0;
+
+    AcquireSRWLockShared(&_srw);
+    BOOL bFound = _Find(pszName, pulAuthPackage);
+    ReleaseSRWLockShared(&_srw);
+    if (bFound)
+    {
+        InterlockedIncrement(&_cHits);
+        return S_OK;
+    }
+
+    LSA_STRING lsaszName;
+    HRESULT hr = _LsaInitString(&lsaszName, pszName);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    AcquireSRWLockExclusive(&_srw);
+
+    // Another thread may have looked it up while we waited.
+    if (_Find(pszName, pulAuthPackage))
+    {
+        ReleaseSRWLockExclusive(&_srw);
+        InterlockedIncrement(&_cHits);
+        return S_OK;
+    }
+
+    if (_hLsa == NULL)
+    {
+        hr = HRESULT_FROM_NT(_plc->Connect(&_hLsa));
+        if (FAILED(hr))
+        {
+            _hLsa = NULL;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // HRESULT_FROM_NT(STATUS_SUCCESS) isn't S_OK, so a package that's looked up gives S_OK
+        // the same as one that comes from the cache.
+        ULONG ulAuthPackage;
+        hr = HRESULT_FROM_NT(_plc->LookupAuthenticationPackage(_hLsa, &lsaszName, &ulAuthPackage));
+        if (SUCCEEDED(hr))
+        {
+            hr = S_OK;
+            *pulAuthPackage = ulAuthPackage;
+            InterlockedIncrement(&_cLookups);
+
+            if (_cPackages < ARRAYSIZE(_rgPackages) &&
+                SUCCEEDED(StringCchCopyA(_rgPackages[_cPackages].szName, ARRAYSIZE(_rgPackages[_cPackages].szName), pszName)))
+            {
+                _rgPackages[_cPackages].ulAuthPackage = ulAuthPackage;
+                _cPackages++;
+            }
+        }
+        else
+        {
+            // The LSA may have restarted under us; the next lookup connects again.
+            _Disconnect();
+        }
+    }
+
+    ReleaseSRWLockExclusive(&_srw);
+    return hr;
+}
+
+void AuthPackageCache::Invalidate()
+{
+    AcquireSRWLockExclusive(&_srw);
+    _Disconnect();
+    _cPackages = 0;
+    ReleaseSRWLockExclusive(&_srw);
+}
+
+HRESULT AuthPackageCacheLookup(
+    __in PCSTR pszName,
+    __out ULONG* pulAuthPackage
+    )
+{
+    return g_apc.Lookup(pszName, pulAuthPackage);
+}
+
+void AuthPackageCacheInvalidate()
+{
+    g_apc.Invalidate();
+
+    if (g_apc.GetLookupCount() > 0)
+    {
+        LogWrite(L"auth packages: %ld looked up, %ld from the cache", g_apc.GetLookupCount(), g_apc.GetHitCount());
+    }
+}
@@ -0,0 +1,107 @@
+// The auth package cache keeps the ids of the LSA authentication packages a
+// serialization names, and the connection to the LSA they were looked up on.
+// A package's id doesn't change while the LSA is running, so each name is
+// looked up once and every serialization after that gets it from here
+// instead of connecting, looking it up and disconnecting again.
+//
+// Lookups take a shared lock, so unlocks on other threads don't wait on each
+// other. Only the first lookup of a name goes to the LSA, under the exclusive
+// lock. A lookup that fails drops the connection, so the next one starts over,
+// and AuthPackageCacheInvalidate forgets everything, which DllCanUnloadNow
+// does before the dll goes.
+//
+// The cache talks to the LSA through an LsaClient. The dll's cache uses the
+// real LSA; a test can hand a cache a client of its own and count what it's
+// asked for.
+
+#pragma once
+#include <windows.h>
+#include <ntsecapi.h>
+
+// Names longer than this are looked up every time.
+#define AUTH_PACKAGE_NAME_CCH   32
+
+// The providers only ever ask for Negotiate, so a few names is plenty.
+#define AUTH_PACKAGE_MAX        4
+
+class LsaClient
+{
+  public:
+    virtual ~LsaClient() {}
+
+    //opens an untrusted connection to the LSA
+    virtual NTSTATUS Connect(__out HANDLE* phLsa) = 0;
+
+    //the id of the authentication package named plsaszName, looked up on hLsa
+    virtual NTSTATUS LookupAuthenticationPackage(
+        __in HANDLE hLsa,
+        __in PLSA_STRING plsaszName,
+        __out ULONG* pulAuthPackage
+        ) = 0;
+
+    //closes a connection Connect opened
+    virtual NTSTATUS Deregister(__in HANDLE hLsa) = 0;
+};
+
+// Talks to the LSA with LsaConnectUntrusted and friends.
+class UntrustedLsaClient : public LsaClient
+{
+  public:
+    NTSTATUS Connect(__out HANDLE* phLsa);
+    NTSTATUS LookupAuthenticationPackage(
+        __in HANDLE hLsa,
+        __in PLSA_STRING plsaszName,
+        __out ULONG* pulAuthPackage
+        );
+    NTSTATUS Deregister(__in HANDLE hLsa);
+};
+
+class AuthPackageCache
+{
+  public:
+    // There's no destructor, for the same reason there's none on ProviderCache: whoever owns the
+    // cache calls Invalidate to close the connection while the LSA can still be talked to.
+    AuthPackageCache(__in LsaClient* plc);
+
+    //the id of the authentication package named pszName, from the LSA the first time it's asked for
+    HRESULT Lookup(
+        __in PCSTR pszName,
+        __out ULONG* pulAuthPackage
+        );
+
+    //forgets every package id and closes the connection to the LSA
+    void Invalidate();
+
+    LONG GetLookupCount() { return _cLookups; }
+    LONG GetHitCount() { return _cHits; }
+
+  private:
+    struct AUTH_PACKAGE
+    {
+        CHAR    szName[AUTH_PACKAGE_NAME_CCH];
+        ULONG   ulAuthPackage;
+    };
+
+    BOOL _Find(__in PCSTR pszName, __out ULONG* pulAuthPackage);
+    void _Disconnect();
+
+    LsaClient*      _plc;
+    SRWLOCK         _srw;
+
+    // Guarded by _srw.
+    AUTH_PACKAGE    _rgPackages[AUTH_PACKAGE_MAX];
+    DWORD           _cPackages;
+    HANDLE          _hLsa;
+
+    LONG            _cLookups;
+    LONG            _cHits;
+};
+
+//the id of the authentication package named pszName, from the dll's cache. See AuthPackageCache::Lookup
+HRESULT AuthPackageCacheLookup(
+    __in PCSTR pszName,
+    __out ULONG* pulAuthPackage
+    );
+
+//forgets the dll's package ids and closes its connection to the LSA
+void AuthPackageCacheInvalidate();
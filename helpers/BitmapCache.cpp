@@ -0,0 +1,271 @@
+// The tile bitmap cache keeps one decoded copy of the tile image for the
+// life of the dll. LogonUI asks each credential for its bitmap and takes
+// ownership of what it gets back, so we still hand out one HBITMAP per call,
+// but it is a copy of the cached DIB section's pixels rather than a fresh read
+// and decode of the file.
+//
+// The image file is re-read only when its size or last write time changes,
+// or when it appears or disappears. The dll's cache looks at the file at most
+// once a second, so a screen full of tiles costs one look, not one each.
+
+#include "BitmapCache.h"
+#include "BmpDecoder.h"
+#include "Dll.h"
+#include "Trace.h"
+#include <strsafe.h>
+
+// How long the dll's cache trusts what it last saw of the .bmp file.
+#define TILE_STAMP_MS   1000
+
+static WCHAR    g_wszBmpPath[MAX_PATH];     // This dll's path with a .bmp extension.
+static INIT_ONCE g_ioBmpPath = INIT_ONCE_STATIC_INIT;
+
+static FileTileImageSource g_tisFile;
+static TileBitmapCache g_tbc(&g_tisFile, TILE_STAMP_MS);
+
+// Builds the path to the bmp in this dll's folder.
+static BOOL CALLBACK _InitBmpPath(__inout PINIT_ONCE, __in PVOID, __out PVOID*)
+{
+    DWORD cch = GetModuleFileName(HINST_THISDLL, g_wszBmpPath, ARRAYSIZE(g_wszBmpPath));
+    if ((cch > 3) && (cch < ARRAYSIZE(g_wszBmpPath)))
+    {
+        StringCchCopyW(g_wszBmpPath + cch - 3, 4, L"bmp");
+    }
+    else
+    {
+        g_wszBmpPath[0] = L'\0';
+    }
+    return TRUE;
+}
+
+void FileTileImageSource::GetStamp(__out TILE_IMAGE_STAMP* ptis)
+{
+    InitOnceExecuteOnce(&g_ioBmpPath, _InitBmpPath, NULL, NULL);
+
+    ZeroMemory(ptis, sizeof(*ptis));
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if ((g_wszBmpPath[0] != L'\0') &&
+        GetFileAttributesEx(g_wszBmpPath, GetFileExInfoStandard, &fad) &&
+        !(fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+        ptis->bExists = TRUE;
+        ptis->cb = ((ULONGLONG)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+        ptis->ftLastWrite = fad.ftLastWriteTime;
+    }
+}
+
+HRESULT FileTileImageSource::DecodeFile(__out HBITMAP* phbmp)
+{
+    InitOnceExecuteOnce(&g_ioBmpPath, _InitBmpPath, NULL, NULL);
+    return BmpDecodeFile(g_wszBmpPath, TILE_IMAGE_CX, TILE_IMAGE_CY, phbmp);
+}
+
+HRESULT FileTileImageSource::DecodeResource(__in UINT idDefault, __out HBITMAP* phbmp)
+{
+    return BmpDecodeResource(HINST_THISDLL, idDefault, TILE_IMAGE_CX, TILE_IMAGE_CY, phbmp);
+}
+
+TileBitmapCache::TileBitmapCache(__in TileImageSource* ptis, __in DWORD dwStampMs) :
+    _ptis(ptis),
+    _dwStampMs(dwStampMs),
+    _hbmpCached(NULL),
+    _bCachedFromFile(FALSE),
+    _idCachedDefault(0),
+    _ullStampTicks(0)
+{
+    InitializeSRWLock(&_srw);
+    InitializeSRWLock(&_srwStamp);
+    ZeroMemory(&_tisCached, sizeof(_tisCached));
+    ZeroMemory(&_tisLast, sizeof(_tisLast));
+}
+
+TileBitmapCache::~TileBitmapCache()
+{
+    Free();
+}
+
+// What the source says about the image file, unless we asked it recently enough.
+void TileBitmapCache::_GetStamp(__out TILE_IMAGE_STAMP* ptis)
+{
+    ULONGLONG ullNow = (_dwStampMs != 0) ? GetTickCount64() : 0;
+
+    AcquireSRWLockShared(&_srwStamp);
+    BOOL bFresh = (_ullStampTicks != 0) && (ullNow - _ullStampTicks < _dwStampMs);
+    *ptis = _tisLast;
+    ReleaseSRWLockShared(&_srwStamp);
+
+    if (!bFresh)
+    {
+        _ptis->GetStamp(ptis);
+
+        AcquireSRWLockExclusive(&_srwStamp);
+        _tisLast = *ptis;
+        _ullStampTicks = ullNow;
+        ReleaseSRWLockExclusive(&_srwStamp);
+    }
+}
+
+// Whether the cached bitmap still matches the image file. Must be called under _srw.
+BOOL TileBitmapCache::_IsCurrent(
+    __in UINT idDefault,
+    __in const TILE_IMAGE_STAMP& tis
+    )
+{
+    if (_hbmpCached == NULL || _tisCached.bExists != tis.bExists)
+    {
+        return FALSE;
+    }
+
+    if (tis.bExists &&
+        ((tis.cb != _tisCached.cb) || (CompareFileTime(&tis.ftLastWrite, &_tisCached.ftLastWrite) != 0)))
+    {
+        return FALSE;
+    }
+
+    // A file that failed to decode is not retried until it changes, but the
+    // resource we fell back to must still be the one the caller asked for.
+    return _bCachedFromFile || (_idCachedDefault == idDefault);
+}
+
+// Decodes the tile bitmap into the cache. Must be called with _srw held exclusively.
+HRESULT TileBitmapCache::_Reload(
+    __in UINT idDefault,
+    __in const TILE_IMAGE_STAMP& tis
+    )
+{
+    HRESULT hr;
+    CTraceScope trace(TM_TILEBITMAP_RELOAD, TRACE_NO_FIELD, &hr);
+    HBITMAP hbmp = NULL;
+    BOOL bFromFile = FALSE;
+
+    // Look for the filesystem bitmap first
+    if (tis.bExists)
+    {
+        bFromFile = SUCCEEDED(_ptis->DecodeFile(&hbmp));
+    }
+
+    // Use the resource bitmap as a backup
+    if (!bFromFile)
+    {
+        hr = _ptis->DecodeResource(idDefault, &hbmp);
+    }
+    else
+    {
+        hr = S_OK;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        if (_hbmpCached != NULL)
+        {
+            DeleteObject(_hbmpCached);
+        }
+        _hbmpCached = hbmp;
+        _bCachedFromFile = bFromFile;
+        _idCachedDefault = idDefault;
+        _tisCached = tis;
+    }
+
+    return hr;
+}
+
+// Makes a new DIB section with the cached bitmap's pixels. Must be called under _srw.
+HRESULT TileBitmapCache::_Copy(
+    __out HBITMAP* phbmp,
+    __out_opt BOOL* pbFromFile
+    )
+{
+    *phbmp = NULL;
+
+    DIBSECTION ds;
+    if (GetObject(_hbmpCached, sizeof(ds), &ds) != sizeof(ds) || ds.dsBm.bmBits == NULL)
+    {
+        return E_UNEXPECTED;
+    }
+
+    BITMAPINFO bmi;
+    ZeroMemory(&bmi, sizeof(bmi));
+    bmi.bmiHeader = ds.dsBmih;
+
+    void* pvBits;
+    HBITMAP hbmp = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &pvBits, NULL, 0);
+    if (hbmp == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    // The decoder only makes 32bpp bitmaps, so there's no palette and no padding to worry about.
+    CopyMemory(pvBits, ds.dsBm.bmBits, (SIZE_T)ds.dsBm.bmWidthBytes * ds.dsBm.bmHeight);
+    *phbmp = hbmp;
+    if (pbFromFile)
+    {
+        *pbFromFile = _bCachedFromFile;
+    }
+    return S_OK;
+}
+
+HRESULT TileBitmapCache::Get(
+    __in UINT idDefault,
+    __out HBITMAP* phbmp,
+    __out_opt BOOL* pbFromFile
+    )
+{
+    HRESULT hr = S_OK;
+    *phbmp = NULL;
+
+    TILE_IMAGE_STAMP tis;
+    _GetStamp(&tis);
+
+    // The common case is a current cache, which only needs the shared lock.
+    AcquireSRWLockShared(&_srw);
+    BOOL bCurrent = _IsCurrent(idDefault, tis);
+    if (bCurrent)
+    {
+        hr = _Copy(phbmp, pbFromFile);
+    }
+    ReleaseSRWLockShared(&_srw);
+
+    if (!bCurrent)
+    {
+        AcquireSRWLockExclusive(&_srw);
+
+        // Someone else may have reloaded it while we waited for the lock.
+        if (!_IsCurrent(idDefault, tis))
+        {
+            hr = _Reload(idDefault, tis);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = _Copy(phbmp, pbFromFile);
+        }
+
+        ReleaseSRWLockExclusive(&_srw);
+    }
+
+    return hr;
+}
+
+void TileBitmapCache::Free()
+{
+    AcquireSRWLockExclusive(&_srw);
+    if (_hbmpCached != NULL)
+    {
+        DeleteObject(_hbmpCached);
+        _hbmpCached = NULL;
+    }
+    ReleaseSRWLockExclusive(&_srw);
+}
+
+HRESULT TileBitmapCacheGet(
+    __in UINT idDefault,
+    __out HBITMAP* phbmp,
+    __out_opt BOOL* pbFromFile
+    )
+{
+    return g_tbc.Get(idDefault, phbmp, pbFromFile);
+}
+
+void TileBitmapCacheFree()
+{
+    g_tbc.Free();
+}
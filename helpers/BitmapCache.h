@@ -0,0 +1,88 @@
+// The tile bitmap cache keeps one decoded copy of the tile image for the
+// life of the dll. Every credential asks the cache for its bitmap instead
+// of loading and decoding the .bmp (or the embedded resource) itself.
+//
+// The cache gets the image from a TileImageSource, so it doesn't care where
+// the image lives. The dll's cache reads the .bmp next to the dll; a test can
+// hand a cache a source of its own and count what it decodes.
+
+#pragma once
+#include <windows.h>
+
+// How the image file looked the last time the source checked.
+struct TILE_IMAGE_STAMP
+{
+    BOOL        bExists;
+    ULONGLONG   cb;
+    FILETIME    ftLastWrite;
+};
+
+class TileImageSource
+{
+  public:
+    virtual ~TileImageSource() {}
+
+    //the size and last write time of the image file, or bExists FALSE if there isn't one
+    virtual void GetStamp(__out TILE_IMAGE_STAMP* ptis) = 0;
+
+    //decodes the image file into a tile sized 32bpp DIB section
+    virtual HRESULT DecodeFile(__out HBITMAP* phbmp) = 0;
+
+    //decodes the bitmap resource idDefault into a tile sized 32bpp DIB section
+    virtual HRESULT DecodeResource(__in UINT idDefault, __out HBITMAP* phbmp) = 0;
+};
+
+// The .bmp with the same name as this dll, in its folder, and the dll's own
+// bitmap resources.
+class FileTileImageSource : public TileImageSource
+{
+  public:
+    void GetStamp(__out TILE_IMAGE_STAMP* ptis);
+    HRESULT DecodeFile(__out HBITMAP* phbmp);
+    HRESULT DecodeResource(__in UINT idDefault, __out HBITMAP* phbmp);
+};
+
+class TileBitmapCache
+{
+  public:
+    //the image file is looked at again once its stamp is more than dwStampMs old; 0 looks every time
+    TileBitmapCache(__in TileImageSource* ptis, __in DWORD dwStampMs);
+    ~TileBitmapCache();
+
+    //returns a copy of the tile bitmap, which the caller owns. The image file wins over the
+    //bitmap resource idDefault. pbFromFile reports which of the two was used.
+    HRESULT Get(__in UINT idDefault, __out HBITMAP* phbmp, __out_opt BOOL* pbFromFile);
+
+    //frees the cached bitmap
+    void Free();
+
+  private:
+    BOOL _IsCurrent(__in UINT idDefault, __in const TILE_IMAGE_STAMP& tis);
+    HRESULT _Reload(__in UINT idDefault, __in const TILE_IMAGE_STAMP& tis);
+    void _GetStamp(__out TILE_IMAGE_STAMP* ptis);
+    HRESULT _Copy(__out HBITMAP* phbmp, __out_opt BOOL* pbFromFile);
+
+    TileImageSource*    _ptis;
+    DWORD               _dwStampMs;
+    SRWLOCK             _srw;
+
+    HBITMAP             _hbmpCached;        // The decoded tile bitmap.
+    BOOL                _bCachedFromFile;   // Whether _hbmpCached came from the image file.
+    UINT                _idCachedDefault;   // The resource used when it didn't.
+    TILE_IMAGE_STAMP    _tisCached;         // The file as it was when we decoded.
+
+    SRWLOCK             _srwStamp;
+    TILE_IMAGE_STAMP    _tisLast;           // The file as it was when we last looked, guarded by _srwStamp.
+    ULONGLONG           _ullStampTicks;     // When that was, or 0 if we haven't looked.
+};
+
+//returns a copy of the dll's tile bitmap, which the caller owns. The .bmp next to the dll wins
+//over the bitmap resource idDefault. pbFromFile reports which of the two was used.
+HRESULT TileBitmapCacheGet(
+    __in UINT idDefault,
+    __out HBITMAP* phbmp,
+    __out_opt BOOL* pbFromFile
+    );
+
+//frees the dll's cached bitmap
+void TileBitmapCacheFree();
@@ -0,0 +1,799 @@
+// The bmp decoder turns the tile image (either a .bmp file or an RT_BITMAP
+// resource) into a 32bpp premultiplied BGRA DIB section of exactly the tile
+// size.
+//
+// Files are memory mapped and resources are used in place, so the only copy
+// of the source pixels is the one the kernel already has. Every header field
+// is checked against the size of the mapping before any pixel is touched.
+//
+// Scaling is separable. Each source row is converted to BGRA, filtered
+// horizontally down to the tile width and kept in a small ring of rows; each
+// output row is then a weighted sum of the rows in that ring. Downscaling uses
+// an area (box) filter, upscaling a linear one. Weights are 14-bit fixed point
+// so the SSE2 kernels and the scalar fallback produce identical results.
+
+#include "BmpDecoder.h"
+#include <intsafe.h>
+#include <math.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define BMP_HAVE_SSE2
+#endif
+
+// Source images larger than this in either dimension are rejected outright.
+#define BMP_MAX_DIMENSION   32768
+
+// Filter weights are fixed point with this many fractional bits.
+#define WEIGHT_BITS         14
+
+// The horizontal pass keeps this many extra bits of precision in its 16-bit output.
+#define HPASS_EXTRA_BITS    (8 - 1)
+#define HPASS_SHIFT         (WEIGHT_BITS - HPASS_EXTRA_BITS)
+#define VPASS_SHIFT         (WEIGHT_BITS + HPASS_EXTRA_BITS)
+
+struct BMP_SOURCE
+{
+    const BYTE* pbBits;         // The first row of pixels in memory.
+    UINT        cx;
+    UINT        cy;
+    UINT        cbStride;
+    UINT        cBitsPerPixel;  // 24 or 32.
+    BOOL        bTopDown;
+    BOOL        bHasAlpha;      // 32bpp only: whether the fourth byte is real alpha.
+};
+
+struct RESAMPLE_TAP
+{
+    UINT iFirst;                // The first source pixel (or row) that contributes.
+    UINT cTaps;                 // How many consecutive ones contribute.
+};
+
+struct RESAMPLE_FILTER
+{
+    UINT          cOut;
+    UINT          cMaxTaps;
+    RESAMPLE_TAP* rgTaps;       // cOut entries.
+    SHORT*        rgWeights;    // cOut * cMaxTaps entries; entry [i * cMaxTaps + k] is for tap k of output i.
+};
+
+//
+// Header parsing.
+//
+
+// Validates the BITMAPINFOHEADER at pbInfo and the pixel array at pbBits. cbInfo is the number
+// of bytes available for the header; cbBits the number available for the pixels.
+static HRESULT _BmpParseInfo(
+    __in_bcount(cbInfo) const BYTE* pbInfo,
+    __in SIZE_T cbInfo,
+    __in const BYTE* pbBits,
+    __in SIZE_T cbBits,
+    __out BMP_SOURCE* psrc
+    )
+{
+    if (cbInfo < sizeof(BITMAPINFOHEADER))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    BITMAPINFOHEADER bih;
+    CopyMemory(&bih, pbInfo, sizeof(bih));
+
+    if ((bih.biSize < sizeof(BITMAPINFOHEADER)) || (bih.biSize > cbInfo) || (bih.biPlanes != 1) ||
+        (bih.biWidth <= 0) || (bih.biWidth > BMP_MAX_DIMENSION) ||
+        (bih.biHeight == 0) || (bih.biHeight > BMP_MAX_DIMENSION) || (bih.biHeight < -BMP_MAX_DIMENSION))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    if ((bih.biBitCount != 24) && (bih.biBitCount != 32))
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    if (bih.biCompression == BI_BITFIELDS)
+    {
+        // Only the plain BGRX layout is supported. The masks follow the first 40 bytes
+        // of the header in every header version.
+        DWORD rgdwMasks[3];
+        if ((bih.biBitCount != 32) || (cbInfo < sizeof(BITMAPINFOHEADER) + sizeof(rgdwMasks)))
+        {
+            return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        }
+        CopyMemory(rgdwMasks, pbInfo + sizeof(BITMAPINFOHEADER), sizeof(rgdwMasks));
+        if ((rgdwMasks[0] != 0x00FF0000) || (rgdwMasks[1] != 0x0000FF00) || (rgdwMasks[2] != 0x000000FF))
+        {
+            return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        }
+    }
+    else if (bih.biCompression != BI_RGB)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    psrc->cx = (UINT)bih.biWidth;
+    psrc->cy = (UINT)((bih.biHeight < 0) ? -bih.biHeight : bih.biHeight);
+    psrc->bTopDown = (bih.biHeight < 0);
+    psrc->cBitsPerPixel = bih.biBitCount;
+    psrc->bHasAlpha = FALSE;
+
+    // Rows are padded to a DWORD boundary. The dimension limits keep this well inside a UINT.
+    psrc->cbStride = ((psrc->cx * psrc->cBitsPerPixel + 31) / 32) * 4;
+
+    ULONGLONG cbImage = (ULONGLONG)psrc->cbStride * psrc->cy;
+    if (cbImage > cbBits)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+    psrc->pbBits = pbBits;
+
+    return S_OK;
+}
+
+// Validates a .bmp file image: a BITMAPFILEHEADER followed by a packed DIB.
+static HRESULT _BmpParseFile(
+    __in_bcount(cb) const BYTE* pb,
+    __in SIZE_T cb,
+    __out BMP_SOURCE* psrc
+    )
+{
+    if (cb < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    BITMAPFILEHEADER bfh;
+    CopyMemory(&bfh, pb, sizeof(bfh));
+
+    // "BM"
+    if ((bfh.bfType != 0x4D42) || (bfh.bfOffBits < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER)) || (bfh.bfOffBits > cb))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    return _BmpParseInfo(pb + sizeof(BITMAPFILEHEADER), bfh.bfOffBits - sizeof(BITMAPFILEHEADER),
+                         pb + bfh.bfOffBits, cb - bfh.bfOffBits, psrc);
+}
+
+// Validates a packed DIB, as stored in an RT_BITMAP resource: the header, an optional
+// color table and the pixels with no BITMAPFILEHEADER in front.
+static HRESULT _BmpParsePackedDib(
+    __in_bcount(cb) const BYTE* pb,
+    __in SIZE_T cb,
+    __out BMP_SOURCE* psrc
+    )
+{
+    if (cb < sizeof(BITMAPINFOHEADER))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    BITMAPINFOHEADER bih;
+    CopyMemory(&bih, pb, sizeof(bih));
+
+    ULONGLONG cbHeader = (ULONGLONG)bih.biSize + (ULONGLONG)bih.biClrUsed * sizeof(RGBQUAD);
+    if ((bih.biCompression == BI_BITFIELDS) && (bih.biSize == sizeof(BITMAPINFOHEADER)))
+    {
+        cbHeader += 3 * sizeof(DWORD);
+    }
+    if (cbHeader > cb)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    return _BmpParseInfo(pb, (SIZE_T)cbHeader, pb + cbHeader, cb - (SIZE_T)cbHeader, psrc);
+}
+
+// Returns the row y of the source, counting from the top of the image.
+static inline const BYTE* _BmpSourceRow(__in const BMP_SOURCE& src, __in UINT y)
+{
+    return src.pbBits + (SIZE_T)src.cbStride * (src.bTopDown ? y : (src.cy - 1 - y));
+}
+
+// 32bpp bitmaps usually leave the fourth byte at zero. Only treat it as alpha if some pixel
+// actually uses it.
+static BOOL _BmpSourceHasAlpha(__in const BMP_SOURCE& src)
+{
+    if (src.cBitsPerPixel == 32)
+    {
+        for (UINT y = 0; y < src.cy; y++)
+        {
+            const BYTE* pbRow = _BmpSourceRow(src, y);
+            for (UINT x = 0; x < src.cx; x++)
+            {
+                if (pbRow[x * 4 + 3] != 0)
+                {
+                    return TRUE;
+                }
+            }
+        }
+    }
+    return FALSE;
+}
+
+// Converts one source row to premultiplied BGRA.
+static void _BmpConvertRow(
+    __in const BMP_SOURCE& src,
+    __in UINT y,
+    __out_bcount(src.cx * 4) BYTE* pbOut
+    )
+{
+    const BYTE* pbIn = _BmpSourceRow(src, y);
+
+    if (src.cBitsPerPixel == 24)
+    {
+        for (UINT x = 0; x < src.cx; x++, pbIn += 3, pbOut += 4)
+        {
+            pbOut[0] = pbIn[0];
+            pbOut[1] = pbIn[1];
+            pbOut[2] = pbIn[2];
+            pbOut[3] = 0xFF;
+        }
+    }
+    else if (!src.bHasAlpha)
+    {
+        for (UINT x = 0; x < src.cx; x++, pbIn += 4, pbOut += 4)
+        {
+            pbOut[0] = pbIn[0];
+            pbOut[1] = pbIn[1];
+            pbOut[2] = pbIn[2];
+            pbOut[3] = 0xFF;
+        }
+    }
+    else
+    {
+        for (UINT x = 0; x < src.cx; x++, pbIn += 4, pbOut += 4)
+        {
+            UINT a = pbIn[3];
+            pbOut[0] = (BYTE)((pbIn[0] * a + 127) / 255);
+            pbOut[1] = (BYTE)((pbIn[1] * a + 127) / 255);
+            pbOut[2] = (BYTE)((pbIn[2] * a + 127) / 255);
+            pbOut[3] = (BYTE)a;
+        }
+    }
+}
+
+//
+// Filter construction.
+//
+
+// Works out, for each of cOut output samples, which of the cIn input samples contribute and
+// with what weight. The weights for each output sum to exactly 1 << WEIGHT_BITS.
+static HRESULT _BuildFilter(
+    __in UINT cIn,
+    __in UINT cOut,
+    __out RESAMPLE_FILTER* pf
+    )
+{
+    double dScale = (double)cIn / cOut;
+
+    // Downscaling touches at most ceil(scale) + 1 inputs per output, upscaling at most two.
+    UINT cMaxTaps = (cIn > cOut) ? (UINT)ceil(dScale) + 1 : 2;
+
+    pf->cOut = cOut;
+    pf->cMaxTaps = cMaxTaps;
+    pf->rgTaps = (RESAMPLE_TAP*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, cOut * sizeof(RESAMPLE_TAP));
+    pf->rgWeights = (SHORT*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (SIZE_T)cOut * cMaxTaps * sizeof(SHORT));
+    if ((pf->rgTaps == NULL) || (pf->rgWeights == NULL))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    for (UINT i = 0; i < cOut; i++)
+    {
+        RESAMPLE_TAP* ptap = &pf->rgTaps[i];
+        SHORT* rgw = &pf->rgWeights[i * cMaxTaps];
+        int rgwRaw[2] = { 0, 0 };
+
+        if (cIn > cOut)
+        {
+            // Area filter: each output covers [x0, x1) of the input.
+            double x0 = i * dScale;
+            double x1 = (i + 1) * dScale;
+            UINT iFirst = (UINT)x0;
+            UINT iLast = (UINT)ceil(x1) - 1;
+            if (iLast >= cIn)
+            {
+                iLast = cIn - 1;
+            }
+
+            ptap->iFirst = iFirst;
+            ptap->cTaps = iLast - iFirst + 1;
+
+            int iSum = 0;
+            UINT kLargest = 0;
+            for (UINT k = 0; k < ptap->cTaps; k++)
+            {
+                double dLo = (iFirst + k > x0) ? (double)(iFirst + k) : x0;
+                double dHi = (iFirst + k + 1 < x1) ? (double)(iFirst + k + 1) : x1;
+                int w = (int)(((dHi - dLo) / dScale) * (1 << WEIGHT_BITS) + 0.5);
+                rgw[k] = (SHORT)w;
+                iSum += w;
+                if (rgw[k] > rgw[kLargest])
+                {
+                    kLargest = k;
+                }
+            }
+
+            // Make the weights sum to exactly one so flat areas stay flat.
+            rgw[kLargest] = (SHORT)(rgw[kLargest] + ((1 << WEIGHT_BITS) - iSum));
+        }
+        else
+        {
+            // Linear filter between the two nearest input samples.
+            double dCenter = (i + 0.5) * dScale - 0.5;
+            if (dCenter < 0)
+            {
+                dCenter = 0;
+            }
+            UINT iFirst = (UINT)dCenter;
+            double dFrac = dCenter - iFirst;
+
+            if (iFirst + 1 >= cIn)
+            {
+                ptap->iFirst = cIn - 1;
+                ptap->cTaps = 1;
+                rgwRaw[0] = 1 << WEIGHT_BITS;
+            }
+            else
+            {
+                ptap->iFirst = iFirst;
+                ptap->cTaps = 2;
+                rgwRaw[1] = (int)(dFrac * (1 << WEIGHT_BITS) + 0.5);
+                rgwRaw[0] = (1 << WEIGHT_BITS) - rgwRaw[1];
+            }
+            rgw[0] = (SHORT)rgwRaw[0];
+            rgw[1] = (SHORT)rgwRaw[1];
+        }
+    }
+
+    return S_OK;
+}
+
+static void _FreeFilter(__inout RESAMPLE_FILTER* pf)
+{
+    if (pf->rgTaps != NULL)
+    {
+        HeapFree(GetProcessHeap(), 0, pf->rgTaps);
+        pf->rgTaps = NULL;
+    }
+    if (pf->rgWeights != NULL)
+    {
+        HeapFree(GetProcessHeap(), 0, pf->rgWeights);
+        pf->rgWeights = NULL;
+    }
+}
+
+//
+// Kernels. The horizontal kernels filter one BGRA row into cOut 16-bit BGRA samples; the
+// vertical kernels combine cRows of those into one row of BGRA bytes.
+//
+
+static void _HorizontalPassScalar(
+    __in const RESAMPLE_FILTER& f,
+    __in const BYTE* pbRow,
+    __out SHORT* psOut
+    )
+{
+    for (UINT i = 0; i < f.cOut; i++, psOut += 4)
+    {
+        const BYTE* pb = pbRow + (SIZE_T)f.rgTaps[i].iFirst * 4;
+        const SHORT* rgw = &f.rgWeights[i * f.cMaxTaps];
+        int rgAcc[4] = { 0, 0, 0, 0 };
+
+        for (UINT k = 0; k < f.rgTaps[i].cTaps; k++, pb += 4)
+        {
+            rgAcc[0] += pb[0] * rgw[k];
+            rgAcc[1] += pb[1] * rgw[k];
+            rgAcc[2] += pb[2] * rgw[k];
+            rgAcc[3] += pb[3] * rgw[k];
+        }
+
+        for (int c = 0; c < 4; c++)
+        {
+            psOut[c] = (SHORT)((rgAcc[c] + (1 << (HPASS_SHIFT - 1))) >> HPASS_SHIFT);
+        }
+    }
+}
+
+static void _VerticalPassScalar(
+    __in_ecount(cRows) const SHORT* const* rgpsRows,
+    __in_ecount(cRows) const SHORT* rgw,
+    __in UINT cRows,
+    __in UINT cValues,
+    __out_ecount(cValues) BYTE* pbOut
+    )
+{
+    for (UINT v = 0; v < cValues; v++)
+    {
+        int iAcc = 0;
+        for (UINT k = 0; k < cRows; k++)
+        {
+            iAcc += rgpsRows[k][v] * rgw[k];
+        }
+
+        iAcc = (iAcc + (1 << (VPASS_SHIFT - 1))) >> VPASS_SHIFT;
+        pbOut[v] = (BYTE)((iAcc < 0) ? 0 : ((iAcc > 255) ? 255 : iAcc));
+    }
+}
+
+#ifdef BMP_HAVE_SSE2
+
+// Packs two 16-bit weights into each 32-bit lane, for use with _mm_madd_epi16.
+static inline __m128i _WeightPair(__in SHORT w0, __in SHORT w1)
+{
+    return _mm_set1_epi32((int)(((UINT)(USHORT)w1 << 16) | (USHORT)w0));
+}
+
+static void _HorizontalPassSse2(
+    __in const RESAMPLE_FILTER& f,
+    __in const BYTE* pbRow,
+    __out SHORT* psOut
+    )
+{
+    const __m128i xZero = _mm_setzero_si128();
+    const __m128i xRound = _mm_set1_epi32(1 << (HPASS_SHIFT - 1));
+
+    for (UINT i = 0; i < f.cOut; i++, psOut += 4)
+    {
+        const BYTE* pb = pbRow + (SIZE_T)f.rgTaps[i].iFirst * 4;
+        const SHORT* rgw = &f.rgWeights[i * f.cMaxTaps];
+        UINT cTaps = f.rgTaps[i].cTaps;
+        __m128i xAcc = xZero;
+
+        // Two pixels per step: interleave their channels as b0 b1 g0 g1 r0 r1 a0 a1 so one
+        // multiply-add applies both weights.
+        UINT k = 0;
+        for (; k + 1 < cTaps; k += 2)
+        {
+            __m128i xPx = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pb + k * 4)), xZero);
+            xPx = _mm_unpacklo_epi16(xPx, _mm_srli_si128(xPx, 8));
+            xAcc = _mm_add_epi32(xAcc, _mm_madd_epi16(xPx, _WeightPair(rgw[k], rgw[k + 1])));
+        }
+        if (k < cTaps)
+        {
+            __m128i xPx = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int*)(pb + k * 4)), xZero);
+            xPx = _mm_unpacklo_epi16(xPx, xZero);
+            xAcc = _mm_add_epi32(xAcc, _mm_madd_epi16(xPx, _WeightPair(rgw[k], 0)));
+        }
+
+        xAcc = _mm_srai_epi32(_mm_add_epi32(xAcc, xRound), HPASS_SHIFT);
+        _mm_storel_epi64((__m128i*)psOut, _mm_packs_epi32(xAcc, xAcc));
+    }
+}
+
+static void _VerticalPassSse2(
+    __in_ecount(cRows) const SHORT* const* rgpsRows,
+    __in_ecount(cRows) const SHORT* rgw,
+    __in UINT cRows,
+    __in UINT cValues,
+    __out_ecount(cValues) BYTE* pbOut
+    )
+{
+    const __m128i xZero = _mm_setzero_si128();
+    const __m128i xRound = _mm_set1_epi32(1 << (VPASS_SHIFT - 1));
+
+    // Eight values (two pixels) per step, two rows at a time.
+    UINT v = 0;
+    for (; v + 8 <= cValues; v += 8)
+    {
+        __m128i xLo = xZero;
+        __m128i xHi = xZero;
+
+        UINT k = 0;
+        for (; k + 1 < cRows; k += 2)
+        {
+            __m128i xA = _mm_loadu_si128((const __m128i*)(rgpsRows[k] + v));
+            __m128i xB = _mm_loadu_si128((const __m128i*)(rgpsRows[k + 1] + v));
+            __m128i xW = _WeightPair(rgw[k], rgw[k + 1]);
+            xLo = _mm_add_epi32(xLo, _mm_madd_epi16(_mm_unpacklo_epi16(xA, xB), xW));
+            xHi = _mm_add_epi32(xHi, _mm_madd_epi16(_mm_unpackhi_epi16(xA, xB), xW));
+        }
+        if (k < cRows)
+        {
+            __m128i xA = _mm_loadu_si128((const __m128i*)(rgpsRows[k] + v));
+            __m128i xW = _WeightPair(rgw[k], 0);
+            xLo = _mm_add_epi32(xLo, _mm_madd_epi16(_mm_unpacklo_epi16(xA, xZero), xW));
+            xHi = _mm_add_epi32(xHi, _mm_madd_epi16(_mm_unpackhi_epi16(xA, xZero), xW));
+        }
+
+        xLo = _mm_srai_epi32(_mm_add_epi32(xLo, xRound), VPASS_SHIFT);
+        xHi = _mm_srai_epi32(_mm_add_epi32(xHi, xRound), VPASS_SHIFT);
+        __m128i xPacked = _mm_packus_epi16(_mm_packs_epi32(xLo, xHi), xZero);
+        _mm_storel_epi64((__m128i*)(pbOut + v), xPacked);
+    }
+
+    // A leftover odd pixel is done the scalar way.
+    for (; v < cValues; v++)
+    {
+        int iAcc = 0;
+        for (UINT k = 0; k < cRows; k++)
+        {
+            iAcc += rgpsRows[k][v] * rgw[k];
+        }
+        iAcc = (iAcc + (1 << (VPASS_SHIFT - 1))) >> VPASS_SHIFT;
+        pbOut[v] = (BYTE)((iAcc < 0) ? 0 : ((iAcc > 255) ? 255 : iAcc));
+    }
+}
+
+#endif // BMP_HAVE_SSE2
+
+typedef void (*PFN_HORIZONTAL_PASS)(const RESAMPLE_FILTER&, const BYTE*, SHORT*);
+typedef void (*PFN_VERTICAL_PASS)(const SHORT* const*, const SHORT*, UINT, UINT, BYTE*);
+
+static void _SelectKernels(
+    __in DWORD dwKernels,
+    __out PFN_HORIZONTAL_PASS* ppfnHorizontal,
+    __out PFN_VERTICAL_PASS* ppfnVertical
+    )
+{
+    *ppfnHorizontal = _HorizontalPassScalar;
+    *ppfnVertical = _VerticalPassScalar;
+    if (dwKernels == BMP_KERNELS_SCALAR)
+    {
+        return;
+    }
+
+#if defined(_M_X64)
+    *ppfnHorizontal = _HorizontalPassSse2;
+    *ppfnVertical = _VerticalPassSse2;
+#elif defined(BMP_HAVE_SSE2)
+    if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+    {
+        *ppfnHorizontal = _HorizontalPassSse2;
+        *ppfnVertical = _VerticalPassSse2;
+    }
+#endif
+}
+
+//
+// Scales src into the cx by cy top-down BGRA buffer pbDst.
+//
+static HRESULT _BmpScale(
+    __in const BMP_SOURCE& src,
+    __in UINT cx,
+    __in UINT cy,
+    __in DWORD dwKernels,
+    __out_bcount(cx * cy * 4) BYTE* pbDst
+    )
+{
+    RESAMPLE_FILTER fH = { 0 };
+    RESAMPLE_FILTER fV = { 0 };
+
+    HRESULT hr = _BuildFilter(src.cx, cx, &fH);
+    if (SUCCEEDED(hr))
+    {
+        hr = _BuildFilter(src.cy, cy, &fV);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // One scratch allocation holds the converted source row, a ring of cMaxTaps
+        // horizontally filtered rows, the source row index held in each ring slot and the
+        // row pointers handed to the vertical kernel.
+        UINT cRing = fV.cMaxTaps;
+        SIZE_T cbConverted = (SIZE_T)src.cx * 4;
+        SIZE_T cbRingRow = (SIZE_T)cx * 4 * sizeof(SHORT);
+        SIZE_T cbScratch = cbConverted + cbRingRow * cRing + cRing * sizeof(UINT) + cRing * sizeof(SHORT*);
+
+        BYTE* pbScratch = (BYTE*)HeapAlloc(GetProcessHeap(), 0, cbScratch);
+        if (pbScratch != NULL)
+        {
+            BYTE* pbConverted = pbScratch;
+            SHORT* psRing = (SHORT*)(pbConverted + cbConverted);
+            UINT* rgiRingRow = (UINT*)((BYTE*)psRing + cbRingRow * cRing);
+            const SHORT** rgpsRows = (const SHORT**)(rgiRingRow + cRing);
+
+            for (UINT s = 0; s < cRing; s++)
+            {
+                rgiRingRow[s] = (UINT)-1;
+            }
+
+            PFN_HORIZONTAL_PASS pfnHorizontal;
+            PFN_VERTICAL_PASS pfnVertical;
+            _SelectKernels(dwKernels, &pfnHorizontal, &pfnVertical);
+
+            for (UINT y = 0; y < cy; y++)
+            {
+                const RESAMPLE_TAP& tap = fV.rgTaps[y];
+
+                // The taps of successive output rows only move forward, so a ring of
+                // cMaxTaps rows never evicts a row the current output still needs.
+                for (UINT k = 0; k < tap.cTaps; k++)
+                {
+                    UINT iRow = tap.iFirst + k;
+                    UINT iSlot = iRow % cRing;
+                    SHORT* psSlot = (SHORT*)((BYTE*)psRing + cbRingRow * iSlot);
+                    if (rgiRingRow[iSlot] != iRow)
+                    {
+                        _BmpConvertRow(src, iRow, pbConverted);
+                        pfnHorizontal(fH, pbConverted, psSlot);
+                        rgiRingRow[iSlot] = iRow;
+                    }
+                    rgpsRows[k] = psSlot;
+                }
+
+                pfnVertical(rgpsRows, &fV.rgWeights[y * fV.cMaxTaps], tap.cTaps, cx * 4, pbDst + (SIZE_T)y * cx * 4);
+            }
+
+            HeapFree(GetProcessHeap(), 0, pbScratch);
+        }
+        else
+        {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
+    _FreeFilter(&fH);
+    _FreeFilter(&fV);
+
+    return hr;
+}
+
+// Creates the output DIB section and scales src into it.
+static HRESULT _BmpCreateTileBitmap(
+    __inout BMP_SOURCE* psrc,
+    __in UINT cx,
+    __in UINT cy,
+    __in DWORD dwKernels,
+    __out HBITMAP* phbmp
+    )
+{
+    *phbmp = NULL;
+
+    if ((cx == 0) || (cy == 0) || (cx > BMP_MAX_DIMENSION) || (cy > BMP_MAX_DIMENSION))
+    {
+        return E_INVALIDARG;
+    }
+
+    psrc->bHasAlpha = _BmpSourceHasAlpha(*psrc);
+
+    BITMAPINFO bmi;
+    ZeroMemory(&bmi, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = (LONG)cx;
+    bmi.bmiHeader.biHeight = -(LONG)cy;     // top-down
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    HRESULT hr;
+    void* pvBits = NULL;
+    HBITMAP hbmp = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &pvBits, NULL, 0);
+    if (hbmp != NULL)
+    {
+        hr = _BmpScale(*psrc, cx, cy, dwKernels, (BYTE*)pvBits);
+        if (SUCCEEDED(hr))
+        {
+            GdiFlush();
+            *phbmp = hbmp;
+        }
+        else
+        {
+            DeleteObject(hbmp);
+        }
+    }
+    else
+    {
+        hr = E_OUTOFMEMORY;
+    }
+
+    return hr;
+}
+
+HRESULT BmpDecodeImage(
+    __in_bcount(cb) const BYTE* pb,
+    __in SIZE_T cb,
+    __in UINT cx,
+    __in UINT cy,
+    __in DWORD dwKernels,
+    __out HBITMAP* phbmp
+    )
+{
+    *phbmp = NULL;
+
+    BMP_SOURCE src;
+    HRESULT hr = _BmpParseFile(pb, cb, &src);
+    if (SUCCEEDED(hr))
+    {
+        hr = _BmpCreateTileBitmap(&src, cx, cy, dwKernels, phbmp);
+    }
+    return hr;
+}
+
+HRESULT BmpDecodeFile(
+    __in PCWSTR pwszPath,
+    __in UINT cx,
+    __in UINT cy,
+    __out HBITMAP* phbmp
+    )
+{
+    *phbmp = NULL;
+
+    HRESULT hr;
+    HANDLE hFile = CreateFile(pwszPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER liSize;
+        if (GetFileSizeEx(hFile, &liSize))
+        {
+            // Anything too big to map in one view can't be a sane tile image.
+            if ((liSize.QuadPart >= (LONGLONG)sizeof(BITMAPFILEHEADER)) && ((ULONGLONG)liSize.QuadPart <= (SIZE_T)-1))
+            {
+                HANDLE hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+                if (hMapping != NULL)
+                {
+                    const BYTE* pb = (const BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+                    if (pb != NULL)
+                    {
+                        hr = BmpDecodeImage(pb, (SIZE_T)liSize.QuadPart, cx, cy, BMP_KERNELS_BEST, phbmp);
+                        UnmapViewOfFile(pb);
+                    }
+                    else
+                    {
+                        hr = HRESULT_FROM_WIN32(GetLastError());
+                    }
+                    CloseHandle(hMapping);
+                }
+                else
+                {
+                    hr = HRESULT_FROM_WIN32(GetLastError());
+                }
+            }
+            else
+            {
+                hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+        CloseHandle(hFile);
+    }
+    else
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return hr;
+}
+
+HRESULT BmpDecodeResource(
+    __in HINSTANCE hinst,
+    __in UINT id,
+    __in UINT cx,
+    __in UINT cy,
+    __out HBITMAP* phbmp
+    )
+{
+    *phbmp = NULL;
+
+    HRESULT hr;
+    HRSRC hrsrc = FindResourceW(hinst, MAKEINTRESOURCE(id), RT_BITMAP);
+    if (hrsrc != NULL)
+    {
+        // Resources live in the mapped image, so this is already a memory mapped view.
+        HGLOBAL hglob = LoadResource(hinst, hrsrc);
+        const BYTE* pb = (hglob != NULL) ? (const BYTE*)LockResource(hglob) : NULL;
+        if (pb != NULL)
+        {
+            BMP_SOURCE src;
+            hr = _BmpParsePackedDib(pb, SizeofResource(hinst, hrsrc), &src);
+            if (SUCCEEDED(hr))
+            {
+                hr = _BmpCreateTileBitmap(&src, cx, cy, BMP_KERNELS_BEST, phbmp);
+            }
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    else
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return hr;
+}
@@ -0,0 +1,44 @@
+// The bmp decoder turns the tile image (either a .bmp file or an RT_BITMAP
+// resource) into a 32bpp premultiplied BGRA DIB section of exactly the tile
+// size. Doing it ourselves means the cost of scaling an oversized image is
+// bounded and predictable instead of being left to LoadImage.
+
+#pragma once
+#include <windows.h>
+
+// The size of the tile image LogonUI displays for a v1 credential provider.
+#define TILE_IMAGE_CX   128
+#define TILE_IMAGE_CY   128
+
+//decodes the .bmp file at pwszPath into a cx by cy DIB section
+HRESULT BmpDecodeFile(
+    __in PCWSTR pwszPath,
+    __in UINT cx,
+    __in UINT cy,
+    __out HBITMAP* phbmp
+    );
+
+//decodes the RT_BITMAP resource id into a cx by cy DIB section
+HRESULT BmpDecodeResource(
+    __in HINSTANCE hinst,
+    __in UINT id,
+    __in UINT cx,
+    __in UINT cy,
+    __out HBITMAP* phbmp
+    );
+
+// Which kernels BmpDecodeImage scales with: the fastest the processor has, or
+// the scalar ones every processor has. The two give identical pixels.
+#define BMP_KERNELS_BEST    0
+#define BMP_KERNELS_SCALAR  1
+
+//decodes the .bmp file image in the cb bytes at pb into a cx by cy DIB section,
+//scaling with dwKernels
+HRESULT BmpDecodeImage(
+    __in_bcount(cb) const BYTE* pb,
+    __in SIZE_T cb,
+    __in UINT cx,
+    __in UINT cy,
+    __in DWORD dwKernels,
+    __out HBITMAP* phbmp
+    );
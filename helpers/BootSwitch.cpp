@@ -0,0 +1,458 @@
+#include "BootSwitch.h"
+#include "Dll.h"
+#include "Log.h"
+#include "Trace.h"
+#include <strsafe.h>
+
+// Posted to the status window when the status changes on another thread.
+#define WM_BOOTSWITCH_STATUS        (WM_APP + 1)
+#define BOOT_SWITCH_WINDOW_CLASS    L"BootPickerBootSwitchStatus"
+
+static HRESULT _BootSwitchSetStartupDisk(__in_opt const STARTUP_PARTITION* psp)
+{
+    HRESULT hr;
+    CTraceScope trace(TM_BOOTSWITCH_SETSTARTUPDISK, TRACE_NO_FIELD, &hr);
+
+    hr = (psp != NULL) ? StartupDiskSetPartition(*psp) : StartupDiskSetMac();
+    return hr;
+}
+
+static HRESULT _BootSwitchRestart()
+{
+    HRESULT hr;
+    CTraceScope trace(TM_BOOTSWITCH_RESTART, TRACE_NO_FIELD, &hr);
+
+    HANDLE hToken;
+    if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+    {
+        TOKEN_PRIVILEGES tkp;
+        tkp.PrivilegeCount = 1;
+        tkp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        if (LookupPrivilegeValue(NULL, SE_SHUTDOWN_NAME, &tkp.Privileges[0].Luid))
+        {
+            // AdjustTokenPrivileges succeeds even when it couldn't enable the privilege,
+            // and says so through the last error.
+            AdjustTokenPrivileges(hToken, FALSE, &tkp, 0, NULL, NULL);
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+        CloseHandle(hToken);
+    }
+    else
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Restart and force all applications to close.
+    if (SUCCEEDED(hr) &&
+        !ExitWindowsEx(EWX_REBOOT | EWX_FORCE,
+                       SHTDN_REASON_MAJOR_OPERATINGSYSTEM | SHTDN_REASON_MINOR_UPGRADE | SHTDN_REASON_FLAG_PLANNED))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return hr;
+}
+
+const BOOT_SWITCH_STEPS g_bssRebootToMac =
+{
+    _BootSwitchSetStartupDisk,
+    _BootSwitchRestart,
+};
+
+// The dry run is only in debug builds. A shipping dll that a stray file could stop
+// from switching would be a support problem, and tests that want other steps pass
+// them to Initialize.
+#ifdef _DEBUG
+// Stand-ins for the real steps that only say what they would have done.
+static HRESULT _BootSwitchDryRunSetStartupDisk(__in_opt const STARTUP_PARTITION* psp)
+{
+    HRESULT hr = S_OK;
+    CTraceScope trace(TM_BOOTSWITCH_SETSTARTUPDISK, TRACE_NO_FIELD, &hr);
+
+    LogWrite(L"dry run: would set the startup disk to %s", (psp != NULL) ? L"the tile's partition" : L"the Mac");
+    return hr;
+}
+
+static HRESULT _BootSwitchDryRunRestart()
+{
+    HRESULT hr = S_OK;
+    CTraceScope trace(TM_BOOTSWITCH_RESTART, TRACE_NO_FIELD, &hr);
+
+    LogWrite(L"dry run: would restart");
+    return hr;
+}
+
+static const BOOT_SWITCH_STEPS s_bssDryRun =
+{
+    _BootSwitchDryRunSetStartupDisk,
+    _BootSwitchDryRunRestart,
+};
+
+static const BOOT_SWITCH_STEPS* g_pbssDefault = &g_bssRebootToMac;
+static INIT_ONCE g_ioDefaultSteps = INIT_ONCE_STATIC_INIT;
+
+// Picks the dry run steps if there's a .dryrun file next to the dll.
+static BOOL CALLBACK _InitDefaultSteps(__inout PINIT_ONCE, __in PVOID, __out PVOID*)
+{
+    WCHAR wszPath[MAX_PATH];
+    DWORD cch = GetModuleFileName(HINST_THISDLL, wszPath, ARRAYSIZE(wszPath));
+    if ((cch > 3) && (cch < ARRAYSIZE(wszPath)) &&
+        SUCCEEDED(StringCchCopyW(wszPath + cch - 3, ARRAYSIZE(wszPath) - (cch - 3), L"dryrun")) &&
+        (GetFileAttributes(wszPath) != INVALID_FILE_ATTRIBUTES))
+    {
+        LogWrite(L"dry run: %s is there, so clicking the command link won't switch or restart", wszPath);
+        g_pbssDefault = &s_bssDryRun;
+    }
+    return TRUE;
+}
+
+const BOOT_SWITCH_STEPS* BootSwitchGetDefaultSteps()
+{
+    InitOnceExecuteOnce(&g_ioDefaultSteps, _InitDefaultSteps, NULL, NULL);
+    return g_pbssDefault;
+}
+#else
+const BOOT_SWITCH_STEPS* BootSwitchGetDefaultSteps()
+{
+    return &g_bssRebootToMac;
+}
+#endif
+
+static ATOM         g_atomStatusClass;
+static INIT_ONCE    g_ioStatusClass = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK _RegisterStatusClass(__inout PINIT_ONCE, __in PVOID pv, __out PVOID*)
+{
+    WNDCLASSW wc = {0};
+    wc.lpfnWndProc = reinterpret_cast<WNDPROC>(pv);
+    wc.hInstance = HINST_THISDLL;
+    wc.lpszClassName = BOOT_SWITCH_WINDOW_CLASS;
+    g_atomStatusClass = RegisterClassW(&wc);
+    if (g_atomStatusClass == 0)
+    {
+        LogWrite(L"boot switch: registering the status window class failed with error %lu", GetLastError());
+    }
+    return TRUE;
+}
+
+void BootSwitchFree()
+{
+    if (g_atomStatusClass != 0)
+    {
+        UnregisterClassW(BOOT_SWITCH_WINDOW_CLASS, HINST_THISDLL);
+        g_atomStatusClass = 0;
+    }
+}
+
+// Puts the system's description of hr in pwsz, or just the number if it doesn't have one.
+static void _BootSwitchFormatError(
+    __in HRESULT hr,
+    __out_ecount(cch) PWSTR pwsz,
+    __in DWORD cch
+    )
+{
+    DWORD cchMessage = FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                                      NULL, hr, 0, pwsz, cch, NULL);
+
+    // The system's messages end with a line break, which a tile can't show.
+    while (cchMessage > 0 && (pwsz[cchMessage - 1] == L'\r' || pwsz[cchMessage - 1] == L'\n' || pwsz[cchMessage - 1] == L'.'))
+    {
+        pwsz[--cchMessage] = L'\0';
+    }
+    if (cchMessage == 0)
+    {
+        StringCchPrintfW(pwsz, cch, L"0x%08x", hr);
+    }
+}
+
+BootSwitch::BootSwitch() :
+    _bss(BSS_IDLE),
+    _pcpce(NULL),
+    _hwndStatus(NULL),
+    _dwStatusThreadId(0),
+    _pcpc(NULL),
+    _dwStatusFieldID(0),
+    _pbss(NULL),
+    _psp(NULL)
+{
+    InitializeSRWLock(&_srw);
+    _wszStatus[0] = L'\0';
+}
+
+BootSwitch::~BootSwitch()
+{
+    // The worker holds a reference on the credential that owns us, so it has finished by now.
+    UnAdvise();
+}
+
+void BootSwitch::Initialize(
+    __in ICredentialProviderCredential* pcpc,
+    __in DWORD dwStatusFieldID,
+    __in const BOOT_SWITCH_STEPS* pbss,
+    __in_opt const STARTUP_PARTITION* psp
+    )
+{
+    _pcpc = pcpc;
+    _dwStatusFieldID = dwStatusFieldID;
+    _pbss = pbss;
+    _psp = psp;
+}
+
+void BootSwitch::Advise(__in ICredentialProviderCredentialEvents* pcpce)
+{
+    // Advising again on another thread moves the window there.
+    if ((_hwndStatus != NULL) && (_dwStatusThreadId != GetCurrentThreadId()))
+    {
+        UnAdvise();
+    }
+
+    // Without a window, status changes made on other threads aren't pushed; LogonUI
+    // still sees them the next time it asks for the field.
+    HWND hwnd = _hwndStatus;
+    if (hwnd == NULL)
+    {
+        InitOnceExecuteOnce(&g_ioStatusClass, _RegisterStatusClass, reinterpret_cast<PVOID>(_WndProc), NULL);
+        hwnd = CreateWindowExW(0, BOOT_SWITCH_WINDOW_CLASS, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, HINST_THISDLL, NULL);
+        if (hwnd != NULL)
+        {
+            SetWindowLongPtr(hwnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(this));
+        }
+        else
+        {
+            LogWrite(L"boot switch: creating the status window failed with error %lu", GetLastError());
+        }
+    }
+
+    pcpce->AddRef();
+
+    AcquireSRWLockExclusive(&_srw);
+    ICredentialProviderCredentialEvents* pcpceOld = _pcpce;
+    _pcpce = pcpce;
+    _hwndStatus = hwnd;
+    _dwStatusThreadId = GetCurrentThreadId();
+    ReleaseSRWLockExclusive(&_srw);
+
+    if (pcpceOld != NULL)
+    {
+        pcpceOld->Release();
+    }
+}
+
+void BootSwitch::UnAdvise()
+{
+    AcquireSRWLockExclusive(&_srw);
+    ICredentialProviderCredentialEvents* pcpceOld = _pcpce;
+    HWND hwnd = _hwndStatus;
+    DWORD dwThreadId = _dwStatusThreadId;
+    _pcpce = NULL;
+    _hwndStatus = NULL;
+    _dwStatusThreadId = 0;
+    ReleaseSRWLockExclusive(&_srw);
+
+    if (hwnd != NULL)
+    {
+        // Anything already posted to the window finds no BootSwitch and does nothing. Only
+        // the thread that made the window can destroy it; from any other, such as the last
+        // release on the worker, it's asked to close itself.
+        SetWindowLongPtr(hwnd, GWLP_USERDATA, 0);
+        if (dwThreadId == GetCurrentThreadId())
+        {
+            DestroyWindow(hwnd);
+        }
+        else
+        {
+            PostMessage(hwnd, WM_CLOSE, 0, 0);
+        }
+    }
+
+    if (pcpceOld != NULL)
+    {
+        pcpceOld->Release();
+    }
+}
+
+BOOT_SWITCH_STATE BootSwitch::GetState()
+{
+    AcquireSRWLockShared(&_srw);
+    BOOT_SWITCH_STATE bss = _bss;
+    ReleaseSRWLockShared(&_srw);
+    return bss;
+}
+
+HRESULT BootSwitch::GetStatusText(__deref_out PWSTR* ppwsz)
+{
+    HRESULT hr = S_FALSE;
+    *ppwsz = NULL;
+
+    AcquireSRWLockShared(&_srw);
+    if (_wszStatus[0] != L'\0')
+    {
+        hr = SHStrDupW(_wszStatus, ppwsz);
+    }
+    ReleaseSRWLockShared(&_srw);
+
+    return hr;
+}
+
+// Claims the switch for a new run, unless one is already under way.
+BOOL BootSwitch::_TryBegin()
+{
+    AcquireSRWLockExclusive(&_srw);
+    BOOL bBegin = (_bss == BSS_IDLE || _bss == BSS_FAILED);
+    if (bBegin)
+    {
+        _bss = BSS_SETTING_STARTUP_DISK;
+    }
+    ReleaseSRWLockExclusive(&_srw);
+    return bBegin;
+}
+
+// Moves to a new state and pushes its status line to the tile: straight away on the
+// thread that advised, and through the status window from any other.
+void BootSwitch::_SetState(
+    __in BOOT_SWITCH_STATE bss,
+    __in PCWSTR pwszFormat,
+    ...
+    )
+{
+    WCHAR wszStatus[BOOT_SWITCH_MAX_STATUS];
+    va_list args;
+    va_start(args, pwszFormat);
+    StringCchVPrintfW(wszStatus, ARRAYSIZE(wszStatus), pwszFormat, args);
+    va_end(args);
+
+    // The message is posted under the lock, so UnAdvise can't destroy the window under us.
+    AcquireSRWLockExclusive(&_srw);
+    _bss = bss;
+    StringCchCopyW(_wszStatus, ARRAYSIZE(_wszStatus), wszStatus);
+    BOOL bPushNow = (_pcpce != NULL) && (_dwStatusThreadId == GetCurrentThreadId());
+    if ((_hwndStatus != NULL) && !bPushNow)
+    {
+        PostMessage(_hwndStatus, WM_BOOTSWITCH_STATUS, 0, 0);
+    }
+    ReleaseSRWLockExclusive(&_srw);
+
+    LogWrite(L"boot switch: %s", wszStatus);
+
+    if (bPushNow)
+    {
+        _PushStatus();
+    }
+}
+
+// Pushes the current status line to the tile, on the thread that advised. The events
+// are called outside the lock, since LogonUI may call back into the credential.
+void BootSwitch::_PushStatus()
+{
+    WCHAR wszStatus[BOOT_SWITCH_MAX_STATUS];
+
+    AcquireSRWLockShared(&_srw);
+    StringCchCopyW(wszStatus, ARRAYSIZE(wszStatus), _wszStatus);
+    ICredentialProviderCredentialEvents* pcpce = _pcpce;
+    if (pcpce != NULL)
+    {
+        pcpce->AddRef();
+    }
+    ReleaseSRWLockShared(&_srw);
+
+    if (pcpce != NULL)
+    {
+        pcpce->SetFieldString(_pcpc, _dwStatusFieldID, wszStatus);
+        pcpce->Release();
+    }
+}
+
+LRESULT CALLBACK BootSwitch::_WndProc(
+    __in HWND hwnd,
+    __in UINT uMsg,
+    __in WPARAM wParam,
+    __in LPARAM lParam
+    )
+{
+    if (uMsg == WM_BOOTSWITCH_STATUS)
+    {
+        BootSwitch* pbs = reinterpret_cast<BootSwitch*>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
+        if (pbs != NULL)
+        {
+            pbs->_PushStatus();
+        }
+        return 0;
+    }
+    return DefWindowProcW(hwnd, uMsg, wParam, lParam);
+}
+
+void BootSwitch::Run()
+{
+    WCHAR wszError[BOOT_SWITCH_MAX_STATUS / 2];
+
+    _SetState(BSS_SETTING_STARTUP_DISK, L"Setting the startup disk...");
+    HRESULT hr = _pbss->pfnSetStartupDisk(_psp);
+    if (FAILED(hr))
+    {
+        _BootSwitchFormatError(hr, wszError, ARRAYSIZE(wszError));
+        _SetState(BSS_FAILED, L"Couldn't set the startup disk: %s", wszError);
+        return;
+    }
+
+    // Once the restart has been asked for we stay here; the session is about to end.
+    _SetState(BSS_RESTARTING, L"Restarting...");
+    hr = _pbss->pfnRestart();
+    if (FAILED(hr))
+    {
+        _BootSwitchFormatError(hr, wszError, ARRAYSIZE(wszError));
+        _SetState(BSS_FAILED, L"Couldn't restart: %s", wszError);
+    }
+}
+
+DWORD WINAPI BootSwitch::_ThreadProc(__in LPVOID pv)
+{
+    BootSwitch* pbs = (BootSwitch*)pv;
+    ICredentialProviderCredential* pcpc = pbs->_pcpc;
+
+    pbs->Run();
+
+    // This may be the last reference on the credential, and so on pbs.
+    pcpc->Release();
+
+    // Drop the reference Start took for us.
+    FreeLibraryAndExitThread(HINST_THISDLL, 0);
+}
+
+HRESULT BootSwitch::Start()
+{
+    if (!_TryBegin())
+    {
+        return S_FALSE;
+    }
+
+    HRESULT hr;
+
+    // Keep the credential, and the dll, around for as long as the thread runs.
+    _pcpc->AddRef();
+    HMODULE hmod;
+    if (GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCWSTR)_ThreadProc, &hmod))
+    {
+        HANDLE hThread = CreateThread(NULL, 0, _ThreadProc, this, 0, NULL);
+        if (hThread != NULL)
+        {
+            CloseHandle(hThread);
+            return S_OK;
+        }
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        FreeLibrary(hmod);
+    }
+    else
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    _pcpc->Release();
+
+    WCHAR wszError[BOOT_SWITCH_MAX_STATUS / 2];
+    _BootSwitchFormatError(hr, wszError, ARRAYSIZE(wszError));
+    _SetState(BSS_FAILED, L"Couldn't start switching: %s", wszError);
+    return hr;
+}
@@ -0,0 +1,108 @@
+// A BootSwitch makes the Mac partition the startup disk and restarts the
+// machine on a worker thread, so that LogonUI's thread never waits on the
+// firmware, BootCamp.exe or ExitWindowsEx. As it goes it pushes a status line
+// to one string field of the credential that owns it: the field shows
+// "Setting the startup disk...", then "Restarting...", or why it failed. A
+// switch that failed can be started again.
+//
+// LogonUI's credential events may only be called on its own thread. Advise
+// makes a message-only window on the thread that advised, and a status change
+// on any other thread is posted to it; the window calls SetFieldString with
+// whatever the status is by the time it gets the message.
+//
+// The switch itself is a small state machine in Run. Start is the only part
+// that knows about threads, and the steps are function pointers, so the state
+// machine can be driven by hand with stand-in steps and events.
+
+#pragma once
+#include <windows.h>
+#include <credentialprovider.h>
+#include "StartupDisk.h"
+
+enum BOOT_SWITCH_STATE
+{
+    BSS_IDLE                    = 0,
+    BSS_SETTING_STARTUP_DISK    = 1,
+    BSS_RESTARTING              = 2,
+    BSS_FAILED                  = 3,
+};
+
+// The steps of a switch, each returning how it went. psp is the partition to
+// switch to, or NULL to let StartupDiskSetMac pick one.
+typedef HRESULT (*PFN_BOOT_SWITCH_SET_STARTUP_DISK)(__in_opt const STARTUP_PARTITION* psp);
+typedef HRESULT (*PFN_BOOT_SWITCH_RESTART)();
+
+struct BOOT_SWITCH_STEPS
+{
+    PFN_BOOT_SWITCH_SET_STARTUP_DISK    pfnSetStartupDisk;
+    PFN_BOOT_SWITCH_RESTART             pfnRestart;
+};
+
+// StartupDiskSetPartition (or StartupDiskSetMac) followed by a forced restart.
+extern const BOOT_SWITCH_STEPS g_bssRebootToMac;
+
+//g_bssRebootToMac. In a debug build, if there's a .dryrun file next to the dll, it's steps that
+//only log what they would have done, which lets logonsim click the command link without the
+//machine going anywhere. A release build never looks for the file
+const BOOT_SWITCH_STEPS* BootSwitchGetDefaultSteps();
+
+//unregisters the status window class, when the dll is unloaded
+void BootSwitchFree();
+
+// Long enough for any of the status lines.
+#define BOOT_SWITCH_MAX_STATUS  128
+
+class BootSwitch
+{
+  public:
+    BootSwitch();
+    ~BootSwitch();
+
+    //pcpc is the credential the status field belongs to, and must own this BootSwitch.
+    //psp, if not NULL, must stay valid for as long as the BootSwitch does.
+    void Initialize(
+        __in ICredentialProviderCredential* pcpc,
+        __in DWORD dwStatusFieldID,
+        __in const BOOT_SWITCH_STEPS* pbss,
+        __in_opt const STARTUP_PARTITION* psp
+        );
+
+    //holds on to the events that status changes are pushed through. Call it on LogonUI's thread,
+    //which is the thread the events are then always called on
+    void Advise(__in ICredentialProviderCredentialEvents* pcpce);
+
+    //stops pushing status changes. Call it on the thread that called Advise
+    void UnAdvise();
+
+    //starts a switch on a worker thread. Returns S_FALSE if one is already running
+    HRESULT Start();
+
+    //runs a switch on the calling thread, once Start has moved it out of BSS_IDLE or BSS_FAILED
+    void Run();
+
+    BOOT_SWITCH_STATE GetState();
+
+    //copies the status line for the field. Returns S_FALSE, and no string, before the first switch
+    HRESULT GetStatusText(__deref_out PWSTR* ppwsz);
+
+  private:
+    BOOL _TryBegin();
+    void _SetState(__in BOOT_SWITCH_STATE bss, __in PCWSTR pwszFormat, ...);
+    void _PushStatus();
+
+    static DWORD WINAPI _ThreadProc(__in LPVOID pv);
+    static LRESULT CALLBACK _WndProc(__in HWND hwnd, __in UINT uMsg, __in WPARAM wParam, __in LPARAM lParam);
+
+  private:
+    SRWLOCK                                 _srw;                   // Guards everything below it.
+    BOOT_SWITCH_STATE                       _bss;
+    WCHAR                                   _wszStatus[BOOT_SWITCH_MAX_STATUS];
+    ICredentialProviderCredentialEvents*    _pcpce;
+    HWND                                    _hwndStatus;            // Owned by the thread that advised.
+    DWORD                                   _dwStatusThreadId;
+
+    ICredentialProviderCredential*          _pcpc;                  // Not a reference; it owns us.
+    DWORD                                   _dwStatusFieldID;
+    const BOOT_SWITCH_STEPS*                _pbss;
+    const STARTUP_PARTITION*                _psp;                   // NULL to let StartupDiskSetMac pick.
+};
@@ -0,0 +1,74 @@
+// Bases for the COM classes in both dlls. Each class that implements an
+// interface I derives from one of them, naming itself as T:
+//
+//     class Provider : public ComObject<Provider, ICredentialProvider>
+//
+// ComInterface<T, I> answers QueryInterface for IUnknown and I from a QITAB
+// that is built at compile time. Classes whose lifetime is managed some other
+// way derive from it directly and supply AddRef and Release themselves.
+//
+// ComObject<T, I> adds the usual reference count, kept with interlocked
+// operations so any thread can hold a reference, and deletes the object when
+// it drops to zero. Each object also holds a reference on the dll for as long
+// as it's alive, so T's constructor and destructor don't have to.
+
+#pragma once
+#include <windows.h>
+#include <unknwn.h>
+
+#pragma warning(push)
+#pragma warning(disable : 4995)
+#include <shlwapi.h>
+#pragma warning(pop)
+
+#include "Dll.h"
+
+template <class T, class I>
+class ComInterface : public I
+{
+  public:
+    IFACEMETHODIMP QueryInterface(__in REFIID riid, __deref_out void** ppv)
+    {
+        static const QITAB qit[] =
+        {
+            { &__uuidof(I), OFFSETOFCLASS(I, T) },
+            {0},
+        };
+        return QISearch(static_cast<T*>(this), qit, riid, ppv);
+    }
+};
+
+template <class T, class I>
+class ComObject : public ComInterface<T, I>
+{
+  public:
+    IFACEMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&_cRef);
+    }
+
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        LONG cRef = InterlockedDecrement(&_cRef);
+        if (!cRef)
+        {
+            delete static_cast<T*>(this);
+        }
+        return cRef;
+    }
+
+  protected:
+    ComObject() :
+        _cRef(1)
+    {
+        DllAddRef();
+    }
+
+    ~ComObject()
+    {
+        DllRelease();
+    }
+
+  private:
+    LONG _cRef;
+};
@@ -0,0 +1,91 @@
+#include "DiskReader.h"
+#include <winioctl.h>
+
+// The sector size of a disk image, unless we're told otherwise.
+#define DISK_IMAGE_SECTOR_SIZE  512
+
+FileDiskReader::FileDiskReader() :
+    _hFile(INVALID_HANDLE_VALUE),
+    _dwSectorSize(0)
+{
+}
+
+FileDiskReader::~FileDiskReader()
+{
+    _Close();
+}
+
+void FileDiskReader::_Close()
+{
+    if (_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(_hFile);
+        _hFile = INVALID_HANDLE_VALUE;
+    }
+    _dwSectorSize = 0;
+}
+
+HRESULT FileDiskReader::Initialize(__in PCWSTR pwszPath, __in DWORD dwSectorSize)
+{
+    // A reader that failed to open one disk is tried on the next.
+    _Close();
+
+    // Other people have the disk open, for writing too, so share everything.
+    _hFile = CreateFile(pwszPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (dwSectorSize == 0)
+    {
+        // Disk images don't answer the IOCTL.
+        DISK_GEOMETRY dg;
+        DWORD cbReturned;
+        if (DeviceIoControl(_hFile, IOCTL_DISK_GET_DRIVE_GEOMETRY, NULL, 0, &dg, sizeof(dg), &cbReturned, NULL) &&
+            (dg.BytesPerSector > 0))
+        {
+            dwSectorSize = dg.BytesPerSector;
+        }
+        else
+        {
+            dwSectorSize = DISK_IMAGE_SECTOR_SIZE;
+        }
+    }
+
+    // Everything reading sectors assumes they're a power of two no smaller than a GPT header block.
+    if ((dwSectorSize < DISK_IMAGE_SECTOR_SIZE) || (dwSectorSize & (dwSectorSize - 1)))
+    {
+        _Close();
+        return HRESULT_FROM_WIN32(ERROR_INVALID_PARAMETER);
+    }
+
+    _dwSectorSize = dwSectorSize;
+    return S_OK;
+}
+
+DWORD FileDiskReader::GetSectorSize()
+{
+    return _dwSectorSize;
+}
+
+HRESULT FileDiskReader::Read(__in ULONGLONG ullOffset, __out_bcount(cb) void* pv, __in DWORD cb)
+{
+    if ((ullOffset % _dwSectorSize) || (cb % _dwSectorSize))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_PARAMETER);
+    }
+
+    OVERLAPPED ov = {0};
+    ov.Offset = (DWORD)ullOffset;
+    ov.OffsetHigh = (DWORD)(ullOffset >> 32);
+
+    DWORD cbRead;
+    if (!ReadFile(_hFile, pv, cb, &cbRead, &ov))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // An image file just stops; treat a short read like reading past the end of a disk.
+    return (cbRead == cb) ? S_OK : HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+}
@@ -0,0 +1,44 @@
+// A DiskReader reads whole sectors from a disk. The GPT scanner only talks to
+// this interface, so it reads a physical drive and a plain disk image file the
+// same way.
+
+#pragma once
+#include <windows.h>
+
+class DiskReader
+{
+  public:
+    virtual ~DiskReader() {}
+
+    //the size of a logical sector, which every read is a multiple of
+    virtual DWORD GetSectorSize() = 0;
+
+    //reads cb bytes starting at byte ullOffset. Both must be multiples of the sector size,
+    //and pv must be aligned to it. Reading past the end of the disk fails.
+    virtual HRESULT Read(
+        __in ULONGLONG ullOffset,
+        __out_bcount(cb) void* pv,
+        __in DWORD cb
+        ) = 0;
+};
+
+// A disk opened by path: \\.\PhysicalDriveN, or a raw image file. A physical
+// drive reports its own sector size; an image is taken to have 512 byte
+// sectors unless Initialize is told otherwise.
+class FileDiskReader : public DiskReader
+{
+  public:
+    FileDiskReader();
+    ~FileDiskReader();
+
+    HRESULT Initialize(__in PCWSTR pwszPath, __in DWORD dwSectorSize = 0);
+
+    DWORD GetSectorSize();
+    HRESULT Read(__in ULONGLONG ullOffset, __out_bcount(cb) void* pv, __in DWORD cb);
+
+  private:
+    void _Close();
+
+    HANDLE  _hFile;
+    DWORD   _dwSectorSize;
+};
@@ -12,6 +12,14 @@
 #include <unknwn.h>
 #include "Dll.h"
 #include "helpers.h"
+#include "BitmapCache.h"
+#include "BootSwitch.h"
+#include "Log.h"
+#include "Trace.h"
+#include "Metrics.h"
+#include "ProviderCache.h"
+#include "AuthPackageCache.h"
+#include "ComObject.h"
 
 static LONG g_cRef = 0;   // global dll reference count
 HINSTANCE g_hinst = NULL; // global dll hinstance
@@ -19,35 +27,22 @@ HINSTANCE g_hinst = NULL; // global dll hinstance
 extern HRESULT CSample_CreateInstance(__in REFIID riid, __deref_out void** ppv);
 EXTERN_C GUID CLSID_CSample;
 
-class CClassFactory : public IClassFactory
+// There's only ever one class factory. It lives as long as the dll does, so a
+// reference on it is a reference on the dll.
+class CClassFactory : public ComInterface<CClassFactory, IClassFactory>
 {
 public:
-    CClassFactory() : _cRef(1) 
-    {
-    }
-
     // IUnknown
-    IFACEMETHODIMP QueryInterface(__in REFIID riid, __deref_out void **ppv)
-    {
-        static const QITAB qit[] = 
-        {
-            QITABENT(CClassFactory, IClassFactory),
-            { 0 },
-        };
-        return QISearch(this, qit, riid, ppv);
-    }
-
     IFACEMETHODIMP_(ULONG) AddRef()
     {
-        return InterlockedIncrement(&_cRef);
+        DllAddRef();
+        return 2;
     }
 
     IFACEMETHODIMP_(ULONG) Release()
     {
-        LONG cRef = InterlockedDecrement(&_cRef);
-        if (!cRef)
-            delete this;
-        return cRef;
+        DllRelease();
+        return 1;
     }
 
     // IClassFactory
@@ -78,14 +73,10 @@ public:
         }
         return S_OK;
     }
-
-private:
-    ~CClassFactory()
-    {
-    }
-    long _cRef;
 };
 
+static CClassFactory g_cf;
+
 HRESULT CClassFactory_CreateInstance(__in REFCLSID rclsid, __in REFIID riid, __deref_out void **ppv)
 {
     *ppv = NULL;
@@ -94,16 +85,7 @@ HRESULT CClassFactory_CreateInstance(__in REFCLSID rclsid, __in REFIID riid, __d
 
     if (CLSID_CSample == rclsid)
     {
-        CClassFactory* pcf = new CClassFactory();
-        if (pcf)
-        {
-            hr = pcf->QueryInterface(riid, ppv);
-            pcf->Release();
-        }
-        else
-        {
-            hr = E_OUTOFMEMORY;
-        }
+        hr = g_cf.QueryInterface(riid, ppv);
     }
     else
     {
@@ -124,7 +106,18 @@ void DllRelease()
 
 STDAPI DllCanUnloadNow()
 {
-    return (g_cRef > 0) ? S_FALSE : S_OK;
+    HRESULT hr = (g_cRef > 0) ? S_FALSE : S_OK;
+    if (hr == S_OK)
+    {
+        // Nothing else will use the idle providers, and they aren't ours to
+        // release from DllMain.
+        ProviderCacheFlush();
+        AuthPackageCacheInvalidate();
+
+        // This is the last chance to see the numbers before we're unloaded.
+        MetricsDump();
+    }
+    return hr;
 }
 
 STDAPI DllGetClassObject(__in REFCLSID rclsid, __in REFIID riid, __deref_out void** ppv)
@@ -132,7 +125,7 @@ STDAPI DllGetClassObject(__in REFCLSID rclsid, __in REFIID riid, __deref_out voi
     return CClassFactory_CreateInstance(rclsid, riid, ppv);
 }
 
-STDAPI_(BOOL) DllMain(__in HINSTANCE hinstDll, __in DWORD dwReason, __in void *)
+STDAPI_(BOOL) DllMain(__in HINSTANCE hinstDll, __in DWORD dwReason, __in void *pvReserved)
 {
     switch (dwReason)
     {
@@ -140,6 +133,15 @@ STDAPI_(BOOL) DllMain(__in HINSTANCE hinstDll, __in DWORD dwReason, __in void *)
         DisableThreadLibraryCalls(hinstDll);
         break;
     case DLL_PROCESS_DETACH:
+        // If the process is exiting the system reclaims everything for us.
+        if (pvReserved == NULL)
+        {
+            TileBitmapCacheFree();
+            BootSwitchFree();
+            LogFree();
+            TraceFree();
+        }
+        break;
     case DLL_THREAD_ATTACH:
     case DLL_THREAD_DETACH:
         break;
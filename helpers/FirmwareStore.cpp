@@ -0,0 +1,214 @@
+#include "FirmwareStore.h"
+#include <strsafe.h>
+
+//
+// EfiVariableStore
+//
+
+EfiVariableStore::EfiVariableStore() :
+    _hToken(NULL)
+{
+    ZeroMemory(&_tpPrevious, sizeof(_tpPrevious));
+}
+
+EfiVariableStore::~EfiVariableStore()
+{
+    if (_hToken != NULL)
+    {
+        // If the privilege was already on, _tpPrevious is empty and this changes nothing.
+        AdjustTokenPrivileges(_hToken, FALSE, &_tpPrevious, 0, NULL, NULL);
+        CloseHandle(_hToken);
+    }
+}
+
+HRESULT EfiVariableStore::Initialize()
+{
+    HRESULT hr;
+    HANDLE hToken;
+    if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+    {
+        TOKEN_PRIVILEGES tkp;
+        tkp.PrivilegeCount = 1;
+        tkp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        if (LookupPrivilegeValue(NULL, SE_SYSTEM_ENVIRONMENT_NAME, &tkp.Privileges[0].Luid))
+        {
+            // AdjustTokenPrivileges succeeds even when it couldn't enable the privilege,
+            // and says so through the last error.
+            DWORD cbPrevious;
+            if (AdjustTokenPrivileges(hToken, FALSE, &tkp, sizeof(_tpPrevious), &_tpPrevious, &cbPrevious))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+                if (SUCCEEDED(hr))
+                {
+                    _hToken = hToken;
+                    hToken = NULL;
+                }
+            }
+            else
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        if (hToken != NULL)
+        {
+            CloseHandle(hToken);
+        }
+    }
+    else
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return hr;
+}
+
+HRESULT EfiVariableStore::ReadVariable(
+    __in PCWSTR pwszName,
+    __in PCWSTR pwszGuid,
+    __out_bcount_part(cb, *pcbRead) void* pv,
+    __in DWORD cb,
+    __out DWORD* pcbRead
+    )
+{
+    *pcbRead = GetFirmwareEnvironmentVariableW(pwszName, pwszGuid, pv, cb);
+    return (*pcbRead > 0) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+}
+
+HRESULT EfiVariableStore::WriteVariable(
+    __in PCWSTR pwszName,
+    __in PCWSTR pwszGuid,
+    __in_bcount(cb) const void* pv,
+    __in DWORD cb
+    )
+{
+    // Variables written this way are non-volatile and visible to both boot services and
+    // the OS, which is what the firmware's boot manager reads.
+    return SetFirmwareEnvironmentVariableW(pwszName, pwszGuid, const_cast<void*>(pv), cb) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+}
+
+HRESULT EfiVariableStore::DeleteVariable(
+    __in PCWSTR pwszName,
+    __in PCWSTR pwszGuid
+    )
+{
+    // Setting a variable to nothing deletes it.
+    if (SetFirmwareEnvironmentVariableW(pwszName, pwszGuid, NULL, 0))
+    {
+        return S_OK;
+    }
+    DWORD dwError = GetLastError();
+    return (dwError == ERROR_ENVVAR_NOT_FOUND) ? S_OK : HRESULT_FROM_WIN32(dwError);
+}
+
+//
+// FileVariableStore
+//
+
+HRESULT FileVariableStore::Initialize(__in PCWSTR pwszFolder)
+{
+    return StringCchCopyW(_wszFolder, ARRAYSIZE(_wszFolder), pwszFolder);
+}
+
+HRESULT FileVariableStore::_GetPath(
+    __in PCWSTR pwszName,
+    __in PCWSTR pwszGuid,
+    __out_ecount(cch) PWSTR pwszPath,
+    __in size_t cch
+    )
+{
+    return StringCchPrintfW(pwszPath, cch, L"%s\\%s-%s", _wszFolder, pwszGuid, pwszName);
+}
+
+HRESULT FileVariableStore::ReadVariable(
+    __in PCWSTR pwszName,
+    __in PCWSTR pwszGuid,
+    __out_bcount_part(cb, *pcbRead) void* pv,
+    __in DWORD cb,
+    __out DWORD* pcbRead
+    )
+{
+    *pcbRead = 0;
+
+    WCHAR wszPath[MAX_PATH];
+    HRESULT hr = _GetPath(pwszName, pwszGuid, wszPath, ARRAYSIZE(wszPath));
+    if (SUCCEEDED(hr))
+    {
+        HANDLE hFile = CreateFile(wszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile != INVALID_HANDLE_VALUE)
+        {
+            // Like the firmware, fail rather than return part of a variable that doesn't fit.
+            LARGE_INTEGER liSize;
+            if (!GetFileSizeEx(hFile, &liSize))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+            else if (liSize.QuadPart > cb)
+            {
+                hr = HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+            }
+            else if (!ReadFile(hFile, pv, (DWORD)liSize.QuadPart, pcbRead, NULL))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+            CloseHandle(hFile);
+        }
+        else
+        {
+            DWORD dwError = GetLastError();
+            hr = HRESULT_FROM_WIN32((dwError == ERROR_FILE_NOT_FOUND) ? ERROR_ENVVAR_NOT_FOUND : dwError);
+        }
+    }
+
+    return hr;
+}
+
+HRESULT FileVariableStore::WriteVariable(
+    __in PCWSTR pwszName,
+    __in PCWSTR pwszGuid,
+    __in_bcount(cb) const void* pv,
+    __in DWORD cb
+    )
+{
+    WCHAR wszPath[MAX_PATH];
+    HRESULT hr = _GetPath(pwszName, pwszGuid, wszPath, ARRAYSIZE(wszPath));
+    if (SUCCEEDED(hr))
+    {
+        HANDLE hFile = CreateFile(wszPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile != INVALID_HANDLE_VALUE)
+        {
+            DWORD cbWritten;
+            if (!WriteFile(hFile, pv, cb, &cbWritten, NULL))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+            CloseHandle(hFile);
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    return hr;
+}
+
+HRESULT FileVariableStore::DeleteVariable(
+    __in PCWSTR pwszName,
+    __in PCWSTR pwszGuid
+    )
+{
+    WCHAR wszPath[MAX_PATH];
+    HRESULT hr = _GetPath(pwszName, pwszGuid, wszPath, ARRAYSIZE(wszPath));
+    if (SUCCEEDED(hr) && !DeleteFile(wszPath))
+    {
+        DWORD dwError = GetLastError();
+        hr = (dwError == ERROR_FILE_NOT_FOUND) ? S_OK : HRESULT_FROM_WIN32(dwError);
+    }
+
+    return hr;
+}
@@ -0,0 +1,77 @@
+// A FirmwareVariableStore reads and writes firmware (NVRAM) variables. The
+// startup disk code only talks to this interface, so the same encode, write
+// and verify steps run against the real firmware or against a folder of files
+// standing in for it.
+
+#pragma once
+#include <windows.h>
+
+// The vendor GUID Apple's firmware keeps its boot settings under.
+#define APPLE_BOOT_VARIABLE_GUID    L"{7C436110-AB2A-4BBB-A880-FE41995C9F82}"
+
+class FirmwareVariableStore
+{
+  public:
+    virtual ~FirmwareVariableStore() {}
+
+    //reads a variable into pv. Fails with HRESULT_FROM_WIN32(ERROR_ENVVAR_NOT_FOUND) if it doesn't exist.
+    virtual HRESULT ReadVariable(
+        __in PCWSTR pwszName,
+        __in PCWSTR pwszGuid,
+        __out_bcount_part(cb, *pcbRead) void* pv,
+        __in DWORD cb,
+        __out DWORD* pcbRead
+        ) = 0;
+
+    //creates or replaces a non-volatile variable
+    virtual HRESULT WriteVariable(
+        __in PCWSTR pwszName,
+        __in PCWSTR pwszGuid,
+        __in_bcount(cb) const void* pv,
+        __in DWORD cb
+        ) = 0;
+
+    //removes a variable. Succeeds if it doesn't exist.
+    virtual HRESULT DeleteVariable(
+        __in PCWSTR pwszName,
+        __in PCWSTR pwszGuid
+        ) = 0;
+};
+
+// The firmware itself, through the firmware environment APIs. Only works on a
+// machine that booted through UEFI, and needs SE_SYSTEM_ENVIRONMENT_NAME, which
+// Initialize turns on for the process. The privilege is put back the way it
+// was when the store is destroyed.
+class EfiVariableStore : public FirmwareVariableStore
+{
+  public:
+    EfiVariableStore();
+    ~EfiVariableStore();
+
+    HRESULT Initialize();
+
+    HRESULT ReadVariable(__in PCWSTR pwszName, __in PCWSTR pwszGuid, __out_bcount_part(cb, *pcbRead) void* pv, __in DWORD cb, __out DWORD* pcbRead);
+    HRESULT WriteVariable(__in PCWSTR pwszName, __in PCWSTR pwszGuid, __in_bcount(cb) const void* pv, __in DWORD cb);
+    HRESULT DeleteVariable(__in PCWSTR pwszName, __in PCWSTR pwszGuid);
+
+  private:
+    HANDLE              _hToken;        // Our process token, while we have the privilege turned on.
+    TOKEN_PRIVILEGES    _tpPrevious;    // The privilege as it was before.
+};
+
+// A folder with one file per variable, named <guid>-<name>, holding the
+// variable's bytes exactly as the firmware would.
+class FileVariableStore : public FirmwareVariableStore
+{
+  public:
+    HRESULT Initialize(__in PCWSTR pwszFolder);
+
+    HRESULT ReadVariable(__in PCWSTR pwszName, __in PCWSTR pwszGuid, __out_bcount_part(cb, *pcbRead) void* pv, __in DWORD cb, __out DWORD* pcbRead);
+    HRESULT WriteVariable(__in PCWSTR pwszName, __in PCWSTR pwszGuid, __in_bcount(cb) const void* pv, __in DWORD cb);
+    HRESULT DeleteVariable(__in PCWSTR pwszName, __in PCWSTR pwszGuid);
+
+  private:
+    HRESULT _GetPath(__in PCWSTR pwszName, __in PCWSTR pwszGuid, __out_ecount(cch) PWSTR pwszPath, __in size_t cch);
+
+    WCHAR   _wszFolder[MAX_PATH];
+};
@@ -0,0 +1,91 @@
+#include "FlushThread.h"
+#include "Dll.h"
+
+enum FLUSH_THREAD_STATE
+{
+    FTS_STOPPED = 0,
+    FTS_RUNNING = 1,
+};
+
+static DWORD WINAPI _FlushThreadProc(__in LPVOID pv)
+{
+    FLUSH_THREAD* pft = (FLUSH_THREAD*)pv;
+
+    for (;;)
+    {
+        InterlockedExchange(&pft->lWakePending, 0);
+        if (!pft->pfnDrain() && (WaitForSingleObject(pft->hWake, pft->dwIdleTimeoutMs) == WAIT_TIMEOUT))
+        {
+            // Nothing for a while. Finish up before giving up the thread so that a new
+            // flush thread never overlaps with this one.
+            pft->pfnIdle();
+
+            InterlockedExchange(&pft->lState, FTS_STOPPED);
+
+            // A writer that queued something just before we stopped saw us running and
+            // won't start a new thread, so check once more.
+            if (!pft->pfnPending() ||
+                (InterlockedCompareExchange(&pft->lState, FTS_RUNNING, FTS_STOPPED) != FTS_STOPPED))
+            {
+                break;
+            }
+        }
+    }
+
+    // Drop the reference FlushThreadWake took for us.
+    FreeLibraryAndExitThread(HINST_THISDLL, 0);
+}
+
+HRESULT FlushThreadInitialize(
+    __inout FLUSH_THREAD* pft
+    )
+{
+    pft->lState = FTS_STOPPED;
+    pft->lWakePending = 0;
+    pft->hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    return (pft->hWake != NULL) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+}
+
+void FlushThreadWake(
+    __inout FLUSH_THREAD* pft
+    )
+{
+    if (pft->hWake == NULL)
+    {
+        return;
+    }
+
+    if (InterlockedCompareExchange(&pft->lState, FTS_RUNNING, FTS_STOPPED) == FTS_STOPPED)
+    {
+        // Keep the dll loaded for as long as the thread runs.
+        HMODULE hmod;
+        if (GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCWSTR)_FlushThreadProc, &hmod))
+        {
+            HANDLE hThread = CreateThread(NULL, 0, _FlushThreadProc, pft, 0, NULL);
+            if (hThread != NULL)
+            {
+                CloseHandle(hThread);
+                return;
+            }
+            FreeLibrary(hmod);
+        }
+
+        // Whatever is queued stays queued for the next wake-up to try again.
+        InterlockedExchange(&pft->lState, FTS_STOPPED);
+    }
+    else if (InterlockedExchange(&pft->lWakePending, 1) == 0)
+    {
+        SetEvent(pft->hWake);
+    }
+}
+
+void FlushThreadFree(
+    __inout FLUSH_THREAD* pft
+    )
+{
+    if (pft->hWake != NULL)
+    {
+        CloseHandle(pft->hWake);
+        pft->hWake = NULL;
+    }
+}
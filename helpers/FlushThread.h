@@ -0,0 +1,46 @@
+// A flush thread drains a queue in the background so that the threads that
+// fill it never touch the disk. It is started by the first wake-up and exits
+// again after it has been idle for a while. While it runs it holds a
+// reference on the dll so that the dll can't be unloaded from under it.
+//
+// Only one flush thread per FLUSH_THREAD runs at a time, so the callbacks
+// never run concurrently with each other.
+
+#pragma once
+#include <windows.h>
+
+// Moves whatever is queued to its destination. Returns FALSE if there was nothing to move.
+typedef BOOL (*PFN_FLUSH_DRAIN)();
+
+// Called before the thread goes away, to write out and close whatever the drain left open.
+typedef void (*PFN_FLUSH_IDLE)();
+
+// Whether anything is queued.
+typedef BOOL (*PFN_FLUSH_PENDING)();
+
+struct FLUSH_THREAD
+{
+    PFN_FLUSH_DRAIN     pfnDrain;
+    PFN_FLUSH_IDLE      pfnIdle;
+    PFN_FLUSH_PENDING   pfnPending;
+    DWORD               dwIdleTimeoutMs;
+
+    volatile LONG       lState;             // FTS_*
+    volatile LONG       lWakePending;       // Whether hWake has been set since the thread last looked.
+    HANDLE              hWake;
+};
+
+// Creates the wake-up event. Call once before the first FlushThreadWake.
+HRESULT FlushThreadInitialize(
+    __inout FLUSH_THREAD* pft
+    );
+
+//starts the flush thread, or wakes it up if it's already running
+void FlushThreadWake(
+    __inout FLUSH_THREAD* pft
+    );
+
+//closes the wake-up event
+void FlushThreadFree(
+    __inout FLUSH_THREAD* pft
+    );
@@ -0,0 +1,482 @@
+#include "GptScanner.h"
+#include "Dll.h"
+#include "Log.h"
+#include "Trace.h"
+#include <strsafe.h>
+
+// GPT partition types Apple uses.
+static const GUID s_guidApfsPartition = { 0x7C3457EF, 0x0000, 0x11AA, { 0xAA, 0x11, 0x00, 0x30, 0x65, 0x43, 0xEC, 0xAC } };
+static const GUID s_guidHfsPlusPartition = { 0x48465300, 0x0000, 0x11AA, { 0xAA, 0x11, 0x00, 0x30, 0x65, 0x43, 0xEC, 0xAC } };
+static const GUID s_guidAppleBootPartition = { 0x426F6F74, 0x0000, 0x11AA, { 0xAA, 0x11, 0x00, 0x30, 0x65, 0x43, 0xEC, 0xAC } };
+
+// Physical disk numbers can have gaps, so we look at this many before giving up.
+#define GPT_MAX_DISKS               16
+
+// A GPT normally has 128 entries of 128 bytes. Anything claiming more than this is corrupt.
+#define GPT_MAX_ENTRY_ARRAY_BYTES   (1024 * 1024)
+#define GPT_MAX_ENTRY_BYTES         4096
+
+#define GPT_SIGNATURE               "EFI PART"
+#define GPT_HEADER_LBA              1
+#define GPT_HEADER_BYTES            92      // sizeof(GPT_HEADER) is padded past the end of it.
+
+// The HFS+ volume header (Apple TN1150). It's big-endian, and starts 1024 bytes into the
+// volume whatever the sector size. finderInfo[0] is the folder bless marked as the one
+// to boot from, and is zero on a volume no one has blessed.
+#define HFS_VOLUME_HEADER_OFFSET    1024
+#define HFS_PLUS_SIGNATURE          0x482B  // 'H+'
+#define HFSX_SIGNATURE              0x4858  // 'HX', case-sensitive HFS+.
+#define HFS_FINDER_INFO_OFFSET      80
+
+// The GPT header and partition entry, as the UEFI spec lays them out. Every
+// field is little-endian and naturally aligned.
+struct GPT_HEADER
+{
+    char        rgchSignature[8];
+    DWORD       dwRevision;
+    DWORD       cbHeader;
+    DWORD       dwHeaderCrc32;
+    DWORD       dwReserved;
+    ULONGLONG   ullMyLba;
+    ULONGLONG   ullAlternateLba;
+    ULONGLONG   ullFirstUsableLba;
+    ULONGLONG   ullLastUsableLba;
+    GUID        guidDisk;
+    ULONGLONG   ullPartitionEntryLba;
+    DWORD       cPartitionEntries;
+    DWORD       cbPartitionEntry;
+    DWORD       dwPartitionEntryArrayCrc32;
+};
+
+struct GPT_ENTRY
+{
+    GUID        guidPartitionType;
+    GUID        guidPartition;
+    ULONGLONG   ullStartingLba;
+    ULONGLONG   ullEndingLba;
+    ULONGLONG   ullAttributes;
+    WCHAR       wszName[GPT_NAME_CCH];      // Not NULL-terminated if it fills the field.
+};
+
+// The CRC-32 the GPT uses, which is the same one as zip and Ethernet.
+static DWORD _GptCrc32(__in_bcount(cb) const BYTE* pb, __in DWORD cb, __in DWORD dwCrc = 0)
+{
+    dwCrc = ~dwCrc;
+    for (DWORD i = 0; i < cb; i++)
+    {
+        dwCrc ^= pb[i];
+        for (int iBit = 0; iBit < 8; iBit++)
+        {
+            dwCrc = (dwCrc >> 1) ^ (0xEDB88320 & (0 - (dwCrc & 1)));
+        }
+    }
+    return ~dwCrc;
+}
+
+// Checks everything about the header we rely on. pHeader is a whole sector, which we may scribble on.
+static BOOL _GptIsHeaderValid(__inout GPT_HEADER* pHeader, __in DWORD cbSector)
+{
+    if ((memcmp(pHeader->rgchSignature, GPT_SIGNATURE, sizeof(pHeader->rgchSignature)) != 0) ||
+        (pHeader->cbHeader < GPT_HEADER_BYTES) ||
+        (pHeader->cbHeader > cbSector) ||
+        (pHeader->ullMyLba != GPT_HEADER_LBA))
+    {
+        return FALSE;
+    }
+
+    // The header's CRC is computed with the CRC field itself zeroed.
+    DWORD dwCrc = pHeader->dwHeaderCrc32;
+    pHeader->dwHeaderCrc32 = 0;
+    if (_GptCrc32(reinterpret_cast<const BYTE*>(pHeader), pHeader->cbHeader) != dwCrc)
+    {
+        return FALSE;
+    }
+
+    // Entries are 128 bytes times a power of two, and have to fit between the header and
+    // the end of the disk without the array getting silly.
+    DWORD cbEntry = pHeader->cbPartitionEntry;
+    return (cbEntry >= sizeof(GPT_ENTRY)) &&
+           (cbEntry <= GPT_MAX_ENTRY_BYTES) &&
+           !(cbEntry & (cbEntry - 1)) &&
+           (pHeader->cPartitionEntries > 0) &&
+           (pHeader->cPartitionEntries <= GPT_MAX_ENTRY_ARRAY_BYTES / cbEntry) &&
+           (pHeader->ullPartitionEntryLba > GPT_HEADER_LBA) &&
+           (pHeader->ullPartitionEntryLba < MAXULONGLONG / cbSector);
+}
+
+// Which of our partition types an entry is. Returns FALSE if it's none of them.
+static BOOL _GptGetTargetKind(__in const GUID& guidType, __out BYTE* pbKind)
+{
+    if (IsEqualGUID(guidType, s_guidApfsPartition))
+    {
+        *pbKind = GTK_APFS;
+    }
+    else if (IsEqualGUID(guidType, s_guidHfsPlusPartition))
+    {
+        *pbKind = GTK_HFSPLUS;
+    }
+    else if (IsEqualGUID(guidType, s_guidAppleBootPartition))
+    {
+        *pbKind = GTK_APPLE_BOOT;
+    }
+    else
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static DWORD _GptGetBigEndian32(__in_bcount(4) const BYTE* pb)
+{
+    return ((DWORD)pb[0] << 24) | ((DWORD)pb[1] << 16) | ((DWORD)pb[2] << 8) | pb[3];
+}
+
+// Whether the HFS+ volume starting at ullStartLba has a blessed system folder. pbSector is
+// a sector-aligned scratch sector. A volume we can't read isn't blessed.
+static BOOL _GptIsBlessedHfsVolume(
+    __in DiskReader* pdr,
+    __in ULONGLONG ullStartLba,
+    __out_bcount(cbSector) BYTE* pbSector,
+    __in DWORD cbSector
+    )
+{
+    if (ullStartLba >= MAXULONGLONG / cbSector - 1)
+    {
+        return FALSE;
+    }
+
+    // Sectors are at least 512 bytes and a power of two, so the header is in a single sector.
+    ULONGLONG ullOffset = ullStartLba * cbSector + (HFS_VOLUME_HEADER_OFFSET / cbSector) * cbSector;
+    const BYTE* pbHeader = pbSector + HFS_VOLUME_HEADER_OFFSET % cbSector;
+    if (FAILED(pdr->Read(ullOffset, pbSector, cbSector)))
+    {
+        return FALSE;
+    }
+
+    WORD wSignature = (WORD)((pbHeader[0] << 8) | pbHeader[1]);
+    return ((wSignature == HFS_PLUS_SIGNATURE) || (wSignature == HFSX_SIGNATURE)) &&
+           (_GptGetBigEndian32(pbHeader + HFS_FINDER_INFO_OFFSET) != 0);
+}
+
+HRESULT GptScanDisk(
+    __in DiskReader* pdr,
+    __in BYTE bDisk,
+    __inout GPT_INDEX* pgi
+    )
+{
+    // Reads must be sector-aligned in memory too, and VirtualAlloc is page-aligned.
+    DWORD cbSector = pdr->GetSectorSize();
+    GPT_HEADER* pHeader = (GPT_HEADER*)VirtualAlloc(NULL, cbSector, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (pHeader == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    HRESULT hr = pdr->Read((ULONGLONG)GPT_HEADER_LBA * cbSector, pHeader, cbSector);
+    if (SUCCEEDED(hr) && !_GptIsHeaderValid(pHeader, cbSector))
+    {
+        // We don't go looking for the backup header; Windows won't use a disk whose primary
+        // GPT is damaged either.
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    BYTE* pbEntries = NULL;
+    DWORD cbEntries = 0;
+    if (SUCCEEDED(hr))
+    {
+        cbEntries = pHeader->cPartitionEntries * pHeader->cbPartitionEntry;
+        DWORD cbRead = (cbEntries + cbSector - 1) & ~(cbSector - 1);
+        pbEntries = (BYTE*)VirtualAlloc(NULL, cbRead, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (pbEntries == NULL)
+        {
+            hr = E_OUTOFMEMORY;
+        }
+        else
+        {
+            hr = pdr->Read(pHeader->ullPartitionEntryLba * cbSector, pbEntries, cbRead);
+        }
+    }
+
+    if (SUCCEEDED(hr) && (_GptCrc32(pbEntries, cbEntries) != pHeader->dwPartitionEntryArrayCrc32))
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // The header's sector is reused for reading volume headers, so keep what we need of it.
+        DWORD cEntries = pHeader->cPartitionEntries;
+        DWORD cbEntry = pHeader->cbPartitionEntry;
+        for (DWORD i = 0; i < cEntries && pgi->cTargets < ARRAYSIZE(pgi->rgTargets); i++)
+        {
+            const GPT_ENTRY* pEntry = reinterpret_cast<const GPT_ENTRY*>(pbEntries + i * cbEntry);
+            BYTE bKind;
+            if (_GptGetTargetKind(pEntry->guidPartitionType, &bKind) &&
+                (pEntry->ullEndingLba >= pEntry->ullStartingLba))
+            {
+                GPT_TARGET& rgt = pgi->rgTargets[pgi->cTargets++];
+                rgt.bKind = bKind;
+                rgt.bDisk = bDisk;
+                rgt.wPartitionNumber = (WORD)(i + 1);
+                rgt.dwSectorSize = cbSector;
+                rgt.ullStartLba = pEntry->ullStartingLba;
+                rgt.ullSizeLba = pEntry->ullEndingLba - pEntry->ullStartingLba + 1;
+                rgt.guidPartition = pEntry->guidPartition;
+                CopyMemory(rgt.wszName, pEntry->wszName, sizeof(pEntry->wszName));
+                rgt.wszName[GPT_NAME_CCH] = L'\0';
+                rgt.bBlessed = (bKind == GTK_HFSPLUS) &&
+                               _GptIsBlessedHfsVolume(pdr, rgt.ullStartLba, reinterpret_cast<BYTE*>(pHeader), cbSector);
+            }
+        }
+    }
+
+    if (pbEntries != NULL)
+    {
+        VirtualFree(pbEntries, 0, MEM_RELEASE);
+    }
+    VirtualFree(pHeader, 0, MEM_RELEASE);
+    return hr;
+}
+
+// One disk being scanned on a thread of its own, into an index of its own.
+struct GPT_DISK_SCAN
+{
+    FileDiskReader  dr;
+    BYTE            bDisk;
+    HRESULT         hr;
+    GPT_INDEX       gi;
+};
+
+static DWORD WINAPI _GptScanDiskThreadProc(__in LPVOID pv)
+{
+    GPT_DISK_SCAN* pds = (GPT_DISK_SCAN*)pv;
+    pds->hr = GptScanDisk(&pds->dr, pds->bDisk, &pds->gi);
+    return 0;
+}
+
+// Builds the path to the .disks folder next to this dll. Returns FALSE if there isn't one.
+static BOOL _GptGetImageFolder(__out_ecount(cch) PWSTR pwszFolder, __in DWORD cch)
+{
+    DWORD cchModule = GetModuleFileName(HINST_THISDLL, pwszFolder, cch);
+    if ((cchModule > 3) && (cchModule < cch) &&
+        SUCCEEDED(StringCchCopyW(pwszFolder + cchModule - 3, cch - (cchModule - 3), L"disks")))
+    {
+        DWORD dwAttributes = GetFileAttributes(pwszFolder);
+        return (dwAttributes != INVALID_FILE_ATTRIBUTES) && (dwAttributes & FILE_ATTRIBUTE_DIRECTORY);
+    }
+    return FALSE;
+}
+
+// Opens every disk we're going to scan. Returns how many were opened.
+static DWORD _GptOpenDisks(__out_ecount(GPT_MAX_DISKS) GPT_DISK_SCAN* rgds)
+{
+    DWORD cDisks = 0;
+
+    WCHAR wszFolder[MAX_PATH];
+    WCHAR wszPath[MAX_PATH];
+    if (_GptGetImageFolder(wszFolder, ARRAYSIZE(wszFolder)))
+    {
+        WIN32_FIND_DATA fd;
+        StringCchPrintfW(wszPath, ARRAYSIZE(wszPath), L"%s\\*.img", wszFolder);
+        HANDLE hFind = FindFirstFile(wszPath, &fd);
+        if (hFind != INVALID_HANDLE_VALUE)
+        {
+            do
+            {
+                if (SUCCEEDED(StringCchPrintfW(wszPath, ARRAYSIZE(wszPath), L"%s\\%s", wszFolder, fd.cFileName)) &&
+                    SUCCEEDED(rgds[cDisks].dr.Initialize(wszPath)))
+                {
+                    rgds[cDisks].bDisk = (BYTE)cDisks;
+                    cDisks++;
+                }
+            } while ((cDisks < GPT_MAX_DISKS) && FindNextFile(hFind, &fd));
+            FindClose(hFind);
+        }
+        LogWrite(L"scanning %lu disk images in %s", cDisks, wszFolder);
+        return cDisks;
+    }
+
+    for (DWORD dwDisk = 0; dwDisk < GPT_MAX_DISKS; dwDisk++)
+    {
+        StringCchPrintfW(wszPath, ARRAYSIZE(wszPath), L"\\\\.\\PhysicalDrive%lu", dwDisk);
+        if (SUCCEEDED(rgds[cDisks].dr.Initialize(wszPath)))
+        {
+            rgds[cDisks].bDisk = (BYTE)dwDisk;
+            cDisks++;
+        }
+    }
+    return cDisks;
+}
+
+// Scans every disk at once and merges what they found, in disk order.
+static HRESULT _GptIndexBuild(__out GPT_INDEX* pgi)
+{
+    HRESULT hr = S_OK;
+    CTraceScope trace(TM_GPTINDEX_BUILD, TRACE_NO_FIELD, &hr);
+
+    pgi->cTargets = 0;
+
+    GPT_DISK_SCAN* rgds = new GPT_DISK_SCAN[GPT_MAX_DISKS];
+    if (rgds == NULL)
+    {
+        hr = E_OUTOFMEMORY;
+        return hr;
+    }
+
+    // Opening a disk is quick; reading it may mean spinning it up, which is what we
+    // don't want to wait on one disk at a time.
+    DWORD cDisks = _GptOpenDisks(rgds);
+    HANDLE rghThreads[GPT_MAX_DISKS];
+    DWORD cThreads = 0;
+    for (DWORD i = 0; i < cDisks; i++)
+    {
+        rgds[i].gi.cTargets = 0;
+        HANDLE hThread = (i + 1 < cDisks) ? CreateThread(NULL, 0, _GptScanDiskThreadProc, &rgds[i], 0, NULL) : NULL;
+        if (hThread != NULL)
+        {
+            rghThreads[cThreads++] = hThread;
+        }
+        else
+        {
+            // The last disk, or one we couldn't get a thread for, is scanned right here.
+            _GptScanDiskThreadProc(&rgds[i]);
+        }
+    }
+
+    if (cThreads > 0)
+    {
+        WaitForMultipleObjects(cThreads, rghThreads, TRUE, INFINITE);
+        for (DWORD i = 0; i < cThreads; i++)
+        {
+            CloseHandle(rghThreads[i]);
+        }
+    }
+
+    for (DWORD i = 0; i < cDisks; i++)
+    {
+        // Disks without a GPT are normal (MBR disks, card readers without a card), so a
+        // failed scan only makes it into the log.
+        if (FAILED(rgds[i].hr))
+        {
+            LogWrite(L"disk %u has no usable GPT: 0x%08x", rgds[i].bDisk, rgds[i].hr);
+        }
+
+        for (DWORD j = 0; j < rgds[i].gi.cTargets && pgi->cTargets < ARRAYSIZE(pgi->rgTargets); j++)
+        {
+            const GPT_TARGET& rgt = rgds[i].gi.rgTargets[j];
+            LogWrite(L"disk %u partition %u: kind %u%s, \"%s\"", rgt.bDisk, rgt.wPartitionNumber, rgt.bKind,
+                     rgt.bBlessed ? L" (blessed)" : L"", rgt.wszName);
+            pgi->rgTargets[pgi->cTargets++] = rgt;
+        }
+    }
+
+    delete[] rgds;
+    return hr;
+}
+
+static GPT_INDEX    g_gi;                   // Everything we found.
+static HRESULT      g_hrIndex = E_FAIL;     // How building g_gi went.
+static INIT_ONCE    g_ioIndex = INIT_ONCE_STATIC_INIT;
+static LONG         g_fPrefetched = FALSE;
+static HANDLE       g_hevIndexReady;        // Set once g_gi is built.
+static INIT_ONCE    g_ioIndexReady = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK _GptIndexReadyInit(__inout PINIT_ONCE, __in PVOID, __out PVOID*)
+{
+    g_hevIndexReady = CreateEvent(NULL, TRUE, FALSE, NULL);
+    return TRUE;
+}
+
+HANDLE GptIndexGetReadyEvent()
+{
+    InitOnceExecuteOnce(&g_ioIndexReady, _GptIndexReadyInit, NULL, NULL);
+    return g_hevIndexReady;
+}
+
+static BOOL CALLBACK _GptIndexInit(__inout PINIT_ONCE, __in PVOID, __out PVOID*)
+{
+    g_hrIndex = _GptIndexBuild(&g_gi);
+    return TRUE;
+}
+
+// Builds the index if no one has yet, or waits for whoever is building it. The ready
+// event is only set once the one-time init has returned, so anyone who sees it set
+// can read the index.
+static void _GptIndexEnsureBuilt()
+{
+    InitOnceExecuteOnce(&g_ioIndex, _GptIndexInit, NULL, NULL);
+
+    HANDLE hev = GptIndexGetReadyEvent();
+    if (hev != NULL)
+    {
+        SetEvent(hev);
+    }
+}
+
+// Whether the index is built, without waiting for it.
+static BOOL _GptIndexIsBuilt()
+{
+    BOOL fPending;
+    return InitOnceBeginInitialize(&g_ioIndex, INIT_ONCE_CHECK_ONLY, &fPending, NULL) && !fPending;
+}
+
+static DWORD WINAPI _GptIndexPrefetchThreadProc(__in LPVOID)
+{
+    _GptIndexEnsureBuilt();
+
+    // Drop the reference GptIndexPrefetch took for us.
+    FreeLibraryAndExitThread(HINST_THISDLL, 0);
+}
+
+void GptIndexPrefetch()
+{
+    if (InterlockedCompareExchange(&g_fPrefetched, TRUE, FALSE) != FALSE)
+    {
+        return;
+    }
+
+    // Keep the dll loaded for as long as the thread runs. If we can't start it, the
+    // first GptIndexGet builds the index instead.
+    HMODULE hmod;
+    if (GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCWSTR)_GptIndexPrefetchThreadProc, &hmod))
+    {
+        HANDLE hThread = CreateThread(NULL, 0, _GptIndexPrefetchThreadProc, NULL, 0, NULL);
+        if (hThread != NULL)
+        {
+            CloseHandle(hThread);
+            return;
+        }
+        FreeLibrary(hmod);
+    }
+}
+
+HRESULT GptIndexGet(
+    __deref_out const GPT_INDEX** ppgi
+    )
+{
+    // Waits for the prefetch if it's still running.
+    _GptIndexEnsureBuilt();
+    *ppgi = &g_gi;
+    return g_hrIndex;
+}
+
+HRESULT GptIndexTryGet(
+    __in DWORD dwMilliseconds,
+    __deref_out_opt const GPT_INDEX** ppgi
+    )
+{
+    *ppgi = NULL;
+    GptIndexPrefetch();
+
+    if (!_GptIndexIsBuilt())
+    {
+        HANDLE hev = GptIndexGetReadyEvent();
+        if ((hev == NULL) || (WaitForSingleObject(hev, dwMilliseconds) != WAIT_OBJECT_0))
+        {
+            return E_PENDING;
+        }
+    }
+
+    *ppgi = &g_gi;
+    return g_hrIndex;
+}
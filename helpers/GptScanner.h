@@ -0,0 +1,85 @@
+// The GPT scanner finds the partitions a Mac can boot from by reading the GUID
+// partition table of every disk itself: macOS volumes (APFS and HFS+) and
+// Apple Boot partitions, by partition type GUID. For an HFS+ volume it also
+// reads the volume header, to tell a blessed system volume from a data or Time
+// Machine volume that has the same partition type. Disks are scanned in
+// parallel, once per process, into a small index that everything else asks.
+//
+// GptIndexPrefetch starts the scan in the background, so that by the time
+// anything needs the index it's usually there already. A disk that is slow to
+// spin up, or hangs, holds the scan up, so code on LogonUI's thread uses
+// GptIndexTryGet and the ready event rather than waiting on GptIndexGet.
+//
+// If a folder with the dll's name and a .disks extension exists next to the
+// dll, the .img files in it are scanned as disks instead of the machine's
+// physical drives.
+
+#pragma once
+#include <windows.h>
+#include "DiskReader.h"
+
+enum GPT_TARGET_KIND
+{
+    GTK_APFS        = 0,
+    GTK_HFSPLUS     = 1,
+    GTK_APPLE_BOOT  = 2,    // Boot Camp's "Recovery HD" and other booter partitions.
+};
+
+// The partition name in a GPT entry is at most this many UTF-16 characters.
+#define GPT_NAME_CCH        36
+
+// We keep at most this many targets, across all disks.
+#define GPT_MAX_TARGETS     32
+
+// One partition a Mac can boot from, or boot through.
+struct GPT_TARGET
+{
+    BYTE        bKind;                      // GTK_*
+    BYTE        bDisk;                      // The n in \\.\PhysicalDriveN, or the image's position in the .disks folder.
+    WORD        wPartitionNumber;           // 1-based index of the entry in the GPT.
+    DWORD       dwSectorSize;
+    ULONGLONG   ullStartLba;
+    ULONGLONG   ullSizeLba;
+    GUID        guidPartition;              // The GPT unique partition GUID.
+    WCHAR       wszName[GPT_NAME_CCH + 1];  // The GPT partition name.
+    BOOL        bBlessed;                   // An HFS+ volume whose header names a blessed system folder.
+};
+
+struct GPT_INDEX
+{
+    DWORD       cTargets;
+    GPT_TARGET  rgTargets[GPT_MAX_TARGETS];
+};
+
+//whether a target holds a macOS volume, rather than something that only helps boot one
+inline BOOL GptIsMacVolume(__in const GPT_TARGET& rgt)
+{
+    return (rgt.bKind == GTK_APFS) || (rgt.bKind == GTK_HFSPLUS);
+}
+
+//reads one disk's GPT and appends the Apple partitions on it to pgi, reading each HFS+ volume's
+//header to see if it's blessed. Fails if the disk doesn't have a valid GPT.
+HRESULT GptScanDisk(
+    __in DiskReader* pdr,
+    __in BYTE bDisk,
+    __inout GPT_INDEX* pgi
+    );
+
+//starts building the index on a background thread, unless it's already built or being built
+void GptIndexPrefetch();
+
+//returns the index, building it first if no one has yet
+HRESULT GptIndexGet(
+    __deref_out const GPT_INDEX** ppgi
+    );
+
+//returns the index if it's built within dwMilliseconds, starting the scan if it hasn't been.
+//Fails with E_PENDING, and sets *ppgi to NULL, if it isn't.
+HRESULT GptIndexTryGet(
+    __in DWORD dwMilliseconds,
+    __deref_out_opt const GPT_INDEX** ppgi
+    );
+
+//returns a manual-reset event that is set once the index is built, or NULL if it couldn't be
+//created. The event lives as long as the dll is loaded; don't close it.
+HANDLE GptIndexGetReadyEvent();
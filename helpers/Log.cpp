@@ -0,0 +1,198 @@
+// Lines are formatted straight into a CRecordRing on the caller's thread, so
+// writers never wait on each other or on the disk; when the ring is full the
+// line is dropped and counted. A flush thread turns them into UTF-8 and
+// appends them to the .log file.
+
+#include "Log.h"
+#include "RecordRing.h"
+#include "FlushThread.h"
+#include "RotatingFile.h"
+#include <strsafe.h>
+
+// How long the flush thread waits for more lines before it exits.
+#define LOG_IDLE_TIMEOUT_MS     5000
+
+// The log file is moved to .log.1 when a write would take it past this size.
+#define LOG_MAX_FILE_BYTES      (1024 * 1024)
+
+// Lines are converted to UTF-8 and written out in chunks of up to this size.
+#define LOG_WRITE_BUFFER_BYTES  (16 * 1024)
+
+// Room for the timestamp and thread id in front of each line.
+#define LOG_PREFIX_CCH          48
+
+struct LOG_LINE
+{
+    DWORD       dwThreadId;
+    FILETIME    ft;
+    WCHAR       wsz[LOG_MAX_LINE_CCH];
+};
+
+static BOOL _LogDrain();
+static void _LogIdle();
+static BOOL _LogPending();
+
+static CRecordRing<LOG_LINE, 128> g_ring;
+static volatile LONG    g_cDropped = 0;             // Lines dropped because the ring was full.
+static FLUSH_THREAD     g_ft = { _LogDrain, _LogIdle, _LogPending, LOG_IDLE_TIMEOUT_MS };
+static INIT_ONCE        g_ioLog = INIT_ONCE_STATIC_INIT;
+
+// The flush thread's view of the log file. Only the flush thread touches these.
+static ROTATING_FILE    g_rf;
+static DWORD            g_cbBuffer = 0;
+static DWORD            g_cRepeat = 0;              // How many times g_wszLast has repeated since it was written.
+static WCHAR            g_wszLast[LOG_MAX_LINE_CCH];
+static CHAR             g_rgchBuffer[LOG_WRITE_BUFFER_BYTES];
+
+static BOOL CALLBACK _InitLog(__inout PINIT_ONCE, __in PVOID, __out PVOID*)
+{
+    g_ring.Initialize();
+    RotatingFileInitialize(&g_rf, L"log", LOG_MAX_FILE_BYTES, NULL, 0);
+    FlushThreadInitialize(&g_ft);
+    return TRUE;
+}
+
+//
+// Flush thread.
+//
+
+// Writes out whatever is in the buffer. If the file can't be written there's nowhere to
+// report it, so the lines are lost.
+static void _LogFlushBuffer()
+{
+    if (g_cbBuffer > 0)
+    {
+        RotatingFileWrite(&g_rf, g_rgchBuffer, g_cbBuffer);
+        g_cbBuffer = 0;
+    }
+}
+
+// Appends one formatted line to the buffer as UTF-8.
+static void _LogAppend(__in const FILETIME& ft, __in DWORD dwThreadId, __in PCWSTR pwsz)
+{
+    WCHAR wszLine[LOG_PREFIX_CCH + LOG_MAX_LINE_CCH + 2];
+
+    FILETIME ftLocal;
+    SYSTEMTIME st;
+    if (!FileTimeToLocalFileTime(&ft, &ftLocal) || !FileTimeToSystemTime(&ftLocal, &st))
+    {
+        ZeroMemory(&st, sizeof(st));
+    }
+
+    StringCchPrintfW(wszLine, ARRAYSIZE(wszLine), L"%04u-%02u-%02u %02u:%02u:%02u.%03u [%lu] %s\r\n",
+                     st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, st.wMilliseconds,
+                     dwThreadId, pwsz);
+
+    // Three bytes per UTF-16 unit is the most UTF-8 can need, so this always fits in an empty buffer.
+    int cchLine = lstrlenW(wszLine);
+    if (g_cbBuffer + cchLine * 3 > sizeof(g_rgchBuffer))
+    {
+        _LogFlushBuffer();
+    }
+
+    g_cbBuffer += WideCharToMultiByte(CP_UTF8, 0, wszLine, cchLine, g_rgchBuffer + g_cbBuffer,
+                                      sizeof(g_rgchBuffer) - g_cbBuffer, NULL, NULL);
+}
+
+// Appends a line of our own, stamped now.
+static void _LogAppendNote(__in PCWSTR pwsz)
+{
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    _LogAppend(ft, GetCurrentThreadId(), pwsz);
+}
+
+// Writes the "repeated" line for the last message, if it's owed one.
+static void _LogAppendRepeat()
+{
+    if (g_cRepeat > 0)
+    {
+        WCHAR wsz[64];
+        StringCchPrintfW(wsz, ARRAYSIZE(wsz), L"last message repeated %lu times", g_cRepeat);
+        _LogAppendNote(wsz);
+        g_cRepeat = 0;
+    }
+}
+
+static BOOL _LogDrain()
+{
+    BOOL bAny = FALSE;
+
+    LONG cDropped = InterlockedExchange(&g_cDropped, 0);
+    if (cDropped > 0)
+    {
+        WCHAR wsz[64];
+        StringCchPrintfW(wsz, ARRAYSIZE(wsz), L"%ld lines dropped, the log buffer was full", cDropped);
+        _LogAppendRepeat();
+        _LogAppendNote(wsz);
+        g_wszLast[0] = L'\0';
+        bAny = TRUE;
+    }
+
+    for (LOG_LINE* pline = g_ring.BeginRead(); pline != NULL; pline = g_ring.BeginRead())
+    {
+        if (wcscmp(pline->wsz, g_wszLast) == 0)
+        {
+            g_cRepeat++;
+        }
+        else
+        {
+            _LogAppendRepeat();
+            _LogAppend(pline->ft, pline->dwThreadId, pline->wsz);
+            StringCchCopyW(g_wszLast, ARRAYSIZE(g_wszLast), pline->wsz);
+        }
+
+        g_ring.EndRead();
+        bAny = TRUE;
+    }
+
+    _LogFlushBuffer();
+    return bAny;
+}
+
+static void _LogIdle()
+{
+    _LogAppendRepeat();
+    _LogFlushBuffer();
+    RotatingFileClose(&g_rf);
+}
+
+static BOOL _LogPending()
+{
+    return g_ring.IsReadReady();
+}
+
+void LogWrite(
+    __in __format_string PCWSTR pwszFormat,
+    ...
+    )
+{
+    InitOnceExecuteOnce(&g_ioLog, _InitLog, NULL, NULL);
+
+    LONG lPos;
+    LOG_LINE* pline = g_ring.BeginWrite(&lPos);
+    if (pline != NULL)
+    {
+        GetSystemTimeAsFileTime(&pline->ft);
+        pline->dwThreadId = GetCurrentThreadId();
+
+        // A line that doesn't fit is truncated, which is what we want.
+        va_list args;
+        va_start(args, pwszFormat);
+        StringCchVPrintfW(pline->wsz, ARRAYSIZE(pline->wsz), pwszFormat, args);
+        va_end(args);
+
+        g_ring.EndWrite(lPos);
+    }
+    else
+    {
+        InterlockedIncrement(&g_cDropped);
+    }
+
+    FlushThreadWake(&g_ft);
+}
+
+void LogFree()
+{
+    FlushThreadFree(&g_ft);
+}
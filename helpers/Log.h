@@ -0,0 +1,21 @@
+// The log is shared by everything in the dll. Callers format a line into a
+// fixed-size ring buffer without taking a lock or touching the disk; a
+// background thread writes the lines out to the .log file next to the dll.
+//
+// The log file is appended to and rotated to .log.1 once it gets too big.
+// A line that repeats the one before it is counted instead of written.
+
+#pragma once
+#include <windows.h>
+
+// Lines longer than this are truncated.
+#define LOG_MAX_LINE_CCH    256
+
+//formats a line and queues it for the log file. Drops the line if the ring is full.
+void LogWrite(
+    __in __format_string PCWSTR pwszFormat,
+    ...
+    );
+
+//closes the handles the log keeps for the life of the dll
+void LogFree();
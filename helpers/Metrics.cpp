@@ -0,0 +1,203 @@
+// The counters are one METRICS_SNAPSHOT that every thread adds to with
+// interlocked operations, indexed by the same method ids as the trace.
+
+#include "Metrics.h"
+
+#ifdef BOOTPICKER_METRICS
+
+#include "Log.h"
+
+#define METRICS_METHOD_NAME(id, name)   L##name,
+
+static const PCWSTR s_rgpwszMethodNames[] =
+{
+    L"(none)",
+    TRACE_METHOD_LIST(METRICS_METHOD_NAME)
+};
+
+C_ASSERT(ARRAYSIZE(s_rgpwszMethodNames) == TM_COUNT);
+
+static METRICS_SNAPSHOT g_ms = { 0 };
+static LONGLONG         g_llFrequency = 0;
+static volatile LONG    g_cCallsDumped = 0;         // How many calls had been made the last time we dumped.
+
+// The innermost CTraceScope on this thread. Credential providers need Vista or later,
+// where __declspec(thread) works in a dll that was loaded with LoadLibrary.
+static __declspec(thread) METRICS_FRAME* g_pmfCurrent = NULL;
+
+static LONGLONG _MetricsTicksToUs(__in LONGLONG llTicks)
+{
+    // The frequency is fixed at boot, so it doesn't matter if two threads both look it up.
+    if (g_llFrequency == 0)
+    {
+        LARGE_INTEGER liFrequency;
+        QueryPerformanceFrequency(&liFrequency);
+        g_llFrequency = liFrequency.QuadPart;
+    }
+    return (llTicks > 0) ? (llTicks * 1000000) / g_llFrequency : 0;
+}
+
+static DWORD _MetricsBucket(__in LONGLONG llUs)
+{
+    DWORD iBucket = 0;
+    if (llUs > 0)
+    {
+        DWORD iBit;
+        BitScanReverse(&iBit, (llUs < MAXLONG) ? (DWORD)llUs : MAXLONG);
+        iBucket = min(iBit + 1, METRICS_BUCKET_COUNT - 1);
+    }
+    return iBucket;
+}
+
+static void _MetricsRecord(__inout METRICS_HISTOGRAM* pmh, __in HRESULT hr, __in LONGLONG llUs)
+{
+    InterlockedIncrement(&pmh->cCalls);
+    if (FAILED(hr))
+    {
+        InterlockedIncrement(&pmh->cFailed);
+    }
+    InterlockedExchangeAdd64(&pmh->llTotalUs, llUs);
+    InterlockedIncrement(&pmh->rgcBuckets[_MetricsBucket(llUs)]);
+
+    LONGLONG llMaxUs = pmh->llMaxUs;
+    while (llUs > llMaxUs)
+    {
+        LONGLONG llPrevUs = InterlockedCompareExchange64(&pmh->llMaxUs, llUs, llMaxUs);
+        if (llPrevUs == llMaxUs)
+        {
+            break;
+        }
+        llMaxUs = llPrevUs;
+    }
+}
+
+void MetricsEnter(
+    __out METRICS_FRAME* pmf
+    )
+{
+    pmf->pmfOuter = g_pmfCurrent;
+    pmf->llWrappedTicks = 0;
+    g_pmfCurrent = pmf;
+}
+
+void MetricsLeave(
+    __in METRICS_FRAME* pmf,
+    __in TRACE_METHOD tm,
+    __in BYTE bFlags,
+    __in HRESULT hr,
+    __in LONGLONG llTicks
+    )
+{
+    g_pmfCurrent = pmf->pmfOuter;
+
+    // All of a wrapped call's time belongs to the wrapped provider; any other call passes
+    // on the wrapped time that was nested in it.
+    if (pmf->pmfOuter != NULL)
+    {
+        pmf->pmfOuter->llWrappedTicks += (bFlags & TRF_WRAPPED) ? llTicks : pmf->llWrappedTicks;
+    }
+
+    if ((tm > TM_NONE) && (tm < TM_COUNT))
+    {
+        METRICS_METHOD* pmm = &g_ms.rgMethods[tm];
+        if (bFlags & TRF_WRAPPED)
+        {
+            _MetricsRecord(&pmm->mhWrapped, hr, _MetricsTicksToUs(llTicks));
+        }
+        else
+        {
+            _MetricsRecord(&pmm->mhTotal, hr, _MetricsTicksToUs(llTicks));
+            _MetricsRecord(&pmm->mhOwn, hr, _MetricsTicksToUs(llTicks - pmf->llWrappedTicks));
+        }
+    }
+}
+
+static void _MetricsCopyHistogram(__out METRICS_HISTOGRAM* pmhDest, __in METRICS_HISTOGRAM* pmhSrc)
+{
+    pmhDest->cCalls = InterlockedCompareExchange(&pmhSrc->cCalls, 0, 0);
+    pmhDest->cFailed = InterlockedCompareExchange(&pmhSrc->cFailed, 0, 0);
+    pmhDest->llTotalUs = InterlockedCompareExchange64(&pmhSrc->llTotalUs, 0, 0);
+    pmhDest->llMaxUs = InterlockedCompareExchange64(&pmhSrc->llMaxUs, 0, 0);
+    for (DWORD i = 0; i < ARRAYSIZE(pmhSrc->rgcBuckets); i++)
+    {
+        pmhDest->rgcBuckets[i] = InterlockedCompareExchange(&pmhSrc->rgcBuckets[i], 0, 0);
+    }
+}
+
+void MetricsSnapshot(
+    __out METRICS_SNAPSHOT* pms
+    )
+{
+    for (DWORD i = 0; i < ARRAYSIZE(g_ms.rgMethods); i++)
+    {
+        _MetricsCopyHistogram(&pms->rgMethods[i].mhTotal, &g_ms.rgMethods[i].mhTotal);
+        _MetricsCopyHistogram(&pms->rgMethods[i].mhOwn, &g_ms.rgMethods[i].mhOwn);
+        _MetricsCopyHistogram(&pms->rgMethods[i].mhWrapped, &g_ms.rgMethods[i].mhWrapped);
+    }
+}
+
+// Returns the upper edge of the bucket that the given percentile of calls fell in.
+// Past the last bucket there is no edge, so the longest call is used.
+static LONGLONG _MetricsPercentileUs(__in const METRICS_HISTOGRAM& mh, __in LONG nPercent)
+{
+    LONG cNeeded = (mh.cCalls * nPercent + 99) / 100;
+    LONG cSeen = 0;
+    for (DWORD i = 0; i < ARRAYSIZE(mh.rgcBuckets) - 1; i++)
+    {
+        cSeen += mh.rgcBuckets[i];
+        if (cSeen >= cNeeded)
+        {
+            return 1LL << i;
+        }
+    }
+    return mh.llMaxUs;
+}
+
+static LONGLONG _MetricsMeanUs(__in const METRICS_HISTOGRAM& mh)
+{
+    return (mh.cCalls > 0) ? mh.llTotalUs / mh.cCalls : 0;
+}
+
+void MetricsDump()
+{
+    METRICS_SNAPSHOT* pms = new METRICS_SNAPSHOT;
+    if (pms == NULL)
+    {
+        return;
+    }
+
+    MetricsSnapshot(pms);
+
+    LONG cCalls = 0;
+    for (DWORD i = 0; i < ARRAYSIZE(pms->rgMethods); i++)
+    {
+        cCalls += pms->rgMethods[i].mhTotal.cCalls + pms->rgMethods[i].mhWrapped.cCalls;
+    }
+
+    // LogonUI can ask whether we can unload many times without calling us in between,
+    // and there's no point writing the same numbers again.
+    if (InterlockedExchange(&g_cCallsDumped, cCalls) != cCalls)
+    {
+        for (DWORD i = 0; i < ARRAYSIZE(pms->rgMethods); i++)
+        {
+            const METRICS_METHOD& mm = pms->rgMethods[i];
+            if (mm.mhTotal.cCalls > 0)
+            {
+                LogWrite(L"metrics %s: %ld calls, %ld failed, mean %I64dus, p50 <%I64dus, p95 <%I64dus, max %I64dus",
+                         s_rgpwszMethodNames[i], mm.mhTotal.cCalls, mm.mhTotal.cFailed, _MetricsMeanUs(mm.mhTotal),
+                         _MetricsPercentileUs(mm.mhTotal, 50), _MetricsPercentileUs(mm.mhTotal, 95), mm.mhTotal.llMaxUs);
+            }
+            if (mm.mhWrapped.cCalls > 0)
+            {
+                LogWrite(L"metrics %s: own mean %I64dus, p95 <%I64dus; wrapped %ld calls, mean %I64dus, p95 <%I64dus, max %I64dus",
+                         s_rgpwszMethodNames[i], _MetricsMeanUs(mm.mhOwn), _MetricsPercentileUs(mm.mhOwn, 95),
+                         mm.mhWrapped.cCalls, _MetricsMeanUs(mm.mhWrapped), _MetricsPercentileUs(mm.mhWrapped, 95),
+                         mm.mhWrapped.llMaxUs);
+            }
+        }
+    }
+
+    delete pms;
+}
+
+#endif
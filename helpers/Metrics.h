@@ -0,0 +1,87 @@
+// Metrics count the calls LogonUI makes into the provider and keep a latency
+// histogram for each method, so a build can be checked against a logon screen
+// latency budget. Each method gets three histograms: the whole call, the part
+// of it spent in our own code, and the calls we made into the wrapped provider
+// or credential. The counters are updated with interlocked operations only.
+//
+// Metrics are only compiled in when BOOTPICKER_METRICS is defined. Otherwise
+// everything here is an empty inline and CTraceScope doesn't time calls unless
+// the trace is on.
+//
+// Calls are recorded by the CTraceScope in each method (see Trace.h), and the
+// numbers are written to the log when the dll is about to be unloaded or when
+// MetricsDump is called.
+
+#pragma once
+#include <windows.h>
+#include "TraceFormat.h"
+
+// Bucket 0 counts calls under 1us, bucket i calls from 2^(i-1) up to 2^i us, and the
+// last bucket everything longer.
+#define METRICS_BUCKET_COUNT    24
+
+struct METRICS_HISTOGRAM
+{
+    LONG        cCalls;
+    LONG        cFailed;
+    LONGLONG    llTotalUs;
+    LONGLONG    llMaxUs;
+    LONG        rgcBuckets[METRICS_BUCKET_COUNT];
+};
+
+struct METRICS_METHOD
+{
+    METRICS_HISTOGRAM   mhTotal;    // The whole call, as the caller sees it.
+    METRICS_HISTOGRAM   mhOwn;      // The call less the time spent in calls into the wrapped provider.
+    METRICS_HISTOGRAM   mhWrapped;  // The calls this method made into the wrapped provider.
+};
+
+struct METRICS_SNAPSHOT
+{
+    METRICS_METHOD      rgMethods[TM_COUNT];
+};
+
+// A CTraceScope's place in the stack of scopes on its thread, which is how the time
+// spent in wrapped calls is taken off the calls around them.
+struct METRICS_FRAME
+{
+    METRICS_FRAME*      pmfOuter;
+    LONGLONG            llWrappedTicks;
+};
+
+#ifdef BOOTPICKER_METRICS
+
+#define METRICS_ENABLED     TRUE
+
+//pushes a frame for a call that is starting on this thread
+void MetricsEnter(
+    __out METRICS_FRAME* pmf
+    );
+
+//pops the frame and records the call
+void MetricsLeave(
+    __in METRICS_FRAME* pmf,
+    __in TRACE_METHOD tm,
+    __in BYTE bFlags,
+    __in HRESULT hr,
+    __in LONGLONG llTicks
+    );
+
+//copies the counters. Each counter is read atomically, but not all of them at once.
+void MetricsSnapshot(
+    __out METRICS_SNAPSHOT* pms
+    );
+
+//writes a line for each method that has been called to the log
+void MetricsDump();
+
+#else
+
+#define METRICS_ENABLED     FALSE
+
+inline void MetricsEnter(__out METRICS_FRAME*) {}
+inline void MetricsLeave(__in METRICS_FRAME*, __in TRACE_METHOD, __in BYTE, __in HRESULT, __in LONGLONG) {}
+inline void MetricsSnapshot(__out METRICS_SNAPSHOT* pms) { ZeroMemory(pms, sizeof(*pms)); }
+inline void MetricsDump() {}
+
+#endif
@@ -0,0 +1,142 @@
+#include "PackedLogon.h"
+
+// What a 32 bit process packs: UNICODE_STRINGs with 32 bit Buffers, and
+// everything on 4 byte boundaries.
+#include <pshpack4.h>
+struct UNICODE_STRING_WOW
+{
+    USHORT  Length;
+    USHORT  MaximumLength;
+    ULONG   Buffer;
+};
+
+struct KERB_INTERACTIVE_UNLOCK_LOGON_WOW
+{
+    KERB_LOGON_SUBMIT_TYPE  MessageType;
+    UNICODE_STRING_WOW      LogonDomainName;
+    UNICODE_STRING_WOW      UserName;
+    UNICODE_STRING_WOW      Password;
+    LUID                    LogonId;
+};
+#include <poppack.h>
+
+// Points pps at the string at ullOffset, if it lies wholly within the cb bytes
+// of rgb past the header and starts on a character boundary.
+static HRESULT _PackedStringInit(
+    __in_bcount(cb) const BYTE* rgb,
+    __in DWORD cb,
+    __in DWORD cbHeader,
+    __in USHORT cbLength,
+    __in USHORT cbMaximumLength,
+    __in ULONGLONG ullOffset,
+    __out PACKED_STRING* pps
+    )
+{
+    pps->pwch = NULL;
+    pps->cch = 0;
+
+    if (cbLength > cbMaximumLength || (cbLength % sizeof(WCHAR)) != 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+    if (cbLength == 0)
+    {
+        return S_OK;
+    }
+
+    // The offset is at most 64 bits and the length 16, so checking against what's
+    // left after the offset can't overflow.
+    if (ullOffset < cbHeader || ullOffset > cb || cbMaximumLength > cb - ullOffset ||
+        (ullOffset % sizeof(WCHAR)) != 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    pps->pwch = reinterpret_cast<PCWSTR>(rgb + ullOffset);
+    pps->cch = cbLength / sizeof(WCHAR);
+    return S_OK;
+}
+
+HRESULT PackedLogonView(
+    __in_bcount(cb) const BYTE* rgb,
+    __in DWORD cb,
+    __in BOOL bWow,
+    __out PACKED_LOGON_VIEW* pplv
+    )
+{
+    ZeroMemory(pplv, sizeof(*pplv));
+
+    // The strings are read through WCHAR pointers, so the blob has to be aligned for them.
+    if (rgb == NULL || ((ULONG_PTR)rgb % sizeof(WCHAR)) != 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    HRESULT hr;
+    if (bWow)
+    {
+        const DWORD cbHeader = sizeof(KERB_INTERACTIVE_UNLOCK_LOGON_WOW);
+        if (cb < cbHeader)
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        // The header may not be aligned for its own fields, so it's read from a copy.
+        KERB_INTERACTIVE_UNLOCK_LOGON_WOW kiul;
+        CopyMemory(&kiul, rgb, cbHeader);
+        pplv->MessageType = kiul.MessageType;
+        pplv->LogonId = kiul.LogonId;
+        hr = _PackedStringInit(rgb, cb, cbHeader, kiul.LogonDomainName.Length, kiul.LogonDomainName.MaximumLength,
+                               kiul.LogonDomainName.Buffer, &pplv->psDomain);
+        if (SUCCEEDED(hr))
+        {
+            hr = _PackedStringInit(rgb, cb, cbHeader, kiul.UserName.Length, kiul.UserName.MaximumLength,
+                                   kiul.UserName.Buffer, &pplv->psUserName);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = _PackedStringInit(rgb, cb, cbHeader, kiul.Password.Length, kiul.Password.MaximumLength,
+                                   kiul.Password.Buffer, &pplv->psPassword);
+        }
+    }
+    else
+    {
+        const DWORD cbHeader = sizeof(KERB_INTERACTIVE_UNLOCK_LOGON);
+        if (cb < cbHeader)
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        KERB_INTERACTIVE_UNLOCK_LOGON kiul;
+        CopyMemory(&kiul, rgb, cbHeader);
+        const KERB_INTERACTIVE_LOGON& kil = kiul.Logon;
+        pplv->MessageType = kil.MessageType;
+        pplv->LogonId = kiul.LogonId;
+        hr = _PackedStringInit(rgb, cb, cbHeader, kil.LogonDomainName.Length, kil.LogonDomainName.MaximumLength,
+                               (ULONG_PTR)kil.LogonDomainName.Buffer, &pplv->psDomain);
+        if (SUCCEEDED(hr))
+        {
+            hr = _PackedStringInit(rgb, cb, cbHeader, kil.UserName.Length, kil.UserName.MaximumLength,
+                                   (ULONG_PTR)kil.UserName.Buffer, &pplv->psUserName);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = _PackedStringInit(rgb, cb, cbHeader, kil.Password.Length, kil.Password.MaximumLength,
+                                   (ULONG_PTR)kil.Password.Buffer, &pplv->psPassword);
+        }
+    }
+
+    if (SUCCEEDED(hr) &&
+        pplv->MessageType != KerbInteractiveLogon &&
+        pplv->MessageType != KerbWorkstationUnlockLogon &&
+        pplv->MessageType != (KERB_LOGON_SUBMIT_TYPE)0)   // What KerbInteractiveUnlockLogonInit uses for CredUI.
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    if (FAILED(hr))
+    {
+        ZeroMemory(pplv, sizeof(*pplv));
+    }
+    return hr;
+}
@@ -0,0 +1,37 @@
+// A packed KERB_INTERACTIVE_UNLOCK_LOGON is the structure followed by its
+// strings, with each string's Buffer holding an offset from the start of the
+// blob instead of a pointer. Blobs handed to SetSerialization come from
+// outside the process (an RDP client, say), so PackedLogonView checks one
+// once, that every offset and length is in range and aligned, and then points
+// into it without writing to it or copying anything.
+//
+// A 32 bit process packs its blob with 32 bit UNICODE_STRINGs, which a 64 bit
+// LogonUI sees as a WOW blob. Both layouts give the same view.
+
+#pragma once
+#include <windows.h>
+#include <ntsecapi.h>
+
+// A counted string in a packed blob. It isn't terminated.
+struct PACKED_STRING
+{
+    PCWSTR  pwch;               // NULL when the string is empty.
+    USHORT  cch;
+};
+
+struct PACKED_LOGON_VIEW
+{
+    KERB_LOGON_SUBMIT_TYPE  MessageType;
+    PACKED_STRING           psDomain;
+    PACKED_STRING           psUserName;
+    PACKED_STRING           psPassword;
+    LUID                    LogonId;
+};
+
+//checks the packed blob rgb, in the native or 32 bit WOW layout, and fills pplv with pointers into it
+HRESULT PackedLogonView(
+    __in_bcount(cb) const BYTE* rgb,
+    __in DWORD cb,
+    __in BOOL bWow,
+    __out PACKED_LOGON_VIEW* pplv
+    );
@@ -0,0 +1,68 @@
+#include "PasswordProtector.h"
+#include <intsafe.h>
+
+//
+// CredProtectW doesn't document how long its output is, only that it asks for more room when it
+// needs it. Its output is a short marker followed, as text, by the DPAPI blob that encrypts the
+// credentials: their bytes padded out to a cipher block, inside a header and trailer (provider,
+// description, algorithm ids, salt, HMAC and signature) that come to a few hundred bytes.  The
+// bound allows PROTECT_CB_BLOB_OVERHEAD bytes for those and PROTECT_CCH_PER_BYTE characters for
+// each byte of the blob, which is more than a six or even a four bit encoding of it takes.
+//
+#define PROTECT_CCH_MARKER          3
+#define PROTECT_CB_CIPHER_BLOCK     16
+#define PROTECT_CB_BLOB_OVERHEAD    512
+#define PROTECT_CCH_PER_BYTE        2
+
+HRESULT CredPasswordProtector::IsProtected(
+    __in PWSTR pwzCredentials,
+    __out CRED_PROTECTION_TYPE* pcpt
+    )
+{
+    *pcpt = CredUnprotected;
+    return CredIsProtectedW(pwzCredentials, pcpt) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+}
+
+HRESULT CredPasswordProtector::GetProtectedCchMax(
+    __in DWORD cchCredentials,
+    __out DWORD* pcchMax
+    )
+{
+    *pcchMax = 0;
+
+    DWORD cbBlob;
+    HRESULT hr = DWordMult(cchCredentials, sizeof(WCHAR), &cbBlob);
+    if (SUCCEEDED(hr))
+    {
+        hr = DWordAdd(cbBlob, PROTECT_CB_CIPHER_BLOCK + PROTECT_CB_BLOB_OVERHEAD, &cbBlob);
+    }
+
+    DWORD cchMax;
+    if (SUCCEEDED(hr))
+    {
+        hr = DWordMult(cbBlob, PROTECT_CCH_PER_BYTE, &cchMax);
+    }
+    if (SUCCEEDED(hr))
+    {
+        // And the output's terminator.
+        hr = DWordAdd(cchMax, PROTECT_CCH_MARKER + 1, &cchMax);
+    }
+    if (SUCCEEDED(hr))
+    {
+        *pcchMax = cchMax;
+    }
+    return hr;
+}
+
+HRESULT CredPasswordProtector::Protect(
+    __in_ecount(cchCredentials) PWSTR pwzCredentials,
+    __in DWORD cchCredentials,
+    __out_ecount(*pcchProtected) PWSTR pwzProtected,
+    __inout DWORD* pcchProtected
+    )
+{
+    // FALSE: protected for the user that's logging on, not for this process's account.
+    return CredProtectW(FALSE, pwzCredentials, cchCredentials, pwzProtected, pcchProtected, NULL)
+        ? S_OK
+        : HRESULT_FROM_WIN32(GetLastError());
+}
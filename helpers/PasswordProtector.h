@@ -0,0 +1,60 @@
+// A password protector encrypts passwords for ProtectIfNecessaryAndCopyPassword.
+// It says whether a password is already protected, how long a protected copy
+// of one can be, and makes the copy. ProtectIfNecessaryAndCopyPassword sizes
+// its output from that bound, so the password is encrypted in a single call.
+//
+// The providers use CredPasswordProtector, which is CredIsProtectedW and
+// CredProtectW; a test can hand ProtectIfNecessaryAndCopyPassword a protector
+// of its own and check what it's asked to do.
+
+#pragma once
+#include <windows.h>
+#include <wincred.h>
+
+class PasswordProtector
+{
+  public:
+    virtual ~PasswordProtector() {}
+
+    //how pwzCredentials is protected, CredUnprotected if it isn't
+    virtual HRESULT IsProtected(
+        __in PWSTR pwzCredentials,
+        __out CRED_PROTECTION_TYPE* pcpt
+        ) = 0;
+
+    //the most characters Protect can need for cchCredentials characters, the terminator included
+    virtual HRESULT GetProtectedCchMax(
+        __in DWORD cchCredentials,
+        __out DWORD* pcchMax
+        ) = 0;
+
+    //encrypts the cchCredentials characters of pwzCredentials, the terminator included, into
+    //pwzProtected. If *pcchProtected is too few it fails with ERROR_INSUFFICIENT_BUFFER and says
+    //how many it needs
+    virtual HRESULT Protect(
+        __in_ecount(cchCredentials) PWSTR pwzCredentials,
+        __in DWORD cchCredentials,
+        __out_ecount(*pcchProtected) PWSTR pwzProtected,
+        __inout DWORD* pcchProtected
+        ) = 0;
+};
+
+// Protects passwords with CredProtectW, for the user that's logging on.
+class CredPasswordProtector : public PasswordProtector
+{
+  public:
+    HRESULT IsProtected(
+        __in PWSTR pwzCredentials,
+        __out CRED_PROTECTION_TYPE* pcpt
+        );
+    HRESULT GetProtectedCchMax(
+        __in DWORD cchCredentials,
+        __out DWORD* pcchMax
+        );
+    HRESULT Protect(
+        __in_ecount(cchCredentials) PWSTR pwzCredentials,
+        __in DWORD cchCredentials,
+        __out_ecount(*pcchProtected) PWSTR pwzProtected,
+        __inout DWORD* pcchProtected
+        );
+};
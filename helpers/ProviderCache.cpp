@@ -0,0 +1,206 @@
+#include "ProviderCache.h"
+#include "Log.h"
+#include "Trace.h"
+
+static ComProviderFactory g_pfCom;
+static ProviderCache g_pc(&g_pfCom);
+
+HRESULT ComProviderFactory::Create(
+    __in REFCLSID clsid,
+    __deref_out ICredentialProvider** ppcp
+    )
+{
+    *ppcp = NULL;
+    IUnknown *pUnknown = NULL;
+    HRESULT hr = CoCreateInstance(clsid, NULL, CLSCTX_ALL, IID_PPV_ARGS(&pUnknown));
+    if (SUCCEEDED(hr))
+    {
+        hr = pUnknown->QueryInterface(IID_PPV_ARGS(ppcp));
+        pUnknown->Release();
+    }
+    return hr;
+}
+
+ProviderCache::ProviderCache(__in ProviderFactory* ppf) :
+    _ppf(ppf),
+    _cCreated(0),
+    _cReused(0)
+{
+    InitializeSRWLock(&_srw);
+    ZeroMemory(&_ipLogon, sizeof(_ipLogon));
+    ZeroMemory(&_ipUnlock, sizeof(_ipUnlock));
+}
+
+// The slot for providers set up for cpus and dwFlags, or NULL if they aren't kept.
+ProviderCache::IDLE_PROVIDER* ProviderCache::_Slot(
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __in DWORD dwFlags
+    )
+{
+    if (dwFlags != 0)
+    {
+        return NULL;
+    }
+
+    switch (cpus)
+    {
+    case CPUS_LOGON:
+        return &_ipLogon;
+    case CPUS_UNLOCK_WORKSTATION:
+        return &_ipUnlock;
+    default:
+        return NULL;
+    }
+}
+
+// Creates a provider and sets it up. This is the only place a provider is told its scenario.
+HRESULT ProviderCache::_Create(
+    __in REFCLSID clsid,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __in DWORD dwFlags,
+    __deref_out ICredentialProvider** ppcp
+    )
+{
+    HRESULT hr;
+    CTraceScope trace(TM_PROVIDERCACHE_CREATE, TRACE_NO_FIELD, &hr);
+
+    ICredentialProvider* pcp;
+    TRACE_WRAPPED_CALL(TM_PROVIDERCACHE_CREATE, TRACE_NO_FIELD, hr, _ppf->Create(clsid, &pcp));
+    if (SUCCEEDED(hr))
+    {
+        InterlockedIncrement(&_cCreated);
+
+        TRACE_WRAPPED_CALL(TM_PROVIDER_SETUSAGESCENARIO, TRACE_NO_FIELD, hr, pcp->SetUsageScenario(cpus, dwFlags));
+        if (SUCCEEDED(hr))
+        {
+            *ppcp = pcp;
+        }
+        else
+        {
+            pcp->Release();
+        }
+    }
+    return hr;
+}
+
+HRESULT ProviderCache::Acquire(
+    __in REFCLSID clsid,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __in DWORD dwFlags,
+    __deref_out ICredentialProvider** ppcp,
+    __out BOOL* pbWarm
+    )
+{
+    *ppcp = NULL;
+    *pbWarm = FALSE;
+
+    IDLE_PROVIDER* pip = _Slot(cpus, dwFlags);
+    if (pip != NULL)
+    {
+        AcquireSRWLockExclusive(&_srw);
+        if (pip->pcp != NULL && pip->clsid == clsid)
+        {
+            *ppcp = pip->pcp;
+            pip->pcp = NULL;
+        }
+        ReleaseSRWLockExclusive(&_srw);
+    }
+
+    if (*ppcp != NULL)
+    {
+        InterlockedIncrement(&_cReused);
+        *pbWarm = TRUE;
+        return S_OK;
+    }
+    return _Create(clsid, cpus, dwFlags, ppcp);
+}
+
+void ProviderCache::GiveBack(
+    __in REFCLSID clsid,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __in DWORD dwFlags,
+    __in BOOL bReusable,
+    __in ICredentialProvider* pcp
+    )
+{
+    IDLE_PROVIDER* pip = bReusable ? _Slot(cpus, dwFlags) : NULL;
+    if (pip != NULL)
+    {
+        // If there's already one idle, the one that's been idle longest goes.
+        AcquireSRWLockExclusive(&_srw);
+        ICredentialProvider* pcpOld = pip->pcp;
+        pip->clsid = clsid;
+        pip->pcp = pcp;
+        ReleaseSRWLockExclusive(&_srw);
+        pcp = pcpOld;
+    }
+
+    if (pcp != NULL)
+    {
+        pcp->Release();
+    }
+}
+
+void ProviderCache::Flush()
+{
+    AcquireSRWLockExclusive(&_srw);
+    ICredentialProvider* pcpLogon = _ipLogon.pcp;
+    ICredentialProvider* pcpUnlock = _ipUnlock.pcp;
+    _ipLogon.pcp = NULL;
+    _ipUnlock.pcp = NULL;
+    ReleaseSRWLockExclusive(&_srw);
+
+    // Release outside the lock, since we can't know what the providers do when they go.
+    if (pcpLogon != NULL)
+    {
+        pcpLogon->Release();
+    }
+    if (pcpUnlock != NULL)
+    {
+        pcpUnlock->Release();
+    }
+}
+
+void ProviderCache::SetFactory(__in ProviderFactory* ppf)
+{
+    // The idle providers came from the old factory, and may not be what the new one makes.
+    Flush();
+    _ppf = ppf;
+}
+
+HRESULT ProviderCacheAcquire(
+    __in REFCLSID clsid,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __in DWORD dwFlags,
+    __deref_out ICredentialProvider** ppcp,
+    __out BOOL* pbWarm
+    )
+{
+    return g_pc.Acquire(clsid, cpus, dwFlags, ppcp, pbWarm);
+}
+
+void ProviderCacheGiveBack(
+    __in REFCLSID clsid,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __in DWORD dwFlags,
+    __in BOOL bReusable,
+    __in ICredentialProvider* pcp
+    )
+{
+    g_pc.GiveBack(clsid, cpus, dwFlags, bReusable, pcp);
+}
+
+void ProviderCacheFlush()
+{
+    g_pc.Flush();
+
+    if (g_pc.GetCreatedCount() > 0)
+    {
+        LogWrite(L"provider cache: %ld created, %ld reused", g_pc.GetCreatedCount(), g_pc.GetReusedCount());
+    }
+}
+
+void ProviderCacheSetFactory(__in_opt ProviderFactory* ppf)
+{
+    g_pc.SetFactory((ppf != NULL) ? ppf : &g_pfCom);
+}
@@ -0,0 +1,129 @@
+// The provider cache keeps wrapped credential providers warm between uses.
+// Creating the password provider is one of the slower things a wrapper does,
+// and LogonUI makes a new wrapper for every lock and unlock. When a wrapper is
+// done with its wrapped provider it gives it back here, and the next wrapper
+// for the same class and scenario gets it instead of creating a new one.
+//
+// ICredentialProvider doesn't say what a provider does if SetUsageScenario is
+// called on it a second time, so the cache never does that. A provider is set
+// up once, when it's created, and is only handed out again for the scenario it
+// was set up for. Only logon and unlock providers set up without flags are
+// kept. A provider that was given a serialization, or is still advised, is
+// released instead. There is at most one idle provider for each scenario, and
+// the cache holds no reference on the dll, so DllCanUnloadNow releases them
+// when the dll is about to go.
+//
+// The cache creates providers through a ProviderFactory. The dll's cache uses
+// CoCreateInstance; a test can hand a cache, or the dll's cache, a factory of
+// its own and count what it creates. Creating a provider is recorded as TM_PROVIDERCACHE_CREATE,
+// so the metrics show what it costs, and the log says how many were created
+// and how many reused when the dll's cache is flushed.
+
+#pragma once
+#include <windows.h>
+#include <credentialprovider.h>
+
+class ProviderFactory
+{
+  public:
+    virtual ~ProviderFactory() {}
+
+    //creates a provider of class clsid
+    virtual HRESULT Create(__in REFCLSID clsid, __deref_out ICredentialProvider** ppcp) = 0;
+};
+
+// Creates providers with CoCreateInstance.
+class ComProviderFactory : public ProviderFactory
+{
+  public:
+    HRESULT Create(__in REFCLSID clsid, __deref_out ICredentialProvider** ppcp);
+};
+
+class ProviderCache
+{
+  public:
+    // There's no destructor: the idle providers may belong to dlls that are already gone by the
+    // time a static cache is destroyed, so whoever owns the cache calls Flush while they're not.
+    ProviderCache(__in ProviderFactory* ppf);
+
+    //gets the idle provider of class clsid that was set up for cpus, or creates one and calls its
+    //SetUsageScenario(cpus, dwFlags). Either way it's ready for cpus. *pbWarm says which
+    HRESULT Acquire(
+        __in REFCLSID clsid,
+        __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+        __in DWORD dwFlags,
+        __deref_out ICredentialProvider** ppcp,
+        __out BOOL* pbWarm
+        );
+
+    //takes the caller's reference on pcp, which Acquire set up for cpus and dwFlags, and keeps it
+    //for the next Acquire if bReusable and cpus and dwFlags allow it. Otherwise it's released
+    void GiveBack(
+        __in REFCLSID clsid,
+        __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+        __in DWORD dwFlags,
+        __in BOOL bReusable,
+        __in ICredentialProvider* pcp
+        );
+
+    //releases the idle providers
+    void Flush();
+
+    //releases the idle providers and creates providers with ppf from now on. Nothing else may
+    //be using the cache meanwhile
+    void SetFactory(__in ProviderFactory* ppf);
+
+    LONG GetCreatedCount() { return _cCreated; }
+    LONG GetReusedCount() { return _cReused; }
+
+  private:
+    struct IDLE_PROVIDER
+    {
+        CLSID                   clsid;
+        ICredentialProvider*    pcp;        // NULL if there isn't one.
+    };
+
+    IDLE_PROVIDER* _Slot(__in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus, __in DWORD dwFlags);
+    HRESULT _Create(
+        __in REFCLSID clsid,
+        __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+        __in DWORD dwFlags,
+        __deref_out ICredentialProvider** ppcp
+        );
+
+    ProviderFactory*    _ppf;
+    SRWLOCK             _srw;
+
+    // One idle provider for each scenario that can be reused, guarded by _srw.
+    IDLE_PROVIDER       _ipLogon;
+    IDLE_PROVIDER       _ipUnlock;
+
+    LONG                _cCreated;
+    LONG                _cReused;
+};
+
+//gets a provider of class clsid ready for cpus and dwFlags from the dll's cache. See
+//ProviderCache::Acquire
+HRESULT ProviderCacheAcquire(
+    __in REFCLSID clsid,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __in DWORD dwFlags,
+    __deref_out ICredentialProvider** ppcp,
+    __out BOOL* pbWarm
+    );
+
+//gives pcp back to the dll's cache. See ProviderCache::GiveBack
+void ProviderCacheGiveBack(
+    __in REFCLSID clsid,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __in DWORD dwFlags,
+    __in BOOL bReusable,
+    __in ICredentialProvider* pcp
+    );
+
+//releases the dll's idle providers
+void ProviderCacheFlush();
+
+//has the dll's cache create providers with ppf, or with CoCreateInstance again if ppf is
+//NULL. See ProviderCache::SetFactory
+void ProviderCacheSetFactory(__in_opt ProviderFactory* ppf);
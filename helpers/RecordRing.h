@@ -0,0 +1,104 @@
+// CRecordRing is a bounded multi-producer, single-consumer queue of fixed
+// size records. Each slot carries a sequence number that says whose turn it
+// is: a writer may fill slot i when its sequence equals the write position,
+// and the reader may take it once the sequence has moved one past that.
+// Writers never wait on each other or on the reader; when the ring is full
+// BeginWrite fails and the caller decides what to do with the record.
+//
+// Instances are meant to be zero-initialized globals; call Initialize once
+// before first use.
+
+#pragma once
+#include <windows.h>
+
+template <typename T, LONG cSlots>
+class CRecordRing
+{
+    C_ASSERT((cSlots & (cSlots - 1)) == 0);
+
+  public:
+    void Initialize()
+    {
+        for (LONG i = 0; i < cSlots; i++)
+        {
+            _rgSlots[i].lSequence = i;
+        }
+        _lEnqueuePos = 0;
+        _lDequeuePos = 0;
+    }
+
+    // Claims the next free slot and returns the record to fill in, or NULL if the ring is full.
+    // The record must be handed back with EndWrite.
+    T* BeginWrite(__out LONG* plPos)
+    {
+        LONG lPos = _lEnqueuePos;
+        for (;;)
+        {
+            SLOT* pslot = &_rgSlots[lPos & (cSlots - 1)];
+            LONG lDiff = pslot->lSequence - lPos;
+            if (lDiff == 0)
+            {
+                LONG lSeen = InterlockedCompareExchange(&_lEnqueuePos, lPos + 1, lPos);
+                if (lSeen == lPos)
+                {
+                    *plPos = lPos;
+                    return &pslot->item;
+                }
+                lPos = lSeen;
+            }
+            else if (lDiff < 0)
+            {
+                // The reader hasn't got to this slot since the last lap.
+                return NULL;
+            }
+            else
+            {
+                lPos = _lEnqueuePos;
+            }
+        }
+    }
+
+    // Publishes a record claimed with BeginWrite.
+    void EndWrite(__in LONG lPos)
+    {
+        InterlockedExchange(&_rgSlots[lPos & (cSlots - 1)].lSequence, lPos + 1);
+    }
+
+    // Returns the oldest published record, or NULL if there isn't one. Only the reader calls this.
+    T* BeginRead()
+    {
+        SLOT* pslot = &_rgSlots[_lDequeuePos & (cSlots - 1)];
+        if (pslot->lSequence != _lDequeuePos + 1)
+        {
+            return NULL;
+        }
+
+        // Don't read the record before we've seen that it's ready.
+        MemoryBarrier();
+        return &pslot->item;
+    }
+
+    // Hands the record returned by BeginRead back to the writers.
+    void EndRead()
+    {
+        InterlockedExchange(&_rgSlots[_lDequeuePos & (cSlots - 1)].lSequence, _lDequeuePos + cSlots);
+        _lDequeuePos++;
+    }
+
+    // Whether BeginRead would return a record.
+    BOOL IsReadReady() const
+    {
+        return _rgSlots[_lDequeuePos & (cSlots - 1)].lSequence == _lDequeuePos + 1;
+    }
+
+  private:
+    struct SLOT
+    {
+        volatile LONG   lSequence;
+        T               item;
+    };
+
+    SLOT            _rgSlots[cSlots];
+    volatile LONG   _lEnqueuePos;       // The next position a writer will claim.
+    LONG            _lDequeuePos;       // The next position the reader will take. Only the reader touches this.
+};
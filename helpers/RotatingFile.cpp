@@ -0,0 +1,123 @@
+#include "RotatingFile.h"
+#include "Dll.h"
+#include <strsafe.h>
+
+HRESULT RotatingFileInitialize(
+    __out ROTATING_FILE* prf,
+    __in PCWSTR pwszExtension,
+    __in ULONGLONG cbMax,
+    __in_bcount_opt(cbHeader) const void* pvHeader,
+    __in DWORD cbHeader
+    )
+{
+    ZeroMemory(prf, sizeof(*prf));
+    prf->hFile = INVALID_HANDLE_VALUE;
+    prf->cbMax = cbMax;
+    prf->pvHeader = pvHeader;
+    prf->cbHeader = (pvHeader != NULL) ? cbHeader : 0;
+
+    // build the path to the file based on this dll's name
+    HRESULT hr;
+    DWORD cch = GetModuleFileName(HINST_THISDLL, prf->wszPath, ARRAYSIZE(prf->wszPath));
+    if ((cch > 3) && (cch < ARRAYSIZE(prf->wszPath)))
+    {
+        hr = StringCchCopyW(prf->wszPath + cch - 3, ARRAYSIZE(prf->wszPath) - (cch - 3), pwszExtension);
+        if (SUCCEEDED(hr))
+        {
+            hr = StringCchPrintfW(prf->wszOldPath, ARRAYSIZE(prf->wszOldPath), L"%s.1", prf->wszPath);
+        }
+    }
+    else
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_FILENAME_EXCED_RANGE);
+    }
+
+    if (FAILED(hr))
+    {
+        prf->wszPath[0] = L'\0';
+        prf->wszOldPath[0] = L'\0';
+    }
+
+    return hr;
+}
+
+static HRESULT _RotatingFileOpen(__inout ROTATING_FILE* prf)
+{
+    if (prf->hFile != INVALID_HANDLE_VALUE)
+    {
+        return S_OK;
+    }
+    if (prf->wszPath[0] == L'\0')
+    {
+        return E_UNEXPECTED;
+    }
+
+    // FILE_APPEND_DATA makes each WriteFile an atomic append, so another process with
+    // this dll loaded can share the file without tearing what we write.
+    HRESULT hr;
+    prf->hFile = CreateFile(prf->wszPath, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (prf->hFile != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER liSize;
+        prf->cbFile = GetFileSizeEx(prf->hFile, &liSize) ? (ULONGLONG)liSize.QuadPart : 0;
+
+        if ((prf->cbFile == 0) && (prf->cbHeader > 0))
+        {
+            DWORD cbWritten = 0;
+            if (WriteFile(prf->hFile, prf->pvHeader, prf->cbHeader, &cbWritten, NULL))
+            {
+                prf->cbFile += cbWritten;
+            }
+        }
+        hr = S_OK;
+    }
+    else
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return hr;
+}
+
+HRESULT RotatingFileWrite(
+    __inout ROTATING_FILE* prf,
+    __in_bcount(cb) const void* pv,
+    __in DWORD cb
+    )
+{
+    HRESULT hr = _RotatingFileOpen(prf);
+
+    if (SUCCEEDED(hr) && (prf->cbFile > prf->cbHeader) && (prf->cbFile + cb > prf->cbMax))
+    {
+        RotatingFileClose(prf);
+        MoveFileEx(prf->wszPath, prf->wszOldPath, MOVEFILE_REPLACE_EXISTING);
+        hr = _RotatingFileOpen(prf);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        DWORD cbWritten = 0;
+        if (WriteFile(prf->hFile, pv, cb, &cbWritten, NULL))
+        {
+            prf->cbFile += cbWritten;
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    return hr;
+}
+
+void RotatingFileClose(
+    __inout ROTATING_FILE* prf
+    )
+{
+    if (prf->hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(prf->hFile);
+        prf->hFile = INVALID_HANDLE_VALUE;
+    }
+}
@@ -0,0 +1,39 @@
+// A rotating file is a file next to the dll, named after it, that is only
+// ever appended to. When a write would take it past its size limit it is
+// renamed with a .1 suffix (replacing any older one) and a new file is
+// started. Files that are new or empty are given a header first.
+
+#pragma once
+#include <windows.h>
+
+struct ROTATING_FILE
+{
+    HANDLE      hFile;
+    ULONGLONG   cbFile;
+    ULONGLONG   cbMax;
+    const void* pvHeader;                   // Written at the start of every new file, if not NULL.
+    DWORD       cbHeader;
+    WCHAR       wszPath[MAX_PATH];
+    WCHAR       wszOldPath[MAX_PATH];
+};
+
+//names the file after this dll with the given extension (without the dot)
+HRESULT RotatingFileInitialize(
+    __out ROTATING_FILE* prf,
+    __in PCWSTR pwszExtension,
+    __in ULONGLONG cbMax,
+    __in_bcount_opt(cbHeader) const void* pvHeader,
+    __in DWORD cbHeader
+    );
+
+//appends cb bytes to the file, opening or rotating it first as needed
+HRESULT RotatingFileWrite(
+    __inout ROTATING_FILE* prf,
+    __in_bcount(cb) const void* pv,
+    __in DWORD cb
+    );
+
+//closes the file; the next write reopens it
+void RotatingFileClose(
+    __inout ROTATING_FILE* prf
+    );
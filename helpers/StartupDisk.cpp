@@ -0,0 +1,385 @@
+#include "StartupDisk.h"
+#include "Dll.h"
+#include "Log.h"
+#include <ShlObj.h>
+#include <strsafe.h>
+
+// How long to give BootCamp.exe, when we have to fall back to it.
+#define BOOTCAMP_TIMEOUT_MS             5000
+
+// EFI device path node types (UEFI spec, "Device Path Protocol").
+#define EFI_MEDIA_DEVICE_PATH           0x04
+#define EFI_MEDIA_HARDDRIVE_DP          0x01
+#define EFI_END_DEVICE_PATH             0x7F
+#define EFI_END_ENTIRE_DEVICE_PATH      0xFF
+#define EFI_HARDDRIVE_NODE_BYTES        42
+#define EFI_END_NODE_BYTES              4
+#define EFI_MBR_TYPE_GPT                0x02
+#define EFI_SIGNATURE_TYPE_GUID         0x02
+
+// The most we'll save of a variable we're about to replace. What bless writes is well under this.
+#define STARTUP_DISK_MAX_SAVED_BYTES    2048
+
+// A variable as it was before we wrote it.
+struct SAVED_VARIABLE
+{
+    BOOL    bExists;
+    DWORD   cb;
+    BYTE    rgb[STARTUP_DISK_MAX_SAVED_BYTES];
+};
+
+void StartupDiskPartitionFromTarget(
+    __in const GPT_TARGET& rgt,
+    __out STARTUP_PARTITION* psp
+    )
+{
+    psp->dwDisk = rgt.bDisk;
+    psp->dwPartitionNumber = rgt.wPartitionNumber;
+    psp->ullStartLba = rgt.ullStartLba;
+    psp->ullSizeLba = rgt.ullSizeLba;
+    psp->guidPartition = rgt.guidPartition;
+    psp->bKind = rgt.bKind;
+}
+
+HRESULT StartupDiskFindMacPartition(
+    __in const GPT_INDEX* pgi,
+    __out STARTUP_PARTITION* psp
+    )
+{
+    // Only the scanner's bBlessed tells a system volume from a data or Time Machine volume
+    // of the same type, and it's only ever set on HFS+ volumes.
+    for (DWORD i = 0; i < pgi->cTargets; i++)
+    {
+        if ((pgi->rgTargets[i].bKind == GTK_HFSPLUS) && pgi->rgTargets[i].bBlessed)
+        {
+            StartupDiskPartitionFromTarget(pgi->rgTargets[i], psp);
+            return S_OK;
+        }
+    }
+
+    return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+}
+
+HRESULT StartupDiskEncodeDevicePath(
+    __in const STARTUP_PARTITION& rsp,
+    __out_bcount_part(cb, *pcbUsed) BYTE* pb,
+    __in DWORD cb,
+    __out DWORD* pcbUsed
+    )
+{
+    *pcbUsed = 0;
+    if (cb < EFI_HARDDRIVE_NODE_BYTES + EFI_END_NODE_BYTES)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+
+    // The firmware finds a GPT partition from a hard drive node on its own by matching
+    // the signature, so the node doesn't need the controller path in front of it. Every
+    // field is little-endian, and an EFI_GUID is laid out the same way as a GUID.
+    ZeroMemory(pb, EFI_HARDDRIVE_NODE_BYTES + EFI_END_NODE_BYTES);
+    pb[0] = EFI_MEDIA_DEVICE_PATH;
+    pb[1] = EFI_MEDIA_HARDDRIVE_DP;
+    pb[2] = EFI_HARDDRIVE_NODE_BYTES;
+    CopyMemory(pb + 4, &rsp.dwPartitionNumber, sizeof(DWORD));
+    CopyMemory(pb + 8, &rsp.ullStartLba, sizeof(ULONGLONG));
+    CopyMemory(pb + 16, &rsp.ullSizeLba, sizeof(ULONGLONG));
+    CopyMemory(pb + 24, &rsp.guidPartition, sizeof(GUID));
+    pb[40] = EFI_MBR_TYPE_GPT;
+    pb[41] = EFI_SIGNATURE_TYPE_GUID;
+
+    BYTE* pbEnd = pb + EFI_HARDDRIVE_NODE_BYTES;
+    pbEnd[0] = EFI_END_DEVICE_PATH;
+    pbEnd[1] = EFI_END_ENTIRE_DEVICE_PATH;
+    pbEnd[2] = EFI_END_NODE_BYTES;
+
+    *pcbUsed = EFI_HARDDRIVE_NODE_BYTES + EFI_END_NODE_BYTES;
+    return S_OK;
+}
+
+HRESULT StartupDiskEncodeBootDevice(
+    __in const STARTUP_PARTITION& rsp,
+    __out_bcount_part(cb, *pcbUsed) BYTE* pb,
+    __in DWORD cb,
+    __out DWORD* pcbUsed
+    )
+{
+    *pcbUsed = 0;
+    if (rsp.bKind == GTK_APFS)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    // This is the same plist bless writes for an HFS+ volume, less the BLLastBSDName key
+    // with the BSD name macOS last saw the disk as, which the firmware doesn't match on.
+    const GUID& g = rsp.guidPartition;
+    PSTR pszEnd;
+    HRESULT hr = StringCbPrintfExA(reinterpret_cast<PSTR>(pb), cb, &pszEnd, NULL, 0,
+        "<array><dict><key>IOMatch</key><dict>"
+        "<key>IOProviderClass</key><string>IOMedia</string>"
+        "<key>IOPropertyMatch</key><dict><key>UUID</key>"
+        "<string>%08lX-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X</string>"
+        "</dict></dict></dict></array>",
+        g.Data1, g.Data2, g.Data3, g.Data4[0], g.Data4[1], g.Data4[2], g.Data4[3],
+        g.Data4[4], g.Data4[5], g.Data4[6], g.Data4[7]);
+    if (SUCCEEDED(hr))
+    {
+        // The variable includes the terminating NULL.
+        *pcbUsed = (DWORD)(reinterpret_cast<BYTE*>(pszEnd) - pb) + 1;
+    }
+
+    return hr;
+}
+
+// Writes one variable and reads it back.
+static HRESULT _StartupDiskWriteVariable(
+    __in FirmwareVariableStore* pfvs,
+    __in PCWSTR pwszName,
+    __in_bcount(cb) const BYTE* pb,
+    __in DWORD cb
+    )
+{
+    HRESULT hr = pfvs->WriteVariable(pwszName, APPLE_BOOT_VARIABLE_GUID, pb, cb);
+    if (SUCCEEDED(hr))
+    {
+        BYTE rgbRead[STARTUP_DISK_MAX_VARIABLE_BYTES];
+        DWORD cbRead;
+        hr = pfvs->ReadVariable(pwszName, APPLE_BOOT_VARIABLE_GUID, rgbRead, sizeof(rgbRead), &cbRead);
+        if (SUCCEEDED(hr) && ((cbRead != cb) || (memcmp(rgbRead, pb, cb) != 0)))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        LogWrite(L"writing %s failed with 0x%08x", pwszName, hr);
+    }
+    return hr;
+}
+
+// Reads what a variable holds now, so that it can be put back.
+static HRESULT _StartupDiskSaveVariable(
+    __in FirmwareVariableStore* pfvs,
+    __in PCWSTR pwszName,
+    __out SAVED_VARIABLE* psv
+    )
+{
+    psv->bExists = FALSE;
+    HRESULT hr = pfvs->ReadVariable(pwszName, APPLE_BOOT_VARIABLE_GUID, psv->rgb, sizeof(psv->rgb), &psv->cb);
+    if (SUCCEEDED(hr))
+    {
+        psv->bExists = TRUE;
+    }
+    else if (hr == HRESULT_FROM_WIN32(ERROR_ENVVAR_NOT_FOUND))
+    {
+        psv->cb = 0;
+        hr = S_OK;
+    }
+    else
+    {
+        LogWrite(L"reading %s failed with 0x%08x", pwszName, hr);
+    }
+    return hr;
+}
+
+// Puts a variable back the way _StartupDiskSaveVariable found it.
+static void _StartupDiskRestoreVariable(
+    __in FirmwareVariableStore* pfvs,
+    __in PCWSTR pwszName,
+    __in const SAVED_VARIABLE& rsv
+    )
+{
+    HRESULT hr = rsv.bExists ?
+        pfvs->WriteVariable(pwszName, APPLE_BOOT_VARIABLE_GUID, rsv.rgb, rsv.cb) :
+        pfvs->DeleteVariable(pwszName, APPLE_BOOT_VARIABLE_GUID);
+    LogWrite(L"restoring %s: 0x%08x", pwszName, hr);
+}
+
+HRESULT StartupDiskWrite(
+    __in FirmwareVariableStore* pfvs,
+    __in const STARTUP_PARTITION& rsp
+    )
+{
+    BYTE rgbDevicePath[STARTUP_DISK_MAX_VARIABLE_BYTES];
+    BYTE rgbBootDevice[STARTUP_DISK_MAX_VARIABLE_BYTES];
+    DWORD cbDevicePath;
+    DWORD cbBootDevice;
+
+    HRESULT hr = StartupDiskEncodeDevicePath(rsp, rgbDevicePath, sizeof(rgbDevicePath), &cbDevicePath);
+    if (SUCCEEDED(hr))
+    {
+        hr = StartupDiskEncodeBootDevice(rsp, rgbBootDevice, sizeof(rgbBootDevice), &cbBootDevice);
+    }
+
+    // The two variables only mean something together, and the firmware can't change both
+    // at once. Save what's there first; if we can't, nothing is written.
+    SAVED_VARIABLE svDevicePath;
+    SAVED_VARIABLE svBootDevice;
+    if (SUCCEEDED(hr))
+    {
+        hr = _StartupDiskSaveVariable(pfvs, L"efi-boot-device-data", &svDevicePath);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = _StartupDiskSaveVariable(pfvs, L"efi-boot-device", &svBootDevice);
+    }
+
+    // The plist is what the firmware matches on, so it goes last. If the device path can't be
+    // written, it's put back and the plist is never touched. If the plist can't be written,
+    // or doesn't read back, both are put back, so the old startup disk is left as it was.
+    if (SUCCEEDED(hr))
+    {
+        hr = _StartupDiskWriteVariable(pfvs, L"efi-boot-device-data", rgbDevicePath, cbDevicePath);
+        if (SUCCEEDED(hr))
+        {
+            hr = _StartupDiskWriteVariable(pfvs, L"efi-boot-device", rgbBootDevice, cbBootDevice);
+            if (FAILED(hr))
+            {
+                _StartupDiskRestoreVariable(pfvs, L"efi-boot-device", svBootDevice);
+            }
+        }
+        if (FAILED(hr))
+        {
+            _StartupDiskRestoreVariable(pfvs, L"efi-boot-device-data", svDevicePath);
+        }
+    }
+
+    return hr;
+}
+
+// Returns the .nvram folder next to the dll, if there is one.
+static BOOL _StartupDiskGetDryRunFolder(__out_ecount(cch) PWSTR pwszFolder, __in DWORD cch)
+{
+    DWORD cchModule = GetModuleFileName(HINST_THISDLL, pwszFolder, cch);
+    if ((cchModule > 3) && (cchModule < cch) &&
+        SUCCEEDED(StringCchCopyW(pwszFolder + cchModule - 3, cch - (cchModule - 3), L"nvram")))
+    {
+        DWORD dwAttributes = GetFileAttributes(pwszFolder);
+        return (dwAttributes != INVALID_FILE_ATTRIBUTES) && (dwAttributes & FILE_ATTRIBUTE_DIRECTORY);
+    }
+    return FALSE;
+}
+
+// The old way: have Boot Camp set the startup disk.
+// http://support.apple.com/kb/HT3802
+static HRESULT _StartupDiskSetMacWithBootCamp()
+{
+    // get the filesystem location of %ProgramFiles%
+    PWSTR pwszProgramFiles;
+    HRESULT hr = SHGetKnownFolderPath(FOLDERID_ProgramFiles, 0, NULL, &pwszProgramFiles);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // "%ProgramFiles%\Boot Camp\BootCamp.exe" -StartupDisk
+    WCHAR wszBootCamp[MAX_PATH];
+    WCHAR wszCmd[MAX_PATH + 16];
+    hr = StringCchPrintfW(wszBootCamp, ARRAYSIZE(wszBootCamp), L"%s\\Boot Camp\\BootCamp.exe", pwszProgramFiles);
+    CoTaskMemFree(pwszProgramFiles);
+    if (SUCCEEDED(hr))
+    {
+        hr = StringCchPrintfW(wszCmd, ARRAYSIZE(wszCmd), L"\"%s\" -StartupDisk", wszBootCamp);
+    }
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Make sure the executable exists
+    DWORD dwAttributes = GetFileAttributes(wszBootCamp);
+    if ((dwAttributes == INVALID_FILE_ATTRIBUTES) || (dwAttributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+        LogWrite(L"BootCamp.exe not found at %s", wszBootCamp);
+        return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+    }
+
+    LogWrite(L"%s", wszCmd);
+
+    STARTUPINFO si;
+    PROCESS_INFORMATION pi;
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    ZeroMemory(&pi, sizeof(pi));
+
+    if (!CreateProcessW(NULL, wszCmd, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi))
+    {
+        DWORD dwError = GetLastError();
+        LogWrite(L"CreateProcess failed with error %lu", dwError);
+        return HRESULT_FROM_WIN32(dwError);
+    }
+
+    WaitForSingleObject(pi.hProcess, BOOTCAMP_TIMEOUT_MS);
+    LogWrite(L"BootCamp.exe finished or timeout elapsed");
+
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    return S_OK;
+}
+
+// Runs BootCamp.exe after we couldn't set the startup disk ourselves. A dry run never
+// falls back to Boot Camp, which would change the real startup disk.
+static HRESULT _StartupDiskFallBackToBootCamp(__in HRESULT hr)
+{
+    WCHAR wszFolder[MAX_PATH];
+    if (!_StartupDiskGetDryRunFolder(wszFolder, ARRAYSIZE(wszFolder)))
+    {
+        LogWrite(L"couldn't set the startup disk through the firmware (0x%08x), trying BootCamp.exe", hr);
+        hr = _StartupDiskSetMacWithBootCamp();
+    }
+    return hr;
+}
+
+HRESULT StartupDiskSetPartition(
+    __in const STARTUP_PARTITION& rsp
+    )
+{
+    LogWrite(L"setting the startup disk to partition %lu on disk %lu", rsp.dwPartitionNumber, rsp.dwDisk);
+
+    HRESULT hr;
+    WCHAR wszFolder[MAX_PATH];
+    if (rsp.bKind == GTK_APFS)
+    {
+        // We can't name an APFS volume the way bless does, so let Boot Camp pick.
+        hr = _StartupDiskFallBackToBootCamp(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+    }
+    else if (_StartupDiskGetDryRunFolder(wszFolder, ARRAYSIZE(wszFolder)))
+    {
+        FileVariableStore fvs;
+        hr = fvs.Initialize(wszFolder);
+        if (SUCCEEDED(hr))
+        {
+            hr = StartupDiskWrite(&fvs, rsp);
+        }
+        LogWrite(L"wrote the startup disk to %s: 0x%08x", wszFolder, hr);
+    }
+    else
+    {
+        EfiVariableStore evs;
+        hr = evs.Initialize();
+        if (SUCCEEDED(hr))
+        {
+            hr = StartupDiskWrite(&evs, rsp);
+        }
+        LogWrite(L"set the startup disk through the firmware: 0x%08x", hr);
+    }
+
+    return hr;
+}
+
+HRESULT StartupDiskSetMac()
+{
+    const GPT_INDEX* pgi;
+    STARTUP_PARTITION sp;
+    HRESULT hr = GptIndexGet(&pgi);
+    if (SUCCEEDED(hr))
+    {
+        hr = StartupDiskFindMacPartition(pgi, &sp);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = StartupDiskSetPartition(sp);
+    }
+
+    return FAILED(hr) ? _StartupDiskFallBackToBootCamp(hr) : hr;
+}
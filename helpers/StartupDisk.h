@@ -0,0 +1,79 @@
+// The startup disk is the partition the Mac firmware boots from next. Boot
+// Camp keeps it in two firmware variables under APPLE_BOOT_VARIABLE_GUID:
+// efi-boot-device, a plist that matches the partition by its GPT unique
+// partition GUID, and efi-boot-device-data, an EFI device path to it. We write
+// both directly, and only run BootCamp.exe -StartupDisk if that fails.
+//
+// That plist only names an HFS+ volume. bless matches an APFS volume by its
+// APFS volume UUID, which is inside the container rather than in the GPT, so
+// for an APFS partition we don't write the variables and leave it to Boot
+// Camp. With no partition given, we only pick an HFS+ volume that has been
+// blessed, so a data or Time Machine volume is never made the startup disk.
+//
+// If a folder with the dll's name and a .nvram extension exists next to the
+// dll, the variables are written to files in it instead of to the firmware,
+// which lets the whole path be tried on a machine without changing how it
+// boots.
+
+#pragma once
+#include <windows.h>
+#include "FirmwareStore.h"
+#include "GptScanner.h"
+
+// A partition the firmware can be told to boot from.
+struct STARTUP_PARTITION
+{
+    DWORD       dwDisk;             // The n in \\.\PhysicalDriveN.
+    DWORD       dwPartitionNumber;  // 1-based index of the entry in the GPT.
+    ULONGLONG   ullStartLba;
+    ULONGLONG   ullSizeLba;
+    GUID        guidPartition;      // The GPT unique partition GUID.
+    BYTE        bKind;              // GTK_*. Only HFS+ and Apple Boot partitions are written directly.
+};
+
+// Big enough for either encoded variable.
+#define STARTUP_DISK_MAX_VARIABLE_BYTES     512
+
+//describes a partition from the GPT index the way the firmware variables need it
+void StartupDiskPartitionFromTarget(
+    __in const GPT_TARGET& rgt,
+    __out STARTUP_PARTITION* psp
+    );
+
+//finds the first blessed HFS+ volume in the index. Fails with ERROR_NOT_FOUND if there isn't one.
+HRESULT StartupDiskFindMacPartition(
+    __in const GPT_INDEX* pgi,
+    __out STARTUP_PARTITION* psp
+    );
+
+//encodes the efi-boot-device-data variable for the partition: a hard drive media device path
+HRESULT StartupDiskEncodeDevicePath(
+    __in const STARTUP_PARTITION& rsp,
+    __out_bcount_part(cb, *pcbUsed) BYTE* pb,
+    __in DWORD cb,
+    __out DWORD* pcbUsed
+    );
+
+//encodes the efi-boot-device variable for the partition: a NULL-terminated plist.
+//Fails with ERROR_NOT_SUPPORTED for an APFS partition.
+HRESULT StartupDiskEncodeBootDevice(
+    __in const STARTUP_PARTITION& rsp,
+    __out_bcount_part(cb, *pcbUsed) BYTE* pb,
+    __in DWORD cb,
+    __out DWORD* pcbUsed
+    );
+
+//writes both variables for the partition to the store and reads them back to check them.
+//If either fails, both are put back the way they were.
+HRESULT StartupDiskWrite(
+    __in FirmwareVariableStore* pfvs,
+    __in const STARTUP_PARTITION& rsp
+    );
+
+//makes the partition the startup disk through the firmware. An APFS partition is left to BootCamp.exe.
+HRESULT StartupDiskSetPartition(
+    __in const STARTUP_PARTITION& rsp
+    );
+
+//makes the first blessed HFS+ volume the startup disk, falling back to BootCamp.exe
+HRESULT StartupDiskSetMac();
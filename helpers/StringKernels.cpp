@@ -0,0 +1,241 @@
+#include "StringKernels.h"
+#include <intsafe.h>
+#include <strsafe.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define STRING_KERNELS_SSE2
+#endif
+
+typedef size_t (*PFN_STRLEN)(PCWSTR pwsz, size_t cchMax);
+typedef BOOL (*PFN_STREQUALI)(PCWSTR pwchA, PCWSTR pwchB, size_t cch);
+
+static PFN_STRLEN       g_pfnStrLen;
+static PFN_STREQUALI    g_pfnStrEqualI;
+static INIT_ONCE        g_ioKernels = INIT_ONCE_STATIC_INIT;
+
+// Folds an ASCII letter to lower case and leaves everything else alone.
+static inline WCHAR _AsciiLower(__in WCHAR wch)
+{
+    return (wch >= L'A' && wch <= L'Z') ? (WCHAR)(wch | 0x20) : wch;
+}
+
+// What's left of two strings once one of them has a character past ASCII.
+static BOOL _StrEqualIOrdinal(
+    __in_ecount(cch) PCWSTR pwchA,
+    __in_ecount(cch) PCWSTR pwchB,
+    __in size_t cch
+    )
+{
+    // CompareStringOrdinal takes int lengths; strings that long aren't folded.
+    if (cch > INT_MAX)
+    {
+        return (memcmp(pwchA, pwchB, cch * sizeof(WCHAR)) == 0);
+    }
+    return (CompareStringOrdinal(pwchA, (int)cch, pwchB, (int)cch, TRUE) == CSTR_EQUAL);
+}
+
+static size_t _StrLenScalar(
+    __in PCWSTR pwsz,
+    __in size_t cchMax
+    )
+{
+    size_t cch = 0;
+    while (cch < cchMax && pwsz[cch] != L'\0')
+    {
+        cch++;
+    }
+    return cch;
+}
+
+static BOOL _StrEqualIScalar(
+    __in_ecount(cch) PCWSTR pwchA,
+    __in_ecount(cch) PCWSTR pwchB,
+    __in size_t cch
+    )
+{
+    for (size_t i = 0; i < cch; i++)
+    {
+        WCHAR wchA = pwchA[i];
+        WCHAR wchB = pwchB[i];
+        if (wchA >= 0x80 || wchB >= 0x80)
+        {
+            return _StrEqualIOrdinal(pwchA + i, pwchB + i, cch - i);
+        }
+        if (_AsciiLower(wchA) != _AsciiLower(wchB))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+#ifdef STRING_KERNELS_SSE2
+
+static size_t _StrLenSse2(
+    __in PCWSTR pwsz,
+    __in size_t cchMax
+    )
+{
+    // An aligned load can't cross into a page the string doesn't reach, so the
+    // characters before the first 16 byte boundary are looked at one at a time.
+    // A string that isn't even on a character boundary never gets there.
+    if (((ULONG_PTR)pwsz % sizeof(WCHAR)) != 0)
+    {
+        return _StrLenScalar(pwsz, cchMax);
+    }
+
+    size_t cch = 0;
+    while (cch < cchMax && ((ULONG_PTR)(pwsz + cch) % sizeof(__m128i)) != 0)
+    {
+        if (pwsz[cch] == L'\0')
+        {
+            return cch;
+        }
+        cch++;
+    }
+
+    const __m128i xmmZero = _mm_setzero_si128();
+    for (; cchMax - cch >= 8; cch += 8)
+    {
+        __m128i xmm = _mm_load_si128(reinterpret_cast<const __m128i*>(pwsz + cch));
+        int nMask = _mm_movemask_epi8(_mm_cmpeq_epi16(xmm, xmmZero));
+        if (nMask != 0)
+        {
+            unsigned long iBit;
+            _BitScanForward(&iBit, (unsigned long)nMask);
+            return cch + iBit / sizeof(WCHAR);
+        }
+    }
+
+    return cch + _StrLenScalar(pwsz + cch, cchMax - cch);
+}
+
+// Lower cases the ASCII letters in eight characters.
+static inline __m128i _AsciiLowerSse2(__in __m128i xmm)
+{
+    __m128i xmmUpper = _mm_and_si128(_mm_cmpgt_epi16(xmm, _mm_set1_epi16(L'A' - 1)),
+                                     _mm_cmplt_epi16(xmm, _mm_set1_epi16(L'Z' + 1)));
+    return _mm_or_si128(xmm, _mm_and_si128(xmmUpper, _mm_set1_epi16(0x20)));
+}
+
+static BOOL _StrEqualISse2(
+    __in_ecount(cch) PCWSTR pwchA,
+    __in_ecount(cch) PCWSTR pwchB,
+    __in size_t cch
+    )
+{
+    const __m128i xmmNotAscii = _mm_set1_epi16((short)0xff80);
+    const __m128i xmmZero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; cch - i >= 8; i += 8)
+    {
+        __m128i xmmA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pwchA + i));
+        __m128i xmmB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pwchB + i));
+
+        __m128i xmmHigh = _mm_and_si128(_mm_or_si128(xmmA, xmmB), xmmNotAscii);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(xmmHigh, xmmZero)) != 0xffff)
+        {
+            return _StrEqualIOrdinal(pwchA + i, pwchB + i, cch - i);
+        }
+
+        __m128i xmmEqual = _mm_cmpeq_epi16(_AsciiLowerSse2(xmmA), _AsciiLowerSse2(xmmB));
+        if (_mm_movemask_epi8(xmmEqual) != 0xffff)
+        {
+            return FALSE;
+        }
+    }
+
+    return _StrEqualIScalar(pwchA + i, pwchB + i, cch - i);
+}
+
+#endif
+
+static BOOL CALLBACK _InitStringKernels(__inout PINIT_ONCE, __in PVOID, __out PVOID*)
+{
+    g_pfnStrLen = _StrLenScalar;
+    g_pfnStrEqualI = _StrEqualIScalar;
+#ifdef STRING_KERNELS_SSE2
+    // Every x64 processor has SSE2; only the oldest x86 ones don't.
+    if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+    {
+        g_pfnStrLen = _StrLenSse2;
+        g_pfnStrEqualI = _StrEqualISse2;
+    }
+#endif
+    return TRUE;
+}
+
+size_t StrLenW(
+    __in PCWSTR pwsz,
+    __in size_t cchMax
+    )
+{
+    InitOnceExecuteOnce(&g_ioKernels, _InitStringKernels, NULL, NULL);
+    return g_pfnStrLen(pwsz, cchMax);
+}
+
+HRESULT StrCopyW(
+    __out_ecount(cchDest) PWSTR pwszDest,
+    __in size_t cchDest,
+    __in_ecount(cchSrc) PCWSTR pwchSrc,
+    __in size_t cchSrc
+    )
+{
+    if (cchSrc >= cchDest)
+    {
+        if (cchDest > 0)
+        {
+            pwszDest[0] = L'\0';
+        }
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+
+    // The CRT's memcpy already moves as much at a time as the processor allows.
+    CopyMemory(pwszDest, pwchSrc, cchSrc * sizeof(WCHAR));
+    pwszDest[cchSrc] = L'\0';
+    return S_OK;
+}
+
+HRESULT StrJoinW(
+    __out_ecount(cchDest) PWSTR pwszDest,
+    __in size_t cchDest,
+    __in_ecount(cchFirst) PCWSTR pwchFirst,
+    __in size_t cchFirst,
+    __in WCHAR wchSeparator,
+    __in_ecount(cchSecond) PCWSTR pwchSecond,
+    __in size_t cchSecond
+    )
+{
+    // Checked piece by piece, so that the sizes can't overflow when added up.
+    if (cchFirst >= cchDest || cchSecond >= cchDest - cchFirst - 1)
+    {
+        if (cchDest > 0)
+        {
+            pwszDest[0] = L'\0';
+        }
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+
+    CopyMemory(pwszDest, pwchFirst, cchFirst * sizeof(WCHAR));
+    pwszDest[cchFirst] = wchSeparator;
+    CopyMemory(pwszDest + cchFirst + 1, pwchSecond, cchSecond * sizeof(WCHAR));
+    pwszDest[cchFirst + 1 + cchSecond] = L'\0';
+    return S_OK;
+}
+
+BOOL StrEqualIW(
+    __in_ecount(cchA) PCWSTR pwchA,
+    __in size_t cchA,
+    __in_ecount(cchB) PCWSTR pwchB,
+    __in size_t cchB
+    )
+{
+    if (cchA != cchB)
+    {
+        return FALSE;
+    }
+    InitOnceExecuteOnce(&g_ioKernels, _InitStringKernels, NULL, NULL);
+    return g_pfnStrEqualI(pwchA, pwchB, cchA);
+}
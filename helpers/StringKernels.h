@@ -0,0 +1,45 @@
+// The string work the providers do on every serialization and every field
+// they pass along: measuring, copying and joining UTF-16 strings, and
+// comparing them without regard to case. Measuring and comparing look at
+// eight characters at a time with SSE2 where the processor has it, which is
+// picked once, the first time a string is measured or compared.
+//
+// Comparisons fold case the way CompareStringOrdinal does, not the way the
+// user's locale would, so that a rule matches the same strings everywhere.
+// ASCII strings, which is nearly all of them, never leave the fast path.
+
+#pragma once
+#include <windows.h>
+
+//the length of pwsz in characters, or cchMax if there's no terminator in its first cchMax characters
+size_t StrLenW(
+    __in PCWSTR pwsz,
+    __in size_t cchMax
+    );
+
+//copies cchSrc characters of pwchSrc and a terminator to pwszDest, if they fit in cchDest
+HRESULT StrCopyW(
+    __out_ecount(cchDest) PWSTR pwszDest,
+    __in size_t cchDest,
+    __in_ecount(cchSrc) PCWSTR pwchSrc,
+    __in size_t cchSrc
+    );
+
+//writes pwchFirst, wchSeparator, pwchSecond and a terminator to pwszDest, if they fit in cchDest
+HRESULT StrJoinW(
+    __out_ecount(cchDest) PWSTR pwszDest,
+    __in size_t cchDest,
+    __in_ecount(cchFirst) PCWSTR pwchFirst,
+    __in size_t cchFirst,
+    __in WCHAR wchSeparator,
+    __in_ecount(cchSecond) PCWSTR pwchSecond,
+    __in size_t cchSecond
+    );
+
+//whether two counted strings are the same apart from case
+BOOL StrEqualIW(
+    __in_ecount(cchA) PCWSTR pwchA,
+    __in size_t cchA,
+    __in_ecount(cchB) PCWSTR pwchB,
+    __in size_t cchB
+    );
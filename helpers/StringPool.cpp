@@ -0,0 +1,215 @@
+#include "StringPool.h"
+#include <intsafe.h>
+#include <strsafe.h>
+
+// Room for what the providers put in without growing.
+#define STRING_POOL_INITIAL_ENTRIES     16
+#define STRING_POOL_INITIAL_CHARS       512
+
+StringPool::StringPool(__in HANDLE hHeap) :
+    _cRef(1),
+    _hHeap(hHeap),
+    _rgEntries(NULL),
+    _cEntries(0),
+    _cEntriesMax(0),
+    _pwchChars(NULL),
+    _cchChars(0),
+    _cchCharsMax(0)
+{
+}
+
+StringPool::~StringPool()
+{
+    if (_rgEntries != NULL)
+    {
+        HeapFree(_hHeap, 0, _rgEntries);
+    }
+    if (_pwchChars != NULL)
+    {
+        HeapFree(_hHeap, 0, _pwchChars);
+    }
+}
+
+HRESULT StringPool::Create(
+    __deref_out StringPool** ppsp,
+    __in_opt HANDLE hHeap
+    )
+{
+    *ppsp = NULL;
+
+    StringPool* psp = new StringPool((hHeap != NULL) ? hHeap : GetProcessHeap());
+    if (psp == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    HRESULT hr = psp->_Reserve(STRING_POOL_INITIAL_ENTRIES, STRING_POOL_INITIAL_CHARS);
+    if (FAILED(hr))
+    {
+        psp->Release();
+        return hr;
+    }
+
+    *ppsp = psp;
+    return S_OK;
+}
+
+ULONG StringPool::AddRef()
+{
+    return InterlockedIncrement(&_cRef);
+}
+
+ULONG StringPool::Release()
+{
+    LONG cRef = InterlockedDecrement(&_cRef);
+    if (!cRef)
+    {
+        delete this;
+    }
+    return cRef;
+}
+
+// Doubles *pcMax, starting from cInitial, until it's at least cNeeded, and
+// reallocates *ppv on hHeap to hold that many elements of cbElement bytes.
+static HRESULT _StringPoolGrow(
+    __in HANDLE hHeap,
+    __inout void** ppv,
+    __inout DWORD* pcMax,
+    __in DWORD cNeeded,
+    __in DWORD cInitial,
+    __in SIZE_T cbElement
+    )
+{
+    if (cNeeded <= *pcMax)
+    {
+        return S_OK;
+    }
+
+    HRESULT hr = S_OK;
+    DWORD cMax = (*pcMax != 0) ? *pcMax : cInitial;
+    while (SUCCEEDED(hr) && cMax < cNeeded)
+    {
+        hr = DWordMult(cMax, 2, &cMax);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        SIZE_T cb = (SIZE_T)cMax * cbElement;
+        void* pv = (*ppv != NULL) ? HeapReAlloc(hHeap, 0, *ppv, cb) : HeapAlloc(hHeap, 0, cb);
+        if (pv != NULL)
+        {
+            *ppv = pv;
+            *pcMax = cMax;
+        }
+        else
+        {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+    return hr;
+}
+
+// Makes room for cEntries more strings and cchChars more characters.
+HRESULT StringPool::_Reserve(
+    __in DWORD cEntries,
+    __in DWORD cchChars
+    )
+{
+    DWORD cEntriesNeeded, cchCharsNeeded;
+    HRESULT hr = DWordAdd(_cEntries, cEntries, &cEntriesNeeded);
+    if (SUCCEEDED(hr))
+    {
+        hr = DWordAdd(_cchChars, cchChars, &cchCharsNeeded);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = _StringPoolGrow(_hHeap, (void**)&_rgEntries, &_cEntriesMax, cEntriesNeeded, STRING_POOL_INITIAL_ENTRIES, sizeof(ENTRY));
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = _StringPoolGrow(_hHeap, (void**)&_pwchChars, &_cchCharsMax, cchCharsNeeded, STRING_POOL_INITIAL_CHARS, sizeof(WCHAR));
+    }
+    return hr;
+}
+
+HRESULT StringPool::Intern(
+    __in PCWSTR pwsz,
+    __out DWORD* pdwIndex
+    )
+{
+    *pdwIndex = 0;
+
+    size_t cch;
+    HRESULT hr = StringCchLengthW(pwsz, STRSAFE_MAX_CCH, &cch);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // A pool holds a few dozen strings at most, so a scan that mostly compares
+    // lengths is as quick as a hash would be.
+    for (DWORD i = 0; i < _cEntries; i++)
+    {
+        if (_rgEntries[i].cch == cch &&
+            memcmp(_pwchChars + _rgEntries[i].ichStart, pwsz, cch * sizeof(WCHAR)) == 0)
+        {
+            *pdwIndex = i;
+            return S_OK;
+        }
+    }
+
+    hr = _Reserve(1, (DWORD)cch + 1);
+    if (SUCCEEDED(hr))
+    {
+        ENTRY& re = _rgEntries[_cEntries];
+        re.ichStart = _cchChars;
+        re.cch = (DWORD)cch;
+        CopyMemory(_pwchChars + re.ichStart, pwsz, (cch + 1) * sizeof(WCHAR));
+
+        _cchChars += re.cch + 1;
+        *pdwIndex = _cEntries++;
+    }
+    return hr;
+}
+
+PCWSTR StringPool::GetString(__in DWORD dwIndex) const
+{
+    return (dwIndex < _cEntries) ? _pwchChars + _rgEntries[dwIndex].ichStart : NULL;
+}
+
+DWORD StringPool::GetLength(__in DWORD dwIndex) const
+{
+    return (dwIndex < _cEntries) ? _rgEntries[dwIndex].cch : 0;
+}
+
+HRESULT StringPool::CoTaskMemDup(
+    __in DWORD dwIndex,
+    __deref_out PWSTR* ppwsz
+    ) const
+{
+    if (dwIndex >= _cEntries)
+    {
+        *ppwsz = NULL;
+        return E_INVALIDARG;
+    }
+
+    const ENTRY& re = _rgEntries[dwIndex];
+    return CoTaskMemDupCch(_pwchChars + re.ichStart, re.cch, ppwsz);
+}
+
+HRESULT CoTaskMemDupCch(
+    __in_ecount(cch) PCWSTR pwsz,
+    __in size_t cch,
+    __deref_out PWSTR* ppwsz
+    )
+{
+    *ppwsz = (PWSTR)CoTaskMemAlloc((cch + 1) * sizeof(WCHAR));
+    if (*ppwsz == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    CopyMemory(*ppwsz, pwsz, cch * sizeof(WCHAR));
+    (*ppwsz)[cch] = L'\0';
+    return S_OK;
+}
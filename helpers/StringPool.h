@@ -0,0 +1,68 @@
+// A StringPool keeps one copy of each string a provider shows on its tiles,
+// with its length measured once when it goes in. Strings are interned: adding
+// a string the pool already has gives back the index it already has, so every
+// tile showing "Reboot to Mac OS X" shares one copy. Credentials hold indices,
+// and GetStringValue hands LogonUI its CoTaskMem copy in a single allocation
+// and copy, without measuring the string again.
+//
+// Strings never change or go away once they're in the pool. Adding strings
+// isn't thread safe; the providers add theirs while enumerating, on LogonUI's
+// thread, and only read after that. The pool is reference counted so that
+// credentials can outlive the provider that built it.
+//
+// The pool allocates from the process heap unless it's given a heap of its own,
+// which is how helperstest counts what it allocates.
+
+#pragma once
+#include <windows.h>
+
+//makes a CoTaskMemAlloc'd copy of pwsz, which is cch characters long, in one allocation and copy
+HRESULT CoTaskMemDupCch(
+    __in_ecount(cch) PCWSTR pwsz,
+    __in size_t cch,
+    __deref_out PWSTR* ppwsz
+    );
+
+class StringPool
+{
+  public:
+    //hHeap is where the pool's storage comes from, or NULL for the process heap
+    static HRESULT Create(__deref_out StringPool** ppsp, __in_opt HANDLE hHeap = NULL);
+
+    ULONG AddRef();
+    ULONG Release();
+
+    //adds pwsz, or finds the copy the pool already has, and returns its index
+    HRESULT Intern(__in PCWSTR pwsz, __out DWORD* pdwIndex);
+
+    //the string at dwIndex, which stays valid until the next Intern
+    PCWSTR GetString(__in DWORD dwIndex) const;
+
+    //the length of the string at dwIndex, in characters
+    DWORD GetLength(__in DWORD dwIndex) const;
+
+    //makes the CoTaskMemAlloc'd copy of the string at dwIndex that LogonUI frees
+    HRESULT CoTaskMemDup(__in DWORD dwIndex, __deref_out PWSTR* ppwsz) const;
+
+  private:
+    StringPool(__in HANDLE hHeap);
+    ~StringPool();
+
+    HRESULT _Reserve(__in DWORD cEntries, __in DWORD cchChars);
+
+  private:
+    struct ENTRY
+    {
+        DWORD   ichStart;           // Where the string starts in _pwchChars.
+        DWORD   cch;                // Not counting its terminator.
+    };
+
+    LONG        _cRef;
+    HANDLE      _hHeap;
+    ENTRY*      _rgEntries;
+    DWORD       _cEntries;
+    DWORD       _cEntriesMax;
+    WCHAR*      _pwchChars;         // Every string and its terminator, back to back.
+    DWORD       _cchChars;
+    DWORD       _cchCharsMax;
+};
@@ -0,0 +1,90 @@
+#include "TileTable.h"
+#include <strsafe.h>
+
+// What a tile is called when the partition doesn't have a name of its own.
+#define TILE_DEFAULT_MAC_NAME       L"Mac OS X"
+#define TILE_DEFAULT_RECOVERY_NAME  L"Recovery"
+
+static void _TileTableAdd(
+    __in const GPT_TARGET& rgt,
+    __inout TILE_TABLE* ptt
+    )
+{
+    TILE& rt = ptt->rgTiles[ptt->cTiles++];
+    rt.bHasPartition = TRUE;
+    StartupDiskPartitionFromTarget(rgt, &rt.sp);
+
+    PCWSTR pwszName = rgt.wszName;
+    if (pwszName[0] == L'\0')
+    {
+        pwszName = GptIsMacVolume(rgt) ? TILE_DEFAULT_MAC_NAME : TILE_DEFAULT_RECOVERY_NAME;
+    }
+    StringCchPrintfW(rt.wszLabel, ARRAYSIZE(rt.wszLabel), L"Reboot to %s", pwszName);
+}
+
+// Two installs are often both called "Macintosh HD". Tiles that would look the
+// same get told apart by where their partition is.
+static void _TileTableDisambiguate(
+    __inout TILE_TABLE* ptt
+    )
+{
+    BOOL rgbDuplicate[ARRAYSIZE(ptt->rgTiles)] = {0};
+    for (DWORD i = 0; i < ptt->cTiles; i++)
+    {
+        for (DWORD j = i + 1; j < ptt->cTiles; j++)
+        {
+            if (lstrcmpiW(ptt->rgTiles[i].wszLabel, ptt->rgTiles[j].wszLabel) == 0)
+            {
+                rgbDuplicate[i] = rgbDuplicate[j] = TRUE;
+            }
+        }
+    }
+
+    for (DWORD i = 0; i < ptt->cTiles; i++)
+    {
+        if (rgbDuplicate[i])
+        {
+            TILE& rt = ptt->rgTiles[i];
+            size_t cchLabel;
+            if (SUCCEEDED(StringCchLengthW(rt.wszLabel, ARRAYSIZE(rt.wszLabel), &cchLabel)))
+            {
+                StringCchPrintfW(rt.wszLabel + cchLabel, ARRAYSIZE(rt.wszLabel) - cchLabel,
+                                 L" (disk %lu, partition %lu)", rt.sp.dwDisk, rt.sp.dwPartitionNumber);
+            }
+        }
+    }
+}
+
+void TileTableBuild(
+    __in const GPT_INDEX* pgi,
+    __out TILE_TABLE* ptt
+    )
+{
+    ptt->cTiles = 0;
+
+    // The index is already in disk order, so two passes keep it within each kind.
+    for (DWORD i = 0; i < pgi->cTargets; i++)
+    {
+        if (GptIsMacVolume(pgi->rgTargets[i]))
+        {
+            _TileTableAdd(pgi->rgTargets[i], ptt);
+        }
+    }
+    for (DWORD i = 0; i < pgi->cTargets; i++)
+    {
+        if (!GptIsMacVolume(pgi->rgTargets[i]))
+        {
+            _TileTableAdd(pgi->rgTargets[i], ptt);
+        }
+    }
+
+    if (ptt->cTiles == 0)
+    {
+        TILE& rt = ptt->rgTiles[ptt->cTiles++];
+        rt.bHasPartition = FALSE;
+        ZeroMemory(&rt.sp, sizeof(rt.sp));
+        StringCchCopyW(rt.wszLabel, ARRAYSIZE(rt.wszLabel), L"Reboot to " TILE_DEFAULT_MAC_NAME);
+    }
+
+    _TileTableDisambiguate(ptt);
+}
@@ -0,0 +1,36 @@
+// The tile table has one row for every partition BootPicker offers to
+// restart into: each macOS volume and each Apple Boot (recovery) partition in
+// the GPT index, with the label its tile shows. The provider keeps the whole
+// table in one block and every credential reads its own row, so a tile costs
+// a row rather than a set of heap strings.
+//
+// When the index has nothing in it the table gets a single row without a
+// partition, which leaves the choice to StartupDiskSetMac: a blessed HFS+
+// volume if it can find one, and otherwise whatever Boot Camp picks.
+
+#pragma once
+#include <windows.h>
+#include "GptScanner.h"
+#include "StartupDisk.h"
+
+// Labels longer than this are truncated.
+#define TILE_LABEL_CCH      80
+
+struct TILE
+{
+    BOOL                bHasPartition;  // FALSE for the row that lets StartupDiskSetMac pick.
+    STARTUP_PARTITION   sp;
+    WCHAR               wszLabel[TILE_LABEL_CCH];
+};
+
+struct TILE_TABLE
+{
+    DWORD   cTiles;
+    TILE    rgTiles[GPT_MAX_TARGETS];
+};
+
+//fills the table from the index: macOS volumes first, then recovery partitions, each in disk order
+void TileTableBuild(
+    __in const GPT_INDEX* pgi,
+    __out TILE_TABLE* ptt
+    );
@@ -0,0 +1,193 @@
+// Records are written into a CRecordRing on the caller's thread and appended
+// to the .trace file by a flush thread, in batches, exactly as they are in
+// memory.
+
+#include "Trace.h"
+#include "RecordRing.h"
+#include "FlushThread.h"
+#include "RotatingFile.h"
+
+// How long the flush thread waits for more records before it exits.
+#define TRACE_IDLE_TIMEOUT_MS   5000
+
+// The trace file is moved to .trace.1 when a write would take it past this size.
+#define TRACE_MAX_FILE_BYTES    (4 * 1024 * 1024)
+
+// Records are written out in batches of up to this many.
+#define TRACE_WRITE_BATCH       256
+
+C_ASSERT(sizeof(TRACE_RECORD) == 40);
+
+static BOOL _TraceDrain();
+static void _TraceIdle();
+static BOOL _TracePending();
+
+// Every new file starts with the header and the current session record, so a file that was
+// just rotated can be decoded on its own.
+struct TRACE_FILE_START
+{
+    TRACE_FILE_HEADER   tfh;
+    TRACE_RECORD        trSession;
+};
+
+static TRACE_FILE_START g_tfs = { { TRACE_FILE_MAGIC, TRACE_FILE_VERSION, sizeof(TRACE_RECORD) } };
+
+static CRecordRing<TRACE_RECORD, 1024> g_ring;
+static volatile LONG    g_cDropped = 0;             // Records dropped because the ring was full.
+static BOOL             g_bEnabled = FALSE;
+static FLUSH_THREAD     g_ft = { _TraceDrain, _TraceIdle, _TracePending, TRACE_IDLE_TIMEOUT_MS };
+static INIT_ONCE        g_ioTrace = INIT_ONCE_STATIC_INIT;
+
+// The flush thread's view of the trace file. Only the flush thread touches these.
+static ROTATING_FILE    g_rf;
+static BOOL             g_bSessionWritten = FALSE;  // Whether this run of the flush thread has written its session record.
+static DWORD            g_cBatch = 0;
+static TRACE_RECORD     g_rgBatch[TRACE_WRITE_BATCH];
+
+static BOOL CALLBACK _InitTrace(__inout PINIT_ONCE, __in PVOID, __out PVOID*)
+{
+    if (SUCCEEDED(RotatingFileInitialize(&g_rf, L"trace", TRACE_MAX_FILE_BYTES, &g_tfs, sizeof(g_tfs))))
+    {
+        DWORD dwAttributes = GetFileAttributes(g_rf.wszPath);
+        if ((dwAttributes != INVALID_FILE_ATTRIBUTES) && !(dwAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        {
+            g_ring.Initialize();
+            g_bEnabled = SUCCEEDED(FlushThreadInitialize(&g_ft));
+        }
+    }
+    return TRUE;
+}
+
+//
+// Flush thread.
+//
+
+static void _TraceFlushBatch()
+{
+    if (g_cBatch > 0)
+    {
+        RotatingFileWrite(&g_rf, g_rgBatch, g_cBatch * sizeof(TRACE_RECORD));
+        g_cBatch = 0;
+    }
+}
+
+static TRACE_RECORD* _TraceNextBatchRecord()
+{
+    if (g_cBatch == ARRAYSIZE(g_rgBatch))
+    {
+        _TraceFlushBatch();
+    }
+
+    TRACE_RECORD* ptr = &g_rgBatch[g_cBatch++];
+    ZeroMemory(ptr, sizeof(*ptr));
+    return ptr;
+}
+
+static BOOL _TraceDrain()
+{
+    BOOL bAny = FALSE;
+
+    // The session record tells the decoder how to turn counter ticks into time. It goes
+    // into the stream as well as the file header because we may be appending to a file
+    // another process started.
+    if (!g_bSessionWritten)
+    {
+        TRACE_RECORD* ptr = &g_tfs.trSession;
+        ZeroMemory(ptr, sizeof(*ptr));
+        ptr->bType = TRT_SESSION;
+        ptr->session.dwProcessId = GetCurrentProcessId();
+
+        FILETIME ft;
+        LARGE_INTEGER liStart;
+        LARGE_INTEGER liFrequency;
+        GetSystemTimeAsFileTime(&ft);
+        QueryPerformanceCounter(&liStart);
+        QueryPerformanceFrequency(&liFrequency);
+        ptr->session.ullFileTime = ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+        ptr->session.llStart = liStart.QuadPart;
+        ptr->session.llFrequency = liFrequency.QuadPart;
+
+        *_TraceNextBatchRecord() = *ptr;
+        g_bSessionWritten = TRUE;
+    }
+
+    LONG cDropped = InterlockedExchange(&g_cDropped, 0);
+    if (cDropped > 0)
+    {
+        TRACE_RECORD* ptr = _TraceNextBatchRecord();
+        ptr->bType = TRT_DROPPED;
+        ptr->dropped.cRecords = cDropped;
+        bAny = TRUE;
+    }
+
+    for (TRACE_RECORD* ptrQueued = g_ring.BeginRead(); ptrQueued != NULL; ptrQueued = g_ring.BeginRead())
+    {
+        *_TraceNextBatchRecord() = *ptrQueued;
+        g_ring.EndRead();
+        bAny = TRUE;
+    }
+
+    _TraceFlushBatch();
+    return bAny;
+}
+
+static void _TraceIdle()
+{
+    _TraceFlushBatch();
+    RotatingFileClose(&g_rf);
+    g_bSessionWritten = FALSE;
+}
+
+static BOOL _TracePending()
+{
+    return g_ring.IsReadReady();
+}
+
+BOOL TraceIsEnabled()
+{
+    InitOnceExecuteOnce(&g_ioTrace, _InitTrace, NULL, NULL);
+    return g_bEnabled;
+}
+
+void TraceRecordCall(
+    __in TRACE_METHOD tm,
+    __in BYTE bFlags,
+    __in DWORD dwFieldID,
+    __in HRESULT hr,
+    __in LONGLONG llStart,
+    __in LONGLONG llEnd
+    )
+{
+    if (!TraceIsEnabled())
+    {
+        return;
+    }
+
+    LONG lPos;
+    TRACE_RECORD* ptr = g_ring.BeginWrite(&lPos);
+    if (ptr != NULL)
+    {
+        ptr->bType = TRT_CALL;
+        ptr->bFlags = bFlags;
+        ptr->usMethod = (USHORT)tm;
+        ptr->dwReserved = 0;
+        ptr->call.dwThreadId = GetCurrentThreadId();
+        ptr->call.dwFieldID = dwFieldID;
+        ptr->call.hr = hr;
+        ptr->call.dwReserved = 0;
+        ptr->call.llStart = llStart;
+        ptr->call.llDuration = llEnd - llStart;
+        g_ring.EndWrite(lPos);
+    }
+    else
+    {
+        InterlockedIncrement(&g_cDropped);
+    }
+
+    FlushThreadWake(&g_ft);
+}
+
+void TraceFree()
+{
+    FlushThreadFree(&g_ft);
+}
@@ -0,0 +1,81 @@
+// The trace records one fixed-size binary record per call into (or out of)
+// the credential provider: when it started, how long it took, which thread
+// made it, which method and field it was for and what it returned. The
+// records go through a ring buffer to a background thread that appends them
+// to the .trace file next to the dll; tools\tracedump turns that file into
+// timelines and per-method latency tables.
+//
+// Tracing is off unless the .trace file already exists when the dll loads,
+// so an empty file is how a machine opts in. When it's off a CTraceScope
+// costs a flag test.
+
+#pragma once
+#include <windows.h>
+#include "TraceFormat.h"
+#include "Metrics.h"
+
+//whether the .trace file was there when the dll loaded
+BOOL TraceIsEnabled();
+
+//queues one call record
+void TraceRecordCall(
+    __in TRACE_METHOD tm,
+    __in BYTE bFlags,
+    __in DWORD dwFieldID,
+    __in HRESULT hr,
+    __in LONGLONG llStart,
+    __in LONGLONG llEnd
+    );
+
+//closes the handles the trace keeps for the life of the dll
+void TraceFree();
+
+// CTraceScope records the call it's declared in when it goes out of scope, in
+// the trace if it's on and in the metrics if they're compiled in.
+// phr points at the HRESULT the call returns, and must be declared before the
+// scope so that it is still alive when the scope ends.
+class CTraceScope
+{
+  public:
+    CTraceScope(__in TRACE_METHOD tm, __in DWORD dwFieldID, __in const HRESULT* phr, __in BYTE bFlags = 0) :
+        _tm(tm), _dwFieldID(dwFieldID), _phr(phr), _bFlags(bFlags), _bTrace(TraceIsEnabled())
+    {
+        if (_bTrace || METRICS_ENABLED)
+        {
+            MetricsEnter(&_mf);
+            QueryPerformanceCounter(&_liStart);
+        }
+    }
+
+    ~CTraceScope()
+    {
+        if (_bTrace || METRICS_ENABLED)
+        {
+            LARGE_INTEGER liEnd;
+            QueryPerformanceCounter(&liEnd);
+            if (_bTrace)
+            {
+                TraceRecordCall(_tm, _bFlags, _dwFieldID, *_phr, _liStart.QuadPart, liEnd.QuadPart);
+            }
+            MetricsLeave(&_mf, _tm, _bFlags, *_phr, liEnd.QuadPart - _liStart.QuadPart);
+        }
+    }
+
+  private:
+    TRACE_METHOD    _tm;
+    DWORD           _dwFieldID;
+    const HRESULT*  _phr;
+    BYTE            _bFlags;
+    BOOL            _bTrace;
+    LARGE_INTEGER   _liStart;
+    METRICS_FRAME   _mf;
+};
+
+// TRACE_WRAPPED_CALL sets hr to the result of a call into the wrapped provider
+// or credential and records that call on its own, so the decoder can tell our
+// time from the wrapped provider's.
+#define TRACE_WRAPPED_CALL(tm, dwFieldID, hr, call) \
+    { \
+        CTraceScope traceWrapped((tm), (dwFieldID), &(hr), TRF_WRAPPED); \
+        (hr) = (call); \
+    }
@@ -0,0 +1,124 @@
+// The layout of the .trace file. This header is shared by the dlls and by
+// tools\tracedump, so it sticks to fixed-size types and doesn't include any
+// Windows headers.
+//
+// A trace file is a TRACE_FILE_HEADER followed by TRACE_RECORDs. Every time
+// a dll starts writing to the file it first writes a session record, which
+// gives the performance counter frequency and the wall clock time that the
+// call records after it are relative to. All values are little-endian.
+
+#pragma once
+#include <stdint.h>
+
+#define TRACE_FILE_MAGIC        0x52545042  // "BPTR"
+#define TRACE_FILE_VERSION      1
+
+// Method ids are written to the file, so only ever add to the end of this list.
+#define TRACE_METHOD_LIST(X) \
+    X(TM_PROVIDER_SETUSAGESCENARIO,                 "Provider::SetUsageScenario") \
+    X(TM_PROVIDER_SETSERIALIZATION,                 "Provider::SetSerialization") \
+    X(TM_PROVIDER_ADVISE,                           "Provider::Advise") \
+    X(TM_PROVIDER_UNADVISE,                         "Provider::UnAdvise") \
+    X(TM_PROVIDER_GETFIELDDESCRIPTORCOUNT,          "Provider::GetFieldDescriptorCount") \
+    X(TM_PROVIDER_GETFIELDDESCRIPTORAT,             "Provider::GetFieldDescriptorAt") \
+    X(TM_PROVIDER_GETCREDENTIALCOUNT,               "Provider::GetCredentialCount") \
+    X(TM_PROVIDER_GETCREDENTIALAT,                  "Provider::GetCredentialAt") \
+    X(TM_CREDENTIAL_ADVISE,                         "Credential::Advise") \
+    X(TM_CREDENTIAL_UNADVISE,                       "Credential::UnAdvise") \
+    X(TM_CREDENTIAL_SETSELECTED,                    "Credential::SetSelected") \
+    X(TM_CREDENTIAL_SETDESELECTED,                  "Credential::SetDeselected") \
+    X(TM_CREDENTIAL_GETFIELDSTATE,                  "Credential::GetFieldState") \
+    X(TM_CREDENTIAL_GETSTRINGVALUE,                 "Credential::GetStringValue") \
+    X(TM_CREDENTIAL_GETBITMAPVALUE,                 "Credential::GetBitmapValue") \
+    X(TM_CREDENTIAL_GETCHECKBOXVALUE,               "Credential::GetCheckboxValue") \
+    X(TM_CREDENTIAL_GETCOMBOBOXVALUECOUNT,          "Credential::GetComboBoxValueCount") \
+    X(TM_CREDENTIAL_GETCOMBOBOXVALUEAT,             "Credential::GetComboBoxValueAt") \
+    X(TM_CREDENTIAL_GETSUBMITBUTTONVALUE,           "Credential::GetSubmitButtonValue") \
+    X(TM_CREDENTIAL_SETSTRINGVALUE,                 "Credential::SetStringValue") \
+    X(TM_CREDENTIAL_SETCHECKBOXVALUE,               "Credential::SetCheckboxValue") \
+    X(TM_CREDENTIAL_SETCOMBOBOXSELECTEDVALUE,       "Credential::SetComboBoxSelectedValue") \
+    X(TM_CREDENTIAL_COMMANDLINKCLICKED,             "Credential::CommandLinkClicked") \
+    X(TM_CREDENTIAL_GETSERIALIZATION,               "Credential::GetSerialization") \
+    X(TM_CREDENTIAL_REPORTRESULT,                   "Credential::ReportResult") \
+    X(TM_EVENTS_SETFIELDSTATE,                      "WrappedCredentialEvents::SetFieldState") \
+    X(TM_EVENTS_SETFIELDINTERACTIVESTATE,           "WrappedCredentialEvents::SetFieldInteractiveState") \
+    X(TM_EVENTS_SETFIELDSTRING,                     "WrappedCredentialEvents::SetFieldString") \
+    X(TM_EVENTS_SETFIELDCHECKBOX,                   "WrappedCredentialEvents::SetFieldCheckbox") \
+    X(TM_EVENTS_SETFIELDBITMAP,                     "WrappedCredentialEvents::SetFieldBitmap") \
+    X(TM_EVENTS_SETFIELDCOMBOBOXSELECTEDITEM,       "WrappedCredentialEvents::SetFieldComboBoxSelectedItem") \
+    X(TM_EVENTS_DELETEFIELDCOMBOBOXITEM,            "WrappedCredentialEvents::DeleteFieldComboBoxItem") \
+    X(TM_EVENTS_APPENDFIELDCOMBOBOXITEM,            "WrappedCredentialEvents::AppendFieldComboBoxItem") \
+    X(TM_EVENTS_SETFIELDSUBMITBUTTON,               "WrappedCredentialEvents::SetFieldSubmitButton") \
+    X(TM_EVENTS_ONCREATINGWINDOW,                   "WrappedCredentialEvents::OnCreatingWindow") \
+    X(TM_TILEBITMAP_RELOAD,                         "TileBitmapCache::Reload") \
+    X(TM_BOOTSWITCH_SETSTARTUPDISK,                 "BootSwitch::SetStartupDisk") \
+    X(TM_BOOTSWITCH_RESTART,                        "BootSwitch::Restart") \
+    X(TM_GPTINDEX_BUILD,                            "GptIndex::Build") \
+    X(TM_PROVIDERCACHE_CREATE,                      "ProviderCache::Create")
+
+#define TRACE_METHOD_ENUM(id, name)     id,
+
+enum TRACE_METHOD
+{
+    TM_NONE = 0,
+    TRACE_METHOD_LIST(TRACE_METHOD_ENUM)
+    TM_COUNT
+};
+
+enum TRACE_RECORD_TYPE
+{
+    TRT_SESSION = 1,
+    TRT_CALL    = 2,
+    TRT_DROPPED = 3,    // Records were lost because the ring was full.
+};
+
+enum TRACE_RECORD_FLAGS
+{
+    TRF_WRAPPED = 0x01, // A call we made into the wrapped provider or credential, rather than one made into us.
+};
+
+// The field id of calls that aren't about a field.
+#define TRACE_NO_FIELD          0xFFFFFFFF
+
+struct TRACE_FILE_HEADER
+{
+    uint32_t    dwMagic;            // TRACE_FILE_MAGIC
+    uint16_t    usVersion;          // TRACE_FILE_VERSION
+    uint16_t    cbRecord;           // sizeof(TRACE_RECORD)
+    uint32_t    rgdwReserved[2];
+};
+
+struct TRACE_RECORD
+{
+    uint8_t     bType;              // TRT_*
+    uint8_t     bFlags;             // TRF_*, for TRT_CALL
+    uint16_t    usMethod;           // TM_*, for TRT_CALL
+    uint32_t    dwReserved;
+
+    union
+    {
+        struct
+        {
+            uint32_t    dwThreadId;
+            uint32_t    dwFieldID;      // TRACE_NO_FIELD if the method doesn't take one.
+            int32_t     hr;
+            uint32_t    dwReserved;
+            int64_t     llStart;        // QueryPerformanceCounter when the call started.
+            int64_t     llDuration;     // In performance counter ticks.
+        } call;
+
+        struct
+        {
+            uint32_t    dwProcessId;
+            uint32_t    dwReserved;
+            uint64_t    ullFileTime;    // The system time (a FILETIME) at llStart.
+            int64_t     llStart;        // QueryPerformanceCounter at ullFileTime.
+            int64_t     llFrequency;    // QueryPerformanceFrequency.
+        } session;
+
+        struct
+        {
+            uint32_t    cRecords;
+        } dropped;
+    };
+};
@@ -11,9 +11,16 @@
 
 
 #include "helpers.h"
+#include "AuthPackageCache.h"
+#include "PackedLogon.h"
+#include "PasswordProtector.h"
+#include "StringKernels.h"
+#include "StringPool.h"
 #include <intsafe.h>
 #include <wincred.h>
 
+static CredPasswordProtector g_ppCred;
+
 // 
 // Copies the field descriptor pointed to by rcpfd into a buffer allocated 
 // using CoTaskMemAlloc. Returns that buffer in ppcpfd.
@@ -109,7 +116,7 @@ HRESULT UnicodeStringInitWithString(
     HRESULT hr;
     if (pwz)
     {
-        size_t lenString = lstrlen(pwz);
+        size_t lenString = StrLenW(pwz, (USHORT_MAX / sizeof(WCHAR)) + 1);
         USHORT usCharCount;
         hr = SizeTToUShort(lenString, &usCharCount);
         if (SUCCEEDED(hr))
@@ -159,6 +166,39 @@ static void _UnicodeStringPackedUnicodeStringCopy(
     CopyMemory(pus->Buffer, rus.Buffer, pus->Length);
 }
 
+//
+// Picks the KERB_LOGON_SUBMIT_TYPE that goes with a usage scenario.
+//
+static HRESULT _KerbLogonSubmitTypeFromUsageScenario(
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __out KERB_LOGON_SUBMIT_TYPE* pMessageType
+    )
+{
+    HRESULT hr;
+    switch (cpus)
+    {
+    case CPUS_UNLOCK_WORKSTATION:
+        *pMessageType = KerbWorkstationUnlockLogon;
+        hr = S_OK;
+        break;
+
+    case CPUS_LOGON:
+        *pMessageType = KerbInteractiveLogon;
+        hr = S_OK;
+        break;
+
+    case CPUS_CREDUI:
+        *pMessageType = (KERB_LOGON_SUBMIT_TYPE)0; // MessageType does not apply to CredUI
+        hr = S_OK;
+        break;
+
+    default:
+        hr = E_FAIL;
+        break;
+    }
+    return hr;
+}
+
 //
 // Initialize the members of a KERB_INTERACTIVE_UNLOCK_LOGON with weak references to the
 // passed-in strings.  This is useful if you will later use KerbInteractiveUnlockLogonPack
@@ -204,28 +244,7 @@ HRESULT KerbInteractiveUnlockLogonInit(
             if (SUCCEEDED(hr))
             {
                 // Set a MessageType based on the usage scenario.
-                switch (cpus)
-                {
-                case CPUS_UNLOCK_WORKSTATION:
-                    pkil->MessageType = KerbWorkstationUnlockLogon;
-                    hr = S_OK;
-                    break;
-
-                case CPUS_LOGON:
-                    pkil->MessageType = KerbInteractiveLogon;
-                    hr = S_OK;
-                    break;
-
-                case CPUS_CREDUI:
-                    pkil->MessageType = (KERB_LOGON_SUBMIT_TYPE)0; // MessageType does not apply to CredUI
-                    hr = S_OK;
-                    break;
-
-                default:
-                    hr = E_FAIL;
-                    break;
-                }
-
+                hr = _KerbLogonSubmitTypeFromUsageScenario(cpus, &pkil->MessageType);
                 if (SUCCEEDED(hr))
                 {
                     // KERB_INTERACTIVE_UNLOCK_LOGON is just a series of structures.  A
@@ -276,7 +295,9 @@ HRESULT KerbInteractiveUnlockLogonPack(
     KERB_INTERACTIVE_UNLOCK_LOGON* pkiulOut = (KERB_INTERACTIVE_UNLOCK_LOGON*)CoTaskMemAlloc(cb);
     if (pkiulOut)
     {
-        ZeroMemory(&pkiulOut->LogonId, sizeof(pkiulOut->LogonId));
+        // The whole header, so that none of CoTaskMemAlloc's leftovers go to the LSA in the
+        // padding between its members.
+        ZeroMemory(pkiulOut, sizeof(*pkiulOut));
 
         //
         // point pbBuffer at the beginning of the extra space
@@ -319,125 +340,189 @@ HRESULT KerbInteractiveUnlockLogonPack(
     return hr;
 }
 
-// 
-// This function packs the string pszSourceString in pszDestinationString
-// for use with LSA functions including LsaLookupAuthenticationPackage.
 //
-static HRESULT _LsaInitString(
-    __out PSTRING pszDestinationString, 
-    __in PCSTR pszSourceString
+// Copies cb bytes of pwz to *ppbBuffer, points pus at the copy using an offset relative to
+// pbBase, and advances *ppbBuffer past the copied bytes.
+//
+static void _UnicodeStringPackAt(
+    __in PCWSTR pwz,
+    __in USHORT cb,
+    __in const BYTE* pbBase,
+    __inout BYTE** ppbBuffer,
+    __out UNICODE_STRING* pus
     )
 {
-    size_t cchLength = lstrlenA(pszSourceString);
-    USHORT usLength;
-    HRESULT hr = SizeTToUShort(cchLength, &usLength);
-    if (SUCCEEDED(hr))
-    {
-        pszDestinationString->Buffer = (PCHAR)pszSourceString;
-        pszDestinationString->Length = usLength;
-        pszDestinationString->MaximumLength = pszDestinationString->Length+1;
-        hr = S_OK;
-    }
-    return hr;
+    pus->Length = cb;
+    pus->MaximumLength = cb;
+    pus->Buffer = (PWSTR)(*ppbBuffer - pbBase);
+
+    CopyMemory(*ppbBuffer, pwz, cb);
+    *ppbBuffer += cb;
 }
 
 //
-// Retrieves the 'negotiate' AuthPackage from the LSA. In this case, Kerberos
-// For more information on auth packages see this msdn page:
-// http://msdn.microsoft.com/library/default.asp?url=/library/en-us/secauthn/security/msv1_0_lm20_logon.asp
+// Measures a NULL-terminated string for use in a UNICODE_STRING.  The returned length is in
+// bytes and does not include the NULL terminator.  Fails if the string is too long to be
+// described by a UNICODE_STRING.
 //
-HRESULT RetrieveNegotiateAuthPackage(__out ULONG *pulAuthPackage)
+static HRESULT _UnicodeStringMeasure(
+    __in PCWSTR pwz,
+    __out USHORT* pcb
+    )
 {
     HRESULT hr;
-    HANDLE hLsa;
-
-    NTSTATUS status = LsaConnectUntrusted(&hLsa);
-    if (SUCCEEDED(HRESULT_FROM_NT(status)))
+    if (pwz)
     {
-        ULONG ulAuthPackage;
-        LSA_STRING lsaszKerberosName;
-        _LsaInitString(&lsaszKerberosName, NEGOSSP_NAME_A);
-
-        status = LsaLookupAuthenticationPackage(hLsa, &lsaszKerberosName, &ulAuthPackage);
-        if (SUCCEEDED(HRESULT_FROM_NT(status)))
+        size_t cch = StrLenW(pwz, (USHORT_MAX / sizeof(WCHAR)) + 1);
+        if (cch <= USHORT_MAX / sizeof(WCHAR))
         {
-            *pulAuthPackage = ulAuthPackage;
+            *pcb = (USHORT)(cch * sizeof(WCHAR));
             hr = S_OK;
         }
         else
         {
-            hr = HRESULT_FROM_NT(status);
+            hr = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
         }
-        LsaDeregisterLogonProcess(hLsa);
     }
     else
     {
-        hr = HRESULT_FROM_NT(status);
+        hr = E_INVALIDARG;
     }
-
     return hr;
 }
 
 //
-// Return a copy of pwzToProtect encrypted with the CredProtect API.
+// Builds a packed KERB_INTERACTIVE_UNLOCK_LOGON directly from the three strings.  This produces
+// the same buffer as KerbInteractiveUnlockLogonInit followed by KerbInteractiveUnlockLogonPack,
+// but each string is measured once and copied once, straight into the single CoTaskMemAlloc'd
+// buffer that is handed back to the caller.
 //
-// pwzToProtect must not be NULL or the empty string.
+// As with KerbInteractiveUnlockLogonInit, pwzPassword should already be protected if the usage
+// scenario calls for it.
 //
-static HRESULT _ProtectAndCopyString(
-    __in PCWSTR pwzToProtect, 
-    __deref_out PWSTR* ppwzProtected
+HRESULT KerbInteractiveUnlockLogonSerialize(
+    __in PCWSTR pwzDomain,
+    __in PCWSTR pwzUsername,
+    __in PCWSTR pwzPassword,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __deref_out_bcount(*pcb) BYTE** prgb,
+    __out DWORD* pcb
     )
 {
-    *ppwzProtected = NULL;
+    *prgb = NULL;
+    *pcb = 0;
 
-    // pwzToProtect is const, but CredProtect takes a non-const string.
-    // So, ake a copy that we know isn't const.
-    PWSTR pwzToProtectCopy;
-    HRESULT hr = SHStrDupW(pwzToProtect, &pwzToProtectCopy);
+    KERB_LOGON_SUBMIT_TYPE messageType;
+    HRESULT hr = _KerbLogonSubmitTypeFromUsageScenario(cpus, &messageType);
     if (SUCCEEDED(hr))
     {
-        // The first call to CredProtect determines the length of the encrypted string.
-        // Because we pass a NULL output buffer, we expect the call to fail.
-        //
-        // Note that the third parameter to CredProtect, the number of characters of pwzToProtectCopy
-        // to encrypt, must include the NULL terminator!
-        DWORD cchProtected = 0;
-        if (!CredProtectW(FALSE, pwzToProtectCopy, (DWORD)wcslen(pwzToProtectCopy)+1, NULL, &cchProtected, NULL))
+        USHORT cbDomain, cbUsername, cbPassword;
+        hr = _UnicodeStringMeasure(pwzDomain, &cbDomain);
+        if (SUCCEEDED(hr))
+        {
+            hr = _UnicodeStringMeasure(pwzUsername, &cbUsername);
+        }
+        if (SUCCEEDED(hr))
         {
-            DWORD dwErr = GetLastError();
+            hr = _UnicodeStringMeasure(pwzPassword, &cbPassword);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            // Each length fits in a USHORT, so the total cannot overflow a DWORD.
+            DWORD cb = sizeof(KERB_INTERACTIVE_UNLOCK_LOGON) + cbDomain + cbUsername + cbPassword;
 
-            if ((ERROR_INSUFFICIENT_BUFFER == dwErr) && (0 < cchProtected))
+            KERB_INTERACTIVE_UNLOCK_LOGON* pkiulOut = (KERB_INTERACTIVE_UNLOCK_LOGON*)CoTaskMemAlloc(cb);
+            if (pkiulOut)
             {
-                // Allocate a buffer long enough for the encrypted string.
-                PWSTR pwzProtected = (PWSTR)CoTaskMemAlloc(cchProtected * sizeof(WCHAR));
-                if (pwzProtected)
-                {
-                    // The second call to CredProtect actually encrypts the string.
-                    if (CredProtectW(FALSE, pwzToProtectCopy, (DWORD)wcslen(pwzToProtectCopy)+1, pwzProtected, &cchProtected, NULL))
-                    {
-                        *ppwzProtected = pwzProtected;
-                        hr = S_OK;
-                    }
-                    else
-                    {
-                        CoTaskMemFree(pwzProtected);
-
-                        dwErr = GetLastError();
-                        hr = HRESULT_FROM_WIN32(dwErr);
-                    }
-                }
-                else
-                {
-                    hr = E_OUTOFMEMORY;
-                }
+                ZeroMemory(pkiulOut, sizeof(*pkiulOut));
+
+                KERB_INTERACTIVE_LOGON* pkilOut = &pkiulOut->Logon;
+                pkilOut->MessageType = messageType;
+
+                BYTE* pbBuffer = (BYTE*)pkiulOut + sizeof(*pkiulOut);
+                _UnicodeStringPackAt(pwzDomain, cbDomain, (BYTE*)pkiulOut, &pbBuffer, &pkilOut->LogonDomainName);
+                _UnicodeStringPackAt(pwzUsername, cbUsername, (BYTE*)pkiulOut, &pbBuffer, &pkilOut->UserName);
+                _UnicodeStringPackAt(pwzPassword, cbPassword, (BYTE*)pkiulOut, &pbBuffer, &pkilOut->Password);
+
+                *prgb = (BYTE*)pkiulOut;
+                *pcb = cb;
             }
             else
             {
-                hr = HRESULT_FROM_WIN32(dwErr);
+                hr = E_OUTOFMEMORY;
+            }
+        }
+    }
+
+    return hr;
+}
+
+//
+// Retrieves the 'negotiate' AuthPackage from the LSA. In this case, Kerberos
+// For more information on auth packages see this msdn page:
+// http://msdn.microsoft.com/library/default.asp?url=/library/en-us/secauthn/security/msv1_0_lm20_logon.asp
+//
+HRESULT RetrieveNegotiateAuthPackage(__out ULONG *pulAuthPackage)
+{
+    // The id doesn't change while the LSA is running, so it's only looked up once.
+    return AuthPackageCacheLookup(NEGOSSP_NAME_A, pulAuthPackage);
+}
+
+//
+// Return a copy of pwzToProtect encrypted by ppp.
+//
+// pwzToProtect is cch characters long, not counting its terminator, and must not be empty.
+// Protect takes a non-const string, so it's the caller's scratch copy. The output buffer is
+// sized from the protector's bound, so it's encrypted in a single call.
+//
+static HRESULT _ProtectAndCopyString(
+    __in PasswordProtector* ppp,
+    __in_ecount(cch + 1) PWSTR pwzToProtect,
+    __in DWORD cch,
+    __deref_out PWSTR* ppwzProtected
+    )
+{
+    *ppwzProtected = NULL;
+
+    // Note that the number of characters of pwzToProtect to encrypt must include the NULL
+    // terminator!
+    DWORD cchProtected;
+    HRESULT hr = ppp->GetProtectedCchMax(cch + 1, &cchProtected);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    PWSTR pwzProtected = (PWSTR)CoTaskMemAlloc(cchProtected * sizeof(WCHAR));
+    hr = (pwzProtected != NULL) ? S_OK : E_OUTOFMEMORY;
+
+    DWORD cchBuffer = cchProtected;
+    if (SUCCEEDED(hr))
+    {
+        hr = ppp->Protect(pwzToProtect, cch + 1, pwzProtected, &cchProtected);
+
+        // The bound was short after all. The protector has told us what it needs, so this is the
+        // last try.
+        if ((HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER) == hr) && (cchProtected > cchBuffer))
+        {
+            CoTaskMemFree(pwzProtected);
+            pwzProtected = (PWSTR)CoTaskMemAlloc(cchProtected * sizeof(WCHAR));
+            hr = E_OUTOFMEMORY;
+            if (pwzProtected)
+            {
+                hr = ppp->Protect(pwzToProtect, cch + 1, pwzProtected, &cchProtected);
             }
         }
+    }
 
-        CoTaskMemFree(pwzToProtectCopy);
+    if (SUCCEEDED(hr))
+    {
+        *ppwzProtected = pwzProtected;
+    }
+    else
+    {
+        CoTaskMemFree(pwzProtected);
     }
 
     return hr;
@@ -454,51 +539,79 @@ HRESULT ProtectIfNecessaryAndCopyPassword(
     __deref_out PWSTR* ppwzProtectedPassword
     )
 {
-    *ppwzProtectedPassword = NULL;
+    return ProtectIfNecessaryAndCopyPassword(&g_ppCred, pwzPassword, cpus, ppwzProtectedPassword);
+}
 
-    HRESULT hr;
+//
+// The same, with ppp in place of CredIsProtected and CredProtect.
+//
+HRESULT ProtectIfNecessaryAndCopyPassword(
+    __in PasswordProtector* ppp,
+    __in PCWSTR pwzPassword,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __deref_out PWSTR* ppwzProtectedPassword
+    )
+{
+    *ppwzProtectedPassword = NULL;
 
     // ProtectAndCopyString is intended for non-empty strings only.  Empty passwords
     // do not need to be encrypted.
-    if (pwzPassword && *pwzPassword)
+    if (!pwzPassword || !*pwzPassword)
     {
-        // pwzPassword is const, but CredIsProtected takes a non-const string.
-        // So, ake a copy that we know isn't const.
-        PWSTR pwzPasswordCopy;
-        hr = SHStrDupW(pwzPassword, &pwzPasswordCopy);
-        if (SUCCEEDED(hr))
+        return SHStrDupW(L"", ppwzProtectedPassword);
+    }
+
+    size_t cch = StrLenW(pwzPassword, STRSAFE_MAX_CCH);
+    if (cch == STRSAFE_MAX_CCH)
+    {
+        return E_INVALIDARG;
+    }
+
+    // pwzPassword is const, but CredIsProtected and CredProtect take non-const strings.
+    // So, make the one copy they both use, on the stack unless the password is unusually
+    // long, and wipe it when we're done.
+    WCHAR wszScratch[CREDUI_MAX_PASSWORD_LENGTH + 1];
+    PWSTR pwzScratch = wszScratch;
+    if (cch >= ARRAYSIZE(wszScratch))
+    {
+        pwzScratch = (PWSTR)HeapAlloc(GetProcessHeap(), 0, (cch + 1) * sizeof(WCHAR));
+        if (!pwzScratch)
         {
-            bool bCredAlreadyEncrypted = false;
-            CRED_PROTECTION_TYPE protectionType;
+            return E_OUTOFMEMORY;
+        }
+    }
+    CopyMemory(pwzScratch, pwzPassword, (cch + 1) * sizeof(WCHAR));
 
-            // If the password is already encrypted, we should not encrypt it again.
-            // An encrypted password may be received through SetSerialization in the 
-            // CPUS_LOGON scenario during a Terminal Services connection, for instance.
-            if (CredIsProtectedW(pwzPasswordCopy, &protectionType))
-            {
-                if(CredUnprotected != protectionType)
-                {
-                    bCredAlreadyEncrypted = true;
-                }
-            }
+    bool bCredAlreadyEncrypted = false;
+    CRED_PROTECTION_TYPE protectionType;
 
-            // Passwords should not be encrypted in the CPUS_CREDUI scenario.  We
-            // cannot know if our caller expects or can handle an encryped password.
-            if (CPUS_CREDUI == cpus || bCredAlreadyEncrypted)
-            {
-                hr = SHStrDupW(pwzPasswordCopy, ppwzProtectedPassword);
-            }
-            else
-            {
-                hr = _ProtectAndCopyString(pwzPasswordCopy, ppwzProtectedPassword);
-            }
-            
-            CoTaskMemFree(pwzPasswordCopy);
+    // If the password is already encrypted, we should not encrypt it again.
+    // An encrypted password may be received through SetSerialization in the 
+    // CPUS_LOGON scenario during a Terminal Services connection, for instance.
+    if (SUCCEEDED(ppp->IsProtected(pwzScratch, &protectionType)))
+    {
+        if(CredUnprotected != protectionType)
+        {
+            bCredAlreadyEncrypted = true;
         }
     }
+
+    // Passwords should not be encrypted in the CPUS_CREDUI scenario.  We
+    // cannot know if our caller expects or can handle an encryped password.
+    HRESULT hr;
+    if (CPUS_CREDUI == cpus || bCredAlreadyEncrypted)
+    {
+        hr = CoTaskMemDupCch(pwzPassword, cch, ppwzProtectedPassword);
+    }
     else
     {
-        hr = SHStrDupW(L"", ppwzProtectedPassword);
+        hr = _ProtectAndCopyString(ppp, pwzScratch, (DWORD)cch, ppwzProtectedPassword);
+    }
+
+    SecureZeroMemory(pwzScratch, (cch + 1) * sizeof(WCHAR));
+    if (pwzScratch != wszScratch)
+    {
+        HeapFree(GetProcessHeap(), 0, pwzScratch);
     }
 
     return hr;
@@ -514,34 +627,23 @@ void KerbInteractiveUnlockLogonUnpackInPlace(
     __in DWORD cb
     )
 {
-    if (sizeof(*pkiul) <= cb)
+    // If every string lies within the blob, the Buffers are offsets and this is a packed
+    // credential. Otherwise it's left alone: it may have been unpacked already.
+    PACKED_LOGON_VIEW plv;
+    if (SUCCEEDED(PackedLogonView((const BYTE*)pkiul, cb, FALSE, &plv)))
     {
         KERB_INTERACTIVE_LOGON* pkil = &pkiul->Logon;
-
-        // Sanity check: if the range described by each (Buffer + MaximumSize) falls within the total bytecount,
-        // we can be pretty confident that the Buffers are actually offsets and that this is a packed credential.
-        if (((ULONG_PTR)pkil->LogonDomainName.Buffer + pkil->LogonDomainName.MaximumLength <= cb) &&
-            ((ULONG_PTR)pkil->UserName.Buffer + pkil->UserName.MaximumLength <= cb) &&
-            ((ULONG_PTR)pkil->Password.Buffer + pkil->Password.MaximumLength <= cb))
-        {
-            pkil->LogonDomainName.Buffer = pkil->LogonDomainName.Buffer
-                ? (PWSTR)((BYTE*)pkiul + (ULONG_PTR)pkil->LogonDomainName.Buffer)
-                : NULL;
-
-            pkil->UserName.Buffer = pkil->UserName.Buffer
-                ? (PWSTR)((BYTE*)pkiul + (ULONG_PTR)pkil->UserName.Buffer)
-                : NULL;
-
-            pkil->Password.Buffer = pkil->Password.Buffer 
-                ? (PWSTR)((BYTE*)pkiul + (ULONG_PTR)pkil->Password.Buffer)
-                : NULL;
-        }
+        pkil->LogonDomainName.Buffer = const_cast<PWSTR>(plv.psDomain.pwch);
+        pkil->UserName.Buffer = const_cast<PWSTR>(plv.psUserName.pwch);
+        pkil->Password.Buffer = const_cast<PWSTR>(plv.psPassword.pwch);
     }
 }
 
 //
-// Use the CredPackAuthenticationBuffer and CredUnpackAuthenticationBuffer to convert a 32 bit WOW
-// cred blob into a 64 bit native blob by unpacking it and immediately repacking it.
+// Converts a 32 bit WOW cred blob into a 64 bit native blob.  The WOW blob is checked by
+// PackedLogonView and its strings are copied once, straight into the single LocalAlloc'd
+// buffer that is handed back to the caller, so the password is never copied anywhere else.
+// The message type and logon id are carried over as they are.
 //
 HRESULT KerbInteractiveUnlockLogonRepackNative(
     __in_bcount(cbWow) BYTE* rgbWow,
@@ -549,65 +651,41 @@ HRESULT KerbInteractiveUnlockLogonRepackNative(
     __deref_out_bcount(*pcbNative) BYTE** prgbNative,
     __out DWORD* pcbNative)
 {
-    HRESULT hr = E_OUTOFMEMORY;
-    PWSTR pszDomainUsername = NULL;
-    DWORD cchDomainUsername = 0;
-    PWSTR pszPassword = NULL;
-    DWORD cchPassword = 0;
-
     *prgbNative = NULL;
     *pcbNative = 0;
 
-    // Unpack the 32 bit KERB structure
-    CredUnPackAuthenticationBufferW(CRED_PACK_WOW_BUFFER, rgbWow, cbWow, pszDomainUsername, &cchDomainUsername, NULL, NULL, pszPassword, &cchPassword);
-    if (ERROR_INSUFFICIENT_BUFFER == GetLastError())
+    PACKED_LOGON_VIEW plv;
+    HRESULT hr = PackedLogonView(rgbWow, cbWow, TRUE, &plv);
+    if (SUCCEEDED(hr))
     {
-        pszDomainUsername = (PWSTR) LocalAlloc(0, cchDomainUsername * sizeof(WCHAR));
-        if (pszDomainUsername)
+        USHORT cbDomain = plv.psDomain.cch * sizeof(WCHAR);
+        USHORT cbUsername = plv.psUserName.cch * sizeof(WCHAR);
+        USHORT cbPassword = plv.psPassword.cch * sizeof(WCHAR);
+
+        // Each length fits in a USHORT, so the total cannot overflow a DWORD.
+        DWORD cb = sizeof(KERB_INTERACTIVE_UNLOCK_LOGON) + cbDomain + cbUsername + cbPassword;
+
+        KERB_INTERACTIVE_UNLOCK_LOGON* pkiulOut = (KERB_INTERACTIVE_UNLOCK_LOGON*)LocalAlloc(LMEM_ZEROINIT, cb);
+        if (pkiulOut)
         {
-            pszPassword = (PWSTR) LocalAlloc(0, cchPassword * sizeof(WCHAR));
-            if (pszPassword)
-            {
-                if (CredUnPackAuthenticationBufferW(CRED_PACK_WOW_BUFFER, rgbWow, cbWow, pszDomainUsername, &cchDomainUsername, NULL, NULL, pszPassword, &cchPassword))
-                {
-                    hr = S_OK;
-                }
-                else
-                {
-                    hr = GetLastError();
-                }
-            }
-        }
-    }
+            KERB_INTERACTIVE_LOGON* pkilOut = &pkiulOut->Logon;
+            pkilOut->MessageType = plv.MessageType;
+            pkiulOut->LogonId = plv.LogonId;
 
-    // Repack native
-    if (SUCCEEDED(hr))
-    {
-        hr = E_OUTOFMEMORY;
-        CredPackAuthenticationBufferW(0, pszDomainUsername, pszPassword, *prgbNative, pcbNative);
-        if (ERROR_INSUFFICIENT_BUFFER == GetLastError())
+            BYTE* pbBuffer = (BYTE*)pkiulOut + sizeof(*pkiulOut);
+            _UnicodeStringPackAt(plv.psDomain.pwch, cbDomain, (BYTE*)pkiulOut, &pbBuffer, &pkilOut->LogonDomainName);
+            _UnicodeStringPackAt(plv.psUserName.pwch, cbUsername, (BYTE*)pkiulOut, &pbBuffer, &pkilOut->UserName);
+            _UnicodeStringPackAt(plv.psPassword.pwch, cbPassword, (BYTE*)pkiulOut, &pbBuffer, &pkilOut->Password);
+
+            *prgbNative = (BYTE*)pkiulOut;
+            *pcbNative = cb;
+        }
+        else
         {
-            *prgbNative = (BYTE*) LocalAlloc(LMEM_ZEROINIT, *pcbNative);
-            if (*prgbNative)
-            {
-                if (CredPackAuthenticationBufferW(0, pszDomainUsername, pszPassword, *prgbNative, pcbNative))
-                {
-                    hr = S_OK;
-                }
-                else
-                {
-                    LocalFree(*prgbNative);
-                }
-            }
+            hr = E_OUTOFMEMORY;
         }
     }
 
-    LocalFree(pszDomainUsername);
-    if (pszPassword)
-    {
-        SecureZeroMemory(pszPassword, cchPassword * sizeof(WCHAR));
-        LocalFree(pszPassword);
-    }
     return hr;
 }
 
@@ -619,14 +697,14 @@ HRESULT DomainUsernameStringAlloc(
     )
 {
     HRESULT hr;
-    size_t cchDomain = lstrlen(pwszDomain);
-    size_t cchUsername = lstrlen(pwszUsername);
+    size_t cchDomain = StrLenW(pwszDomain, STRSAFE_MAX_CCH);
+    size_t cchUsername = StrLenW(pwszUsername, STRSAFE_MAX_CCH);
     // Length of domain, 1 character for '\', length of Username, plus null terminator. 
-    size_t cbLen = sizeof(WCHAR) * (cchDomain + 1 + cchUsername +1);
-    PWSTR pwszDest = (PWSTR)HeapAlloc(GetProcessHeap(), 0, cbLen);
+    size_t cchLen = cchDomain + 1 + cchUsername + 1;
+    PWSTR pwszDest = (PWSTR)HeapAlloc(GetProcessHeap(), 0, cchLen * sizeof(WCHAR));
     if (pwszDest)
     {
-        hr = StringCbPrintfW(pwszDest, cbLen, L"%s\\%s", pwszDomain, pwszUsername);
+        hr = StrJoinW(pwszDest, cchLen, pwszDomain, cchDomain, L'\\', pwszUsername, cchUsername);
         if (SUCCEEDED(hr))
         {
             *ppwszDomainUsername = pwszDest;
@@ -24,6 +24,8 @@
 #include <shlwapi.h>
 #pragma warning(pop)
 
+class PasswordProtector;
+
 //makes a copy of a field descriptor using CoTaskMemAlloc
 HRESULT FieldDescriptorCoAllocCopy(
     __in const CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR& rcpfd,
@@ -58,6 +60,16 @@ HRESULT KerbInteractiveUnlockLogonPack(
     __out DWORD* pcb
     );
 
+//initializes and packs a KERB_INTERACTIVE_UNLOCK_LOGON in a single pass and a single allocation
+HRESULT KerbInteractiveUnlockLogonSerialize(
+    __in PCWSTR pwzDomain,
+    __in PCWSTR pwzUsername,
+    __in PCWSTR pwzPassword,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __deref_out_bcount(*pcb) BYTE** prgb,
+    __out DWORD* pcb
+    );
+
 //get the authentication package that will be used for our logon attempt
 HRESULT RetrieveNegotiateAuthPackage(
     __out ULONG * pulAuthPackage
@@ -70,6 +82,15 @@ HRESULT ProtectIfNecessaryAndCopyPassword(
     __deref_out PWSTR* ppwzProtectedPassword
     );
 
+//encrypt a password (if necessary) with ppp and copy it; if not, just copy it
+HRESULT ProtectIfNecessaryAndCopyPassword(
+    __in PasswordProtector* ppp,
+    __in PCWSTR pwzPassword,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __deref_out PWSTR* ppwzProtectedPassword
+    );
+
+//checks a packed 32 bit WOW blob and repacks it in the native layout, in one LocalAlloc'd buffer
 HRESULT KerbInteractiveUnlockLogonRepackNative(
     __in_bcount(cbWow) BYTE* rgbWow,
     __in DWORD cbWow,
@@ -0,0 +1,235 @@
+#ifndef WIN32_NO_STATUS
+#include <ntstatus.h>
+#define WIN32_NO_STATUS
+#endif
+#include "helperstest.h"
+#include <string.h>
+#include "AuthPackageCache.h"
+
+#define APC_THREADS         8
+#define APC_PER_THREAD      1000
+
+static const struct
+{
+    PCSTR   pszName;
+    ULONG   ulAuthPackage;
+} s_rgFakePackages[] =
+{
+    { "Negotiate",  7 },
+    { "Kerberos",   2 },
+    { "NTLM",       1 },
+    { "Schannel",   11 },
+    { "CredSSP",    12 },
+    { "Negotiate_Extender_With_A_Very_Long_Name", 13 },
+};
+
+// An LSA that knows a few packages, counts what it's asked, and can be told to refuse.
+class FakeLsaClient : public LsaClient
+{
+  public:
+    FakeLsaClient() :
+        cConnects(0),
+        cLookups(0),
+        cDeregisters(0),
+        bStaleHandle(FALSE),
+        statusConnect(STATUS_SUCCESS),
+        statusLookup(STATUS_SUCCESS),
+        dwLookupDelay(0),
+        _hLsa(NULL)
+    {
+    }
+
+    NTSTATUS Connect(__out HANDLE* phLsa)
+    {
+        cConnects++;
+        if (statusConnect != STATUS_SUCCESS)
+        {
+            return statusConnect;
+        }
+        if (_hLsa != NULL)
+        {
+            // A second connection while the first is still open.
+            bStaleHandle = TRUE;
+        }
+        _hLsa = reinterpret_cast<HANDLE>(static_cast<ULONG_PTR>(cConnects));
+        *phLsa = _hLsa;
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS LookupAuthenticationPackage(
+        __in HANDLE hLsa,
+        __in PLSA_STRING plsaszName,
+        __out ULONG* pulAuthPackage
+        )
+    {
+        cLookups++;
+        if (hLsa == NULL || hLsa != _hLsa)
+        {
+            bStaleHandle = TRUE;
+        }
+        if (dwLookupDelay != 0)
+        {
+            Sleep(dwLookupDelay);
+        }
+        if (statusLookup != STATUS_SUCCESS)
+        {
+            return statusLookup;
+        }
+        for (DWORD i = 0; i < ARRAYSIZE(s_rgFakePackages); i++)
+        {
+            if (lstrlenA(s_rgFakePackages[i].pszName) == plsaszName->Length &&
+                memcmp(s_rgFakePackages[i].pszName, plsaszName->Buffer, plsaszName->Length) == 0)
+            {
+                *pulAuthPackage = s_rgFakePackages[i].ulAuthPackage;
+                return STATUS_SUCCESS;
+            }
+        }
+        return STATUS_NO_SUCH_PACKAGE;
+    }
+
+    NTSTATUS Deregister(__in HANDLE hLsa)
+    {
+        cDeregisters++;
+        if (hLsa == NULL || hLsa != _hLsa)
+        {
+            bStaleHandle = TRUE;
+        }
+        _hLsa = NULL;
+        return STATUS_SUCCESS;
+    }
+
+    BOOL IsConnected() { return _hLsa != NULL; }
+
+    DWORD       cConnects;
+    DWORD       cLookups;
+    DWORD       cDeregisters;
+    BOOL        bStaleHandle;       // Whether the cache ever used a connection that wasn't open.
+    NTSTATUS    statusConnect;
+    NTSTATUS    statusLookup;
+    DWORD       dwLookupDelay;      // How long a lookup takes, in milliseconds.
+
+  private:
+    HANDLE      _hLsa;
+};
+
+// Set once every thread is ready, so they all ask at once.
+static volatile LONG s_fStart = FALSE;
+
+struct APC_THREAD
+{
+    AuthPackageCache*   papc;
+    BOOL                bMatches;   // Whether every lookup gave back Negotiate's id.
+};
+
+static DWORD WINAPI _LookupThread(__in void* pv)
+{
+    APC_THREAD* pat = static_cast<APC_THREAD*>(pv);
+    while (!s_fStart)
+    {
+        Sleep(0);
+    }
+    for (DWORD i = 0; i < APC_PER_THREAD; i++)
+    {
+        ULONG ulAuthPackage;
+        if (FAILED(pat->papc->Lookup("Negotiate", &ulAuthPackage)) || ulAuthPackage != 7)
+        {
+            pat->bMatches = FALSE;
+        }
+    }
+    return 0;
+}
+
+void TestAuthPackageCache()
+{
+    FakeLsaClient lc;
+    AuthPackageCache apc(&lc);
+    ULONG ulAuthPackage;
+
+    // The first lookup connects and asks; the ones after that don't go to the LSA.
+    HT_CHECK(apc.Lookup("Negotiate", &ulAuthPackage) == S_OK);
+    HT_CHECK(ulAuthPackage == 7);
+    HT_CHECK(apc.Lookup("Negotiate", &ulAuthPackage) == S_OK);
+    HT_CHECK(ulAuthPackage == 7);
+    HT_CHECK(lc.cConnects == 1 && lc.cLookups == 1);
+    HT_CHECK(apc.GetLookupCount() == 1 && apc.GetHitCount() == 1);
+
+    // Another name is looked up on the same connection.
+    HT_CHECK(apc.Lookup("Kerberos", &ulAuthPackage) == S_OK);
+    HT_CHECK(ulAuthPackage == 2);
+    HT_CHECK(lc.cConnects == 1 && lc.cLookups == 2);
+    HT_CHECK(lc.IsConnected());
+
+    // A name the LSA doesn't know fails, isn't remembered, and drops the connection. The names
+    // already looked up still come from the cache.
+    HT_CHECK(apc.Lookup("NoSuchPackage", &ulAuthPackage) == HRESULT_FROM_NT(STATUS_NO_SUCH_PACKAGE));
+    HT_CHECK(ulAuthPackage == 0);
+    HT_CHECK(!lc.IsConnected() && lc.cDeregisters == 1);
+    HT_CHECK(apc.Lookup("Kerberos", &ulAuthPackage) == S_OK && ulAuthPackage == 2);
+    HT_CHECK(lc.cConnects == 1);
+    HT_CHECK(apc.Lookup("NoSuchPackage", &ulAuthPackage) == HRESULT_FROM_NT(STATUS_NO_SUCH_PACKAGE));
+    HT_CHECK(lc.cConnects == 2 && lc.cLookups == 4);
+
+    // Failing to connect isn't remembered either.
+    lc.statusConnect = STATUS_ACCESS_DENIED;
+    HT_CHECK(apc.Lookup("NTLM", &ulAuthPackage) == HRESULT_FROM_NT(STATUS_ACCESS_DENIED));
+    HT_CHECK(lc.cConnects == 3 && lc.cLookups == 4);
+    lc.statusConnect = STATUS_SUCCESS;
+    HT_CHECK(apc.Lookup("NTLM", &ulAuthPackage) == S_OK && ulAuthPackage == 1);
+    HT_CHECK(lc.cConnects == 4 && lc.cLookups == 5);
+
+    // Past AUTH_PACKAGE_MAX names, or a name too long to keep, each lookup goes to the LSA.
+    HT_CHECK(apc.Lookup("Schannel", &ulAuthPackage) == S_OK && ulAuthPackage == 11);
+    HT_CHECK(apc.Lookup("CredSSP", &ulAuthPackage) == S_OK && ulAuthPackage == 12);
+    HT_CHECK(apc.Lookup("CredSSP", &ulAuthPackage) == S_OK && ulAuthPackage == 12);
+    HT_CHECK(lc.cLookups == 8);
+    HT_CHECK(apc.Lookup("Schannel", &ulAuthPackage) == S_OK);
+    HT_CHECK(lc.cLookups == 8);
+
+    // Invalidating closes the connection and forgets every id.
+    apc.Invalidate();
+    HT_CHECK(!lc.IsConnected());
+    HT_CHECK(apc.Lookup("Negotiate", &ulAuthPackage) == S_OK && ulAuthPackage == 7);
+    HT_CHECK(lc.cConnects == 5 && lc.cLookups == 9);
+    HT_CHECK(apc.Lookup("Negotiate_Extender_With_A_Very_Long_Name", &ulAuthPackage) == S_OK && ulAuthPackage == 13);
+    HT_CHECK(apc.Lookup("Negotiate_Extender_With_A_Very_Long_Name", &ulAuthPackage) == S_OK && ulAuthPackage == 13);
+    HT_CHECK(lc.cLookups == 11);
+
+    // Invalidating an empty cache doesn't talk to the LSA.
+    apc.Invalidate();
+    DWORD cDeregisters = lc.cDeregisters;
+    apc.Invalidate();
+    HT_CHECK(lc.cDeregisters == cDeregisters);
+
+    // Many threads asking at once for a name nobody's looked up yet, with the LSA slow enough
+    // that they all miss the cache: the LSA is still asked only once.
+    DWORD cLookups = lc.cLookups;
+    lc.dwLookupDelay = 100;
+    APC_THREAD rgat[APC_THREADS];
+    HANDLE rghThreads[APC_THREADS];
+    DWORD cThreads = 0;
+    for (DWORD i = 0; i < APC_THREADS; i++)
+    {
+        rgat[i].papc = &apc;
+        rgat[i].bMatches = TRUE;
+        rghThreads[cThreads] = CreateThread(NULL, 0, _LookupThread, &rgat[i], 0, NULL);
+        if (rghThreads[cThreads] != NULL)
+        {
+            cThreads++;
+        }
+    }
+    HT_CHECK(cThreads == APC_THREADS);
+    Sleep(100);
+    InterlockedExchange(&s_fStart, TRUE);
+    WaitForMultipleObjects(cThreads, rghThreads, TRUE, INFINITE);
+    for (DWORD i = 0; i < cThreads; i++)
+    {
+        CloseHandle(rghThreads[i]);
+        HT_CHECK(rgat[i].bMatches);
+    }
+    HT_CHECK(lc.cLookups == cLookups + 1);
+
+    apc.Invalidate();
+    HT_CHECK(!lc.IsConnected());
+    HT_CHECK(lc.cConnects == lc.cDeregisters + 1);  // The one connection that failed was never opened.
+    HT_CHECK(!lc.bStaleHandle);
+}
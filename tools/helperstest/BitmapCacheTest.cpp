@@ -0,0 +1,244 @@
+#include "helperstest.h"
+#include "BitmapCache.h"
+
+// The resource bitmap is one color and the file another, so a copy shows where it came from.
+#define FAKE_FILE_COLOR     0xff0000ff
+#define FAKE_RESOURCE_COLOR 0xff00ff00
+
+#define BC_THREADS          8
+#define BC_PER_THREAD       50
+
+// A tile image that lives in memory. The test changes its stamp to stand in
+// for the file changing, and counts what the cache asks it to decode.
+class FakeTileImageSource : public TileImageSource
+{
+  public:
+    FakeTileImageSource() : cStamps(0), cFileDecodes(0), cResourceDecodes(0), bFileDecodes(TRUE), dwStampDelay(0)
+    {
+        ZeroMemory(&tis, sizeof(tis));
+    }
+
+    void GetStamp(__out TILE_IMAGE_STAMP* ptis)
+    {
+        InterlockedIncrement(&cStamps);
+        if (dwStampDelay != 0)
+        {
+            Sleep(dwStampDelay);
+        }
+        *ptis = tis;
+    }
+
+    HRESULT DecodeFile(__out HBITMAP* phbmp)
+    {
+        cFileDecodes++;
+        *phbmp = NULL;
+        return bFileDecodes ? _Make(FAKE_FILE_COLOR, phbmp) : E_FAIL;
+    }
+
+    HRESULT DecodeResource(__in UINT, __out HBITMAP* phbmp)
+    {
+        cResourceDecodes++;
+        return _Make(FAKE_RESOURCE_COLOR, phbmp);
+    }
+
+    TILE_IMAGE_STAMP    tis;
+    LONG                cStamps;
+    DWORD               cFileDecodes;
+    DWORD               cResourceDecodes;
+    BOOL                bFileDecodes;       // FALSE makes the file fail to decode.
+    DWORD               dwStampDelay;       // How long looking at the file takes, in milliseconds.
+
+  private:
+    static HRESULT _Make(__in DWORD dwColor, __out HBITMAP* phbmp)
+    {
+        BITMAPINFO bmi = {};
+        bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+        bmi.bmiHeader.biWidth = 4;
+        bmi.bmiHeader.biHeight = -4;
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        void* pvBits;
+        *phbmp = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &pvBits, NULL, 0);
+        if (*phbmp == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            static_cast<DWORD*>(pvBits)[i] = dwColor;
+        }
+        return S_OK;
+    }
+};
+
+// The color of the first pixel of a bitmap the cache handed out, which the caller then owns.
+static DWORD _ColorOf(__in HBITMAP hbmp)
+{
+    DIBSECTION ds;
+    DWORD dwColor = 0;
+    if (GetObject(hbmp, sizeof(ds), &ds) == sizeof(ds) && ds.dsBm.bmBits != NULL)
+    {
+        dwColor = *static_cast<DWORD*>(ds.dsBm.bmBits);
+    }
+    DeleteObject(hbmp);
+    return dwColor;
+}
+
+// Paints over a bitmap the cache handed out, which shouldn't touch the cache's own copy.
+static void _Scribble(__in HBITMAP hbmp)
+{
+    DIBSECTION ds;
+    if (GetObject(hbmp, sizeof(ds), &ds) == sizeof(ds) && ds.dsBm.bmBits != NULL)
+    {
+        FillMemory(ds.dsBm.bmBits, (SIZE_T)ds.dsBm.bmWidthBytes * ds.dsBm.bmHeight, 0x5a);
+    }
+}
+
+// Set once every thread is ready, so they all ask at once.
+static volatile LONG s_fStart = FALSE;
+
+struct BC_THREAD
+{
+    TileBitmapCache*    ptbc;
+    BOOL                bMatches;   // Whether every copy was the file's, and could be painted over.
+};
+
+static DWORD WINAPI _GetThread(__in void* pv)
+{
+    BC_THREAD* pbt = static_cast<BC_THREAD*>(pv);
+    while (!s_fStart)
+    {
+        Sleep(0);
+    }
+    for (DWORD i = 0; i < BC_PER_THREAD; i++)
+    {
+        HBITMAP hbmp;
+        BOOL bFromFile;
+        if (FAILED(pbt->ptbc->Get(1, &hbmp, &bFromFile)))
+        {
+            pbt->bMatches = FALSE;
+            continue;
+        }
+        DIBSECTION ds;
+        if (!bFromFile || GetObject(hbmp, sizeof(ds), &ds) != sizeof(ds) || *static_cast<DWORD*>(ds.dsBm.bmBits) != FAKE_FILE_COLOR)
+        {
+            pbt->bMatches = FALSE;
+        }
+        _Scribble(hbmp);
+        DeleteObject(hbmp);
+    }
+    return 0;
+}
+
+void TestBitmapCache()
+{
+    FakeTileImageSource ftis;
+    ftis.tis.bExists = TRUE;
+    ftis.tis.cb = 100;
+    ftis.tis.ftLastWrite.dwLowDateTime = 1;
+
+    TileBitmapCache tbc(&ftis, 0);
+    HBITMAP hbmp;
+    BOOL bFromFile;
+
+    // The first call decodes the file, and later ones copy it.
+    HT_CHECK(SUCCEEDED(tbc.Get(1, &hbmp, &bFromFile)) && bFromFile);
+    HT_CHECK(_ColorOf(hbmp) == FAKE_FILE_COLOR);
+    for (int i = 0; i < 10; i++)
+    {
+        HT_CHECK(SUCCEEDED(tbc.Get(1, &hbmp, NULL)));
+        HT_CHECK(_ColorOf(hbmp) == FAKE_FILE_COLOR);
+    }
+    HT_CHECK(ftis.cFileDecodes == 1 && ftis.cResourceDecodes == 0);
+
+    // A new timestamp, or a new size, means a new file.
+    ftis.tis.ftLastWrite.dwLowDateTime = 2;
+    HT_CHECK(SUCCEEDED(tbc.Get(1, &hbmp, NULL)) && _ColorOf(hbmp) == FAKE_FILE_COLOR);
+    ftis.tis.cb = 200;
+    HT_CHECK(SUCCEEDED(tbc.Get(1, &hbmp, NULL)) && _ColorOf(hbmp) == FAKE_FILE_COLOR);
+    HT_CHECK(ftis.cFileDecodes == 3);
+
+    // With the file gone the resource is used, once.
+    ftis.tis.bExists = FALSE;
+    HT_CHECK(SUCCEEDED(tbc.Get(1, &hbmp, &bFromFile)) && !bFromFile);
+    HT_CHECK(_ColorOf(hbmp) == FAKE_RESOURCE_COLOR);
+    HT_CHECK(SUCCEEDED(tbc.Get(1, &hbmp, NULL)) && _ColorOf(hbmp) == FAKE_RESOURCE_COLOR);
+    HT_CHECK(ftis.cResourceDecodes == 1);
+
+    // Asking for a different resource decodes that one.
+    HT_CHECK(SUCCEEDED(tbc.Get(2, &hbmp, NULL)) && _ColorOf(hbmp) == FAKE_RESOURCE_COLOR);
+    HT_CHECK(ftis.cResourceDecodes == 2);
+
+    // A file that won't decode falls back to the resource, and isn't tried again until it changes.
+    ftis.tis.bExists = TRUE;
+    ftis.bFileDecodes = FALSE;
+    HT_CHECK(SUCCEEDED(tbc.Get(2, &hbmp, &bFromFile)) && !bFromFile);
+    DeleteObject(hbmp);
+    HT_CHECK(SUCCEEDED(tbc.Get(2, &hbmp, NULL)));
+    DeleteObject(hbmp);
+    HT_CHECK(ftis.cFileDecodes == 4 && ftis.cResourceDecodes == 3);
+
+    ftis.bFileDecodes = TRUE;
+    ftis.tis.ftLastWrite.dwLowDateTime = 3;
+    HT_CHECK(SUCCEEDED(tbc.Get(2, &hbmp, &bFromFile)) && bFromFile);
+    DeleteObject(hbmp);
+
+    // With a stamp interval the source isn't asked on every call.
+    FakeTileImageSource ftisSlow;
+    TileBitmapCache tbcSlow(&ftisSlow, 60 * 1000);
+    for (int i = 0; i < 10; i++)
+    {
+        HT_CHECK(SUCCEEDED(tbcSlow.Get(1, &hbmp, NULL)));
+        DeleteObject(hbmp);
+    }
+    HT_CHECK(ftisSlow.cStamps == 1 && ftisSlow.cResourceDecodes == 1);
+
+    // Each caller gets a bitmap of its own: painting over one doesn't change the next.
+    HBITMAP hbmpOther;
+    HT_CHECK(SUCCEEDED(tbc.Get(2, &hbmp, NULL)));
+    _Scribble(hbmp);
+    HT_CHECK(SUCCEEDED(tbc.Get(2, &hbmpOther, NULL)));
+    HT_CHECK(hbmpOther != hbmp);
+    DeleteObject(hbmp);
+    HT_CHECK(_ColorOf(hbmpOther) == FAKE_FILE_COLOR);
+
+    // Freeing the cache means the next call decodes again.
+    DWORD cFileDecodes = ftis.cFileDecodes;
+    tbc.Free();
+    HT_CHECK(SUCCEEDED(tbc.Get(2, &hbmp, NULL)) && _ColorOf(hbmp) == FAKE_FILE_COLOR);
+    HT_CHECK(ftis.cFileDecodes == cFileDecodes + 1);
+    tbc.Free();
+    tbc.Free();
+
+    // Many threads asking at once for a file nobody has decoded yet, with the first look at it
+    // slow enough that they all find the cache empty: the file is still decoded only once.
+    FakeTileImageSource ftisShared;
+    ftisShared.tis.bExists = TRUE;
+    ftisShared.dwStampDelay = 100;
+    TileBitmapCache tbcShared(&ftisShared, 60 * 1000);
+    BC_THREAD rgbt[BC_THREADS];
+    HANDLE rghThreads[BC_THREADS];
+    DWORD cThreads = 0;
+    for (DWORD i = 0; i < BC_THREADS; i++)
+    {
+        rgbt[i].ptbc = &tbcShared;
+        rgbt[i].bMatches = TRUE;
+        rghThreads[cThreads] = CreateThread(NULL, 0, _GetThread, &rgbt[i], 0, NULL);
+        if (rghThreads[cThreads] != NULL)
+        {
+            cThreads++;
+        }
+    }
+    HT_CHECK(cThreads == BC_THREADS);
+    Sleep(100);
+    InterlockedExchange(&s_fStart, TRUE);
+    WaitForMultipleObjects(cThreads, rghThreads, TRUE, INFINITE);
+    for (DWORD i = 0; i < cThreads; i++)
+    {
+        CloseHandle(rghThreads[i]);
+        HT_CHECK(rgbt[i].bMatches);
+    }
+    HT_CHECK(ftisShared.cFileDecodes == 1 && ftisShared.cResourceDecodes == 0);
+}
@@ -0,0 +1,452 @@
+#include "helperstest.h"
+#include "BmpDecoder.h"
+
+#define BD_CB_HEADERS       (sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER))
+#define BD_PADDING          0xcd
+#define BD_SEED             0x5eed0003
+#define BD_BENCH_CX         3000
+#define BD_BENCH_CY         2000
+#define BD_BENCH_ROUNDS     20
+
+// What a test image looks like. Its pixels come from _Random, seeded with ulSeed, so two images
+// with the same seed and size have the same pixels whichever way up they're stored.
+struct BD_SPEC
+{
+    UINT    cx;
+    UINT    cy;
+    WORD    wBitCount;
+    BOOL    bTopDown;
+    BOOL    bAlpha;         // 32bpp only: whether the fourth byte is alpha or left at zero.
+    BOOL    bMasks;         // 32bpp only: BI_BITFIELDS with the BGRX masks rather than BI_RGB.
+    ULONG   ulSeed;
+};
+
+// A .bmp file image on the process heap.
+struct BD_IMAGE
+{
+    BYTE*   pb;
+    SIZE_T  cb;
+};
+
+static ULONG _Random(__inout ULONG* pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return (*pulState >> 16) & 0x7fff;
+}
+
+static UINT _CbStride(__in const BD_SPEC& spec)
+{
+    return ((spec.cx * spec.wBitCount + 31) / 32) * 4;
+}
+
+// The four bytes of source pixel (x, y), counting y from the top. When ulSeed is zero every
+// pixel is the same.
+static void _SourcePixel(__in const BD_SPEC& spec, __in UINT x, __in UINT y, __out BYTE rgb[4])
+{
+    ULONG ulState = (spec.ulSeed != 0) ? spec.ulSeed + (y * spec.cx + x) * 2654435761u : 0;
+    for (int c = 0; c < 4; c++)
+    {
+        rgb[c] = (BYTE)(_Random(&ulState) >> 3);
+    }
+    if (spec.wBitCount == 32 && !spec.bAlpha)
+    {
+        rgb[3] = 0;
+    }
+}
+
+// Builds the image spec describes, with the padding at the end of each row filled with
+// BD_PADDING so a decoder that reads it shows.
+static BOOL _MakeImage(__in const BD_SPEC& spec, __out BD_IMAGE* pimg)
+{
+    SIZE_T cbMasks = spec.bMasks ? 3 * sizeof(DWORD) : 0;
+    SIZE_T cbOffBits = BD_CB_HEADERS + cbMasks;
+    UINT cbStride = _CbStride(spec);
+
+    pimg->cb = cbOffBits + (SIZE_T)cbStride * spec.cy;
+    pimg->pb = (BYTE*)HeapAlloc(GetProcessHeap(), 0, pimg->cb);
+    if (pimg->pb == NULL)
+    {
+        return FALSE;
+    }
+
+    BITMAPFILEHEADER bfh;
+    ZeroMemory(&bfh, sizeof(bfh));
+    bfh.bfType = 0x4D42;
+    bfh.bfSize = (DWORD)pimg->cb;
+    bfh.bfOffBits = (DWORD)cbOffBits;
+    CopyMemory(pimg->pb, &bfh, sizeof(bfh));
+
+    BITMAPINFOHEADER bih;
+    ZeroMemory(&bih, sizeof(bih));
+    bih.biSize = sizeof(bih);
+    bih.biWidth = (LONG)spec.cx;
+    bih.biHeight = spec.bTopDown ? -(LONG)spec.cy : (LONG)spec.cy;
+    bih.biPlanes = 1;
+    bih.biBitCount = spec.wBitCount;
+    bih.biCompression = spec.bMasks ? BI_BITFIELDS : BI_RGB;
+    CopyMemory(pimg->pb + sizeof(bfh), &bih, sizeof(bih));
+
+    if (spec.bMasks)
+    {
+        static const DWORD s_rgdwMasks[] = { 0x00FF0000, 0x0000FF00, 0x000000FF };
+        CopyMemory(pimg->pb + BD_CB_HEADERS, s_rgdwMasks, sizeof(s_rgdwMasks));
+    }
+
+    UINT cbPixel = spec.wBitCount / 8;
+    for (UINT y = 0; y < spec.cy; y++)
+    {
+        BYTE* pbRow = pimg->pb + cbOffBits + (SIZE_T)cbStride * (spec.bTopDown ? y : spec.cy - 1 - y);
+        FillMemory(pbRow, cbStride, BD_PADDING);
+        for (UINT x = 0; x < spec.cx; x++)
+        {
+            BYTE rgb[4];
+            _SourcePixel(spec, x, y, rgb);
+            CopyMemory(pbRow + x * cbPixel, rgb, cbPixel);
+        }
+    }
+    return TRUE;
+}
+
+static void _FreeImage(__inout BD_IMAGE* pimg)
+{
+    HeapFree(GetProcessHeap(), 0, pimg->pb);
+    pimg->pb = NULL;
+}
+
+// The top-down BGRA pixels of a cx by cy DIB section the decoder made.
+static const BYTE* _Pixels(__in HBITMAP hbmp, __in UINT cx, __in UINT cy)
+{
+    DIBSECTION ds;
+    if (GetObjectW(hbmp, sizeof(ds), &ds) != sizeof(ds) || ds.dsBm.bmWidth != (LONG)cx ||
+        ds.dsBm.bmHeight != (LONG)cy || ds.dsBm.bmBitsPixel != 32)
+    {
+        return NULL;
+    }
+    return static_cast<const BYTE*>(ds.dsBm.bmBits);
+}
+
+// Decodes img at its own size and checks every pixel is the source's, premultiplied.
+static BOOL _DecodesExactly(__in const BD_SPEC& spec, __in DWORD dwKernels)
+{
+    BD_IMAGE img;
+    if (!_MakeImage(spec, &img))
+    {
+        return FALSE;
+    }
+
+    HBITMAP hbmp;
+    BOOL bExact = SUCCEEDED(BmpDecodeImage(img.pb, img.cb, spec.cx, spec.cy, dwKernels, &hbmp));
+    if (bExact)
+    {
+        const BYTE* pb = _Pixels(hbmp, spec.cx, spec.cy);
+        bExact = (pb != NULL);
+        for (UINT y = 0; bExact && y < spec.cy; y++)
+        {
+            for (UINT x = 0; x < spec.cx; x++, pb += 4)
+            {
+                BYTE rgb[4];
+                _SourcePixel(spec, x, y, rgb);
+                UINT a = spec.bAlpha ? rgb[3] : 0xFF;
+                for (int c = 0; c < 3; c++)
+                {
+                    if (pb[c] != (BYTE)((rgb[c] * a + 127) / 255))
+                    {
+                        bExact = FALSE;
+                    }
+                }
+                if (pb[3] != a)
+                {
+                    bExact = FALSE;
+                }
+            }
+        }
+        DeleteObject(hbmp);
+    }
+    _FreeImage(&img);
+    return bExact;
+}
+
+// Decodes two images to cx by cy, with the kernels given for each, and checks they come out
+// the same.
+static BOOL _DecodeAlike(
+    __in const BD_SPEC& specA,
+    __in DWORD dwKernelsA,
+    __in const BD_SPEC& specB,
+    __in DWORD dwKernelsB,
+    __in UINT cx,
+    __in UINT cy
+    )
+{
+    BD_IMAGE imgA = { NULL, 0 };
+    BD_IMAGE imgB = { NULL, 0 };
+    HBITMAP hbmpA = NULL;
+    HBITMAP hbmpB = NULL;
+
+    BOOL bAlike = _MakeImage(specA, &imgA) && _MakeImage(specB, &imgB) &&
+                  SUCCEEDED(BmpDecodeImage(imgA.pb, imgA.cb, cx, cy, dwKernelsA, &hbmpA)) &&
+                  SUCCEEDED(BmpDecodeImage(imgB.pb, imgB.cb, cx, cy, dwKernelsB, &hbmpB));
+    if (bAlike)
+    {
+        const BYTE* pbA = _Pixels(hbmpA, cx, cy);
+        const BYTE* pbB = _Pixels(hbmpB, cx, cy);
+        bAlike = (pbA != NULL && pbB != NULL && memcmp(pbA, pbB, (SIZE_T)cx * cy * 4) == 0);
+    }
+    DeleteObject(hbmpA);
+    DeleteObject(hbmpB);
+    _FreeImage(&imgA);
+    _FreeImage(&imgB);
+    return bAlike;
+}
+
+// Decodes a copy of img with the cbValue bytes at ib replaced by dwValue and checks it fails
+// with hrExpected and no bitmap.
+static BOOL _RejectsPatched(
+    __in const BD_IMAGE& img,
+    __in SIZE_T ib,
+    __in DWORD dwValue,
+    __in SIZE_T cbValue,
+    __in HRESULT hrExpected
+    )
+{
+    BYTE* pb = (BYTE*)HeapAlloc(GetProcessHeap(), 0, img.cb);
+    if (pb == NULL)
+    {
+        return FALSE;
+    }
+    CopyMemory(pb, img.pb, img.cb);
+    CopyMemory(pb + ib, &dwValue, cbValue);
+
+    HBITMAP hbmp = (HBITMAP)1;
+    HRESULT hr = BmpDecodeImage(pb, img.cb, TILE_IMAGE_CX, TILE_IMAGE_CY, BMP_KERNELS_BEST, &hbmp);
+    if (SUCCEEDED(hr))
+    {
+        DeleteObject(hbmp);
+    }
+    HeapFree(GetProcessHeap(), 0, pb);
+    return hr == hrExpected && hbmp == NULL;
+}
+
+// Decodes the first cb bytes of img to cx by cy and checks it fails with hrExpected and no bitmap.
+static BOOL _Rejects(
+    __in const BD_IMAGE& img,
+    __in SIZE_T cb,
+    __in UINT cx,
+    __in UINT cy,
+    __in HRESULT hrExpected
+    )
+{
+    HBITMAP hbmp = (HBITMAP)1;
+    HRESULT hr = BmpDecodeImage(img.pb, cb, cx, cy, BMP_KERNELS_BEST, &hbmp);
+    if (SUCCEEDED(hr))
+    {
+        DeleteObject(hbmp);
+    }
+    return hr == hrExpected && hbmp == NULL;
+}
+
+#define BD_INFO_AT(field)   (sizeof(BITMAPFILEHEADER) + FIELD_OFFSET(BITMAPINFOHEADER, field))
+
+void TestBmpDecoder()
+{
+    static const DWORD s_rgdwKernels[] = { BMP_KERNELS_BEST, BMP_KERNELS_SCALAR };
+    const HRESULT hrInvalid = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    const HRESULT hrNotSupported = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+    // At its own size an image comes through exactly, whatever its depth, however it's stored,
+    // and whatever its rows are padded to.
+    for (DWORD i = 0; i < ARRAYSIZE(s_rgdwKernels); i++)
+    {
+        DWORD dwKernels = s_rgdwKernels[i];
+        for (BOOL bTopDown = FALSE; bTopDown <= TRUE; bTopDown++)
+        {
+            BD_SPEC rgspec[] =
+            {
+                { 1, 1, 24, bTopDown, FALSE, FALSE, BD_SEED },
+                { 5, 3, 24, bTopDown, FALSE, FALSE, BD_SEED },
+                { 7, 2, 24, bTopDown, FALSE, FALSE, BD_SEED },
+                { 130, 9, 24, bTopDown, FALSE, FALSE, BD_SEED },
+                { 3, 4, 32, bTopDown, FALSE, FALSE, BD_SEED },
+                { 3, 4, 32, bTopDown, TRUE, FALSE, BD_SEED },
+                { 9, 5, 32, bTopDown, FALSE, TRUE, BD_SEED },
+                { 9, 5, 32, bTopDown, TRUE, TRUE, BD_SEED },
+            };
+            for (DWORD j = 0; j < ARRAYSIZE(rgspec); j++)
+            {
+                HT_CHECK(_DecodesExactly(rgspec[j], dwKernels));
+            }
+        }
+    }
+
+    // Scaled, a bottom-up image comes out the same as the top-down one with the same pixels.
+    static const UINT s_rgSizes[][4] =
+    {
+        // source cx, cy, then output cx, cy
+        { 37, 23, 128, 128 },
+        { 301, 177, 128, 128 },
+        { 1, 1, 128, 128 },
+        { 999, 1000, 128, 128 },
+        { 129, 127, 128, 128 },
+        { 255, 33, 7, 3 },
+        { 64, 64, 1, 1 },
+        { 3, 5, 200, 50 },
+        { 640, 480, 128, 96 },
+    };
+    for (DWORD i = 0; i < ARRAYSIZE(s_rgSizes); i++)
+    {
+        BD_SPEC specUp = { s_rgSizes[i][0], s_rgSizes[i][1], 24, FALSE, FALSE, FALSE, BD_SEED + i };
+        BD_SPEC specDown = specUp;
+        specDown.bTopDown = TRUE;
+        HT_CHECK(_DecodeAlike(specUp, BMP_KERNELS_BEST, specDown, BMP_KERNELS_BEST, s_rgSizes[i][2], s_rgSizes[i][3]));
+    }
+
+    // And the scalar kernels give exactly what the fastest ones do, at every depth and scale.
+    for (DWORD i = 0; i < ARRAYSIZE(s_rgSizes); i++)
+    {
+        static const struct
+        {
+            WORD    wBitCount;
+            BOOL    bAlpha;
+        } s_rgDepths[] = { { 24, FALSE }, { 32, FALSE }, { 32, TRUE } };
+        for (DWORD j = 0; j < ARRAYSIZE(s_rgDepths); j++)
+        {
+            BD_SPEC spec = { s_rgSizes[i][0], s_rgSizes[i][1], s_rgDepths[j].wBitCount, (BOOL)(i & 1),
+                             s_rgDepths[j].bAlpha, FALSE, BD_SEED + i * 3 + j };
+            HT_CHECK(_DecodeAlike(spec, BMP_KERNELS_SCALAR, spec, BMP_KERNELS_BEST, s_rgSizes[i][2], s_rgSizes[i][3]));
+            HT_CHECK(_DecodeAlike(spec, BMP_KERNELS_SCALAR, spec, BMP_KERNELS_BEST, s_rgSizes[i][2] + 1, s_rgSizes[i][3] + 3));
+        }
+    }
+
+    // A flat image stays flat at any scale, alpha and all.
+    for (DWORD i = 0; i < ARRAYSIZE(s_rgSizes); i++)
+    {
+        BD_SPEC spec = { s_rgSizes[i][0], s_rgSizes[i][1], 32, FALSE, TRUE, FALSE, 0 };
+        BD_IMAGE img;
+        HT_CHECK(_MakeImage(spec, &img));
+        if (img.pb != NULL)
+        {
+            BYTE rgbFlat[4];
+            _SourcePixel(spec, 0, 0, rgbFlat);
+            BYTE rgbExpected[4];
+            for (int c = 0; c < 3; c++)
+            {
+                rgbExpected[c] = (BYTE)((rgbFlat[c] * rgbFlat[3] + 127) / 255);
+            }
+            rgbExpected[3] = rgbFlat[3];
+
+            UINT cx = s_rgSizes[i][2];
+            UINT cy = s_rgSizes[i][3];
+            HBITMAP hbmp;
+            HT_CHECK(SUCCEEDED(BmpDecodeImage(img.pb, img.cb, cx, cy, BMP_KERNELS_BEST, &hbmp)));
+            const BYTE* pb = _Pixels(hbmp, cx, cy);
+            HT_CHECK(pb != NULL);
+            BOOL bFlat = (pb != NULL);
+            for (UINT p = 0; bFlat && p < cx * cy; p++)
+            {
+                bFlat = (memcmp(pb + p * 4, rgbExpected, 4) == 0);
+            }
+            HT_CHECK(bFlat);
+            DeleteObject(hbmp);
+            _FreeImage(&img);
+        }
+    }
+
+    // Headers that are cut short, lie about the pixels, or describe something the decoder
+    // doesn't handle are turned away before any pixel is read.
+    BD_SPEC spec = { 5, 3, 24, FALSE, FALSE, FALSE, BD_SEED };
+    BD_IMAGE img;
+    HT_CHECK(_MakeImage(spec, &img));
+    if (img.pb != NULL)
+    {
+        HT_CHECK(_Rejects(img, 0, TILE_IMAGE_CX, TILE_IMAGE_CY, hrInvalid));
+        HT_CHECK(_Rejects(img, sizeof(BITMAPFILEHEADER), TILE_IMAGE_CX, TILE_IMAGE_CY, hrInvalid));
+        HT_CHECK(_Rejects(img, BD_CB_HEADERS - 1, TILE_IMAGE_CX, TILE_IMAGE_CY, hrInvalid));
+        HT_CHECK(_Rejects(img, BD_CB_HEADERS, TILE_IMAGE_CX, TILE_IMAGE_CY, hrInvalid));
+        HT_CHECK(_Rejects(img, img.cb - 1, TILE_IMAGE_CX, TILE_IMAGE_CY, hrInvalid));   // The last row's padding.
+        HT_CHECK(_Rejects(img, img.cb, 0, TILE_IMAGE_CY, E_INVALIDARG));
+        HT_CHECK(_Rejects(img, img.cb, TILE_IMAGE_CX, 0, E_INVALIDARG));
+        HT_CHECK(_Rejects(img, img.cb, 32769, TILE_IMAGE_CY, E_INVALIDARG));
+
+        HT_CHECK(_RejectsPatched(img, FIELD_OFFSET(BITMAPFILEHEADER, bfType), 0x4D43, sizeof(WORD), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, FIELD_OFFSET(BITMAPFILEHEADER, bfOffBits), BD_CB_HEADERS - 1, sizeof(DWORD), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, FIELD_OFFSET(BITMAPFILEHEADER, bfOffBits), (DWORD)img.cb + 1, sizeof(DWORD), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, FIELD_OFFSET(BITMAPFILEHEADER, bfOffBits), BD_CB_HEADERS + 1, sizeof(DWORD), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biSize), sizeof(BITMAPINFOHEADER) - 1, sizeof(DWORD), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biSize), sizeof(BITMAPINFOHEADER) + 1, sizeof(DWORD), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biPlanes), 2, sizeof(WORD), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biWidth), 0, sizeof(LONG), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biWidth), (DWORD)-5, sizeof(LONG), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biWidth), 32769, sizeof(LONG), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biWidth), 6, sizeof(LONG), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biHeight), 0, sizeof(LONG), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biHeight), 4, sizeof(LONG), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biHeight), (DWORD)-4, sizeof(LONG), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biHeight), (DWORD)-32769, sizeof(LONG), hrInvalid));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biBitCount), 8, sizeof(WORD), hrNotSupported));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biBitCount), 16, sizeof(WORD), hrNotSupported));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biCompression), BI_RLE8, sizeof(DWORD), hrNotSupported));
+        HT_CHECK(_RejectsPatched(img, BD_INFO_AT(biCompression), BI_BITFIELDS, sizeof(DWORD), hrNotSupported));
+
+        // While the image itself is fine.
+        HBITMAP hbmp;
+        HT_CHECK(SUCCEEDED(BmpDecodeImage(img.pb, img.cb, TILE_IMAGE_CX, TILE_IMAGE_CY, BMP_KERNELS_BEST, &hbmp)));
+        HT_CHECK(_Pixels(hbmp, TILE_IMAGE_CX, TILE_IMAGE_CY) != NULL);
+        DeleteObject(hbmp);
+        _FreeImage(&img);
+    }
+
+    // Masks other than BGRX, or masks that don't fit in the header, aren't supported.
+    BD_SPEC specMasks = { 4, 4, 32, TRUE, FALSE, TRUE, BD_SEED };
+    HT_CHECK(_MakeImage(specMasks, &img));
+    if (img.pb != NULL)
+    {
+        HT_CHECK(_RejectsPatched(img, BD_CB_HEADERS, 0x000000FF, sizeof(DWORD), hrNotSupported));
+        HT_CHECK(_RejectsPatched(img, BD_CB_HEADERS + 2 * sizeof(DWORD), 0x00FF0000, sizeof(DWORD), hrNotSupported));
+        HT_CHECK(_RejectsPatched(img, FIELD_OFFSET(BITMAPFILEHEADER, bfOffBits), BD_CB_HEADERS + sizeof(DWORD), sizeof(DWORD), hrNotSupported));
+        _FreeImage(&img);
+    }
+}
+
+// A tile image the size of a photo straight off a camera, and the kernels to scale it with.
+struct BD_BENCH
+{
+    BD_IMAGE    img;
+    DWORD       dwKernels;
+};
+
+static void _BenchDecode(__in void* pv)
+{
+    BD_BENCH* pbdb = static_cast<BD_BENCH*>(pv);
+    HBITMAP hbmp;
+    if (SUCCEEDED(BmpDecodeImage(pbdb->img.pb, pbdb->img.cb, TILE_IMAGE_CX, TILE_IMAGE_CY, pbdb->dwKernels, &hbmp)))
+    {
+        DeleteObject(hbmp);
+    }
+}
+
+void BenchBmpDecoder()
+{
+    static const struct
+    {
+        PCSTR   pszName;
+        WORD    wBitCount;
+        BOOL    bAlpha;
+        DWORD   dwKernels;
+    } s_rgBenches[] =
+    {
+        { "BmpDecodeImage 3000x2000 24bpp",          24, FALSE, BMP_KERNELS_BEST },
+        { "BmpDecodeImage 3000x2000 24bpp, scalar",  24, FALSE, BMP_KERNELS_SCALAR },
+        { "BmpDecodeImage 3000x2000 32bpp alpha",    32, TRUE,  BMP_KERNELS_BEST },
+        { "BmpDecodeImage 3000x2000 32bpp, scalar",  32, TRUE,  BMP_KERNELS_SCALAR },
+    };
+    for (DWORD i = 0; i < ARRAYSIZE(s_rgBenches); i++)
+    {
+        BD_SPEC spec = { BD_BENCH_CX, BD_BENCH_CY, s_rgBenches[i].wBitCount, FALSE, s_rgBenches[i].bAlpha, FALSE, BD_SEED };
+        BD_BENCH bdb;
+        bdb.dwKernels = s_rgBenches[i].dwKernels;
+        if (_MakeImage(spec, &bdb.img))
+        {
+            HelpersTestBenchmark(s_rgBenches[i].pszName, BD_BENCH_ROUNDS, _BenchDecode, &bdb);
+            _FreeImage(&bdb.img);
+        }
+    }
+}
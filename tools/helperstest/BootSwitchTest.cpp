@@ -0,0 +1,274 @@
+#include "helperstest.h"
+#include "BootSwitch.h"
+#include "ComObject.h"
+
+#define BST_STATUS_FIELD    7
+#define BST_TIMEOUT_MS      10000
+
+// A credential that only has to be there: the switch holds a reference on it while
+// its worker runs, and hands it to the events.
+class FakeCredential : public ComObject<FakeCredential, ICredentialProviderCredential>
+{
+  public:
+    IFACEMETHODIMP Advise(__in ICredentialProviderCredentialEvents*) { return E_NOTIMPL; }
+    IFACEMETHODIMP UnAdvise() { return E_NOTIMPL; }
+    IFACEMETHODIMP SetSelected(__out BOOL* pbAutoLogon) { *pbAutoLogon = FALSE; return E_NOTIMPL; }
+    IFACEMETHODIMP SetDeselected() { return E_NOTIMPL; }
+    IFACEMETHODIMP GetFieldState(__in DWORD, __out CREDENTIAL_PROVIDER_FIELD_STATE*, __out CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE*) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetStringValue(__in DWORD, __deref_out PWSTR* ppwsz) { *ppwsz = NULL; return E_NOTIMPL; }
+    IFACEMETHODIMP GetBitmapValue(__in DWORD, __out HBITMAP* phbmp) { *phbmp = NULL; return E_NOTIMPL; }
+    IFACEMETHODIMP GetCheckboxValue(__in DWORD, __out BOOL*, __deref_out PWSTR* ppwszLabel) { *ppwszLabel = NULL; return E_NOTIMPL; }
+    IFACEMETHODIMP GetSubmitButtonValue(__in DWORD, __out DWORD*) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetComboBoxValueCount(__in DWORD, __out DWORD*, __out DWORD*) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetComboBoxValueAt(__in DWORD, __in DWORD, __deref_out PWSTR* ppwszItem) { *ppwszItem = NULL; return E_NOTIMPL; }
+    IFACEMETHODIMP SetStringValue(__in DWORD, __in PCWSTR) { return E_NOTIMPL; }
+    IFACEMETHODIMP SetCheckboxValue(__in DWORD, __in BOOL) { return E_NOTIMPL; }
+    IFACEMETHODIMP SetComboBoxSelectedValue(__in DWORD, __in DWORD) { return E_NOTIMPL; }
+    IFACEMETHODIMP CommandLinkClicked(__in DWORD) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetSerialization(__out CREDENTIAL_PROVIDER_GET_SERIALIZATION_RESPONSE*, __out CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION*,
+                                    __deref_out_opt PWSTR* ppwszOptionalStatusText, __out CREDENTIAL_PROVIDER_STATUS_ICON*)
+    {
+        *ppwszOptionalStatusText = NULL;
+        return E_NOTIMPL;
+    }
+    IFACEMETHODIMP ReportResult(__in NTSTATUS, __in NTSTATUS, __deref_out_opt PWSTR* ppwszOptionalStatusText, __out CREDENTIAL_PROVIDER_STATUS_ICON*)
+    {
+        *ppwszOptionalStatusText = NULL;
+        return E_NOTIMPL;
+    }
+};
+
+// LogonUI's side of a credential. It remembers the last string it was given, and
+// whether it was ever called on a thread other than the one that made it.
+class FakeCredentialEvents : public ComObject<FakeCredentialEvents, ICredentialProviderCredentialEvents>
+{
+  public:
+    FakeCredentialEvents() :
+        dwThreadId(GetCurrentThreadId()), bWrongThread(FALSE), cSetFieldString(0),
+        pcpcLast(NULL), dwFieldIDLast(0)
+    {
+        wszLast[0] = L'\0';
+    }
+
+    IFACEMETHODIMP SetFieldString(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in PCWSTR pwsz)
+    {
+        bWrongThread |= (GetCurrentThreadId() != dwThreadId);
+        cSetFieldString++;
+        pcpcLast = pcpc;
+        dwFieldIDLast = dwFieldID;
+        lstrcpynW(wszLast, pwsz, ARRAYSIZE(wszLast));
+        return S_OK;
+    }
+
+    IFACEMETHODIMP SetFieldState(__in ICredentialProviderCredential*, __in DWORD, __in CREDENTIAL_PROVIDER_FIELD_STATE) { return _Unexpected(); }
+    IFACEMETHODIMP SetFieldInteractiveState(__in ICredentialProviderCredential*, __in DWORD, __in CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE) { return _Unexpected(); }
+    IFACEMETHODIMP SetFieldCheckbox(__in ICredentialProviderCredential*, __in DWORD, __in BOOL, __in PCWSTR) { return _Unexpected(); }
+    IFACEMETHODIMP SetFieldBitmap(__in ICredentialProviderCredential*, __in DWORD, __in HBITMAP) { return _Unexpected(); }
+    IFACEMETHODIMP SetFieldComboBoxSelectedItem(__in ICredentialProviderCredential*, __in DWORD, __in DWORD) { return _Unexpected(); }
+    IFACEMETHODIMP DeleteFieldComboBoxItem(__in ICredentialProviderCredential*, __in DWORD, __in DWORD) { return _Unexpected(); }
+    IFACEMETHODIMP AppendFieldComboBoxItem(__in ICredentialProviderCredential*, __in DWORD, __in PCWSTR) { return _Unexpected(); }
+    IFACEMETHODIMP SetFieldSubmitButton(__in ICredentialProviderCredential*, __in DWORD, __in DWORD) { return _Unexpected(); }
+    IFACEMETHODIMP OnCreatingWindow(__out HWND* phwndOwner) { *phwndOwner = NULL; return _Unexpected(); }
+
+    DWORD                           dwThreadId;
+    BOOL                            bWrongThread;
+    LONG                            cSetFieldString;
+    ICredentialProviderCredential*  pcpcLast;
+    DWORD                           dwFieldIDLast;
+    WCHAR                           wszLast[BOOT_SWITCH_MAX_STATUS];
+
+  private:
+    HRESULT _Unexpected()
+    {
+        HT_CHECK(!"a switch only ever sets its status string");
+        return E_NOTIMPL;
+    }
+};
+
+// Steps that say what they were asked to do and return what they're told to.
+static HRESULT                  s_hrSetStartupDisk;
+static HRESULT                  s_hrRestart;
+static LONG                     s_cSetStartupDisk;
+static LONG                     s_cRestart;
+static const STARTUP_PARTITION* s_pspLast;
+static HANDLE                   s_hevSetStartupDisk;    // If not NULL, setting the disk waits for it.
+
+static HRESULT _FakeSetStartupDisk(__in_opt const STARTUP_PARTITION* psp)
+{
+    if (s_hevSetStartupDisk != NULL)
+    {
+        WaitForSingleObject(s_hevSetStartupDisk, BST_TIMEOUT_MS);
+    }
+    InterlockedIncrement(&s_cSetStartupDisk);
+    s_pspLast = psp;
+    return s_hrSetStartupDisk;
+}
+
+static HRESULT _FakeRestart()
+{
+    InterlockedIncrement(&s_cRestart);
+    return s_hrRestart;
+}
+
+static const BOOT_SWITCH_STEPS s_bssFake =
+{
+    _FakeSetStartupDisk,
+    _FakeRestart,
+};
+
+static void _ResetSteps(__in HRESULT hrSetStartupDisk, __in HRESULT hrRestart)
+{
+    s_hrSetStartupDisk = hrSetStartupDisk;
+    s_hrRestart = hrRestart;
+    s_cSetStartupDisk = 0;
+    s_cRestart = 0;
+    s_pspLast = NULL;
+}
+
+// Whether the status the switch reports, and the last one the events were given, start with pwszPrefix.
+static BOOL _StatusStartsWith(__in BootSwitch* pbs, __in FakeCredentialEvents* pfce, __in PCWSTR pwszPrefix)
+{
+    PWSTR pwsz;
+    BOOL bMatch = FALSE;
+    if (pbs->GetStatusText(&pwsz) == S_OK)
+    {
+        size_t cch = wcslen(pwszPrefix);
+        bMatch = (wcsncmp(pwsz, pwszPrefix, cch) == 0) && (wcsncmp(pfce->wszLast, pwszPrefix, cch) == 0);
+        CoTaskMemFree(pwsz);
+    }
+    return bMatch;
+}
+
+static ULONG _CountReferences(__in IUnknown* punk)
+{
+    punk->AddRef();
+    return punk->Release();
+}
+
+// Dispatches what the worker posts to the status window until the switch settles into
+// bss and the events have been told about it, or it's taken too long.
+static BOOL _PumpUntil(__in BootSwitch* pbs, __in FakeCredentialEvents* pfce, __in BOOT_SWITCH_STATE bss, __in PCWSTR pwszStatus)
+{
+    DWORD dwStart = GetTickCount();
+    while (GetTickCount() - dwStart < BST_TIMEOUT_MS)
+    {
+        MSG msg;
+        while (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE))
+        {
+            DispatchMessageW(&msg);
+        }
+        if ((pbs->GetState() == bss) && _StatusStartsWith(pbs, pfce, pwszStatus))
+        {
+            return TRUE;
+        }
+        MsgWaitForMultipleObjects(0, NULL, FALSE, 10, QS_POSTMESSAGE);
+    }
+    return FALSE;
+}
+
+void TestBootSwitch()
+{
+    FakeCredential* pfc = new FakeCredential();
+    FakeCredentialEvents* pfce = new FakeCredentialEvents();
+    if (pfc == NULL || pfce == NULL)
+    {
+        HT_CHECK(!"out of memory");
+        return;
+    }
+
+    STARTUP_PARTITION sp = {};
+    sp.dwPartitionNumber = 2;
+    sp.bKind = GTK_HFSPLUS;
+
+    // Nothing to show before the first switch.
+    {
+        BootSwitch bs;
+        bs.Initialize(pfc, BST_STATUS_FIELD, &s_bssFake, &sp);
+        PWSTR pwsz;
+        HT_CHECK(bs.GetStatusText(&pwsz) == S_FALSE && pwsz == NULL);
+        HT_CHECK(bs.GetState() == BSS_IDLE);
+    }
+
+    // A switch that works ends restarting, having pushed each status on this thread.
+    {
+        _ResetSteps(S_OK, S_OK);
+        BootSwitch bs;
+        bs.Initialize(pfc, BST_STATUS_FIELD, &s_bssFake, &sp);
+        bs.Advise(pfce);
+        LONG cBefore = pfce->cSetFieldString;
+        bs.Run();
+        HT_CHECK(bs.GetState() == BSS_RESTARTING);
+        HT_CHECK(s_cSetStartupDisk == 1 && s_pspLast == &sp && s_cRestart == 1);
+        HT_CHECK(pfce->cSetFieldString == cBefore + 2);
+        HT_CHECK(pfce->pcpcLast == pfc && pfce->dwFieldIDLast == BST_STATUS_FIELD);
+        HT_CHECK(_StatusStartsWith(&bs, pfce, L"Restarting..."));
+        bs.UnAdvise();
+    }
+
+    // Setting the disk fails: no restart, and the tile says why.
+    {
+        _ResetSteps(HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED), S_OK);
+        BootSwitch bs;
+        bs.Initialize(pfc, BST_STATUS_FIELD, &s_bssFake, NULL);
+        bs.Advise(pfce);
+        bs.Run();
+        HT_CHECK(bs.GetState() == BSS_FAILED);
+        HT_CHECK(s_cSetStartupDisk == 1 && s_pspLast == NULL && s_cRestart == 0);
+        HT_CHECK(_StatusStartsWith(&bs, pfce, L"Couldn't set the startup disk: "));
+        bs.UnAdvise();
+    }
+
+    // Restarting fails, then a retry on the worker thread works. Until this thread
+    // dispatches what the worker posted, the events aren't called at all.
+    {
+        _ResetSteps(S_OK, HRESULT_FROM_WIN32(ERROR_PRIVILEGE_NOT_HELD));
+        BootSwitch bs;
+        bs.Initialize(pfc, BST_STATUS_FIELD, &s_bssFake, &sp);
+        bs.Advise(pfce);
+        bs.Run();
+        HT_CHECK(bs.GetState() == BSS_FAILED);
+        HT_CHECK(s_cSetStartupDisk == 1 && s_cRestart == 1);
+        HT_CHECK(_StatusStartsWith(&bs, pfce, L"Couldn't restart: "));
+
+        _ResetSteps(S_OK, S_OK);
+        s_hevSetStartupDisk = CreateEvent(NULL, TRUE, FALSE, NULL);
+        HT_CHECK(s_hevSetStartupDisk != NULL);
+        LONG cBefore = pfce->cSetFieldString;
+        HT_CHECK(bs.Start() == S_OK);
+        HT_CHECK(bs.Start() == S_FALSE);
+        HT_CHECK(bs.GetState() == BSS_SETTING_STARTUP_DISK);
+        SetEvent(s_hevSetStartupDisk);
+
+        // Let the worker finish, which is when it drops its reference on the credential,
+        // without dispatching anything.
+        DWORD dwStart = GetTickCount();
+        while (_CountReferences(pfc) > 1 && GetTickCount() - dwStart < BST_TIMEOUT_MS)
+        {
+            Sleep(1);
+        }
+        HT_CHECK(_CountReferences(pfc) == 1);
+        HT_CHECK(pfce->cSetFieldString == cBefore);
+
+        HT_CHECK(_PumpUntil(&bs, pfce, BSS_RESTARTING, L"Restarting..."));
+        HT_CHECK(s_cSetStartupDisk == 1 && s_cRestart == 1);
+        HT_CHECK(pfce->pcpcLast == pfc && pfce->dwFieldIDLast == BST_STATUS_FIELD);
+        bs.UnAdvise();
+
+        CloseHandle(s_hevSetStartupDisk);
+        s_hevSetStartupDisk = NULL;
+    }
+
+    // A switch that isn't advised runs without anyone to tell.
+    {
+        _ResetSteps(S_OK, S_OK);
+        BootSwitch bs;
+        bs.Initialize(pfc, BST_STATUS_FIELD, &s_bssFake, &sp);
+        LONG cBefore = pfce->cSetFieldString;
+        bs.Run();
+        HT_CHECK(bs.GetState() == BSS_RESTARTING && pfce->cSetFieldString == cBefore);
+    }
+
+    HT_CHECK(!pfce->bWrongThread);
+    pfce->Release();
+    pfc->Release();
+}
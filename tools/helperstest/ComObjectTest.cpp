@@ -0,0 +1,129 @@
+#include "helperstest.h"
+#include <credentialprovider.h>
+#include "ComObject.h"
+
+#define COM_THREADS         8
+#define COM_ROUNDS          20
+#define COM_PER_THREAD      20000
+
+static LONG s_cDestroyed = 0;
+
+// An object that counts how many times it's been destroyed.
+class CountedObject : public ComObject<CountedObject, ICredentialProviderEvents>
+{
+  public:
+    IFACEMETHODIMP CredentialsChanged(__in UINT_PTR)
+    {
+        return S_OK;
+    }
+
+  private:
+    ~CountedObject()
+    {
+        InterlockedIncrement(&s_cDestroyed);
+    }
+    friend class ComObject<CountedObject, ICredentialProviderEvents>;
+};
+
+struct COM_THREAD
+{
+    ICredentialProviderEvents*  pcpe;       // A reference the thread owns and releases when it's done.
+    BOOL                        bAlive;     // Whether the object was alive every time the thread looked.
+    BOOL                        bQueried;   // Whether every QueryInterface gave back the object.
+};
+
+// Takes and drops references through AddRef and QueryInterface, checking that the object is
+// still there while it holds one, then drops the reference it was given.
+static DWORD WINAPI _ComThread(__in void* pv)
+{
+    COM_THREAD* pct = static_cast<COM_THREAD*>(pv);
+    ICredentialProviderEvents* pcpe = pct->pcpe;
+    for (LONG i = 0; i < COM_PER_THREAD; i++)
+    {
+        pcpe->AddRef();
+
+        IUnknown* punk;
+        if (FAILED(pcpe->QueryInterface(IID_PPV_ARGS(&punk))) || punk != pcpe)
+        {
+            pct->bQueried = FALSE;
+        }
+        else
+        {
+            punk->Release();
+        }
+
+        if (s_cDestroyed != 0)
+        {
+            pct->bAlive = FALSE;
+        }
+        pcpe->Release();
+    }
+    pcpe->Release();
+    return 0;
+}
+
+void TestComObject()
+{
+    HT_CHECK(DllCanUnloadNow() == S_OK);
+
+    // QueryInterface answers for IUnknown and the object's interface, with the same pointer, and
+    // nothing else. The object holds the dll while it's alive.
+    CountedObject* pco = new CountedObject();
+    HT_CHECK(DllCanUnloadNow() == S_FALSE);
+
+    IUnknown* punk = NULL;
+    ICredentialProviderEvents* pcpe = NULL;
+    ICredentialProvider* pcp = NULL;
+    HT_CHECK(pco->QueryInterface(IID_PPV_ARGS(&punk)) == S_OK);
+    HT_CHECK(pco->QueryInterface(IID_PPV_ARGS(&pcpe)) == S_OK);
+    HT_CHECK(pco->QueryInterface(IID_PPV_ARGS(&pcp)) == E_NOINTERFACE);
+    HT_CHECK(punk == static_cast<ICredentialProviderEvents*>(pco));
+    HT_CHECK(pcpe == static_cast<ICredentialProviderEvents*>(pco));
+    HT_CHECK(punk->Release() == 2);
+    HT_CHECK(pcpe->Release() == 1);
+    HT_CHECK(s_cDestroyed == 0);
+    HT_CHECK(pco->Release() == 0);
+    HT_CHECK(s_cDestroyed == 1);
+    HT_CHECK(DllCanUnloadNow() == S_OK);
+
+    // Many threads at once: each object is destroyed exactly once, by whichever thread lets go
+    // of it last, and never while any thread still holds it.
+    for (LONG iRound = 0; iRound < COM_ROUNDS; iRound++)
+    {
+        s_cDestroyed = 0;
+        pco = new CountedObject();
+
+        COM_THREAD rgct[COM_THREADS];
+        HANDLE rghThreads[COM_THREADS];
+        DWORD cThreads = 0;
+        for (DWORD i = 0; i < COM_THREADS; i++)
+        {
+            pco->AddRef();
+            rgct[i].pcpe = pco;
+            rgct[i].bAlive = TRUE;
+            rgct[i].bQueried = TRUE;
+            rghThreads[cThreads] = CreateThread(NULL, 0, _ComThread, &rgct[i], 0, NULL);
+            if (rghThreads[cThreads] != NULL)
+            {
+                cThreads++;
+            }
+            else
+            {
+                pco->Release();
+            }
+        }
+        HT_CHECK(cThreads == COM_THREADS);
+
+        // Let the threads race for the last reference.
+        pco->Release();
+        WaitForMultipleObjects(cThreads, rghThreads, TRUE, INFINITE);
+        for (DWORD i = 0; i < cThreads; i++)
+        {
+            CloseHandle(rghThreads[i]);
+            HT_CHECK(rgct[i].bAlive);
+            HT_CHECK(rgct[i].bQueried);
+        }
+        HT_CHECK(s_cDestroyed == 1);
+        HT_CHECK(DllCanUnloadNow() == S_OK);
+    }
+}
@@ -0,0 +1,530 @@
+#include "helperstest.h"
+#include "../../BootPickerWrapper/Credential.h"
+
+// The wrapped provider's fields in these tests: a typical password tile.
+static const CREDENTIAL_PROVIDER_FIELD_TYPE s_rgcpftWrapped[] =
+{
+    CPFT_TILE_IMAGE,
+    CPFT_LARGE_TEXT,
+    CPFT_PASSWORD_TEXT,
+    CPFT_SUBMIT_BUTTON,
+    CPFT_SMALL_TEXT,
+};
+
+#define FMT_WRAPPED_PASSWORD    2
+#define FMT_WRAPPED_SUBMIT      3           // Sits next to the password.
+#define FMT_NOT_ASKED           ((DWORD)-2)
+
+// A wrapped credential that remembers which of its fields it was last asked about,
+// and can raise events on them the way a real one does.
+class MockWrappedCredential : public ComObject<MockWrappedCredential, ICredentialProviderCredential>
+{
+  public:
+    MockWrappedCredential() : dwLastID(FMT_NOT_ASKED), pcpce(NULL), cUnAdvise(0), cGetStringValue(0)
+    {
+        StringCchCopyW(wszValue, ARRAYSIZE(wszValue), L"wrapped");
+    }
+
+    ~MockWrappedCredential()
+    {
+        if (pcpce != NULL)
+        {
+            pcpce->Release();
+        }
+    }
+
+    IFACEMETHODIMP Advise(__in ICredentialProviderCredentialEvents* pcpceNew)
+    {
+        if (pcpce != NULL)
+        {
+            pcpce->Release();
+        }
+        pcpce = pcpceNew;
+        pcpce->AddRef();
+        return S_OK;
+    }
+
+    IFACEMETHODIMP UnAdvise()
+    {
+        cUnAdvise++;
+        if (pcpce != NULL)
+        {
+            pcpce->Release();
+            pcpce = NULL;
+        }
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetFieldState(__in DWORD dwFieldID, __out CREDENTIAL_PROVIDER_FIELD_STATE* pcpfs, __out CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE* pcpfis)
+    {
+        dwLastID = dwFieldID;
+        *pcpfs = CPFS_DISPLAY_IN_DESELECTED_TILE;
+        *pcpfis = CPFIS_READONLY;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetStringValue(__in DWORD dwFieldID, __deref_out PWSTR* ppwsz)
+    {
+        dwLastID = dwFieldID;
+        cGetStringValue++;
+        return SHStrDupW(wszValue, ppwsz);
+    }
+
+    IFACEMETHODIMP GetSubmitButtonValue(__in DWORD dwFieldID, __out DWORD* pdwAdjacentTo)
+    {
+        dwLastID = dwFieldID;
+        *pdwAdjacentTo = FMT_WRAPPED_PASSWORD;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP SetStringValue(__in DWORD dwFieldID, __in PCWSTR) { return _Record(dwFieldID); }
+    IFACEMETHODIMP CommandLinkClicked(__in DWORD dwFieldID) { return _Record(dwFieldID); }
+    IFACEMETHODIMP SetCheckboxValue(__in DWORD dwFieldID, __in BOOL) { return _Record(dwFieldID); }
+    IFACEMETHODIMP SetComboBoxSelectedValue(__in DWORD dwFieldID, __in DWORD) { return _Record(dwFieldID); }
+
+    IFACEMETHODIMP SetSelected(__out BOOL* pbAutoLogon) { *pbAutoLogon = FALSE; return S_OK; }
+    IFACEMETHODIMP SetDeselected() { return S_OK; }
+    IFACEMETHODIMP GetBitmapValue(__in DWORD, __out HBITMAP* phbmp) { *phbmp = NULL; return E_NOTIMPL; }
+    IFACEMETHODIMP GetCheckboxValue(__in DWORD, __out BOOL*, __deref_out PWSTR* ppwszLabel) { *ppwszLabel = NULL; return E_NOTIMPL; }
+    IFACEMETHODIMP GetComboBoxValueCount(__in DWORD, __out DWORD*, __out DWORD*) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetComboBoxValueAt(__in DWORD, __in DWORD, __deref_out PWSTR* ppwszItem) { *ppwszItem = NULL; return E_NOTIMPL; }
+    IFACEMETHODIMP GetSerialization(__out CREDENTIAL_PROVIDER_GET_SERIALIZATION_RESPONSE*, __out CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION*,
+                                    __deref_out_opt PWSTR* ppwszOptionalStatusText, __out CREDENTIAL_PROVIDER_STATUS_ICON*)
+    {
+        *ppwszOptionalStatusText = NULL;
+        return E_NOTIMPL;
+    }
+    IFACEMETHODIMP ReportResult(__in NTSTATUS, __in NTSTATUS, __deref_out_opt PWSTR* ppwszOptionalStatusText, __out CREDENTIAL_PROVIDER_STATUS_ICON*)
+    {
+        *ppwszOptionalStatusText = NULL;
+        return E_NOTIMPL;
+    }
+
+    DWORD                                   dwLastID;
+    ICredentialProviderCredentialEvents*    pcpce;      // What the wrapper gave us to raise events on.
+    LONG                                    cUnAdvise;
+    LONG                                    cGetStringValue;
+    WCHAR                                   wszValue[64];   // What GetStringValue gives for every field.
+
+  private:
+    HRESULT _Record(__in DWORD dwFieldID)
+    {
+        dwLastID = dwFieldID;
+        return S_OK;
+    }
+};
+
+// LogonUI's side: remembers the last event, and which credential and field it came for.
+class RecordingEvents : public ComObject<RecordingEvents, ICredentialProviderCredentialEvents>
+{
+  public:
+    RecordingEvents() : cEvents(0), pcpcLast(NULL), dwFieldIDLast(FMT_NOT_ASKED), dwAdjacentToLast(FMT_NOT_ASKED)
+    {
+        wszLast[0] = L'\0';
+    }
+
+    IFACEMETHODIMP SetFieldState(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in CREDENTIAL_PROVIDER_FIELD_STATE)
+    {
+        return _Record(pcpc, dwFieldID);
+    }
+    IFACEMETHODIMP SetFieldInteractiveState(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE)
+    {
+        return _Record(pcpc, dwFieldID);
+    }
+    IFACEMETHODIMP SetFieldString(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in PCWSTR pwsz)
+    {
+        StringCchCopyW(wszLast, ARRAYSIZE(wszLast), pwsz);
+        return _Record(pcpc, dwFieldID);
+    }
+    IFACEMETHODIMP SetFieldSubmitButton(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in DWORD dwAdjacentTo)
+    {
+        dwAdjacentToLast = dwAdjacentTo;
+        return _Record(pcpc, dwFieldID);
+    }
+    IFACEMETHODIMP SetFieldCheckbox(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in BOOL, __in PCWSTR) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP SetFieldBitmap(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in HBITMAP) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP SetFieldComboBoxSelectedItem(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in DWORD) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP DeleteFieldComboBoxItem(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in DWORD) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP AppendFieldComboBoxItem(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in PCWSTR) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP OnCreatingWindow(__out HWND* phwndOwner) { *phwndOwner = NULL; return E_NOTIMPL; }
+
+    LONG                            cEvents;
+    ICredentialProviderCredential*  pcpcLast;
+    DWORD                           dwFieldIDLast;
+    DWORD                           dwAdjacentToLast;
+    WCHAR                           wszLast[64];
+
+  private:
+    HRESULT _Record(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID)
+    {
+        cEvents++;
+        pcpcLast = pcpc;
+        dwFieldIDLast = dwFieldID;
+        return S_OK;
+    }
+};
+
+// Checks the map against where ours should be: wrapped fields before dwInsertBefore keep
+// their ids, ours follow, and the rest of the wrapped ones move down past ours.
+static void _CheckMap(__in const FieldMap* pfm, __in DWORD dwInsertBefore)
+{
+    const DWORD cWrapped = ARRAYSIZE(s_rgcpftWrapped);
+    HT_CHECK(pfm->GetCount() == cWrapped + SFI_NUM_FIELDS);
+    HT_CHECK(pfm->GetWrappedCount() == cWrapped);
+
+    for (DWORD dwOuterID = 0; dwOuterID < pfm->GetCount(); dwOuterID++)
+    {
+        DWORD dwInnerID;
+        FIELD_OWNER fo = pfm->ToInner(dwOuterID, &dwInnerID);
+        if (dwOuterID < dwInsertBefore)
+        {
+            HT_CHECK(fo == FO_WRAPPED && dwInnerID == dwOuterID);
+        }
+        else if (dwOuterID < dwInsertBefore + SFI_NUM_FIELDS)
+        {
+            HT_CHECK(fo == FO_OURS && dwInnerID == dwOuterID - dwInsertBefore);
+        }
+        else
+        {
+            HT_CHECK(fo == FO_WRAPPED && dwInnerID == dwOuterID - SFI_NUM_FIELDS);
+        }
+
+        // And back again.
+        HT_CHECK(((fo == FO_WRAPPED) ? pfm->WrappedToOuter(dwInnerID) : pfm->OursToOuter(dwInnerID)) == dwOuterID);
+    }
+
+    for (DWORD i = 0; i < cWrapped; i++)
+    {
+        HT_CHECK(pfm->GetWrappedType(i) == s_rgcpftWrapped[i]);
+    }
+
+    DWORD dwInnerID;
+    HT_CHECK(pfm->ToInner(pfm->GetCount(), &dwInnerID) == FO_NONE);
+    HT_CHECK(pfm->ToInner(MAXDWORD, &dwInnerID) == FO_NONE);
+    HT_CHECK(pfm->WrappedToOuter(cWrapped) == FIELD_MAP_NO_FIELD);
+    HT_CHECK(pfm->OursToOuter(SFI_NUM_FIELDS) == FIELD_MAP_NO_FIELD);
+    HT_CHECK(pfm->GetWrappedType(cWrapped) == CPFT_INVALID);
+}
+
+static void _TestFieldMapInsertBefore()
+{
+    const DWORD cWrapped = ARRAYSIZE(s_rgcpftWrapped);
+
+    // With the type there, ours go in front of its first field; without it, or for
+    // CPFT_INVALID, at the end.
+    HT_CHECK(FieldMap::FindInsertBefore(cWrapped, s_rgcpftWrapped, CPFT_SUBMIT_BUTTON) == FMT_WRAPPED_SUBMIT);
+    HT_CHECK(FieldMap::FindInsertBefore(cWrapped, s_rgcpftWrapped, CPFT_TILE_IMAGE) == 0);
+    HT_CHECK(FieldMap::FindInsertBefore(cWrapped, s_rgcpftWrapped, CPFT_CHECKBOX) == cWrapped);
+    HT_CHECK(FieldMap::FindInsertBefore(cWrapped, s_rgcpftWrapped, CPFT_INVALID) == cWrapped);
+    HT_CHECK(FieldMap::FindInsertBefore(0, NULL, CPFT_SUBMIT_BUTTON) == 0);
+
+    // A field whose descriptor couldn't be had is CPFT_INVALID, and still doesn't pull ours in.
+    const CREDENTIAL_PROVIDER_FIELD_TYPE rgcpftUnknown[] = { CPFT_LARGE_TEXT, CPFT_INVALID, CPFT_SMALL_TEXT, CPFT_SMALL_TEXT };
+    HT_CHECK(FieldMap::FindInsertBefore(ARRAYSIZE(rgcpftUnknown), rgcpftUnknown, CPFT_INVALID) == ARRAYSIZE(rgcpftUnknown));
+    HT_CHECK(FieldMap::FindInsertBefore(ARRAYSIZE(rgcpftUnknown), rgcpftUnknown, CPFT_SMALL_TEXT) == 2);
+
+    // Whatever MY_FIELDS_INSERT_BEFORE is set to, ours land just before the first field of
+    // that type, or at the end.
+    DWORD dwExpected = cWrapped;
+    for (DWORD i = 0; i < cWrapped && MY_FIELDS_INSERT_BEFORE != CPFT_INVALID; i++)
+    {
+        if (s_rgcpftWrapped[i] == MY_FIELDS_INSERT_BEFORE)
+        {
+            dwExpected = i;
+            break;
+        }
+    }
+    DWORD dwInsertBefore = FieldMap::FindInsertBefore(cWrapped, s_rgcpftWrapped, MY_FIELDS_INSERT_BEFORE);
+    HT_CHECK(dwInsertBefore == dwExpected);
+
+    FieldMap* pfm;
+    HT_CHECK(SUCCEEDED(FieldMap::Create(cWrapped, s_rgcpftWrapped, SFI_NUM_FIELDS, dwInsertBefore, &pfm)));
+    if (pfm != NULL)
+    {
+        _CheckMap(pfm, dwInsertBefore);
+        pfm->Release();
+    }
+
+    // An insertion point past the end is the end.
+    HT_CHECK(SUCCEEDED(FieldMap::Create(cWrapped, s_rgcpftWrapped, SFI_NUM_FIELDS, cWrapped + 10, &pfm)));
+    if (pfm != NULL)
+    {
+        _CheckMap(pfm, cWrapped);
+        pfm->Release();
+    }
+
+    HT_CHECK(FieldMap::Create(MAXDWORD - SFI_NUM_FIELDS, s_rgcpftWrapped, SFI_NUM_FIELDS, 0, &pfm) == E_INVALIDARG && pfm == NULL);
+}
+
+// Routes LogonUI's calls and the wrapped credential's events through a wrapper credential
+// whose map has ours in front of wrapped field dwInsertBefore.
+static void _TestFieldMapRouting(__in StringPool* psp, __in const DWORD* rgdwFieldStrings, __in DWORD dwInsertBefore)
+{
+    const DWORD cWrapped = ARRAYSIZE(s_rgcpftWrapped);
+    FieldMap* pfm;
+    HT_CHECK(SUCCEEDED(FieldMap::Create(cWrapped, s_rgcpftWrapped, SFI_NUM_FIELDS, dwInsertBefore, &pfm)));
+    MockWrappedCredential* pmwc = new MockWrappedCredential();
+    RecordingEvents* pre = new RecordingEvents();
+    Credential* pc = new Credential();
+    if (pfm == NULL || pmwc == NULL || pre == NULL || pc == NULL)
+    {
+        HT_CHECK(!"out of memory");
+        return;
+    }
+    HT_CHECK(SUCCEEDED(pc->Initialize(pmwc, pfm, psp, rgdwFieldStrings)));
+    HT_CHECK(pc->GetFieldMap() == pfm);
+
+    // Outer to inner: LogonUI's calls on wrapped fields reach the wrapped credential under
+    // its own ids, and calls on ours never do.
+    for (DWORD dwOuterID = 0; dwOuterID < pfm->GetCount(); dwOuterID++)
+    {
+        DWORD dwInnerID;
+        FIELD_OWNER fo = pfm->ToInner(dwOuterID, &dwInnerID);
+
+        CREDENTIAL_PROVIDER_FIELD_STATE cpfs;
+        CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE cpfis;
+        pmwc->dwLastID = FMT_NOT_ASKED;
+        HT_CHECK(pc->GetFieldState(dwOuterID, &cpfs, &cpfis) == S_OK);
+        if (fo == FO_WRAPPED)
+        {
+            HT_CHECK(pmwc->dwLastID == dwInnerID && cpfs == CPFS_DISPLAY_IN_DESELECTED_TILE && cpfis == CPFIS_READONLY);
+        }
+        else
+        {
+            HT_CHECK(pmwc->dwLastID == FMT_NOT_ASKED);
+            HT_CHECK(cpfs == s_rgFieldStatePairs[dwInnerID].cpfs && cpfis == s_rgFieldStatePairs[dwInnerID].cpfis);
+        }
+
+        pmwc->dwLastID = FMT_NOT_ASKED;
+        HRESULT hr = pc->SetStringValue(dwOuterID, L"typed");
+        HT_CHECK((fo == FO_WRAPPED) ? (hr == S_OK && pmwc->dwLastID == dwInnerID) : (hr == E_INVALIDARG && pmwc->dwLastID == FMT_NOT_ASKED));
+    }
+
+    // Our command link shows its value from the pool.
+    PWSTR pwsz;
+    HT_CHECK(pc->GetStringValue(pfm->OursToOuter(SFI_BOOT_MAC_COMMAND), &pwsz) == S_OK);
+    if (pwsz != NULL)
+    {
+        HT_CHECK(lstrcmpW(pwsz, s_rgpwszFieldValues[SFI_BOOT_MAC_COMMAND]) == 0);
+        CoTaskMemFree(pwsz);
+    }
+
+    // The submit button's neighbour comes back as an outer id too.
+    DWORD dwAdjacentTo;
+    HT_CHECK(pc->GetSubmitButtonValue(pfm->WrappedToOuter(FMT_WRAPPED_SUBMIT), &dwAdjacentTo) == S_OK);
+    HT_CHECK(pmwc->dwLastID == FMT_WRAPPED_SUBMIT && dwAdjacentTo == pfm->WrappedToOuter(FMT_WRAPPED_PASSWORD));
+
+    // Ids past the end belong to no one.
+    pmwc->dwLastID = FMT_NOT_ASKED;
+    HT_CHECK(pc->CommandLinkClicked(pfm->GetCount()) == E_INVALIDARG && pmwc->dwLastID == FMT_NOT_ASKED);
+
+    // Wrapped to outer: the wrapped credential's events reach LogonUI from the wrapper
+    // credential, under the ids LogonUI knows.
+    HT_CHECK(SUCCEEDED(pc->Advise(pre)));
+    HT_CHECK(pmwc->pcpce != NULL);
+    if (pmwc->pcpce != NULL)
+    {
+        for (DWORD dwInnerID = 0; dwInnerID < cWrapped; dwInnerID++)
+        {
+            pre->pcpcLast = NULL;
+            HT_CHECK(pmwc->pcpce->SetFieldState(pmwc, dwInnerID, CPFS_HIDDEN) == S_OK);
+            HT_CHECK(pre->pcpcLast == pc && pre->dwFieldIDLast == pfm->WrappedToOuter(dwInnerID));
+            pre->pcpcLast = NULL;
+            HT_CHECK(pmwc->pcpce->SetFieldInteractiveState(pmwc, dwInnerID, CPFIS_DISABLED) == S_OK);
+            HT_CHECK(pre->pcpcLast == pc && pre->dwFieldIDLast == pfm->WrappedToOuter(dwInnerID));
+        }
+
+        // Text goes through the wrapper credential, which passes text it has no rule for as is.
+        HT_CHECK(pmwc->pcpce->SetFieldString(pmwc, 4, L"Locked") == S_OK);
+        HT_CHECK(pre->pcpcLast == pc && pre->dwFieldIDLast == pfm->WrappedToOuter(4) && lstrcmpW(pre->wszLast, L"Locked") == 0);
+
+        HT_CHECK(pmwc->pcpce->SetFieldSubmitButton(pmwc, FMT_WRAPPED_SUBMIT, FMT_WRAPPED_PASSWORD) == S_OK);
+        HT_CHECK(pre->dwFieldIDLast == pfm->WrappedToOuter(FMT_WRAPPED_SUBMIT) &&
+                 pre->dwAdjacentToLast == pfm->WrappedToOuter(FMT_WRAPPED_PASSWORD));
+
+        // An id the wrapped credential doesn't have isn't passed on.
+        LONG cEvents = pre->cEvents;
+        HT_CHECK(pmwc->pcpce->SetFieldState(pmwc, cWrapped, CPFS_HIDDEN) == E_INVALIDARG);
+        HT_CHECK(pmwc->pcpce->SetFieldSubmitButton(pmwc, FMT_WRAPPED_SUBMIT, cWrapped) == E_INVALIDARG);
+        HT_CHECK(pre->cEvents == cEvents);
+    }
+
+    HT_CHECK(SUCCEEDED(pc->UnAdvise()));
+    HT_CHECK(pmwc->cUnAdvise == 1 && pmwc->pcpce == NULL);
+
+    pc->Release();
+    pre->Release();
+    pmwc->Release();
+    pfm->Release();
+}
+
+// The wrapper credential asks the wrapped one for a text field's value once, and then
+// remembers it until the wrapped credential says it changed or LogonUI advises again.
+static void _TestFieldMapMemo(__in StringPool* psp, __in const DWORD* rgdwFieldStrings)
+{
+    const DWORD cWrapped = ARRAYSIZE(s_rgcpftWrapped);
+    FieldMap* pfm;
+    HT_CHECK(SUCCEEDED(FieldMap::Create(cWrapped, s_rgcpftWrapped, SFI_NUM_FIELDS, cWrapped, &pfm)));
+    MockWrappedCredential* pmwc = new MockWrappedCredential();
+    RecordingEvents* pre = new RecordingEvents();
+    Credential* pc = new Credential();
+    if (pfm == NULL || pmwc == NULL || pre == NULL || pc == NULL)
+    {
+        HT_CHECK(!"out of memory");
+        return;
+    }
+    HT_CHECK(SUCCEEDED(pc->Initialize(pmwc, pfm, psp, rgdwFieldStrings)));
+
+    // Field 1 is large text and field 4 small text; field 2 is the password, which isn't remembered.
+    StringCchCopyW(pmwc->wszValue, ARRAYSIZE(pmwc->wszValue), L"Alice");
+    static const struct
+    {
+        DWORD   dwInnerID;
+        PCWSTR  pwszExpected;
+        LONG    cGetStringValue;
+    } s_rgSteps[] =
+    {
+        { 1, L"Alice", 1 },
+        { 1, L"Alice", 1 },
+        { 4, L"Alice", 2 },
+        { 4, L"Alice", 2 },
+        { 2, L"Alice", 3 },
+        { 2, L"Alice", 4 },
+    };
+    for (DWORD i = 0; i < ARRAYSIZE(s_rgSteps); i++)
+    {
+        PWSTR pwsz = NULL;
+        HT_CHECK(pc->GetStringValue(pfm->WrappedToOuter(s_rgSteps[i].dwInnerID), &pwsz) == S_OK);
+        HT_CHECK(pwsz != NULL && lstrcmpW(pwsz, s_rgSteps[i].pwszExpected) == 0);
+        HT_CHECK(pmwc->cGetStringValue == s_rgSteps[i].cGetStringValue);
+        CoTaskMemFree(pwsz);
+    }
+
+    // Nothing told us about changes before LogonUI advised, so it asks again after.
+    PWSTR pwsz = NULL;
+    HT_CHECK(SUCCEEDED(pc->Advise(pre)));
+    HT_CHECK(pc->GetStringValue(pfm->WrappedToOuter(1), &pwsz) == S_OK && pmwc->cGetStringValue == 5);
+    CoTaskMemFree(pwsz);
+
+    if (pmwc->pcpce != NULL)
+    {
+        // A change the wrapped credential reports replaces what we remember, without asking.
+        HT_CHECK(pmwc->pcpce->SetFieldString(pmwc, 1, L"Bob") == S_OK && lstrcmpW(pre->wszLast, L"Bob") == 0);
+        pwsz = NULL;
+        HT_CHECK(pc->GetStringValue(pfm->WrappedToOuter(1), &pwsz) == S_OK);
+        HT_CHECK(pwsz != NULL && lstrcmpW(pwsz, L"Bob") == 0 && pmwc->cGetStringValue == 5);
+        CoTaskMemFree(pwsz);
+
+        // One it doesn't report isn't seen, since we don't ask again.
+        StringCchCopyW(pmwc->wszValue, ARRAYSIZE(pmwc->wszValue), L"Carol");
+        pwsz = NULL;
+        HT_CHECK(pc->GetStringValue(pfm->WrappedToOuter(1), &pwsz) == S_OK);
+        HT_CHECK(pwsz != NULL && lstrcmpW(pwsz, L"Bob") == 0 && pmwc->cGetStringValue == 5);
+        CoTaskMemFree(pwsz);
+
+        // The other text field was forgotten when LogonUI advised, so it is asked for again.
+        pwsz = NULL;
+        HT_CHECK(pc->GetStringValue(pfm->WrappedToOuter(4), &pwsz) == S_OK);
+        HT_CHECK(pwsz != NULL && lstrcmpW(pwsz, L"Carol") == 0 && pmwc->cGetStringValue == 6);
+        CoTaskMemFree(pwsz);
+
+        // A change to the password passes through and isn't remembered.
+        HT_CHECK(pmwc->pcpce->SetFieldString(pmwc, 2, L"typed") == S_OK && lstrcmpW(pre->wszLast, L"typed") == 0);
+        pwsz = NULL;
+        HT_CHECK(pc->GetStringValue(pfm->WrappedToOuter(2), &pwsz) == S_OK);
+        HT_CHECK(pwsz != NULL && lstrcmpW(pwsz, L"Carol") == 0 && pmwc->cGetStringValue == 7);
+        CoTaskMemFree(pwsz);
+    }
+    else
+    {
+        HT_CHECK(!"not advised");
+    }
+
+    HT_CHECK(SUCCEEDED(pc->UnAdvise()));
+    pc->Release();
+    pre->Release();
+    pmwc->Release();
+    pfm->Release();
+}
+
+// The provider gives a credential it reuses the map from its latest enumeration, and the
+// credential may still be advised: the wrapped credential's events have to follow it to
+// the new map, and keep it alive, rather than use the old one.
+static void _TestFieldMapRemap(__in StringPool* psp, __in const DWORD* rgdwFieldStrings)
+{
+    const DWORD cWrapped = ARRAYSIZE(s_rgcpftWrapped);
+    FieldMap* pfmOld;
+    FieldMap* pfmNew;
+    HT_CHECK(SUCCEEDED(FieldMap::Create(cWrapped, s_rgcpftWrapped, SFI_NUM_FIELDS, FMT_WRAPPED_SUBMIT, &pfmOld)));
+    HT_CHECK(SUCCEEDED(FieldMap::Create(cWrapped, s_rgcpftWrapped, SFI_NUM_FIELDS, cWrapped, &pfmNew)));
+    MockWrappedCredential* pmwc = new MockWrappedCredential();
+    RecordingEvents* pre = new RecordingEvents();
+    Credential* pc = new Credential();
+    if (pfmOld == NULL || pfmNew == NULL || pmwc == NULL || pre == NULL || pc == NULL)
+    {
+        HT_CHECK(!"out of memory");
+        return;
+    }
+    HT_CHECK(SUCCEEDED(pc->Initialize(pmwc, pfmOld, psp, rgdwFieldStrings)));
+    HT_CHECK(SUCCEEDED(pc->Advise(pre)));
+    HT_CHECK(SUCCEEDED(pc->Initialize(pmwc, pfmNew, psp, rgdwFieldStrings)));
+    HT_CHECK(pc->GetFieldMap() == pfmNew);
+
+    // The last field moves when ours go at the end instead of before the submit button.
+    HT_CHECK(pfmOld->WrappedToOuter(4) != pfmNew->WrappedToOuter(4));
+    if (pmwc->pcpce != NULL)
+    {
+        HT_CHECK(pmwc->pcpce->SetFieldString(pmwc, 4, L"Locked") == S_OK);
+        HT_CHECK(pre->pcpcLast == pc && pre->dwFieldIDLast == pfmNew->WrappedToOuter(4));
+        HT_CHECK(pmwc->pcpce->SetFieldSubmitButton(pmwc, FMT_WRAPPED_SUBMIT, FMT_WRAPPED_PASSWORD) == S_OK);
+        HT_CHECK(pre->dwFieldIDLast == pfmNew->WrappedToOuter(FMT_WRAPPED_SUBMIT) &&
+                 pre->dwAdjacentToLast == pfmNew->WrappedToOuter(FMT_WRAPPED_PASSWORD));
+    }
+    else
+    {
+        HT_CHECK(!"not advised");
+    }
+
+    // Nothing holds the old map but us; the credential and its events both hold the new one.
+    HT_CHECK(pfmOld->AddRef() == 2);
+    pfmOld->Release();
+    HT_CHECK(pfmNew->AddRef() == 4);
+    pfmNew->Release();
+
+    // And the events let go of it when LogonUI unadvises.
+    HT_CHECK(SUCCEEDED(pc->UnAdvise()));
+    HT_CHECK(pfmNew->AddRef() == 3);
+    pfmNew->Release();
+
+    pc->Release();
+    pre->Release();
+    pmwc->Release();
+    pfmOld->Release();
+    pfmNew->Release();
+}
+
+void TestFieldMap()
+{
+    _TestFieldMapInsertBefore();
+
+    // The provider puts its fields' values in a pool the same way.
+    StringPool* psp;
+    HT_CHECK(SUCCEEDED(StringPool::Create(&psp)));
+    if (psp == NULL)
+    {
+        return;
+    }
+    DWORD rgdwFieldStrings[SFI_NUM_FIELDS];
+    for (DWORD i = 0; i < SFI_NUM_FIELDS; i++)
+    {
+        HT_CHECK(SUCCEEDED(psp->Intern(s_rgpwszFieldValues[i], &rgdwFieldStrings[i])));
+    }
+
+    // Ours in front of the submit button, where the type is there, and at the end, where it isn't.
+    _TestFieldMapRouting(psp, rgdwFieldStrings, FieldMap::FindInsertBefore(ARRAYSIZE(s_rgcpftWrapped), s_rgcpftWrapped, CPFT_SUBMIT_BUTTON));
+    _TestFieldMapRouting(psp, rgdwFieldStrings, FieldMap::FindInsertBefore(ARRAYSIZE(s_rgcpftWrapped), s_rgcpftWrapped, CPFT_CHECKBOX));
+    _TestFieldMapMemo(psp, rgdwFieldStrings);
+    _TestFieldMapRemap(psp, rgdwFieldStrings);
+
+    psp->Release();
+}
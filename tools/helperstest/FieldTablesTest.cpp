@@ -0,0 +1,106 @@
+#include "helperstest.h"
+#include "helpers.h"
+
+// One row of a field list, as MY_FIELDS gives it.
+struct FIELD_ROW
+{
+    DWORD                                       dwFieldID;
+    CREDENTIAL_PROVIDER_FIELD_TYPE              cpft;
+    PCWSTR                                      pwszLabel;
+    PCWSTR                                      pwszValue;  // NULL for BootPicker, which has no values.
+    CREDENTIAL_PROVIDER_FIELD_STATE             cpfs;
+    CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE cpfis;
+};
+
+// Both providers' common.h use the same names, so each goes in a namespace of its
+// own. Everything they include is already in, so only their own declarations land
+// there. MY_FIELDS is a macro, which no namespace holds, so each provider's list is
+// read before the next common.h redefines it.
+namespace BootPickerFields
+{
+#include "../../BootPicker/common.h"
+
+#define BOOTPICKER_FIELD_ROW(id, cpft, label, cpfs, cpfis)  { id, cpft, label, NULL, cpfs, cpfis },
+    static const FIELD_ROW s_rgRows[] =
+    {
+        MY_FIELDS(BOOTPICKER_FIELD_ROW)
+    };
+#undef BOOTPICKER_FIELD_ROW
+#undef MY_FIELDS
+}
+
+namespace WrapperFields
+{
+#include "../../BootPickerWrapper/common.h"
+
+#define WRAPPER_FIELD_ROW(id, cpft, label, value, cpfs, cpfis)  { id, cpft, label, value, cpfs, cpfis },
+    static const FIELD_ROW s_rgRows[] =
+    {
+        MY_FIELDS(WRAPPER_FIELD_ROW)
+    };
+#undef WRAPPER_FIELD_ROW
+}
+
+// Checks that each table has a row for every field in the list, in the list's order,
+// and that a descriptor's id is its index, which is what LogonUI asks for it by. The
+// providers each have their own FIELD_STATE_PAIR.
+template <class FIELD_STATE_PAIR_T>
+static void _CheckFieldTables(
+    __in_ecount(cRows) const FIELD_ROW* rgRows,
+    __in DWORD cRows,
+    __in_ecount(cRows) const CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR* rgcpfd,
+    __in_ecount(cRows) const FIELD_STATE_PAIR_T* rgfsp,
+    __in_ecount_opt(cRows) const PCWSTR* rgpwszValues
+    )
+{
+    for (DWORD i = 0; i < cRows; i++)
+    {
+        HT_CHECK(rgRows[i].dwFieldID == i);
+        HT_CHECK(rgcpfd[i].dwFieldID == i);
+        HT_CHECK(rgcpfd[i].cpft == rgRows[i].cpft);
+        HT_CHECK(lstrcmpW(rgcpfd[i].pszLabel, rgRows[i].pwszLabel) == 0);
+        HT_CHECK(rgfsp[i].cpfs == rgRows[i].cpfs);
+        HT_CHECK(rgfsp[i].cpfis == rgRows[i].cpfis);
+        if (rgpwszValues != NULL)
+        {
+            HT_CHECK(rgpwszValues[i] != NULL && lstrcmpW(rgpwszValues[i], rgRows[i].pwszValue) == 0);
+        }
+
+        // LogonUI tells fields apart by id; a label used twice is almost certainly a copied row.
+        for (DWORD j = 0; j < i; j++)
+        {
+            HT_CHECK(lstrcmpW(rgcpfd[i].pszLabel, rgcpfd[j].pszLabel) != 0);
+        }
+    }
+}
+
+static void _TestBootPickerFields()
+{
+    using namespace BootPickerFields;
+
+    _CheckFieldTables(s_rgRows, SFI_NUM_FIELDS, s_rgCredProvFieldDescriptors, s_rgFieldStatePairs, NULL);
+
+    // The credential finds its command link by id, and only the selected tile shows it.
+    HT_CHECK(s_rgCredProvFieldDescriptors[SFI_COMMAND_LINK].cpft == CPFT_COMMAND_LINK);
+    HT_CHECK(s_rgFieldStatePairs[SFI_COMMAND_LINK].cpfs == CPFS_DISPLAY_IN_SELECTED_TILE);
+    HT_CHECK(s_rgCredProvFieldDescriptors[SFI_TILEIMAGE].cpft == CPFT_TILE_IMAGE);
+    HT_CHECK(s_rgCredProvFieldDescriptors[SFI_LARGE_TEXT].cpft == CPFT_LARGE_TEXT);
+}
+
+static void _TestWrapperFields()
+{
+    using namespace WrapperFields;
+
+    _CheckFieldTables(s_rgRows, SFI_NUM_FIELDS, s_rgCredProvFieldDescriptors, s_rgFieldStatePairs, s_rgpwszFieldValues);
+
+    HT_CHECK(s_rgCredProvFieldDescriptors[SFI_BOOT_MAC_COMMAND].cpft == CPFT_COMMAND_LINK);
+    HT_CHECK(lstrcmpW(s_rgpwszFieldValues[SFI_BOOT_MAC_COMMAND], L"Reboot to Mac OS X") == 0);
+    HT_CHECK(s_rgFieldStatePairs[SFI_BOOT_MAC_COMMAND].cpfs == CPFS_DISPLAY_IN_SELECTED_TILE);
+    HT_CHECK(s_rgCredProvFieldDescriptors[SFI_BLANK_LINE].cpft == CPFT_SMALL_TEXT);
+}
+
+void TestFieldTables()
+{
+    _TestBootPickerFields();
+    _TestWrapperFields();
+}
@@ -0,0 +1,358 @@
+#include "helperstest.h"
+#include "GptScanner.h"
+
+#define IMAGE_ENTRIES       128
+#define IMAGE_ENTRY_BYTES   128
+#define IMAGE_ENTRY_LBA     2
+#define IMAGE_MUTATIONS     20000
+
+// A disk that lives in memory, for building GPTs and then breaking them.
+class MemoryDiskReader : public DiskReader
+{
+  public:
+    MemoryDiskReader(__in DWORD cbSector, __in DWORD cSectors) :
+        cbSector(cbSector), cb(cbSector * cSectors), bFailReads(FALSE)
+    {
+        pb = new BYTE[cb];
+        ZeroMemory(pb, cb);
+    }
+
+    ~MemoryDiskReader()
+    {
+        delete[] pb;
+    }
+
+    DWORD GetSectorSize()
+    {
+        return cbSector;
+    }
+
+    HRESULT Read(__in ULONGLONG ullOffset, __out_bcount(cbRead) void* pv, __in DWORD cbRead)
+    {
+        if (bFailReads)
+        {
+            return HRESULT_FROM_WIN32(ERROR_NOT_READY);
+        }
+        if ((ullOffset % cbSector) || (cbRead % cbSector) || (ullOffset > cb) || (cbRead > cb - ullOffset))
+        {
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        }
+        CopyMemory(pv, pb + ullOffset, cbRead);
+        return S_OK;
+    }
+
+    DWORD   cbSector;
+    DWORD   cb;
+    BYTE*   pb;
+    BOOL    bFailReads;     // Every read fails, like a disk that isn't there any more.
+};
+
+// The GPT's CRC-32, worked out separately from the scanner's.
+static DWORD _Crc32(__in_bcount(cb) const BYTE* pb, __in DWORD cb)
+{
+    static DWORD s_rgdwTable[256];
+    if (s_rgdwTable[1] == 0)
+    {
+        for (DWORD i = 0; i < 256; i++)
+        {
+            DWORD dw = i;
+            for (int j = 0; j < 8; j++)
+            {
+                dw = (dw & 1) ? (0xEDB88320 ^ (dw >> 1)) : (dw >> 1);
+            }
+            s_rgdwTable[i] = dw;
+        }
+    }
+
+    DWORD dwCrc = 0xFFFFFFFF;
+    for (DWORD i = 0; i < cb; i++)
+    {
+        dwCrc = s_rgdwTable[(dwCrc ^ pb[i]) & 0xFF] ^ (dwCrc >> 8);
+    }
+    return ~dwCrc;
+}
+
+// Little-endian fields at byte offsets, so the test doesn't share the scanner's structs.
+static void _Put32(__out_bcount(4) BYTE* pb, __in DWORD dw)
+{
+    CopyMemory(pb, &dw, sizeof(dw));
+}
+
+static void _Put64(__out_bcount(8) BYTE* pb, __in ULONGLONG ull)
+{
+    CopyMemory(pb, &ull, sizeof(ull));
+}
+
+static const GUID s_guidApfs = { 0x7C3457EF, 0x0000, 0x11AA, { 0xAA, 0x11, 0x00, 0x30, 0x65, 0x43, 0xEC, 0xAC } };
+static const GUID s_guidHfsPlus = { 0x48465300, 0x0000, 0x11AA, { 0xAA, 0x11, 0x00, 0x30, 0x65, 0x43, 0xEC, 0xAC } };
+static const GUID s_guidAppleBoot = { 0x426F6F74, 0x0000, 0x11AA, { 0xAA, 0x11, 0x00, 0x30, 0x65, 0x43, 0xEC, 0xAC } };
+static const GUID s_guidBasicData = { 0xEBD0A0A2, 0xB9E5, 0x4433, { 0x87, 0xC0, 0x68, 0xB6, 0xB7, 0x26, 0x99, 0xC7 } };
+
+// Fills in partition entry i.
+static void _PutEntry(__inout MemoryDiskReader* pmdr, __in DWORD i, __in const GUID& guidType, __in ULONGLONG ullStart, __in ULONGLONG ullEnd, __in PCWSTR pwszName)
+{
+    BYTE* pb = pmdr->pb + IMAGE_ENTRY_LBA * pmdr->cbSector + i * IMAGE_ENTRY_BYTES;
+    CopyMemory(pb, &guidType, sizeof(GUID));
+    GUID guidPartition = guidType;
+    guidPartition.Data2 = (WORD)(i + 1);
+    CopyMemory(pb + 16, &guidPartition, sizeof(GUID));
+    _Put64(pb + 32, ullStart);
+    _Put64(pb + 40, ullEnd);
+    for (DWORD j = 0; pwszName[j] != L'\0' && j < 36; j++)
+    {
+        CopyMemory(pb + 56 + j * sizeof(WCHAR), &pwszName[j], sizeof(WCHAR));
+    }
+}
+
+// Writes the header for the entries, with both CRCs right.
+static void _PutHeader(__inout MemoryDiskReader* pmdr)
+{
+    BYTE* pbEntries = pmdr->pb + IMAGE_ENTRY_LBA * pmdr->cbSector;
+    BYTE* pb = pmdr->pb + pmdr->cbSector;
+    ZeroMemory(pb, pmdr->cbSector);
+    CopyMemory(pb, "EFI PART", 8);
+    _Put32(pb + 8, 0x00010000);
+    _Put32(pb + 12, 92);
+    _Put64(pb + 24, 1);
+    _Put64(pb + 32, pmdr->cb / pmdr->cbSector - 1);
+    _Put64(pb + 40, 34);
+    _Put64(pb + 48, pmdr->cb / pmdr->cbSector - 34);
+    _Put64(pb + 72, IMAGE_ENTRY_LBA);
+    _Put32(pb + 80, IMAGE_ENTRIES);
+    _Put32(pb + 84, IMAGE_ENTRY_BYTES);
+    _Put32(pb + 88, _Crc32(pbEntries, IMAGE_ENTRIES * IMAGE_ENTRY_BYTES));
+    _Put32(pb + 16, _Crc32(pb, 92));
+}
+
+// Makes the CRCs match whatever the header and entries hold now.
+static void _FixCrcs(__inout MemoryDiskReader* pmdr)
+{
+    BYTE* pb = pmdr->pb + pmdr->cbSector;
+    _Put32(pb + 88, _Crc32(pmdr->pb + IMAGE_ENTRY_LBA * pmdr->cbSector, IMAGE_ENTRIES * IMAGE_ENTRY_BYTES));
+    DWORD cbHeader;
+    CopyMemory(&cbHeader, pb + 12, sizeof(cbHeader));
+    _Put32(pb + 16, 0);
+    _Put32(pb + 16, _Crc32(pb, (cbHeader <= pmdr->cbSector) ? cbHeader : 92));
+}
+
+// An HFS+ volume header at the start of the partition: the signature, and the blessed
+// system folder in finderInfo[0]. Both are big-endian.
+static void _PutHfsHeader(__inout MemoryDiskReader* pmdr, __in ULONGLONG ullStartLba, __in WORD wSignature, __in DWORD dwBlessedFolder)
+{
+    BYTE* pb = pmdr->pb + ullStartLba * pmdr->cbSector + 1024;
+    ZeroMemory(pb, 512);
+    pb[0] = HIBYTE(wSignature);
+    pb[1] = LOBYTE(wSignature);
+    pb[80] = (BYTE)(dwBlessedFolder >> 24);
+    pb[81] = (BYTE)(dwBlessedFolder >> 16);
+    pb[82] = (BYTE)(dwBlessedFolder >> 8);
+    pb[83] = (BYTE)dwBlessedFolder;
+}
+
+// Scans the disk and returns whether its only HFS+ volume came out blessed.
+static BOOL _IsHfsVolumeBlessed(__in MemoryDiskReader* pmdr)
+{
+    GPT_INDEX gi = {};
+    if (FAILED(GptScanDisk(pmdr, 0, &gi)))
+    {
+        return FALSE;
+    }
+    for (DWORD i = 0; i < gi.cTargets; i++)
+    {
+        if (gi.rgTargets[i].bKind == GTK_HFSPLUS)
+        {
+            return gi.rgTargets[i].bBlessed;
+        }
+    }
+    return FALSE;
+}
+
+// A Mac's disk: EFI system partition, APFS, Recovery HD, then Windows.
+static void _MakeMacDisk(__inout MemoryDiskReader* pmdr)
+{
+    ZeroMemory(pmdr->pb, pmdr->cb);
+    _PutEntry(pmdr, 0, s_guidBasicData, 40, 99, L"EFI");
+    _PutEntry(pmdr, 1, s_guidApfs, 100, 199, L"Macintosh HD");
+    _PutEntry(pmdr, 2, s_guidAppleBoot, 200, 249, L"Recovery HD");
+    _PutEntry(pmdr, 3, s_guidBasicData, 250, 399, L"BOOTCAMP");
+    _PutEntry(pmdr, 5, s_guidHfsPlus, 400, 449, L"Old Mac");
+    _PutHeader(pmdr);
+}
+
+// Whether everything the scanner found could have come from the disk.
+static BOOL _IsIndexSane(__in const GPT_INDEX& gi, __in const MemoryDiskReader& mdr)
+{
+    if (gi.cTargets > ARRAYSIZE(gi.rgTargets))
+    {
+        return FALSE;
+    }
+    for (DWORD i = 0; i < gi.cTargets; i++)
+    {
+        const GPT_TARGET& rgt = gi.rgTargets[i];
+        if (rgt.bKind > GTK_APPLE_BOOT || rgt.wPartitionNumber == 0 || rgt.ullSizeLba == 0 ||
+            rgt.dwSectorSize != mdr.cbSector || rgt.wszName[GPT_NAME_CCH] != L'\0' ||
+            (rgt.bBlessed && rgt.bKind != GTK_HFSPLUS))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void _TestGptSectorSize(__in DWORD cbSector)
+{
+    MemoryDiskReader mdr(cbSector, 4096 * 512 / cbSector);
+    _MakeMacDisk(&mdr);
+
+    GPT_INDEX gi = {};
+    HT_CHECK(SUCCEEDED(GptScanDisk(&mdr, 3, &gi)));
+    HT_CHECK(gi.cTargets == 3);
+    if (gi.cTargets == 3)
+    {
+        HT_CHECK(gi.rgTargets[0].bKind == GTK_APFS && gi.rgTargets[0].wPartitionNumber == 2);
+        HT_CHECK(gi.rgTargets[0].ullStartLba == 100 && gi.rgTargets[0].ullSizeLba == 100);
+        HT_CHECK(gi.rgTargets[0].bDisk == 3 && gi.rgTargets[0].dwSectorSize == cbSector);
+        HT_CHECK(gi.rgTargets[0].guidPartition.Data2 == 2);
+        HT_CHECK(lstrcmpW(gi.rgTargets[0].wszName, L"Macintosh HD") == 0);
+        HT_CHECK(gi.rgTargets[1].bKind == GTK_APPLE_BOOT && gi.rgTargets[1].wPartitionNumber == 3);
+        HT_CHECK(gi.rgTargets[2].bKind == GTK_HFSPLUS && gi.rgTargets[2].wPartitionNumber == 6);
+        HT_CHECK(GptIsMacVolume(gi.rgTargets[0]) && !GptIsMacVolume(gi.rgTargets[1]));
+        HT_CHECK(!gi.rgTargets[0].bBlessed && !gi.rgTargets[1].bBlessed && !gi.rgTargets[2].bBlessed);
+    }
+
+    // The HFS+ volume header is 1024 bytes in whatever the sector size, so with 4K
+    // sectors it's in the partition's first sector rather than its third.
+    _PutHfsHeader(&mdr, 400, 0x482B, 2);
+    HT_CHECK(_IsHfsVolumeBlessed(&mdr));
+
+    // A second disk appends to the same index.
+    HT_CHECK(SUCCEEDED(GptScanDisk(&mdr, 4, &gi)) && gi.cTargets == 6 && gi.rgTargets[5].bDisk == 4);
+}
+
+void TestGptScanner()
+{
+    _TestGptSectorSize(512);
+    _TestGptSectorSize(4096);
+
+    MemoryDiskReader mdr(512, 4096);
+    GPT_INDEX gi;
+
+    // Only an HFS+ or HFSX volume with a blessed system folder is blessed. A data or Time
+    // Machine volume has no folder, and a volume of another kind doesn't count.
+    _MakeMacDisk(&mdr);
+    _PutHfsHeader(&mdr, 400, 0x4858, 0x12345678);
+    HT_CHECK(_IsHfsVolumeBlessed(&mdr));
+    _PutHfsHeader(&mdr, 400, 0x482B, 0);
+    HT_CHECK(!_IsHfsVolumeBlessed(&mdr));
+    _PutHfsHeader(&mdr, 400, 0x4244, 2);
+    HT_CHECK(!_IsHfsVolumeBlessed(&mdr));
+    _PutHfsHeader(&mdr, 400, 0x2B48, 2);
+    HT_CHECK(!_IsHfsVolumeBlessed(&mdr));
+    _PutHfsHeader(&mdr, 100, 0x482B, 2);
+    gi.cTargets = 0;
+    HT_CHECK(SUCCEEDED(GptScanDisk(&mdr, 0, &gi)) && gi.rgTargets[0].bKind == GTK_APFS && !gi.rgTargets[0].bBlessed);
+
+    // An HFS+ volume whose header is past the end of the disk isn't blessed, and doesn't
+    // stop the rest of the disk being scanned.
+    _MakeMacDisk(&mdr);
+    _PutEntry(&mdr, 5, s_guidHfsPlus, 4095, 4200, L"Off the end");
+    _PutHeader(&mdr);
+    gi.cTargets = 0;
+    HT_CHECK(SUCCEEDED(GptScanDisk(&mdr, 0, &gi)) && gi.cTargets == 3 && !gi.rgTargets[2].bBlessed);
+
+    // A name that fills its field is still terminated.
+    _MakeMacDisk(&mdr);
+    _PutEntry(&mdr, 1, s_guidApfs, 100, 199, L"0123456789012345678901234567890123456789");
+    _PutHeader(&mdr);
+    gi.cTargets = 0;
+    HT_CHECK(SUCCEEDED(GptScanDisk(&mdr, 0, &gi)) && gi.rgTargets[0].wszName[GPT_NAME_CCH] == L'\0');
+
+    // An entry that ends before it starts is skipped.
+    _MakeMacDisk(&mdr);
+    _PutEntry(&mdr, 1, s_guidApfs, 199, 100, L"Backwards");
+    _PutHeader(&mdr);
+    gi.cTargets = 0;
+    HT_CHECK(SUCCEEDED(GptScanDisk(&mdr, 0, &gi)) && gi.cTargets == 2);
+
+    // More targets than the index holds stops at the index.
+    _MakeMacDisk(&mdr);
+    for (DWORD i = 0; i < IMAGE_ENTRIES; i++)
+    {
+        _PutEntry(&mdr, i, s_guidApfs, 100 + i, 100 + i, L"");
+    }
+    _PutHeader(&mdr);
+    gi.cTargets = 0;
+    HT_CHECK(SUCCEEDED(GptScanDisk(&mdr, 0, &gi)) && gi.cTargets == GPT_MAX_TARGETS);
+
+    // Each of these breaks the GPT in a way that has to be caught.
+    struct
+    {
+        DWORD       ibField;    // Offset of a DWORD in the header sector.
+        DWORD       dwValue;
+        BOOL        bFixCrc;    // Whether to make the CRCs right again afterwards.
+    } s_rgBreaks[] =
+    {
+        { 0, 0x20494646, TRUE },        // Signature.
+        { 16, 0, FALSE },               // Header CRC.
+        { 12, 91, TRUE },               // Header too small.
+        { 12, 513, TRUE },              // Header bigger than a sector.
+        { 24, 2, TRUE },                // Header not where it says it is.
+        { 80, 0, TRUE },                // No entries.
+        { 80, 0x10000000, TRUE },       // Far too many entries.
+        { 84, 96, TRUE },               // Entries smaller than an entry.
+        { 84, 192, TRUE },              // Entry size not a power of two.
+        { 84, 8192, TRUE },             // Entries too big.
+        { 72, 1, TRUE },                // Entries on top of the header.
+        { 72, 4000, TRUE },             // Entries past the end of the disk.
+    };
+    for (int i = 0; i < ARRAYSIZE(s_rgBreaks); i++)
+    {
+        _MakeMacDisk(&mdr);
+        BYTE* pbHeader = mdr.pb + mdr.cbSector;
+        _Put32(pbHeader + s_rgBreaks[i].ibField, s_rgBreaks[i].dwValue);
+        if (s_rgBreaks[i].bFixCrc)
+        {
+            _FixCrcs(&mdr);
+        }
+        gi.cTargets = 0;
+        HT_CHECK(FAILED(GptScanDisk(&mdr, 0, &gi)) && gi.cTargets == 0);
+    }
+
+    // An entry that doesn't match the entry array CRC.
+    _MakeMacDisk(&mdr);
+    mdr.pb[IMAGE_ENTRY_LBA * mdr.cbSector + IMAGE_ENTRY_BYTES + 32] ^= 1;
+    gi.cTargets = 0;
+    HT_CHECK(FAILED(GptScanDisk(&mdr, 0, &gi)) && gi.cTargets == 0);
+
+    // A disk that can't be read.
+    _MakeMacDisk(&mdr);
+    mdr.bFailReads = TRUE;
+    gi.cTargets = 0;
+    HT_CHECK(FAILED(GptScanDisk(&mdr, 0, &gi)) && gi.cTargets == 0);
+    mdr.bFailReads = FALSE;
+
+    // Random damage to the header and entries, with the CRCs made right again half the time
+    // so the damage gets past them. Nothing may crash, and whatever is found must make sense.
+    DWORD dwSeed = 1;
+    BOOL bSane = TRUE;
+    for (int i = 0; i < IMAGE_MUTATIONS && bSane; i++)
+    {
+        _MakeMacDisk(&mdr);
+        int cFlips = 1 + (i % 8);
+        for (int j = 0; j < cFlips; j++)
+        {
+            dwSeed = dwSeed * 1103515245 + 12345;
+            DWORD ib = (dwSeed >> 8) % (92 + 8 * IMAGE_ENTRY_BYTES);
+            ib = (ib < 92) ? mdr.cbSector + ib : IMAGE_ENTRY_LBA * mdr.cbSector + ib - 92;
+            mdr.pb[ib] ^= (BYTE)(1 << ((dwSeed >> 4) & 7));
+        }
+        if (i & 1)
+        {
+            _FixCrcs(&mdr);
+        }
+        gi.cTargets = 0;
+        GptScanDisk(&mdr, 0, &gi);
+        bSane = _IsIndexSane(gi, mdr);
+    }
+    HT_CHECK(bSane);
+}
@@ -0,0 +1,380 @@
+#include "helperstest.h"
+#include "helpers.h"
+#include <wincred.h>
+
+#define KL_BENCH_ROUNDS     200000
+#define KL_CCH_MAX          (USHORT_MAX / sizeof(WCHAR))
+
+// The 32 bit layout a WOW caller packs, as PackedLogon.cpp reads it.
+#include <pshpack4.h>
+struct KL_UNICODE_STRING_WOW
+{
+    USHORT  Length;
+    USHORT  MaximumLength;
+    ULONG   Buffer;
+};
+
+struct KL_KERB_INTERACTIVE_UNLOCK_LOGON_WOW
+{
+    KERB_LOGON_SUBMIT_TYPE  MessageType;
+    KL_UNICODE_STRING_WOW   LogonDomainName;
+    KL_UNICODE_STRING_WOW   UserName;
+    KL_UNICODE_STRING_WOW   Password;
+    LUID                    LogonId;
+};
+#include <poppack.h>
+
+// What KerbInteractiveUnlockLogonSerialize should give: the two calls it replaces.
+static HRESULT _InitAndPack(
+    __in PCWSTR pwzDomain,
+    __in PCWSTR pwzUsername,
+    __in PCWSTR pwzPassword,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __deref_out_bcount(*pcb) BYTE** prgb,
+    __out DWORD* pcb
+    )
+{
+    *prgb = NULL;
+    *pcb = 0;
+
+    KERB_INTERACTIVE_UNLOCK_LOGON kiul;
+    HRESULT hr = KerbInteractiveUnlockLogonInit(const_cast<PWSTR>(pwzDomain), const_cast<PWSTR>(pwzUsername),
+                                                const_cast<PWSTR>(pwzPassword), cpus, &kiul);
+    if (SUCCEEDED(hr))
+    {
+        hr = KerbInteractiveUnlockLogonPack(kiul, prgb, pcb);
+    }
+    return hr;
+}
+
+// Whether both ways of serializing the three strings succeed with the same bytes, or fail alike.
+static BOOL _SerializesAlike(
+    __in PCWSTR pwzDomain,
+    __in PCWSTR pwzUsername,
+    __in PCWSTR pwzPassword,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus
+    )
+{
+    BYTE* rgbExpected;
+    DWORD cbExpected;
+    HRESULT hrExpected = _InitAndPack(pwzDomain, pwzUsername, pwzPassword, cpus, &rgbExpected, &cbExpected);
+
+    BYTE* rgb = (BYTE*)1;
+    DWORD cb = 1;
+    HRESULT hr = KerbInteractiveUnlockLogonSerialize(pwzDomain, pwzUsername, pwzPassword, cpus, &rgb, &cb);
+
+    BOOL bAlike;
+    if (SUCCEEDED(hrExpected))
+    {
+        bAlike = SUCCEEDED(hr) && cb == cbExpected && memcmp(rgb, rgbExpected, cb) == 0;
+    }
+    else
+    {
+        bAlike = FAILED(hr) && rgb == NULL && cb == 0;
+    }
+    CoTaskMemFree(rgbExpected);
+    CoTaskMemFree(rgb);
+    return bAlike;
+}
+
+// A string of cch characters that don't repeat often, so a string copied to the wrong place shows.
+static PWSTR _MakeString(__in size_t cch, __in WCHAR wchFirst)
+{
+    PWSTR pwz = (PWSTR)HeapAlloc(GetProcessHeap(), 0, (cch + 1) * sizeof(WCHAR));
+    if (pwz != NULL)
+    {
+        for (size_t i = 0; i < cch; i++)
+        {
+            pwz[i] = (WCHAR)(wchFirst + i % 251);
+        }
+        pwz[cch] = L'\0';
+    }
+    return pwz;
+}
+
+void TestKerbLogonSerialize()
+{
+    static const CREDENTIAL_PROVIDER_USAGE_SCENARIO s_rgcpus[] = { CPUS_LOGON, CPUS_UNLOCK_WORKSTATION, CPUS_CREDUI };
+    for (DWORD i = 0; i < ARRAYSIZE(s_rgcpus); i++)
+    {
+        HT_CHECK(_SerializesAlike(L"CONTOSO", L"alice", L"hunter2", s_rgcpus[i]));
+        HT_CHECK(_SerializesAlike(L"", L"", L"", s_rgcpus[i]));
+        HT_CHECK(_SerializesAlike(L".", L"bob", L"", s_rgcpus[i]));
+        HT_CHECK(_SerializesAlike(L"", L"carol", L"\x00e9t\x00e9", s_rgcpus[i]));
+    }
+
+    // The strings follow the header in order, and the header's padding is zeroed.
+    BYTE* rgb;
+    DWORD cb;
+    HRESULT hr = KerbInteractiveUnlockLogonSerialize(L"DOM", L"user", L"pw", CPUS_UNLOCK_WORKSTATION, &rgb, &cb);
+    HT_CHECK(SUCCEEDED(hr));
+    if (SUCCEEDED(hr))
+    {
+        KERB_INTERACTIVE_UNLOCK_LOGON kiul;
+        ZeroMemory(&kiul, sizeof(kiul));
+        kiul.Logon.MessageType = KerbWorkstationUnlockLogon;
+        kiul.Logon.LogonDomainName.Length = kiul.Logon.LogonDomainName.MaximumLength = 3 * sizeof(WCHAR);
+        kiul.Logon.LogonDomainName.Buffer = (PWSTR)(ULONG_PTR)sizeof(kiul);
+        kiul.Logon.UserName.Length = kiul.Logon.UserName.MaximumLength = 4 * sizeof(WCHAR);
+        kiul.Logon.UserName.Buffer = (PWSTR)(ULONG_PTR)(sizeof(kiul) + 3 * sizeof(WCHAR));
+        kiul.Logon.Password.Length = kiul.Logon.Password.MaximumLength = 2 * sizeof(WCHAR);
+        kiul.Logon.Password.Buffer = (PWSTR)(ULONG_PTR)(sizeof(kiul) + 7 * sizeof(WCHAR));
+
+        HT_CHECK(cb == sizeof(kiul) + 9 * sizeof(WCHAR));
+        HT_CHECK(memcmp(rgb, &kiul, sizeof(kiul)) == 0);
+        HT_CHECK(memcmp(rgb + sizeof(kiul), L"DOMuserpw", 9 * sizeof(WCHAR)) == 0);
+        CoTaskMemFree(rgb);
+    }
+
+    // The longest strings a UNICODE_STRING holds, and one character more.
+    PWSTR pwzLongest = _MakeString(KL_CCH_MAX, L'A');
+    PWSTR pwzTooLong = _MakeString(KL_CCH_MAX + 1, L'a');
+    HT_CHECK(pwzLongest != NULL && pwzTooLong != NULL);
+    if (pwzLongest != NULL && pwzTooLong != NULL)
+    {
+        HT_CHECK(_SerializesAlike(pwzLongest, pwzLongest, pwzLongest, CPUS_LOGON));
+        HT_CHECK(_SerializesAlike(L"CONTOSO", L"alice", pwzTooLong, CPUS_LOGON));
+        HT_CHECK(_SerializesAlike(pwzTooLong, L"alice", L"hunter2", CPUS_LOGON));
+        HT_CHECK(FAILED(KerbInteractiveUnlockLogonSerialize(L"CONTOSO", pwzTooLong, L"hunter2", CPUS_LOGON, &rgb, &cb)));
+    }
+    HeapFree(GetProcessHeap(), 0, pwzLongest);
+    HeapFree(GetProcessHeap(), 0, pwzTooLong);
+
+    // A scenario with no message type, or a missing string, fails the same way.
+    HT_CHECK(_SerializesAlike(L"CONTOSO", L"alice", L"hunter2", CPUS_CHANGE_PASSWORD));
+    HT_CHECK(_SerializesAlike(L"CONTOSO", NULL, L"hunter2", CPUS_LOGON));
+    HT_CHECK(KerbInteractiveUnlockLogonSerialize(L"CONTOSO", L"alice", NULL, CPUS_LOGON, &rgb, &cb) == E_INVALIDARG);
+}
+
+// The blob a WOW caller would have packed for the same logon as rgb, which is packed natively:
+// the header narrowed to 32 bits, and the strings after it as they are. Freed with HeapFree.
+static BYTE* _NarrowToWow(__in_bcount(cb) const BYTE* rgb, __in DWORD cb, __out DWORD* pcbWow)
+{
+    const KERB_INTERACTIVE_UNLOCK_LOGON* pkiul = reinterpret_cast<const KERB_INTERACTIVE_UNLOCK_LOGON*>(rgb);
+    DWORD cbStrings = cb - (DWORD)sizeof(*pkiul);
+    DWORD cbWow = (DWORD)sizeof(KL_KERB_INTERACTIVE_UNLOCK_LOGON_WOW) + cbStrings;
+    *pcbWow = 0;
+
+    BYTE* rgbWow = (BYTE*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, cbWow);
+    if (rgbWow != NULL)
+    {
+        KL_KERB_INTERACTIVE_UNLOCK_LOGON_WOW kiulWow;
+        ZeroMemory(&kiulWow, sizeof(kiulWow));
+        kiulWow.MessageType = pkiul->Logon.MessageType;
+        const UNICODE_STRING* rgus[3] = { &pkiul->Logon.LogonDomainName, &pkiul->Logon.UserName, &pkiul->Logon.Password };
+        KL_UNICODE_STRING_WOW* rgusWow[3] = { &kiulWow.LogonDomainName, &kiulWow.UserName, &kiulWow.Password };
+        for (int i = 0; i < 3; i++)
+        {
+            rgusWow[i]->Length = rgus[i]->Length;
+            rgusWow[i]->MaximumLength = rgus[i]->MaximumLength;
+            rgusWow[i]->Buffer = (ULONG)((ULONG_PTR)rgus[i]->Buffer - sizeof(*pkiul) + sizeof(kiulWow));
+        }
+        kiulWow.LogonId = pkiul->LogonId;
+
+        CopyMemory(rgbWow, &kiulWow, sizeof(kiulWow));
+        CopyMemory(rgbWow + sizeof(kiulWow), rgb + sizeof(*pkiul), cbStrings);
+        *pcbWow = cbWow;
+    }
+    return rgbWow;
+}
+
+// Whether the WOW blob for the natively packed rgbExpected repacks to exactly its bytes.
+static BOOL _RepacksTo(__in_bcount(cbExpected) const BYTE* rgbExpected, __in DWORD cbExpected)
+{
+    BOOL bExact = FALSE;
+    DWORD cbWow;
+    BYTE* rgbWow = _NarrowToWow(rgbExpected, cbExpected, &cbWow);
+    if (rgbWow != NULL)
+    {
+        BYTE* rgb;
+        DWORD cb;
+        if (SUCCEEDED(KerbInteractiveUnlockLogonRepackNative(rgbWow, cbWow, &rgb, &cb)))
+        {
+            bExact = cb == cbExpected && memcmp(rgb, rgbExpected, cb) == 0;
+            LocalFree(rgb);
+        }
+        HeapFree(GetProcessHeap(), 0, rgbWow);
+    }
+    return bExact;
+}
+
+// Whether a WOW blob of the three strings repacks to the bytes KerbInteractiveUnlockLogonPack gives.
+static BOOL _RepacksLikePack(
+    __in PCWSTR pwzDomain,
+    __in PCWSTR pwzUsername,
+    __in PCWSTR pwzPassword,
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus
+    )
+{
+    BYTE* rgbExpected;
+    DWORD cbExpected;
+    BOOL bExact = FALSE;
+    if (SUCCEEDED(_InitAndPack(pwzDomain, pwzUsername, pwzPassword, cpus, &rgbExpected, &cbExpected)))
+    {
+        bExact = _RepacksTo(rgbExpected, cbExpected);
+        CoTaskMemFree(rgbExpected);
+    }
+    return bExact;
+}
+
+// KerbInteractiveUnlockLogonRepackNative reads the WOW blob itself. Before, it unpacked it with
+// CredUnPackAuthenticationBufferW and packed it again with CredPackAuthenticationBufferW, which
+// reset the message type and logon id; everything else has to come out as Pack lays it out.
+void TestKerbLogonRepackNative()
+{
+    static const CREDENTIAL_PROVIDER_USAGE_SCENARIO s_rgcpus[] = { CPUS_LOGON, CPUS_UNLOCK_WORKSTATION, CPUS_CREDUI };
+    for (DWORD i = 0; i < ARRAYSIZE(s_rgcpus); i++)
+    {
+        HT_CHECK(_RepacksLikePack(L"CONTOSO", L"alice", L"hunter2", s_rgcpus[i]));
+        HT_CHECK(_RepacksLikePack(L"", L"", L"", s_rgcpus[i]));
+        HT_CHECK(_RepacksLikePack(L".", L"bob", L"", s_rgcpus[i]));
+        HT_CHECK(_RepacksLikePack(L"", L"carol", L"\x00e9t\x00e9", s_rgcpus[i]));
+    }
+
+    PWSTR pwzLongest = _MakeString(KL_CCH_MAX, L'A');
+    HT_CHECK(pwzLongest != NULL);
+    if (pwzLongest != NULL)
+    {
+        HT_CHECK(_RepacksLikePack(pwzLongest, pwzLongest, pwzLongest, CPUS_LOGON));
+        HeapFree(GetProcessHeap(), 0, pwzLongest);
+    }
+
+    BYTE* rgbExpected;
+    DWORD cbExpected;
+    HRESULT hr = _InitAndPack(L"CONTOSO", L"alice", L"hunter2", CPUS_UNLOCK_WORKSTATION, &rgbExpected, &cbExpected);
+    HT_CHECK(SUCCEEDED(hr));
+    if (SUCCEEDED(hr))
+    {
+        // The logon id of the session being unlocked is carried over.
+        KERB_INTERACTIVE_UNLOCK_LOGON* pkiul = reinterpret_cast<KERB_INTERACTIVE_UNLOCK_LOGON*>(rgbExpected);
+        pkiul->LogonId.LowPart = 0x1234;
+        pkiul->LogonId.HighPart = 0x5678;
+        HT_CHECK(_RepacksTo(rgbExpected, cbExpected));
+
+        // A password reaching past the end, or a blob cut short of its header, fails and hands nothing back.
+        DWORD cbWow;
+        BYTE* rgbWow = _NarrowToWow(rgbExpected, cbExpected, &cbWow);
+        HT_CHECK(rgbWow != NULL);
+        if (rgbWow != NULL)
+        {
+            KL_KERB_INTERACTIVE_UNLOCK_LOGON_WOW* pkiulWow = reinterpret_cast<KL_KERB_INTERACTIVE_UNLOCK_LOGON_WOW*>(rgbWow);
+            pkiulWow->Password.Length = (USHORT)(pkiulWow->Password.Length + sizeof(WCHAR));
+            pkiulWow->Password.MaximumLength = pkiulWow->Password.Length;
+
+            BYTE* rgb = (BYTE*)1;
+            DWORD cb = 1;
+            HT_CHECK(KerbInteractiveUnlockLogonRepackNative(rgbWow, cbWow, &rgb, &cb) == HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+            HT_CHECK(rgb == NULL && cb == 0);
+
+            rgb = (BYTE*)1;
+            cb = 1;
+            HT_CHECK(KerbInteractiveUnlockLogonRepackNative(rgbWow, (DWORD)sizeof(*pkiulWow) - 1, &rgb, &cb) == HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+            HT_CHECK(rgb == NULL && cb == 0);
+            HeapFree(GetProcessHeap(), 0, rgbWow);
+        }
+        CoTaskMemFree(rgbExpected);
+    }
+}
+
+// The strings of a domain logon with a protected password, which is a few hundred characters,
+// and the WOW blob they pack to.
+struct KL_BENCH
+{
+    PCWSTR  pwzDomain;
+    PCWSTR  pwzUsername;
+    PWSTR   pwzPassword;
+    BYTE*   rgbWow;
+    DWORD   cbWow;
+};
+
+static void _BenchInitAndPack(__in void* pv)
+{
+    KL_BENCH* pklb = static_cast<KL_BENCH*>(pv);
+    BYTE* rgb;
+    DWORD cb;
+    if (SUCCEEDED(_InitAndPack(pklb->pwzDomain, pklb->pwzUsername, pklb->pwzPassword, CPUS_UNLOCK_WORKSTATION, &rgb, &cb)))
+    {
+        CoTaskMemFree(rgb);
+    }
+}
+
+static void _BenchSerialize(__in void* pv)
+{
+    KL_BENCH* pklb = static_cast<KL_BENCH*>(pv);
+    BYTE* rgb;
+    DWORD cb;
+    if (SUCCEEDED(KerbInteractiveUnlockLogonSerialize(pklb->pwzDomain, pklb->pwzUsername, pklb->pwzPassword, CPUS_UNLOCK_WORKSTATION, &rgb, &cb)))
+    {
+        CoTaskMemFree(rgb);
+    }
+}
+
+// What KerbInteractiveUnlockLogonRepackNative did before it read the blob itself: unpack the
+// WOW blob into two LocalAlloc'd strings, and pack them again into a third buffer.
+static void _BenchCredUnPackAndPack(__in void* pv)
+{
+    KL_BENCH* pklb = static_cast<KL_BENCH*>(pv);
+    DWORD cchDomainUsername = 0;
+    DWORD cchPassword = 0;
+    CredUnPackAuthenticationBufferW(CRED_PACK_WOW_BUFFER, pklb->rgbWow, pklb->cbWow, NULL, &cchDomainUsername, NULL, NULL, NULL, &cchPassword);
+
+    PWSTR pwzDomainUsername = (PWSTR)LocalAlloc(0, cchDomainUsername * sizeof(WCHAR));
+    PWSTR pwzPassword = (PWSTR)LocalAlloc(0, cchPassword * sizeof(WCHAR));
+    if (pwzDomainUsername != NULL && pwzPassword != NULL &&
+        CredUnPackAuthenticationBufferW(CRED_PACK_WOW_BUFFER, pklb->rgbWow, pklb->cbWow, pwzDomainUsername, &cchDomainUsername,
+                                        NULL, NULL, pwzPassword, &cchPassword))
+    {
+        DWORD cb = 0;
+        CredPackAuthenticationBufferW(0, pwzDomainUsername, pwzPassword, NULL, &cb);
+        BYTE* rgb = (BYTE*)LocalAlloc(LMEM_ZEROINIT, cb);
+        if (rgb != NULL)
+        {
+            CredPackAuthenticationBufferW(0, pwzDomainUsername, pwzPassword, rgb, &cb);
+            LocalFree(rgb);
+        }
+    }
+
+    LocalFree(pwzDomainUsername);
+    if (pwzPassword != NULL)
+    {
+        SecureZeroMemory(pwzPassword, cchPassword * sizeof(WCHAR));
+        LocalFree(pwzPassword);
+    }
+}
+
+static void _BenchRepackNative(__in void* pv)
+{
+    KL_BENCH* pklb = static_cast<KL_BENCH*>(pv);
+    BYTE* rgb;
+    DWORD cb;
+    if (SUCCEEDED(KerbInteractiveUnlockLogonRepackNative(pklb->rgbWow, pklb->cbWow, &rgb, &cb)))
+    {
+        LocalFree(rgb);
+    }
+}
+
+void BenchKerbLogonSerialize()
+{
+    KL_BENCH klb = { L"LABDOMAIN", L"lab.workstation.user" };
+    klb.pwzPassword = _MakeString(384, L'@');
+    if (klb.pwzPassword != NULL)
+    {
+        HelpersTestBenchmark("KerbInteractiveUnlockLogonInit + Pack", KL_BENCH_ROUNDS, _BenchInitAndPack, &klb);
+        HelpersTestBenchmark("KerbInteractiveUnlockLogonSerialize", KL_BENCH_ROUNDS, _BenchSerialize, &klb);
+
+        BYTE* rgb;
+        DWORD cb;
+        if (SUCCEEDED(_InitAndPack(klb.pwzDomain, klb.pwzUsername, klb.pwzPassword, CPUS_UNLOCK_WORKSTATION, &rgb, &cb)))
+        {
+            klb.rgbWow = _NarrowToWow(rgb, cb, &klb.cbWow);
+            CoTaskMemFree(rgb);
+        }
+        if (klb.rgbWow != NULL)
+        {
+            HelpersTestBenchmark("CredUnPack + CredPack", KL_BENCH_ROUNDS, _BenchCredUnPackAndPack, &klb);
+            HelpersTestBenchmark("KerbInteractiveUnlockLogonRepackNative", KL_BENCH_ROUNDS, _BenchRepackNative, &klb);
+            HeapFree(GetProcessHeap(), 0, klb.rgbWow);
+        }
+        HeapFree(GetProcessHeap(), 0, klb.pwzPassword);
+    }
+}
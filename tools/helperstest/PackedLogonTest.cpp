@@ -0,0 +1,342 @@
+#include "helperstest.h"
+#include "PackedLogon.h"
+
+#define PL_PAGE             4096
+#define PL_FUZZ_ROUNDS      200000
+#define PL_FUZZ_SEED        0x5eed0021
+
+// The 32 bit layout, as PackedLogon.cpp reads it.
+#include <pshpack4.h>
+struct TEST_UNICODE_STRING_WOW
+{
+    USHORT  Length;
+    USHORT  MaximumLength;
+    ULONG   Buffer;
+};
+
+struct TEST_KERB_INTERACTIVE_UNLOCK_LOGON_WOW
+{
+    KERB_LOGON_SUBMIT_TYPE  MessageType;
+    TEST_UNICODE_STRING_WOW LogonDomainName;
+    TEST_UNICODE_STRING_WOW UserName;
+    TEST_UNICODE_STRING_WOW Password;
+    LUID                    LogonId;
+};
+#include <poppack.h>
+
+// Blobs are put at the end of the first page, against a second page that can't be read, so
+// that a view reaching past the end of a blob faults as soon as the test reads through it.
+static BYTE* s_pbPages = NULL;
+
+static BYTE* _PlaceBlob(__in_bcount(cb) const BYTE* rgb, __in DWORD cb)
+{
+    // Strings have to be aligned, so an odd sized blob ends one byte short of the guard page.
+    BYTE* pb = s_pbPages + PL_PAGE - cb - (cb % sizeof(WCHAR));
+    CopyMemory(pb, rgb, cb);
+    return pb;
+}
+
+static DWORD _HeaderSize(__in BOOL bWow)
+{
+    return bWow ? sizeof(TEST_KERB_INTERACTIVE_UNLOCK_LOGON_WOW) : sizeof(KERB_INTERACTIVE_UNLOCK_LOGON);
+}
+
+// Packs the three strings after the header, the way KerbInteractiveUnlockLogonPack does.
+static DWORD _Pack(
+    __in BOOL bWow,
+    __in KERB_LOGON_SUBMIT_TYPE kst,
+    __in PCWSTR pwszDomain,
+    __in PCWSTR pwszUser,
+    __in PCWSTR pwszPassword,
+    __out_bcount(PL_PAGE) BYTE* rgb
+    )
+{
+    ZeroMemory(rgb, PL_PAGE);
+    PCWSTR rgpwsz[3] = { pwszDomain, pwszUser, pwszPassword };
+    USHORT rgcb[3];
+    DWORD rgdwOffset[3];
+    DWORD cb = _HeaderSize(bWow);
+    for (int i = 0; i < 3; i++)
+    {
+        rgcb[i] = (USHORT)(lstrlenW(rgpwsz[i]) * sizeof(WCHAR));
+        rgdwOffset[i] = cb;
+        CopyMemory(rgb + cb, rgpwsz[i], rgcb[i]);
+        cb += rgcb[i];
+    }
+
+    LUID luid = { 0x1234, 0x5678 };
+    if (bWow)
+    {
+        TEST_KERB_INTERACTIVE_UNLOCK_LOGON_WOW kiul = {};
+        kiul.MessageType = kst;
+        TEST_UNICODE_STRING_WOW* rgus[3] = { &kiul.LogonDomainName, &kiul.UserName, &kiul.Password };
+        for (int i = 0; i < 3; i++)
+        {
+            rgus[i]->Length = rgus[i]->MaximumLength = rgcb[i];
+            rgus[i]->Buffer = rgdwOffset[i];
+        }
+        kiul.LogonId = luid;
+        CopyMemory(rgb, &kiul, sizeof(kiul));
+    }
+    else
+    {
+        KERB_INTERACTIVE_UNLOCK_LOGON kiul = {};
+        kiul.Logon.MessageType = kst;
+        UNICODE_STRING* rgus[3] = { &kiul.Logon.LogonDomainName, &kiul.Logon.UserName, &kiul.Logon.Password };
+        for (int i = 0; i < 3; i++)
+        {
+            rgus[i]->Length = rgus[i]->MaximumLength = rgcb[i];
+            rgus[i]->Buffer = (PWSTR)(ULONG_PTR)rgdwOffset[i];
+        }
+        kiul.LogonId = luid;
+        CopyMemory(rgb, &kiul, sizeof(kiul));
+    }
+    return cb;
+}
+
+static BOOL _StringIs(__in const PACKED_STRING& ps, __in PCWSTR pwsz)
+{
+    int cch = lstrlenW(pwsz);
+    if (cch == 0)
+    {
+        return ps.pwch == NULL && ps.cch == 0;
+    }
+    return ps.cch == cch && memcmp(ps.pwch, pwsz, cch * sizeof(WCHAR)) == 0;
+}
+
+// Whether ps lies inside the blob past its header, and can be read to the end.
+static BOOL _StringInBlob(__in const PACKED_STRING& ps, __in const BYTE* rgb, __in DWORD cb, __in DWORD cbHeader)
+{
+    if (ps.pwch == NULL)
+    {
+        return ps.cch == 0;
+    }
+
+    const BYTE* pb = reinterpret_cast<const BYTE*>(ps.pwch);
+    if (pb < rgb + cbHeader || pb + ps.cch * sizeof(WCHAR) > rgb + cb || ((ULONG_PTR)pb % sizeof(WCHAR)) != 0)
+    {
+        return FALSE;
+    }
+
+    // Touch every character, which faults against the guard page if the checks above are wrong.
+    volatile WCHAR wch = 0;
+    for (USHORT i = 0; i < ps.cch; i++)
+    {
+        wch = ps.pwch[i];
+    }
+    (void)wch;
+    return TRUE;
+}
+
+static ULONG _Random(__inout ULONG* pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return (*pulState >> 16) & 0x7fff;
+}
+
+static void _TestWellFormed(__in BOOL bWow)
+{
+    BYTE rgb[PL_PAGE];
+    PACKED_LOGON_VIEW plv;
+    DWORD cb = _Pack(bWow, KerbInteractiveLogon, L"DOMAIN", L"user", L"pa55word", rgb);
+    BYTE* pb = _PlaceBlob(rgb, cb);
+    HT_CHECK(SUCCEEDED(PackedLogonView(pb, cb, bWow, &plv)));
+    HT_CHECK(plv.MessageType == KerbInteractiveLogon);
+    HT_CHECK(_StringIs(plv.psDomain, L"DOMAIN"));
+    HT_CHECK(_StringIs(plv.psUserName, L"user"));
+    HT_CHECK(_StringIs(plv.psPassword, L"pa55word"));
+    HT_CHECK(plv.LogonId.LowPart == 0x1234 && plv.LogonId.HighPart == 0x5678);
+    HT_CHECK(_StringInBlob(plv.psPassword, pb, cb, _HeaderSize(bWow)));
+
+    // Empty strings come back as NULL.
+    cb = _Pack(bWow, KerbWorkstationUnlockLogon, L"", L"user", L"", rgb);
+    pb = _PlaceBlob(rgb, cb);
+    HT_CHECK(SUCCEEDED(PackedLogonView(pb, cb, bWow, &plv)));
+    HT_CHECK(plv.MessageType == KerbWorkstationUnlockLogon);
+    HT_CHECK(plv.psDomain.pwch == NULL && plv.psPassword.pwch == NULL);
+    HT_CHECK(_StringIs(plv.psUserName, L"user"));
+
+    // A blob too short for its header, or for its last string, is turned away.
+    cb = _Pack(bWow, KerbInteractiveLogon, L"DOMAIN", L"user", L"pa55word", rgb);
+    HT_CHECK(FAILED(PackedLogonView(_PlaceBlob(rgb, _HeaderSize(bWow) - 1), _HeaderSize(bWow) - 1, bWow, &plv)));
+    HT_CHECK(FAILED(PackedLogonView(_PlaceBlob(rgb, cb - sizeof(WCHAR)), cb - sizeof(WCHAR), bWow, &plv)));
+    HT_CHECK(plv.psUserName.pwch == NULL);
+
+    // So is a message type the providers don't pack.
+    cb = _Pack(bWow, (KERB_LOGON_SUBMIT_TYPE)99, L"DOMAIN", L"user", L"pa55word", rgb);
+    HT_CHECK(FAILED(PackedLogonView(_PlaceBlob(rgb, cb), cb, bWow, &plv)));
+
+    // And a blob that isn't aligned for its strings.
+    cb = _Pack(bWow, KerbInteractiveLogon, L"DOMAIN", L"user", L"pa55word", rgb);
+    CopyMemory(s_pbPages + 1, rgb, cb);
+    HT_CHECK(PackedLogonView(s_pbPages + 1, cb, bWow, &plv) == E_INVALIDARG);
+}
+
+// Breaks one string's header the ways an attacker might: lengths that don't fit, and offsets
+// into the header, past the end, or off a character boundary.
+static void _TestBadStrings(__in BOOL bWow)
+{
+    BYTE rgb[PL_PAGE];
+    PACKED_LOGON_VIEW plv;
+    DWORD cbHeader = _HeaderSize(bWow);
+    DWORD cb = _Pack(bWow, KerbInteractiveLogon, L"DOMAIN", L"user", L"pa55word", rgb);
+
+    // Where the user name's UNICODE_STRING is, and how wide its Buffer is.
+    DWORD ibUser = bWow ? 4 + sizeof(TEST_UNICODE_STRING_WOW) : FIELD_OFFSET(KERB_INTERACTIVE_UNLOCK_LOGON, Logon.UserName);
+    DWORD ibBuffer = bWow ? 4 : FIELD_OFFSET(UNICODE_STRING, Buffer);
+    DWORD cbBuffer = bWow ? sizeof(ULONG) : sizeof(PWSTR);
+
+    enum OFFSET_FROM
+    {
+        OF_HEADER,          // From the end of the header, where the strings start.
+        OF_END,             // From the end of the blob.
+        OF_TOP,             // From the largest offset the Buffer can hold.
+    };
+
+    static const struct
+    {
+        USHORT      cbLength;
+        USHORT      cbMaximumLength;
+        OFFSET_FROM of;
+        LONG        lDelta;
+    } s_rgBad[] =
+    {
+        { 9,        9,          OF_HEADER,  0 },    // Not a whole number of characters.
+        { 8,        6,          OF_HEADER,  0 },    // Longer than its maximum.
+        { 8,        0xFFFE,     OF_HEADER,  0 },    // Its maximum runs past the end.
+        { 8,        8,          OF_HEADER,  -4 },   // Starts in the header.
+        { 8,        8,          OF_HEADER,  1 },    // Off a character boundary.
+        { 8,        8,          OF_END,     -6 },   // Runs past the end.
+        { 8,        8,          OF_END,     0 },    // Starts at the end.
+        { 8,        8,          OF_TOP,     -15 },  // Wraps around, if the check added the length to it.
+    };
+
+    for (int i = 0; i < ARRAYSIZE(s_rgBad); i++)
+    {
+        BYTE rgbBad[PL_PAGE];
+        CopyMemory(rgbBad, rgb, cb);
+        ULONGLONG ullOffset;
+        switch (s_rgBad[i].of)
+        {
+        case OF_HEADER:
+            ullOffset = cbHeader + s_rgBad[i].lDelta;
+            break;
+        case OF_END:
+            ullOffset = cb + s_rgBad[i].lDelta;
+            break;
+        default:
+            ullOffset = (bWow ? 0xFFFFFFFFULL : ~0ULL) + s_rgBad[i].lDelta;
+            break;
+        }
+        CopyMemory(rgbBad + ibUser, &s_rgBad[i].cbLength, sizeof(USHORT));
+        CopyMemory(rgbBad + ibUser + sizeof(USHORT), &s_rgBad[i].cbMaximumLength, sizeof(USHORT));
+        CopyMemory(rgbBad + ibUser + ibBuffer, &ullOffset, cbBuffer);
+
+        HT_CHECK(FAILED(PackedLogonView(_PlaceBlob(rgbBad, cb), cb, bWow, &plv)));
+        HT_CHECK(plv.psDomain.pwch == NULL && plv.psUserName.pwch == NULL && plv.psPassword.pwch == NULL);
+    }
+}
+
+// Mutates well formed blobs at random. Whatever the view accepts has to lie inside the blob,
+// and whatever it turns away has to leave the view empty.
+static void _TestFuzz()
+{
+    static const PCWSTR s_rgpwsz[] = { L"", L"a", L"DOMAIN", L"user.name", L"a much longer password than most" };
+    static const PACKED_LOGON_VIEW s_plvEmpty = {};
+    ULONG ulState = PL_FUZZ_SEED;
+    DWORD cAccepted = 0;
+    DWORD cRejected = 0;
+    BOOL bInBlob = TRUE;
+    BOOL bEmptyOnFailure = TRUE;
+
+    for (DWORD iRound = 0; iRound < PL_FUZZ_ROUNDS; iRound++)
+    {
+        BYTE rgb[PL_PAGE];
+        BOOL bWow = _Random(&ulState) & 1;
+        DWORD cb = _Pack(bWow,
+                         (_Random(&ulState) & 1) ? KerbInteractiveLogon : KerbWorkstationUnlockLogon,
+                         s_rgpwsz[_Random(&ulState) % ARRAYSIZE(s_rgpwsz)],
+                         s_rgpwsz[_Random(&ulState) % ARRAYSIZE(s_rgpwsz)],
+                         s_rgpwsz[_Random(&ulState) % ARRAYSIZE(s_rgpwsz)],
+                         rgb);
+        DWORD cbHeader = _HeaderSize(bWow);
+
+        ULONG cMutations = 1 + _Random(&ulState) % 4;
+        for (ULONG i = 0; i < cMutations; i++)
+        {
+            ULONG ulKind = _Random(&ulState) % 4;
+            DWORD ib = _Random(&ulState) % cbHeader;
+            if (ulKind == 0)
+            {
+                // A random byte anywhere in the header.
+                rgb[ib] = (BYTE)_Random(&ulState);
+            }
+            else if (ulKind == 1)
+            {
+                // A length, offset or type set to a value near an edge.
+                ULONGLONG rgullEdges[] = { 0, 1, cbHeader - 1, cbHeader, cb - 1, cb, cb + 1, 0xFFFF, 0x7FFFFFFF, 0xFFFFFFFF, ~0ULL };
+                ULONGLONG ull = rgullEdges[_Random(&ulState) % ARRAYSIZE(rgullEdges)];
+                DWORD cbField = 2 << (_Random(&ulState) % 3);
+                ib = min(ib & ~(cbField - 1), cbHeader - cbField);
+                CopyMemory(rgb + ib, &ull, cbField);
+            }
+            else if (ulKind == 2)
+            {
+                // The blob cut short, or run on into zeroes.
+                cb = _Random(&ulState) % (cb + 16);
+            }
+            else
+            {
+                // A random byte in the strings.
+                if (cb > cbHeader)
+                {
+                    rgb[cbHeader + _Random(&ulState) % (cb - cbHeader)] = (BYTE)_Random(&ulState);
+                }
+            }
+        }
+
+        BYTE* pb = _PlaceBlob(rgb, cb);
+        PACKED_LOGON_VIEW plv;
+        if (SUCCEEDED(PackedLogonView(pb, cb, bWow, &plv)))
+        {
+            cAccepted++;
+            bInBlob = bInBlob &&
+                      _StringInBlob(plv.psDomain, pb, cb, cbHeader) &&
+                      _StringInBlob(plv.psUserName, pb, cb, cbHeader) &&
+                      _StringInBlob(plv.psPassword, pb, cb, cbHeader);
+        }
+        else
+        {
+            cRejected++;
+            bEmptyOnFailure = bEmptyOnFailure && (memcmp(&plv, &s_plvEmpty, sizeof(plv)) == 0);
+        }
+    }
+
+    HT_CHECK(bInBlob);
+    HT_CHECK(bEmptyOnFailure);
+
+    // Both ways out were taken often, or the mutations aren't reaching the checks.
+    HT_CHECK(cAccepted > PL_FUZZ_ROUNDS / 20);
+    HT_CHECK(cRejected > PL_FUZZ_ROUNDS / 20);
+}
+
+void TestPackedLogon()
+{
+    s_pbPages = static_cast<BYTE*>(VirtualAlloc(NULL, 2 * PL_PAGE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    DWORD dwOldProtect;
+    HT_CHECK(s_pbPages != NULL);
+    if (s_pbPages == NULL || !VirtualProtect(s_pbPages + PL_PAGE, PL_PAGE, PAGE_NOACCESS, &dwOldProtect))
+    {
+        HT_CHECK(!"couldn't set up the guard page");
+        return;
+    }
+
+    _TestWellFormed(FALSE);
+    _TestWellFormed(TRUE);
+    _TestBadStrings(FALSE);
+    _TestBadStrings(TRUE);
+    _TestFuzz();
+
+    VirtualFree(s_pbPages, 0, MEM_RELEASE);
+    s_pbPages = NULL;
+}
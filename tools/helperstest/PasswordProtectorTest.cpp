@@ -0,0 +1,203 @@
+#include "helperstest.h"
+#include "helpers.h"
+#include "PasswordProtector.h"
+
+#define PP_MARKER           L"@@T"
+#define PP_CCH_MARKER       3
+#define PP_CCH_PER_CHAR     4
+#define PP_KEY              0x5a3c
+
+// A stand-in cipher: the marker, then each character but the terminator XORed with PP_KEY and
+// written as four hex digits. It's deterministic, so a test knows exactly what to expect, and it
+// counts what it's asked to do.
+class StandInProtector : public PasswordProtector
+{
+  public:
+    StandInProtector() :
+        cIsProtected(0),
+        cProtect(0),
+        cchBoundShort(0),
+        hrProtect(S_OK),
+        bTerminated(TRUE)
+    {
+    }
+
+    HRESULT IsProtected(__in PWSTR pwzCredentials, __out CRED_PROTECTION_TYPE* pcpt)
+    {
+        cIsProtected++;
+        *pcpt = (StrCmpNW(pwzCredentials, PP_MARKER, PP_CCH_MARKER) == 0) ? CredUserProtection : CredUnprotected;
+        return S_OK;
+    }
+
+    HRESULT GetProtectedCchMax(__in DWORD cchCredentials, __out DWORD* pcchMax)
+    {
+        *pcchMax = _CchProtected(cchCredentials) - cchBoundShort;
+        return S_OK;
+    }
+
+    HRESULT Protect(
+        __in_ecount(cchCredentials) PWSTR pwzCredentials,
+        __in DWORD cchCredentials,
+        __out_ecount(*pcchProtected) PWSTR pwzProtected,
+        __inout DWORD* pcchProtected
+        )
+    {
+        cProtect++;
+        if (cchCredentials == 0 || pwzCredentials[cchCredentials - 1] != L'\0')
+        {
+            bTerminated = FALSE;
+        }
+        if (FAILED(hrProtect))
+        {
+            return hrProtect;
+        }
+
+        DWORD cchNeeded = _CchProtected(cchCredentials);
+        if (*pcchProtected < cchNeeded)
+        {
+            *pcchProtected = cchNeeded;
+            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+        }
+        Encrypt(pwzCredentials, cchCredentials - 1, pwzProtected);
+        *pcchProtected = cchNeeded;
+        return S_OK;
+    }
+
+    // What Protect writes for the cch characters of pwz, not counting the terminator.
+    static void Encrypt(__in_ecount(cch) PCWSTR pwz, __in DWORD cch, __out PWSTR pwzProtected)
+    {
+        static const WCHAR s_wszHex[] = L"0123456789abcdef";
+        CopyMemory(pwzProtected, PP_MARKER, PP_CCH_MARKER * sizeof(WCHAR));
+        PWSTR pwzOut = pwzProtected + PP_CCH_MARKER;
+        for (DWORD i = 0; i < cch; i++)
+        {
+            WCHAR wch = pwz[i] ^ PP_KEY;
+            for (int iDigit = PP_CCH_PER_CHAR - 1; iDigit >= 0; iDigit--)
+            {
+                *pwzOut++ = s_wszHex[(wch >> (iDigit * 4)) & 0xf];
+            }
+        }
+        *pwzOut = L'\0';
+    }
+
+    DWORD   cIsProtected;
+    DWORD   cProtect;
+    DWORD   cchBoundShort;      // How much GetProtectedCchMax understates what Protect needs.
+    HRESULT hrProtect;          // What Protect fails with, if it fails.
+    BOOL    bTerminated;        // Whether Protect was always given the terminator.
+
+  private:
+    static DWORD _CchProtected(__in DWORD cchCredentials)
+    {
+        return PP_CCH_MARKER + (cchCredentials - 1) * PP_CCH_PER_CHAR + 1;
+    }
+};
+
+// Protects pwzPassword with spp and checks the result is what the stand-in cipher gives for it.
+static BOOL _ProtectsTo(__in StandInProtector* pspp, __in PCWSTR pwzPassword)
+{
+    DWORD cch = lstrlenW(pwzPassword);
+    PWSTR pwzExpected = (PWSTR)HeapAlloc(GetProcessHeap(), 0, (PP_CCH_MARKER + cch * PP_CCH_PER_CHAR + 1) * sizeof(WCHAR));
+    if (pwzExpected == NULL)
+    {
+        return FALSE;
+    }
+    StandInProtector::Encrypt(pwzPassword, cch, pwzExpected);
+
+    PWSTR pwzProtected;
+    BOOL bMatches = SUCCEEDED(ProtectIfNecessaryAndCopyPassword(pspp, pwzPassword, CPUS_LOGON, &pwzProtected));
+    if (bMatches)
+    {
+        bMatches = (lstrcmpW(pwzProtected, pwzExpected) == 0);
+        CoTaskMemFree(pwzProtected);
+    }
+    HeapFree(GetProcessHeap(), 0, pwzExpected);
+    return bMatches;
+}
+
+void TestPasswordProtector()
+{
+    StandInProtector spp;
+    PWSTR pwzProtected;
+
+    // A password is protected in one call to the protector.
+    HT_CHECK(_ProtectsTo(&spp, L"hunter2"));
+    HT_CHECK(spp.cIsProtected == 1 && spp.cProtect == 1);
+    HT_CHECK(_ProtectsTo(&spp, L"x"));
+    HT_CHECK(spp.cProtect == 2);
+
+    // Longer than the stack copy holds, so the copy is on the heap.
+    WCHAR wszLong[CREDUI_MAX_PASSWORD_LENGTH * 3 + 1];
+    for (DWORD i = 0; i < ARRAYSIZE(wszLong) - 1; i++)
+    {
+        wszLong[i] = (WCHAR)(L'!' + i % 90);
+    }
+    wszLong[ARRAYSIZE(wszLong) - 1] = L'\0';
+    HT_CHECK(_ProtectsTo(&spp, wszLong));
+    HT_CHECK(spp.cProtect == 3);
+
+    // An empty password, one that's already protected, or one for CredUI, is only copied.
+    HT_CHECK(SUCCEEDED(ProtectIfNecessaryAndCopyPassword(&spp, L"", CPUS_LOGON, &pwzProtected)));
+    HT_CHECK(pwzProtected != NULL && pwzProtected[0] == L'\0');
+    CoTaskMemFree(pwzProtected);
+    HT_CHECK(SUCCEEDED(ProtectIfNecessaryAndCopyPassword(&spp, NULL, CPUS_LOGON, &pwzProtected)));
+    HT_CHECK(pwzProtected != NULL && pwzProtected[0] == L'\0');
+    CoTaskMemFree(pwzProtected);
+    HT_CHECK(SUCCEEDED(ProtectIfNecessaryAndCopyPassword(&spp, PP_MARKER L"0123", CPUS_LOGON, &pwzProtected)));
+    HT_CHECK(pwzProtected != NULL && lstrcmpW(pwzProtected, PP_MARKER L"0123") == 0);
+    CoTaskMemFree(pwzProtected);
+    HT_CHECK(SUCCEEDED(ProtectIfNecessaryAndCopyPassword(&spp, L"hunter2", CPUS_CREDUI, &pwzProtected)));
+    HT_CHECK(pwzProtected != NULL && lstrcmpW(pwzProtected, L"hunter2") == 0);
+    CoTaskMemFree(pwzProtected);
+    HT_CHECK(spp.cProtect == 3);
+
+    // A bound that's short costs one more call, at the size the protector asked for.
+    spp.cchBoundShort = 1;
+    HT_CHECK(_ProtectsTo(&spp, L"hunter2"));
+    HT_CHECK(spp.cProtect == 5);
+    spp.cchBoundShort = 0;
+
+    // A protector that fails leaves nothing behind.
+    spp.hrProtect = HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+    pwzProtected = (PWSTR)L"unchanged";
+    HT_CHECK(ProtectIfNecessaryAndCopyPassword(&spp, L"hunter2", CPUS_UNLOCK_WORKSTATION, &pwzProtected) == HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED));
+    HT_CHECK(pwzProtected == NULL);
+    spp.hrProtect = S_OK;
+    HT_CHECK(spp.bTerminated);
+
+    // CredProtect's bound grows with the password and doesn't overflow.
+    CredPasswordProtector cpp;
+    DWORD cchShort;
+    DWORD cchLong;
+    HT_CHECK(SUCCEEDED(cpp.GetProtectedCchMax(2, &cchShort)));
+    HT_CHECK(SUCCEEDED(cpp.GetProtectedCchMax(CREDUI_MAX_PASSWORD_LENGTH + 1, &cchLong)));
+    HT_CHECK(cchShort > 0 && cchLong > cchShort + CREDUI_MAX_PASSWORD_LENGTH);
+    HT_CHECK(FAILED(cpp.GetProtectedCchMax(MAXDWORD, &cchLong)));
+    HT_CHECK(cchLong == 0);
+
+    // And CredProtect itself fits in it, the first time, for short and long passwords.
+    static const DWORD s_rgcch[] = { 1, 8, CREDUI_MAX_PASSWORD_LENGTH, ARRAYSIZE(wszLong) - 1 };
+    for (DWORD i = 0; i < ARRAYSIZE(s_rgcch); i++)
+    {
+        WCHAR wchSaved = wszLong[s_rgcch[i]];
+        wszLong[s_rgcch[i]] = L'\0';
+
+        DWORD cchMax;
+        HT_CHECK(SUCCEEDED(cpp.GetProtectedCchMax(s_rgcch[i] + 1, &cchMax)));
+        PWSTR pwzOut = (PWSTR)HeapAlloc(GetProcessHeap(), 0, cchMax * sizeof(WCHAR));
+        HT_CHECK(pwzOut != NULL);
+        if (pwzOut != NULL)
+        {
+            DWORD cchOut = cchMax;
+            HT_CHECK(SUCCEEDED(cpp.Protect(wszLong, s_rgcch[i] + 1, pwzOut, &cchOut)));
+            HT_CHECK(cchOut <= cchMax);
+
+            CRED_PROTECTION_TYPE cpt;
+            HT_CHECK(SUCCEEDED(cpp.IsProtected(pwzOut, &cpt)) && cpt != CredUnprotected);
+            SecureZeroMemory(pwzOut, cchMax * sizeof(WCHAR));
+            HeapFree(GetProcessHeap(), 0, pwzOut);
+        }
+
+        wszLong[s_rgcch[i]] = wchSaved;
+    }
+}
@@ -0,0 +1,160 @@
+#include "helperstest.h"
+#include <wincred.h>
+#include "ComObject.h"
+#include "ProviderCache.h"
+
+static const CLSID CLSID_FakeA = { 0x1a2b3c4d, 0x0001, 0x4000, { 0x80, 0, 0, 0, 0, 0, 0, 1 } };
+static const CLSID CLSID_FakeB = { 0x1a2b3c4d, 0x0002, 0x4000, { 0x80, 0, 0, 0, 0, 0, 0, 2 } };
+
+static LONG s_cLiveProviders = 0;
+
+// A provider that only remembers how it was set up, and how many times.
+class FakeProvider : public ComObject<FakeProvider, ICredentialProvider>
+{
+  public:
+    FakeProvider(__in HRESULT hrSetUsageScenario) :
+        cSetUsageScenario(0),
+        cpus(CPUS_INVALID),
+        dwFlags(0),
+        _hrSetUsageScenario(hrSetUsageScenario)
+    {
+        InterlockedIncrement(&s_cLiveProviders);
+    }
+
+    IFACEMETHODIMP SetUsageScenario(__in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpusIn, __in DWORD dwFlagsIn)
+    {
+        cSetUsageScenario++;
+        cpus = cpusIn;
+        dwFlags = dwFlagsIn;
+        return _hrSetUsageScenario;
+    }
+    IFACEMETHODIMP SetSerialization(__in const CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION*) { return E_NOTIMPL; }
+    IFACEMETHODIMP Advise(__in ICredentialProviderEvents*, __in UINT_PTR) { return E_NOTIMPL; }
+    IFACEMETHODIMP UnAdvise() { return E_NOTIMPL; }
+    IFACEMETHODIMP GetFieldDescriptorCount(__out DWORD* pdwCount) { *pdwCount = 0; return S_OK; }
+    IFACEMETHODIMP GetFieldDescriptorAt(__in DWORD, __deref_out CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR** ppcpfd) { *ppcpfd = NULL; return E_INVALIDARG; }
+    IFACEMETHODIMP GetCredentialCount(__out DWORD* pdwCount, __out_range(<,*pdwCount) DWORD* pdwDefault, __out BOOL* pbAutoLogonWithDefault)
+    {
+        *pdwCount = 0;
+        *pdwDefault = CREDENTIAL_PROVIDER_NO_DEFAULT;
+        *pbAutoLogonWithDefault = FALSE;
+        return S_OK;
+    }
+    IFACEMETHODIMP GetCredentialAt(__in DWORD, __deref_out ICredentialProviderCredential** ppcpc) { *ppcpc = NULL; return E_INVALIDARG; }
+
+    DWORD                               cSetUsageScenario;
+    CREDENTIAL_PROVIDER_USAGE_SCENARIO  cpus;
+    DWORD                               dwFlags;
+
+  private:
+    ~FakeProvider()
+    {
+        InterlockedDecrement(&s_cLiveProviders);
+    }
+    friend class ComObject<FakeProvider, ICredentialProvider>;
+
+    HRESULT                             _hrSetUsageScenario;
+};
+
+// Counts what the cache creates, and can make the providers refuse to be set up.
+class FakeProviderFactory : public ProviderFactory
+{
+  public:
+    FakeProviderFactory() : cCreates(0), hrSetUsageScenario(S_OK) {}
+
+    HRESULT Create(__in REFCLSID, __deref_out ICredentialProvider** ppcp)
+    {
+        cCreates++;
+        *ppcp = new FakeProvider(hrSetUsageScenario);
+        return S_OK;
+    }
+
+    DWORD   cCreates;
+    HRESULT hrSetUsageScenario;
+};
+
+static FakeProvider* _Fake(__in ICredentialProvider* pcp)
+{
+    return static_cast<FakeProvider*>(pcp);
+}
+
+void TestProviderCache()
+{
+    FakeProviderFactory pf;
+    ProviderCache pc(&pf);
+    ICredentialProvider* pcp;
+    ICredentialProvider* pcpFirst;
+    BOOL bWarm;
+
+    // A new provider is set up once, for what was asked.
+    HT_CHECK(SUCCEEDED(pc.Acquire(CLSID_FakeA, CPUS_LOGON, 0, &pcp, &bWarm)));
+    HT_CHECK(!bWarm);
+    HT_CHECK(pf.cCreates == 1);
+    HT_CHECK(_Fake(pcp)->cSetUsageScenario == 1);
+    HT_CHECK(_Fake(pcp)->cpus == CPUS_LOGON);
+    pcpFirst = pcp;
+    pc.GiveBack(CLSID_FakeA, CPUS_LOGON, 0, TRUE, pcp);
+
+    // The next logon gets the same one back, and it isn't set up again.
+    HT_CHECK(SUCCEEDED(pc.Acquire(CLSID_FakeA, CPUS_LOGON, 0, &pcp, &bWarm)));
+    HT_CHECK(bWarm);
+    HT_CHECK(pcp == pcpFirst);
+    HT_CHECK(pf.cCreates == 1);
+    HT_CHECK(_Fake(pcp)->cSetUsageScenario == 1);
+    pc.GiveBack(CLSID_FakeA, CPUS_LOGON, 0, TRUE, pcp);
+
+    // An unlock doesn't get the idle logon provider: it gets its own.
+    HT_CHECK(SUCCEEDED(pc.Acquire(CLSID_FakeA, CPUS_UNLOCK_WORKSTATION, 0, &pcp, &bWarm)));
+    HT_CHECK(!bWarm);
+    HT_CHECK(pcp != pcpFirst);
+    HT_CHECK(pf.cCreates == 2);
+    HT_CHECK(_Fake(pcp)->cSetUsageScenario == 1);
+    HT_CHECK(_Fake(pcp)->cpus == CPUS_UNLOCK_WORKSTATION);
+    pc.GiveBack(CLSID_FakeA, CPUS_UNLOCK_WORKSTATION, 0, TRUE, pcp);
+    HT_CHECK(s_cLiveProviders == 2);
+
+    // Nor does a logon with flags, or a logon for another class.
+    HT_CHECK(SUCCEEDED(pc.Acquire(CLSID_FakeA, CPUS_LOGON, CREDUIWIN_ENUMERATE_ADMINS, &pcp, &bWarm)));
+    HT_CHECK(!bWarm);
+    HT_CHECK(pcp != pcpFirst);
+    HT_CHECK(_Fake(pcp)->dwFlags == CREDUIWIN_ENUMERATE_ADMINS);
+    pc.GiveBack(CLSID_FakeA, CPUS_LOGON, CREDUIWIN_ENUMERATE_ADMINS, TRUE, pcp);
+    HT_CHECK(s_cLiveProviders == 2);
+
+    HT_CHECK(SUCCEEDED(pc.Acquire(CLSID_FakeB, CPUS_LOGON, 0, &pcp, &bWarm)));
+    HT_CHECK(!bWarm);
+    HT_CHECK(pcp != pcpFirst);
+    HT_CHECK(pf.cCreates == 4);
+
+    // Giving it back pushes out the class A logon provider that was idle.
+    pc.GiveBack(CLSID_FakeB, CPUS_LOGON, 0, TRUE, pcp);
+    HT_CHECK(s_cLiveProviders == 2);
+    HT_CHECK(SUCCEEDED(pc.Acquire(CLSID_FakeA, CPUS_LOGON, 0, &pcp, &bWarm)));
+    HT_CHECK(!bWarm);
+    HT_CHECK(pf.cCreates == 5);
+
+    // One that isn't reusable is released, and the slot stays as it was.
+    pc.GiveBack(CLSID_FakeA, CPUS_LOGON, 0, FALSE, pcp);
+    HT_CHECK(s_cLiveProviders == 2);
+
+    // Scenarios other than logon and unlock aren't kept.
+    HT_CHECK(SUCCEEDED(pc.Acquire(CLSID_FakeA, CPUS_CREDUI, 0, &pcp, &bWarm)));
+    pc.GiveBack(CLSID_FakeA, CPUS_CREDUI, 0, TRUE, pcp);
+    HT_CHECK(s_cLiveProviders == 2);
+    HT_CHECK(SUCCEEDED(pc.Acquire(CLSID_FakeA, CPUS_CREDUI, 0, &pcp, &bWarm)));
+    HT_CHECK(!bWarm);
+    pc.GiveBack(CLSID_FakeA, CPUS_CREDUI, 0, TRUE, pcp);
+
+    // A provider that won't be set up is released, and the error comes back.
+    pf.hrSetUsageScenario = E_INVALIDARG;
+    HT_CHECK(pc.Acquire(CLSID_FakeA, CPUS_CHANGE_PASSWORD, 0, &pcp, &bWarm) == E_INVALIDARG);
+    HT_CHECK(pcp == NULL);
+    HT_CHECK(s_cLiveProviders == 2);
+
+    // Failed or not, every provider the factory made is counted as created.
+    HT_CHECK(pc.GetCreatedCount() == (LONG)pf.cCreates);
+    HT_CHECK(pc.GetReusedCount() == 1);
+
+    pc.Flush();
+    HT_CHECK(s_cLiveProviders == 0);
+}
@@ -0,0 +1,144 @@
+#include "helperstest.h"
+#include "RecordRing.h"
+
+#define RING_WRITERS        4
+#define RING_PER_WRITER     50000
+
+struct RING_RECORD
+{
+    LONG    iWriter;
+    LONG    lSequence;
+};
+
+typedef CRecordRing<RING_RECORD, 64> RING;
+
+static RING s_ring;
+
+struct RING_WRITER
+{
+    LONG    iWriter;
+    LONG    cWritten;
+    LONG    cDropped;
+};
+
+// Writes RING_PER_WRITER records, each numbered, counting the ones the full ring turned away.
+static DWORD WINAPI _RingWriter(__in void* pv)
+{
+    RING_WRITER* prw = static_cast<RING_WRITER*>(pv);
+    for (LONG i = 0; i < RING_PER_WRITER; i++)
+    {
+        LONG lPos;
+        RING_RECORD* prr = s_ring.BeginWrite(&lPos);
+        if (prr == NULL)
+        {
+            prw->cDropped++;
+            SwitchToThread();
+            continue;
+        }
+        prr->iWriter = prw->iWriter;
+        prr->lSequence = prw->cWritten++;
+        s_ring.EndWrite(lPos);
+    }
+    return 0;
+}
+
+// Takes records until every writer has finished and the ring is empty, and checks that each
+// writer's records arrive once each and in the order they were written.
+static void _RingRead(__in_ecount(cThreads) HANDLE* rghThreads, __in DWORD cThreads, __out_ecount(RING_WRITERS) LONG* rgcRead)
+{
+    BOOL bInOrder = TRUE;
+    for (;;)
+    {
+        RING_RECORD* prr = s_ring.BeginRead();
+        if (prr != NULL)
+        {
+            if (prr->iWriter < 0 || prr->iWriter >= RING_WRITERS || prr->lSequence != rgcRead[prr->iWriter])
+            {
+                bInOrder = FALSE;
+            }
+            else
+            {
+                rgcRead[prr->iWriter]++;
+            }
+            s_ring.EndRead();
+        }
+        else if (WaitForMultipleObjects(cThreads, rghThreads, TRUE, 0) == WAIT_OBJECT_0)
+        {
+            // The writers are done; whatever they published is visible now.
+            if (!s_ring.IsReadReady())
+            {
+                break;
+            }
+        }
+    }
+    HT_CHECK(bInOrder);
+}
+
+void TestRecordRing()
+{
+    // One thread: the ring holds exactly its slot count and gives them back in order.
+    s_ring.Initialize();
+    LONG lPos;
+    for (LONG i = 0; i < 64; i++)
+    {
+        RING_RECORD* prr = s_ring.BeginWrite(&lPos);
+        HT_CHECK(prr != NULL);
+        if (prr != NULL)
+        {
+            prr->iWriter = 0;
+            prr->lSequence = i;
+            s_ring.EndWrite(lPos);
+        }
+    }
+    HT_CHECK(s_ring.BeginWrite(&lPos) == NULL);
+    for (LONG i = 0; i < 64; i++)
+    {
+        RING_RECORD* prr = s_ring.BeginRead();
+        HT_CHECK(prr != NULL && prr->lSequence == i);
+        s_ring.EndRead();
+    }
+    HT_CHECK(s_ring.BeginRead() == NULL);
+
+    // A claimed slot isn't readable until it's published, and holds up the ones behind it.
+    RING_RECORD* prrFirst = s_ring.BeginWrite(&lPos);
+    LONG lPosSecond;
+    RING_RECORD* prrSecond = s_ring.BeginWrite(&lPosSecond);
+    HT_CHECK(prrFirst != NULL && prrSecond != NULL);
+    s_ring.EndWrite(lPosSecond);
+    HT_CHECK(!s_ring.IsReadReady());
+    s_ring.EndWrite(lPos);
+    HT_CHECK(s_ring.IsReadReady());
+    s_ring.BeginRead();
+    s_ring.EndRead();
+    s_ring.BeginRead();
+    s_ring.EndRead();
+
+    // Several writers against one reader, with the ring small enough to fill up.
+    s_ring.Initialize();
+    RING_WRITER rgrw[RING_WRITERS] = {};
+    HANDLE rghThreads[RING_WRITERS];
+    DWORD cThreads = 0;
+    for (LONG i = 0; i < RING_WRITERS; i++)
+    {
+        rgrw[i].iWriter = i;
+        rghThreads[cThreads] = CreateThread(NULL, 0, _RingWriter, &rgrw[i], 0, NULL);
+        if (rghThreads[cThreads] != NULL)
+        {
+            cThreads++;
+        }
+    }
+    HT_CHECK(cThreads == RING_WRITERS);
+
+    LONG rgcRead[RING_WRITERS] = {};
+    _RingRead(rghThreads, cThreads, rgcRead);
+    for (DWORD i = 0; i < cThreads; i++)
+    {
+        CloseHandle(rghThreads[i]);
+    }
+
+    for (LONG i = 0; i < RING_WRITERS; i++)
+    {
+        HT_CHECK(rgcRead[i] == rgrw[i].cWritten);
+        HT_CHECK(rgrw[i].cWritten + rgrw[i].cDropped == RING_PER_WRITER);
+    }
+}
@@ -0,0 +1,276 @@
+#include "helperstest.h"
+#include <strsafe.h>
+#include "StringKernels.h"
+#include "../../BootPickerWrapper/RewriteRules.h"
+
+#define RR_BENCH_ROUNDS     1000000
+#define RR_NO_SLOT          ((DWORD)-1)
+
+static BOOL _IsRule(
+    __in const REWRITE_RULES& rr,
+    __in DWORD iRule,
+    __in DWORD dwField,
+    __in PCWSTR pwszMatch,
+    __in PCWSTR pwszReplacement
+    )
+{
+    return (iRule < rr.cRules) && (rr.rgRules[iRule].dwField == dwField) &&
+           (lstrcmpW(rr.pStrings->GetString(rr.rgRules[iRule].dwMatch), pwszMatch) == 0) &&
+           (lstrcmpW(rr.pStrings->GetString(rr.rgRules[iRule].dwReplacement), pwszReplacement) == 0);
+}
+
+static DWORD _Find(
+    __in const REWRITE_RULES& rr,
+    __in DWORD dwInnerID,
+    __in CREDENTIAL_PROVIDER_FIELD_TYPE cpft,
+    __in PCWSTR pwszValue
+    )
+{
+    return RewriteRulesFind(&rr, dwInnerID, cpft, pwszValue, lstrlenW(pwszValue));
+}
+
+// The slot a rule for pwszMatch in dwField goes in when the table is empty.
+static DWORD _SlotOf(
+    __in DWORD dwField,
+    __in PCWSTR pwszMatch
+    )
+{
+    DWORD iSlot = RR_NO_SLOT;
+    REWRITE_RULES rr;
+    if (SUCCEEDED(RewriteRulesInit(&rr)) && RewriteRulesAdd(&rr, dwField, pwszMatch, L"") == S_OK)
+    {
+        for (DWORD i = 0; i < ARRAYSIZE(rr.rgbSlots); i++)
+        {
+            if (rr.rgbSlots[i] != 0)
+            {
+                iSlot = i;
+            }
+        }
+    }
+    RewriteRulesCleanup(&rr);
+    return iSlot;
+}
+
+// Makes a value named after pwszPrefix, starting at *pn, whose rule for field dwField lands in
+// slot iSlot, and moves *pn past it.
+static BOOL _MakeValueForSlot(
+    __in DWORD dwField,
+    __in DWORD iSlot,
+    __in PCWSTR pwszPrefix,
+    __inout DWORD* pn,
+    __out_ecount(cch) PWSTR pwsz,
+    __in size_t cch
+    )
+{
+    for (DWORD cTries = 0; cTries < 10000; cTries++)
+    {
+        StringCchPrintfW(pwsz, cch, L"%s %lu", pwszPrefix, (*pn)++);
+        if (_SlotOf(dwField, pwsz) == iSlot)
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void _TestRewriteParse()
+{
+    WCHAR wszText[] =
+        L"# Comments and blank lines are skipped.\r\n"
+        L"\r\n"
+        L"0\tOther User\tLogin to Windows\r\n"
+        L"LargeText\tLocked\tLocked out\n"
+        L"commandlink\tSwitch User\tSomeone else\n"
+        L"Title\tunknown field\tskipped\n"
+        L"3\tno replacement\n"
+        L"4\n"
+        L"\tno field\tskipped\n"
+        L"2147483647\thighest field\tkept\n"
+        L"2147483648\tfield with the type bit\tskipped\n"
+        L"4294967296\ttoo big\tskipped\n"
+        L"-1\tnegative\tskipped\n"
+        L"6\tLast line\twithout a line end";
+
+    REWRITE_RULES rr;
+    HT_CHECK(SUCCEEDED(RewriteRulesInit(&rr)));
+    RewriteRulesParse(&rr, wszText);
+    HT_CHECK(rr.cRules == 5);
+    HT_CHECK(_IsRule(rr, 0, 0, L"Other User", L"Login to Windows"));
+    HT_CHECK(_IsRule(rr, 1, REWRITE_FIELD_FOR_TYPE(CPFT_LARGE_TEXT), L"Locked", L"Locked out"));
+    HT_CHECK(_IsRule(rr, 2, REWRITE_FIELD_FOR_TYPE(CPFT_COMMAND_LINK), L"Switch User", L"Someone else"));
+    HT_CHECK(_IsRule(rr, 3, 2147483647, L"highest field", L"kept"));
+    HT_CHECK(_IsRule(rr, 4, 6, L"Last line", L"without a line end"));
+    RewriteRulesCleanup(&rr);
+
+    // Lines past the most rules there can be are dropped, and parsing stops.
+    WCHAR wszMany[(REWRITE_MAX_RULES + 8) * 16] = L"";
+    for (DWORD i = 0; i < REWRITE_MAX_RULES + 8; i++)
+    {
+        WCHAR wszLine[16];
+        StringCchPrintfW(wszLine, ARRAYSIZE(wszLine), L"%lu\tv\tr\n", i);
+        StringCchCatW(wszMany, ARRAYSIZE(wszMany), wszLine);
+    }
+    HT_CHECK(SUCCEEDED(RewriteRulesInit(&rr)));
+    RewriteRulesParse(&rr, wszMany);
+    HT_CHECK(rr.cRules == REWRITE_MAX_RULES);
+    for (DWORD i = 0; i < REWRITE_MAX_RULES; i++)
+    {
+        HT_CHECK(_Find(rr, i, CPFT_SMALL_TEXT, L"v") == i);
+    }
+    HT_CHECK(_Find(rr, REWRITE_MAX_RULES, CPFT_SMALL_TEXT, L"v") == REWRITE_NO_RULE);
+    HT_CHECK(RewriteRulesAdd(&rr, REWRITE_MAX_RULES, L"v", L"r") == S_FALSE && rr.cRules == REWRITE_MAX_RULES);
+    RewriteRulesCleanup(&rr);
+}
+
+static void _TestRewriteCollisions()
+{
+    // Two values whose rules want the same slot, and a third that wants it too but has no
+    // rule; the second rule goes in the next slot along.
+    DWORD n = 0;
+    WCHAR wszFirst[32], wszSecond[32], wszNone[32];
+    StringCchCopyW(wszFirst, ARRAYSIZE(wszFirst), L"First");
+    DWORD iSlot = _SlotOf(1, wszFirst);
+    if (iSlot == RR_NO_SLOT ||
+        !_MakeValueForSlot(1, iSlot, L"Second", &n, wszSecond, ARRAYSIZE(wszSecond)) ||
+        !_MakeValueForSlot(1, iSlot, L"None", &n, wszNone, ARRAYSIZE(wszNone)))
+    {
+        HT_CHECK(!"no values that collide");
+        return;
+    }
+
+    REWRITE_RULES rr;
+    HT_CHECK(SUCCEEDED(RewriteRulesInit(&rr)));
+    HT_CHECK(RewriteRulesAdd(&rr, 1, wszFirst, L"1") == S_OK);
+    HT_CHECK(RewriteRulesAdd(&rr, 1, wszSecond, L"2") == S_OK);
+    HT_CHECK(rr.rgbSlots[iSlot] == 1 && rr.rgbSlots[(iSlot + 1) % ARRAYSIZE(rr.rgbSlots)] == 2);
+    HT_CHECK(_Find(rr, 1, CPFT_LARGE_TEXT, wszFirst) == 0);
+    HT_CHECK(_Find(rr, 1, CPFT_LARGE_TEXT, wszSecond) == 1);
+    HT_CHECK(_Find(rr, 1, CPFT_LARGE_TEXT, wszNone) == REWRITE_NO_RULE);
+
+    // The same value in another field is another key.
+    HT_CHECK(_Find(rr, 2, CPFT_LARGE_TEXT, wszFirst) == REWRITE_NO_RULE);
+    RewriteRulesCleanup(&rr);
+
+    // Probing wraps from the last slot to the first.
+    DWORD iLast = (DWORD)ARRAYSIZE(rr.rgbSlots) - 1;
+    if (!_MakeValueForSlot(1, iLast, L"First", &n, wszFirst, ARRAYSIZE(wszFirst)) ||
+        !_MakeValueForSlot(1, iLast, L"Second", &n, wszSecond, ARRAYSIZE(wszSecond)))
+    {
+        HT_CHECK(!"no values for the last slot");
+        return;
+    }
+    HT_CHECK(SUCCEEDED(RewriteRulesInit(&rr)));
+    HT_CHECK(RewriteRulesAdd(&rr, 1, wszFirst, L"1") == S_OK);
+    HT_CHECK(RewriteRulesAdd(&rr, 1, wszSecond, L"2") == S_OK);
+    HT_CHECK(rr.rgbSlots[iLast] == 1 && rr.rgbSlots[0] == 2);
+    HT_CHECK(_Find(rr, 1, CPFT_SMALL_TEXT, wszFirst) == 0);
+    HT_CHECK(_Find(rr, 1, CPFT_SMALL_TEXT, wszSecond) == 1);
+    RewriteRulesCleanup(&rr);
+}
+
+static void _TestRewriteCaseFolding()
+{
+    REWRITE_RULES rr;
+    HT_CHECK(SUCCEEDED(RewriteRulesInit(&rr)));
+    HT_CHECK(RewriteRulesAdd(&rr, 0, L"Other User", L"Login to Windows") == S_OK);
+    HT_CHECK(RewriteRulesAdd(&rr, 0, L"\x00c9" L"cran", L"Screen") == S_OK);
+    HT_CHECK(RewriteRulesAdd(&rr, 0, L"\x03a3", L"Sigma") == S_OK);
+
+    HT_CHECK(_Find(rr, 0, CPFT_LARGE_TEXT, L"Other User") == 0);
+    HT_CHECK(_Find(rr, 0, CPFT_LARGE_TEXT, L"OTHER USER") == 0);
+    HT_CHECK(_Find(rr, 0, CPFT_LARGE_TEXT, L"other user") == 0);
+    HT_CHECK(_Find(rr, 0, CPFT_LARGE_TEXT, L"Other Users") == REWRITE_NO_RULE);
+    HT_CHECK(RewriteRulesFind(&rr, 0, CPFT_LARGE_TEXT, L"Other User", 5) == REWRITE_NO_RULE);
+
+    // Past ASCII, a value in another case has to hash to the same slot as well as compare equal.
+    // Each differs from its rule in the case of one character.
+    HT_CHECK(_Find(rr, 0, CPFT_LARGE_TEXT, L"\x00e9" L"CRAN") == 1);
+    HT_CHECK(_Find(rr, 0, CPFT_LARGE_TEXT, L"\x00c9" L"cran") == 1);
+    HT_CHECK(_Find(rr, 0, CPFT_LARGE_TEXT, L"\x03c3") == 2);
+    RewriteRulesCleanup(&rr);
+}
+
+static void _TestRewriteFieldsAndTypes()
+{
+    REWRITE_RULES rr;
+    HT_CHECK(SUCCEEDED(RewriteRulesInit(&rr)));
+    HT_CHECK(_Find(rr, 0, CPFT_LARGE_TEXT, L"Other User") == REWRITE_NO_RULE);
+    HT_CHECK(RewriteRulesAdd(&rr, REWRITE_FIELD_FOR_TYPE(CPFT_LARGE_TEXT), L"Hello", L"By type") == S_OK);
+    HT_CHECK(RewriteRulesAdd(&rr, 3, L"Hello", L"By number") == S_OK);
+
+    // A rule for the field's number wins over one for its type.
+    HT_CHECK(_Find(rr, 3, CPFT_LARGE_TEXT, L"hello") == 1);
+    HT_CHECK(_Find(rr, 4, CPFT_LARGE_TEXT, L"hello") == 0);
+    HT_CHECK(_Find(rr, 4, CPFT_SMALL_TEXT, L"hello") == REWRITE_NO_RULE);
+
+    // Fields the user types into are never rewritten, and neither is a field number
+    // that looks like a type.
+    HT_CHECK(_Find(rr, 3, CPFT_PASSWORD_TEXT, L"Hello") == REWRITE_NO_RULE);
+    HT_CHECK(_Find(rr, 3, CPFT_EDIT_TEXT, L"Hello") == REWRITE_NO_RULE);
+    HT_CHECK(_Find(rr, REWRITE_FIELD_FOR_TYPE(CPFT_LARGE_TEXT), CPFT_LARGE_TEXT, L"Hello") == REWRITE_NO_RULE);
+    RewriteRulesCleanup(&rr);
+}
+
+void TestRewriteRules()
+{
+    _TestRewriteParse();
+    _TestRewriteCollisions();
+    _TestRewriteCaseFolding();
+    _TestRewriteFieldsAndTypes();
+}
+
+// A full set of rules, and the values to look up in it.
+struct RR_BENCH
+{
+    REWRITE_RULES   rr;
+    PCWSTR          pwszValue;
+    size_t          cchValue;
+};
+
+static void _BenchFind(__in void* pv)
+{
+    RR_BENCH* prrb = static_cast<RR_BENCH*>(pv);
+    RewriteRulesFind(&prrb->rr, 7, CPFT_LARGE_TEXT, prrb->pwszValue, prrb->cchValue);
+}
+
+// What the lookup replaces: comparing the value with every rule in turn.
+static void _BenchScan(__in void* pv)
+{
+    RR_BENCH* prrb = static_cast<RR_BENCH*>(pv);
+    const REWRITE_RULES& rr = prrb->rr;
+    for (DWORD i = 0; i < rr.cRules; i++)
+    {
+        if (rr.rgRules[i].dwField == 7 &&
+            StrEqualIW(rr.pStrings->GetString(rr.rgRules[i].dwMatch), rr.pStrings->GetLength(rr.rgRules[i].dwMatch), prrb->pwszValue, prrb->cchValue))
+        {
+            break;
+        }
+    }
+}
+
+void BenchRewriteRules()
+{
+    RR_BENCH rrb;
+    if (FAILED(RewriteRulesInit(&rrb.rr)))
+    {
+        return;
+    }
+    for (DWORD i = 0; i < REWRITE_MAX_RULES; i++)
+    {
+        WCHAR wszMatch[32];
+        StringCchPrintfW(wszMatch, ARRAYSIZE(wszMatch), L"Other User %lu", i);
+        RewriteRulesAdd(&rrb.rr, 7, wszMatch, L"Login to Windows");
+    }
+
+    rrb.pwszValue = L"OTHER USER 31";
+    rrb.cchValue = lstrlenW(rrb.pwszValue);
+    HelpersTestBenchmark("RewriteRulesFind, 32 rules, last rule", RR_BENCH_ROUNDS, _BenchFind, &rrb);
+    HelpersTestBenchmark("Scan of 32 rules, last rule", RR_BENCH_ROUNDS, _BenchScan, &rrb);
+
+    rrb.pwszValue = L"Administrator";
+    rrb.cchValue = lstrlenW(rrb.pwszValue);
+    HelpersTestBenchmark("RewriteRulesFind, 32 rules, no match", RR_BENCH_ROUNDS, _BenchFind, &rrb);
+    HelpersTestBenchmark("Scan of 32 rules, no match", RR_BENCH_ROUNDS, _BenchScan, &rrb);
+
+    RewriteRulesCleanup(&rrb.rr);
+}
@@ -0,0 +1,290 @@
+#include "helperstest.h"
+#include "StartupDisk.h"
+
+#define MEMORY_STORE_VARIABLES  4
+#define MEMORY_STORE_BYTES      1024
+
+// Firmware variables kept in memory. A variable can be made to fail its
+// writes, or to read back something other than what was written.
+class MemoryVariableStore : public FirmwareVariableStore
+{
+  public:
+    MemoryVariableStore() : pwszFailWrite(NULL), pwszCorrupt(NULL), cFailWrites(0)
+    {
+        ZeroMemory(_rgVariables, sizeof(_rgVariables));
+    }
+
+    HRESULT ReadVariable(__in PCWSTR pwszName, __in PCWSTR, __out_bcount_part(cb, *pcbRead) void* pv, __in DWORD cb, __out DWORD* pcbRead)
+    {
+        *pcbRead = 0;
+        VARIABLE* pvar = _Find(pwszName, FALSE);
+        if (pvar == NULL)
+        {
+            return HRESULT_FROM_WIN32(ERROR_ENVVAR_NOT_FOUND);
+        }
+        if (pvar->cb > cb)
+        {
+            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+        }
+        CopyMemory(pv, pvar->rgb, pvar->cb);
+        if (pvar->bCorrupt && pvar->cb > 0)
+        {
+            static_cast<BYTE*>(pv)[0] ^= 0xff;
+        }
+        *pcbRead = pvar->cb;
+        return S_OK;
+    }
+
+    HRESULT WriteVariable(__in PCWSTR pwszName, __in PCWSTR, __in_bcount(cb) const void* pv, __in DWORD cb)
+    {
+        if (pwszFailWrite != NULL && lstrcmpW(pwszName, pwszFailWrite) == 0 && cFailWrites > 0)
+        {
+            cFailWrites--;
+            return E_FAIL;
+        }
+        VARIABLE* pvar = _Find(pwszName, TRUE);
+        if (pvar == NULL || cb > sizeof(pvar->rgb))
+        {
+            return E_OUTOFMEMORY;
+        }
+        CopyMemory(pvar->rgb, pv, cb);
+        pvar->cb = cb;
+        pvar->bCorrupt = (pwszCorrupt != NULL && lstrcmpW(pwszName, pwszCorrupt) == 0);
+        return S_OK;
+    }
+
+    HRESULT DeleteVariable(__in PCWSTR pwszName, __in PCWSTR)
+    {
+        VARIABLE* pvar = _Find(pwszName, FALSE);
+        if (pvar != NULL)
+        {
+            pvar->pwszName = NULL;
+        }
+        return S_OK;
+    }
+
+    // Whether a variable exists and holds exactly these bytes.
+    BOOL Holds(__in PCWSTR pwszName, __in_bcount(cb) const void* pv, __in DWORD cb)
+    {
+        VARIABLE* pvar = _Find(pwszName, FALSE);
+        return pvar != NULL && pvar->cb == cb && memcmp(pvar->rgb, pv, cb) == 0;
+    }
+
+    BOOL Exists(__in PCWSTR pwszName)
+    {
+        return _Find(pwszName, FALSE) != NULL;
+    }
+
+    PCWSTR  pwszFailWrite;      // Writes of this variable fail, cFailWrites times.
+    PCWSTR  pwszCorrupt;        // Writes of this variable read back with their first byte flipped.
+    DWORD   cFailWrites;
+
+  private:
+    struct VARIABLE
+    {
+        PCWSTR  pwszName;
+        BOOL    bCorrupt;
+        DWORD   cb;
+        BYTE    rgb[MEMORY_STORE_BYTES];
+    };
+
+    VARIABLE* _Find(__in PCWSTR pwszName, __in BOOL bCreate)
+    {
+        VARIABLE* pvFree = NULL;
+        for (int i = 0; i < MEMORY_STORE_VARIABLES; i++)
+        {
+            if (_rgVariables[i].pwszName == NULL)
+            {
+                pvFree = (pvFree == NULL) ? &_rgVariables[i] : pvFree;
+            }
+            else if (lstrcmpW(_rgVariables[i].pwszName, pwszName) == 0)
+            {
+                return &_rgVariables[i];
+            }
+        }
+        if (bCreate && pvFree != NULL)
+        {
+            // The names are all string literals, which outlive the store.
+            pvFree->pwszName = pwszName;
+            pvFree->bCorrupt = FALSE;
+            pvFree->cb = 0;
+            return pvFree;
+        }
+        return NULL;
+    }
+
+    VARIABLE _rgVariables[MEMORY_STORE_VARIABLES];
+};
+
+// What we write for disk0s2 of an HFS+ Mac, with GPT unique partition GUID
+// 5A1B9B2E-1C8D-4F3A-9E27-61B00C44D583, starting at LBA 409640 and 975093952
+// sectors long. These were put together by hand, from the UEFI spec's hard drive
+// media device path and from efi-boot-device as nvram -p shows it after
+// bless --setBoot on an HFS+ volume; they weren't captured from bless itself.
+// bless also adds a BLLastBSDName key to the plist, which the firmware doesn't
+// match on and we leave out, and puts the controller path in front of the hard
+// drive node, which the firmware finds the partition without.
+static const GUID s_guidGolden = { 0x5A1B9B2E, 0x1C8D, 0x4F3A, { 0x9E, 0x27, 0x61, 0xB0, 0x0C, 0x44, 0xD5, 0x83 } };
+
+static const BYTE s_rgbGoldenDevicePath[] =
+{
+    0x04, 0x01, 0x2a, 0x00,                                 // Media, hard drive, 42 bytes.
+    0x02, 0x00, 0x00, 0x00,                                 // Partition 2.
+    0x28, 0x40, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00,         // Start LBA.
+    0xc0, 0xc0, 0x1e, 0x3a, 0x00, 0x00, 0x00, 0x00,         // Size in sectors.
+    0x2e, 0x9b, 0x1b, 0x5a, 0x8d, 0x1c, 0x3a, 0x4f,         // Partition GUID, as an EFI_GUID.
+    0x9e, 0x27, 0x61, 0xb0, 0x0c, 0x44, 0xd5, 0x83,
+    0x02,                                                   // GPT.
+    0x02,                                                   // GUID signature.
+    0x7f, 0xff, 0x04, 0x00,                                 // End of the entire path.
+};
+
+static const char s_szGoldenBootDevice[] =
+    "<array><dict><key>IOMatch</key><dict>"
+    "<key>IOProviderClass</key><string>IOMedia</string>"
+    "<key>IOPropertyMatch</key><dict><key>UUID</key>"
+    "<string>5A1B9B2E-1C8D-4F3A-9E27-61B00C44D583</string>"
+    "</dict></dict></dict></array>";
+
+static const BYTE s_rgbOldDevicePath[] = { 1, 2, 3, 4 };
+static const char s_szOldBootDevice[] = "<array>old</array>";
+
+static void _SetOldStartupDisk(__inout MemoryVariableStore* pmvs)
+{
+    pmvs->WriteVariable(L"efi-boot-device-data", APPLE_BOOT_VARIABLE_GUID, s_rgbOldDevicePath, sizeof(s_rgbOldDevicePath));
+    pmvs->WriteVariable(L"efi-boot-device", APPLE_BOOT_VARIABLE_GUID, s_szOldBootDevice, sizeof(s_szOldBootDevice));
+}
+
+static BOOL _HasOldStartupDisk(__in MemoryVariableStore* pmvs)
+{
+    return pmvs->Holds(L"efi-boot-device-data", s_rgbOldDevicePath, sizeof(s_rgbOldDevicePath)) &&
+        pmvs->Holds(L"efi-boot-device", s_szOldBootDevice, sizeof(s_szOldBootDevice));
+}
+
+// A target in an index, for picking from.
+static void _AddTarget(__inout GPT_INDEX* pgi, __in BYTE bKind, __in BOOL bBlessed, __in WORD wPartitionNumber)
+{
+    GPT_TARGET& rgt = pgi->rgTargets[pgi->cTargets++];
+    ZeroMemory(&rgt, sizeof(rgt));
+    rgt.bKind = bKind;
+    rgt.bBlessed = bBlessed;
+    rgt.wPartitionNumber = wPartitionNumber;
+}
+
+static void _TestStartupDiskGolden()
+{
+    STARTUP_PARTITION sp = {};
+    sp.dwDisk = 0;
+    sp.dwPartitionNumber = 2;
+    sp.ullStartLba = 409640;
+    sp.ullSizeLba = 975093952;
+    sp.guidPartition = s_guidGolden;
+    sp.bKind = GTK_HFSPLUS;
+
+    BYTE rgb[STARTUP_DISK_MAX_VARIABLE_BYTES];
+    DWORD cb;
+    HT_CHECK(SUCCEEDED(StartupDiskEncodeDevicePath(sp, rgb, sizeof(rgb), &cb)));
+    HT_CHECK(cb == sizeof(s_rgbGoldenDevicePath) && memcmp(rgb, s_rgbGoldenDevicePath, cb) == 0);
+    HT_CHECK(SUCCEEDED(StartupDiskEncodeBootDevice(sp, rgb, sizeof(rgb), &cb)));
+    HT_CHECK(cb == sizeof(s_szGoldenBootDevice) && memcmp(rgb, s_szGoldenBootDevice, cb) == 0);
+
+    // A buffer one byte short of either fails rather than truncating.
+    HT_CHECK(FAILED(StartupDiskEncodeDevicePath(sp, rgb, sizeof(s_rgbGoldenDevicePath) - 1, &cb)) && cb == 0);
+    HT_CHECK(FAILED(StartupDiskEncodeBootDevice(sp, rgb, sizeof(s_szGoldenBootDevice) - 1, &cb)) && cb == 0);
+
+    // An APFS volume can't be named this way, so nothing is encoded or written for one.
+    sp.bKind = GTK_APFS;
+    HT_CHECK(StartupDiskEncodeBootDevice(sp, rgb, sizeof(rgb), &cb) == HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED) && cb == 0);
+    MemoryVariableStore mvs;
+    _SetOldStartupDisk(&mvs);
+    HT_CHECK(FAILED(StartupDiskWrite(&mvs, sp)));
+    HT_CHECK(_HasOldStartupDisk(&mvs));
+}
+
+static void _TestStartupDiskFind()
+{
+    // Only a blessed HFS+ volume is picked: not APFS, not a recovery partition, and not an
+    // HFS+ data or Time Machine volume that comes before it.
+    GPT_INDEX gi = {};
+    _AddTarget(&gi, GTK_APFS, FALSE, 2);
+    _AddTarget(&gi, GTK_APPLE_BOOT, FALSE, 3);
+    _AddTarget(&gi, GTK_HFSPLUS, FALSE, 4);
+    _AddTarget(&gi, GTK_HFSPLUS, TRUE, 5);
+    _AddTarget(&gi, GTK_HFSPLUS, TRUE, 6);
+    STARTUP_PARTITION sp = {};
+    HT_CHECK(SUCCEEDED(StartupDiskFindMacPartition(&gi, &sp)));
+    HT_CHECK(sp.dwPartitionNumber == 5 && sp.bKind == GTK_HFSPLUS);
+
+    // With none blessed, nothing is picked and StartupDiskSetMac leaves it to Boot Camp.
+    gi.cTargets = 3;
+    HT_CHECK(StartupDiskFindMacPartition(&gi, &sp) == HRESULT_FROM_WIN32(ERROR_NOT_FOUND));
+    gi.cTargets = 0;
+    HT_CHECK(StartupDiskFindMacPartition(&gi, &sp) == HRESULT_FROM_WIN32(ERROR_NOT_FOUND));
+}
+
+void TestStartupDisk()
+{
+    _TestStartupDiskGolden();
+    _TestStartupDiskFind();
+
+    STARTUP_PARTITION sp = {};
+    sp.dwDisk = 0;
+    sp.dwPartitionNumber = 2;
+    sp.ullStartLba = 409640;
+    sp.ullSizeLba = 1000000;
+    sp.guidPartition.Data1 = 0x12345678;
+    sp.bKind = GTK_HFSPLUS;
+
+    BYTE rgbDevicePath[STARTUP_DISK_MAX_VARIABLE_BYTES];
+    BYTE rgbBootDevice[STARTUP_DISK_MAX_VARIABLE_BYTES];
+    DWORD cbDevicePath;
+    DWORD cbBootDevice;
+    HT_CHECK(SUCCEEDED(StartupDiskEncodeDevicePath(sp, rgbDevicePath, sizeof(rgbDevicePath), &cbDevicePath)));
+    HT_CHECK(SUCCEEDED(StartupDiskEncodeBootDevice(sp, rgbBootDevice, sizeof(rgbBootDevice), &cbBootDevice)));
+
+    // Both variables are written.
+    {
+        MemoryVariableStore mvs;
+        _SetOldStartupDisk(&mvs);
+        HT_CHECK(SUCCEEDED(StartupDiskWrite(&mvs, sp)));
+        HT_CHECK(mvs.Holds(L"efi-boot-device-data", rgbDevicePath, cbDevicePath));
+        HT_CHECK(mvs.Holds(L"efi-boot-device", rgbBootDevice, cbBootDevice));
+    }
+
+    // The plist can't be written: the device path goes back to what it was.
+    {
+        MemoryVariableStore mvs;
+        _SetOldStartupDisk(&mvs);
+        mvs.pwszFailWrite = L"efi-boot-device";
+        mvs.cFailWrites = 1;
+        HT_CHECK(FAILED(StartupDiskWrite(&mvs, sp)));
+        HT_CHECK(_HasOldStartupDisk(&mvs));
+    }
+
+    // The plist doesn't read back: both go back.
+    {
+        MemoryVariableStore mvs;
+        _SetOldStartupDisk(&mvs);
+        mvs.pwszCorrupt = L"efi-boot-device";
+        HT_CHECK(FAILED(StartupDiskWrite(&mvs, sp)));
+        HT_CHECK(_HasOldStartupDisk(&mvs));
+    }
+
+    // The device path doesn't read back: it goes back, and the plist is never touched.
+    {
+        MemoryVariableStore mvs;
+        _SetOldStartupDisk(&mvs);
+        mvs.pwszCorrupt = L"efi-boot-device-data";
+        HT_CHECK(FAILED(StartupDiskWrite(&mvs, sp)));
+        HT_CHECK(_HasOldStartupDisk(&mvs));
+    }
+
+    // With no startup disk set before, a failed write leaves none set.
+    {
+        MemoryVariableStore mvs;
+        mvs.pwszFailWrite = L"efi-boot-device";
+        mvs.cFailWrites = 1;
+        HT_CHECK(FAILED(StartupDiskWrite(&mvs, sp)));
+        HT_CHECK(!mvs.Exists(L"efi-boot-device-data") && !mvs.Exists(L"efi-boot-device"));
+    }
+}
@@ -0,0 +1,217 @@
+#include "helperstest.h"
+#include <strsafe.h>
+#include "StringKernels.h"
+
+#define SK_PAGE             4096
+#define SK_MAX_CCH          300
+#define SK_EQUAL_ROUNDS     100000
+#define SK_SEED             0x5eed0023
+
+// The characters the random strings are made of: letters and the characters either side of
+// each range of them, digits, and characters past ASCII that do and don't have a case. The
+// first SK_ASCII_CHARS of them are ASCII.
+#define SK_ASCII_CHARS      15
+
+static const WCHAR s_rgwchAlphabet[] =
+{
+    L'A', L'M', L'Z', L'a', L'm', L'z', L'@', L'[', L'`', L'{', L'0', L'9', L' ', L'\\', 0x7f,
+    0x80, 0xc9, 0xe9, 0x3a3, 0x3c3, 0x130, 0xff21, 0xff41, 0xff80, 0xffff,
+};
+
+// Two pages, the second of which can't be read. A string put against the end of the first
+// faults if a kernel reads past what it was allowed to.
+static BYTE* s_pbPages = NULL;
+
+// Characters past ASCII in the alphabet and their other case.
+static const WCHAR s_rgwchCasePairs[][2] =
+{
+    { 0xc9, 0xe9 }, { 0x3a3, 0x3c3 }, { 0xff21, 0xff41 },
+};
+
+static PWSTR _AtPageEnd(__in size_t cch, __in size_t cbSkew)
+{
+    return reinterpret_cast<PWSTR>(s_pbPages + SK_PAGE - cch * sizeof(WCHAR) - cbSkew);
+}
+
+static ULONG _Random(__inout ULONG* pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return (*pulState >> 16) & 0x7fff;
+}
+
+// The other case of a letter in the alphabet, or the character itself.
+static WCHAR _OtherCase(__in WCHAR wch)
+{
+    if (wch < 0x80 && (wch | 0x20) >= L'a' && (wch | 0x20) <= L'z')
+    {
+        return wch ^ 0x20;
+    }
+    for (size_t i = 0; i < ARRAYSIZE(s_rgwchCasePairs); i++)
+    {
+        if (wch == s_rgwchCasePairs[i][0] || wch == s_rgwchCasePairs[i][1])
+        {
+            return s_rgwchCasePairs[i][0] ^ s_rgwchCasePairs[i][1] ^ wch;
+        }
+    }
+    return wch;
+}
+
+static size_t _RefStrLen(__in PCWSTR pwsz, __in size_t cchMax)
+{
+    size_t cch = 0;
+    while (cch < cchMax && pwsz[cch] != L'\0')
+    {
+        cch++;
+    }
+    return cch;
+}
+
+static BOOL _RefStrEqualI(__in PCWSTR pwchA, __in PCWSTR pwchB, __in size_t cch)
+{
+    return CompareStringOrdinal(pwchA, (int)cch, pwchB, (int)cch, TRUE) == CSTR_EQUAL;
+}
+
+// Every length up to SK_MAX_CCH, at every alignment, terminated or cut off by cchMax, with the
+// last character it may read the last one before the guard page.
+static void _TestStrLen()
+{
+    BOOL bMatches = TRUE;
+    for (size_t cch = 0; cch <= SK_MAX_CCH; cch++)
+    {
+        for (size_t cbSkew = 0; cbSkew < 16; cbSkew++)
+        {
+            // Terminated, with a cchMax that reaches the terminator and no further.
+            PWSTR pwsz = _AtPageEnd(cch + 1, cbSkew);
+            for (size_t i = 0; i < cch; i++)
+            {
+                pwsz[i] = (WCHAR)(L'a' + i % 26);
+            }
+            pwsz[cch] = L'\0';
+            bMatches = bMatches && (StrLenW(pwsz, cch + 1) == cch);
+
+            // Unterminated, cut off by cchMax at the guard page.
+            pwsz = _AtPageEnd(cch, cbSkew);
+            for (size_t i = 0; i < cch; i++)
+            {
+                pwsz[i] = (WCHAR)(0x100 + i);
+            }
+            bMatches = bMatches && (StrLenW(pwsz, cch) == cch);
+
+            // A terminator short of cchMax, with characters after it that mustn't be counted.
+            if (cch > 2)
+            {
+                pwsz[cch / 2] = L'\0';
+                bMatches = bMatches && (StrLenW(pwsz, cch) == _RefStrLen(pwsz, cch));
+            }
+        }
+    }
+    HT_CHECK(bMatches);
+    HT_CHECK(StrLenW(L"", 0) == 0);
+    HT_CHECK(StrLenW(L"abc", 2) == 2);
+}
+
+// Random strings, and copies of them with the case of some letters changed and sometimes one
+// character replaced, at every alignment against the guard page, compared the way
+// CompareStringOrdinal compares them.
+static void _TestStrEqualI()
+{
+    ULONG ulState = SK_SEED;
+    DWORD cEqual = 0;
+    DWORD cUnequal = 0;
+    DWORD cPastAscii = 0;
+    BOOL bMatches = TRUE;
+    WCHAR rgwchA[SK_MAX_CCH];
+
+    for (DWORD iRound = 0; iRound < SK_EQUAL_ROUNDS; iRound++)
+    {
+        size_t cch = (_Random(&ulState) % 4 == 0) ? _Random(&ulState) % SK_MAX_CCH : _Random(&ulState) % 40;
+
+        // Mostly ASCII, since that's the fast path, with a character past it now and then.
+        BOOL bPastAscii = (_Random(&ulState) % 4 == 0);
+        for (size_t i = 0; i < cch; i++)
+        {
+            size_t cAlphabet = bPastAscii ? ARRAYSIZE(s_rgwchAlphabet) : SK_ASCII_CHARS;
+            rgwchA[i] = s_rgwchAlphabet[_Random(&ulState) % cAlphabet];
+        }
+
+        PWSTR pwchB = _AtPageEnd(cch, (_Random(&ulState) % 8) * sizeof(WCHAR));
+        for (size_t i = 0; i < cch; i++)
+        {
+            pwchB[i] = (_Random(&ulState) & 1) ? _OtherCase(rgwchA[i]) : rgwchA[i];
+        }
+        if (cch > 0 && (_Random(&ulState) % 3) == 0)
+        {
+            pwchB[_Random(&ulState) % cch] = s_rgwchAlphabet[_Random(&ulState) % ARRAYSIZE(s_rgwchAlphabet)];
+        }
+
+        BOOL bEqual = StrEqualIW(rgwchA, cch, pwchB, cch);
+        bMatches = bMatches && (bEqual == _RefStrEqualI(rgwchA, pwchB, cch));
+        if (bEqual)
+        {
+            cEqual++;
+        }
+        else
+        {
+            cUnequal++;
+        }
+        if (bPastAscii)
+        {
+            cPastAscii++;
+        }
+    }
+    HT_CHECK(bMatches);
+    HT_CHECK(cEqual > SK_EQUAL_ROUNDS / 10 && cUnequal > SK_EQUAL_ROUNDS / 10);
+    HT_CHECK(cPastAscii > 0);
+
+    // The edges of the letters, and characters past ASCII that fold only through CompareStringOrdinal.
+    HT_CHECK(StrEqualIW(L"", 0, L"", 0));
+    HT_CHECK(!StrEqualIW(L"abc", 3, L"ab", 2));
+    HT_CHECK(StrEqualIW(L"ABCDEFGHIJKLMNOPQRSTUVWXYZ", 26, L"abcdefghijklmnopqrstuvwxyz", 26));
+    HT_CHECK(!StrEqualIW(L"@[`{@[`{", 8, L"`{@[`{@[", 8));
+    HT_CHECK(StrEqualIW(L"user\x00c9t\x00e9", 7, L"USER\x00e9T\x00c9", 7));
+    HT_CHECK(StrEqualIW(L"\x00c9\x00e9" L"abcdefgh", 10, L"\x00e9\x00c9" L"ABCDEFGH", 10));
+    HT_CHECK(StrEqualIW(L"12345678\x03a3", 9, L"12345678\x03c3", 9));
+}
+
+static void _TestCopyAndJoin()
+{
+    WCHAR wszDest[8];
+
+    HT_CHECK(SUCCEEDED(StrCopyW(wszDest, ARRAYSIZE(wszDest), L"1234567", 7)));
+    HT_CHECK(lstrcmpW(wszDest, L"1234567") == 0);
+    HT_CHECK(StrCopyW(wszDest, ARRAYSIZE(wszDest), L"12345678", 8) == STRSAFE_E_INSUFFICIENT_BUFFER);
+    HT_CHECK(wszDest[0] == L'\0');
+
+    HT_CHECK(SUCCEEDED(StrJoinW(wszDest, ARRAYSIZE(wszDest), L"dom", 3, L'\\', L"usr", 3)));
+    HT_CHECK(lstrcmpW(wszDest, L"dom\\usr") == 0);
+    HT_CHECK(StrJoinW(wszDest, ARRAYSIZE(wszDest), L"dom", 3, L'\\', L"user", 4) == STRSAFE_E_INSUFFICIENT_BUFFER);
+    HT_CHECK(wszDest[0] == L'\0');
+
+    // Sizes that would wrap if they were added up before they were checked.
+    HT_CHECK(StrJoinW(wszDest, ARRAYSIZE(wszDest), L"dom", 3, L'\\', L"usr", (size_t)-2) == STRSAFE_E_INSUFFICIENT_BUFFER);
+    HT_CHECK(StrJoinW(wszDest, ARRAYSIZE(wszDest), L"dom", (size_t)-1, L'\\', L"usr", 3) == STRSAFE_E_INSUFFICIENT_BUFFER);
+
+    // No room at all isn't written to.
+    wszDest[0] = L'x';
+    HT_CHECK(StrCopyW(wszDest, 0, L"", 0) == STRSAFE_E_INSUFFICIENT_BUFFER);
+    HT_CHECK(wszDest[0] == L'x');
+}
+
+void TestStringKernels()
+{
+    s_pbPages = static_cast<BYTE*>(VirtualAlloc(NULL, 2 * SK_PAGE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    DWORD dwOldProtect;
+    HT_CHECK(s_pbPages != NULL);
+    if (s_pbPages == NULL || !VirtualProtect(s_pbPages + SK_PAGE, SK_PAGE, PAGE_NOACCESS, &dwOldProtect))
+    {
+        HT_CHECK(!"couldn't set up the guard page");
+        return;
+    }
+
+    _TestStrLen();
+    _TestStrEqualI();
+    _TestCopyAndJoin();
+
+    VirtualFree(s_pbPages, 0, MEM_RELEASE);
+    s_pbPages = NULL;
+}
@@ -0,0 +1,89 @@
+#include "helperstest.h"
+#include "StringPool.h"
+
+// What's allocated on a heap: how many blocks, and how many bytes they hold.
+struct HEAP_COUNT
+{
+    DWORD   cBlocks;
+    SIZE_T  cb;
+};
+
+static HEAP_COUNT _CountHeap(__in HANDLE hHeap)
+{
+    HEAP_COUNT hc = {};
+    PROCESS_HEAP_ENTRY phe = {};
+    while (HeapWalk(hHeap, &phe))
+    {
+        if (phe.wFlags & PROCESS_HEAP_ENTRY_BUSY)
+        {
+            hc.cBlocks++;
+            hc.cb += phe.cbData;
+        }
+    }
+    return hc;
+}
+
+static BOOL _SameCount(__in const HEAP_COUNT& hc1, __in const HEAP_COUNT& hc2)
+{
+    return (hc1.cBlocks == hc2.cBlocks) && (hc1.cb == hc2.cb);
+}
+
+void TestStringPool()
+{
+    // A heap of the pool's own, so that everything on it is the pool's. Only this
+    // thread uses it, and without serialization it never turns on the low
+    // fragmentation heap, whose blocks would be counted too.
+    HANDLE hHeap = HeapCreate(HEAP_NO_SERIALIZE, 0, 0);
+    HT_CHECK(hHeap != NULL);
+    if (hHeap == NULL)
+    {
+        return;
+    }
+
+    StringPool* psp;
+    HT_CHECK(SUCCEEDED(StringPool::Create(&psp, hHeap)));
+    HEAP_COUNT hcCreated = _CountHeap(hHeap);
+    HT_CHECK(hcCreated.cBlocks == 2);
+
+    DWORD dwMac;
+    HT_CHECK(SUCCEEDED(psp->Intern(L"Reboot to Mac OS X", &dwMac)));
+    PCWSTR pwszMac = psp->GetString(dwMac);
+    HT_CHECK(pwszMac != NULL && lstrcmpW(pwszMac, L"Reboot to Mac OS X") == 0);
+    HT_CHECK(psp->GetLength(dwMac) == 18);
+
+    // The room it made up front holds the first strings without growing.
+    HT_CHECK(_SameCount(_CountHeap(hHeap), hcCreated));
+
+    // The same string again, from another buffer, is the copy the pool already has,
+    // and nothing is allocated for it.
+    WCHAR wszMac[] = L"Reboot to Mac OS X";
+    HEAP_COUNT hcBefore = _CountHeap(hHeap);
+    DWORD dwMacAgain;
+    HT_CHECK(SUCCEEDED(psp->Intern(wszMac, &dwMacAgain)));
+    HT_CHECK(dwMacAgain == dwMac);
+    HT_CHECK(psp->GetString(dwMacAgain) == pwszMac);
+    HT_CHECK(_SameCount(_CountHeap(hHeap), hcBefore));
+
+    // A prefix of a string in the pool, and the empty string, are strings of their own.
+    DWORD dwPrefix, dwEmpty, dwEmptyAgain;
+    HT_CHECK(SUCCEEDED(psp->Intern(L"Reboot to", &dwPrefix)));
+    HT_CHECK(dwPrefix != dwMac && lstrcmpW(psp->GetString(dwPrefix), L"Reboot to") == 0);
+    HT_CHECK(SUCCEEDED(psp->Intern(L"", &dwEmpty)));
+    HT_CHECK(SUCCEEDED(psp->Intern(L"", &dwEmptyAgain)));
+    HT_CHECK(dwEmpty == dwEmptyAgain && dwEmpty != dwPrefix && psp->GetLength(dwEmpty) == 0);
+    HT_CHECK(psp->GetString(dwMac) == pwszMac);
+
+    // LogonUI's copy comes from CoTaskMemAlloc, not the pool's heap.
+    hcBefore = _CountHeap(hHeap);
+    PWSTR pwszDup;
+    HT_CHECK(SUCCEEDED(psp->CoTaskMemDup(dwMac, &pwszDup)));
+    HT_CHECK(pwszDup != pwszMac && lstrcmpW(pwszDup, L"Reboot to Mac OS X") == 0);
+    CoTaskMemFree(pwszDup);
+    HT_CHECK(_SameCount(_CountHeap(hHeap), hcBefore));
+    HT_CHECK(psp->CoTaskMemDup(dwMac + 100, &pwszDup) == E_INVALIDARG && pwszDup == NULL);
+
+    // The last reference frees everything the pool allocated.
+    psp->Release();
+    HT_CHECK(_CountHeap(hHeap).cBlocks == 0);
+    HeapDestroy(hHeap);
+}
@@ -0,0 +1,140 @@
+#include "helperstest.h"
+#include "TileTable.h"
+#include <strsafe.h>
+
+static void _AddTarget(
+    __inout GPT_INDEX* pgi,
+    __in BYTE bKind,
+    __in BYTE bDisk,
+    __in WORD wPartitionNumber,
+    __in PCWSTR pwszName
+    )
+{
+    GPT_TARGET& rgt = pgi->rgTargets[pgi->cTargets++];
+    ZeroMemory(&rgt, sizeof(rgt));
+    rgt.bKind = bKind;
+    rgt.bDisk = bDisk;
+    rgt.wPartitionNumber = wPartitionNumber;
+    rgt.ullStartLba = 40 + wPartitionNumber;
+    StringCchCopyW(rgt.wszName, ARRAYSIZE(rgt.wszName), pwszName);
+}
+
+static BOOL _IsTile(
+    __in const TILE& rt,
+    __in BYTE bKind,
+    __in DWORD dwDisk,
+    __in DWORD dwPartitionNumber,
+    __in PCWSTR pwszLabel
+    )
+{
+    return rt.bHasPartition && (rt.sp.bKind == bKind) && (rt.sp.dwDisk == dwDisk) &&
+           (rt.sp.dwPartitionNumber == dwPartitionNumber) && (rt.sp.ullStartLba == 40 + dwPartitionNumber) &&
+           (lstrcmpW(rt.wszLabel, pwszLabel) == 0);
+}
+
+// The tile the provider shows while the GPT scan is still running, and after a scan
+// that found nothing: one row that leaves the choice to StartupDiskSetMac.
+static BOOL _IsMacTile(__in const TILE_TABLE& tt)
+{
+    STARTUP_PARTITION spZero = {};
+    return (tt.cTiles == 1) && !tt.rgTiles[0].bHasPartition &&
+           (memcmp(&tt.rgTiles[0].sp, &spZero, sizeof(spZero)) == 0) &&
+           (lstrcmpW(tt.rgTiles[0].wszLabel, L"Reboot to Mac OS X") == 0);
+}
+
+static void _TestTileTableEmpty()
+{
+    // The provider builds its early tile from an empty index rather than wait on the scan.
+    GPT_INDEX gi = {};
+    TILE_TABLE tt;
+    FillMemory(&tt, sizeof(tt), 0xcc);
+    TileTableBuild(&gi, &tt);
+    HT_CHECK(_IsMacTile(tt));
+
+    // Once the scan is done the same provider builds the real table, which has no such row.
+    _AddTarget(&gi, GTK_APPLE_BOOT, 0, 3, L"Recovery HD");
+    TileTableBuild(&gi, &tt);
+    HT_CHECK(tt.cTiles == 1 && _IsTile(tt.rgTiles[0], GTK_APPLE_BOOT, 0, 3, L"Reboot to Recovery HD"));
+}
+
+static void _TestTileTableOrder()
+{
+    // macOS volumes come first and recovery partitions after, each kind in disk order.
+    GPT_INDEX gi = {};
+    _AddTarget(&gi, GTK_APPLE_BOOT, 0, 3, L"Recovery HD");
+    _AddTarget(&gi, GTK_HFSPLUS, 0, 2, L"Snow Leopard");
+    _AddTarget(&gi, GTK_APPLE_BOOT, 1, 4, L"Boot OS X");
+    _AddTarget(&gi, GTK_APFS, 1, 2, L"Ventura");
+    _AddTarget(&gi, GTK_HFSPLUS, 2, 5, L"");
+    _AddTarget(&gi, GTK_APPLE_BOOT, 2, 6, L"");
+
+    TILE_TABLE tt;
+    TileTableBuild(&gi, &tt);
+    HT_CHECK(tt.cTiles == 6);
+    HT_CHECK(_IsTile(tt.rgTiles[0], GTK_HFSPLUS, 0, 2, L"Reboot to Snow Leopard"));
+    HT_CHECK(_IsTile(tt.rgTiles[1], GTK_APFS, 1, 2, L"Reboot to Ventura"));
+    HT_CHECK(_IsTile(tt.rgTiles[2], GTK_HFSPLUS, 2, 5, L"Reboot to Mac OS X"));
+    HT_CHECK(_IsTile(tt.rgTiles[3], GTK_APPLE_BOOT, 0, 3, L"Reboot to Recovery HD"));
+    HT_CHECK(_IsTile(tt.rgTiles[4], GTK_APPLE_BOOT, 1, 4, L"Reboot to Boot OS X"));
+    HT_CHECK(_IsTile(tt.rgTiles[5], GTK_APPLE_BOOT, 2, 6, L"Reboot to Recovery"));
+
+    // A full index fills the table.
+    ZeroMemory(&gi, sizeof(gi));
+    for (WORD i = 0; i < GPT_MAX_TARGETS; i++)
+    {
+        _AddTarget(&gi, (i % 2) ? GTK_APPLE_BOOT : GTK_HFSPLUS, (BYTE)(i / 8), (WORD)(i + 1), L"");
+    }
+    TileTableBuild(&gi, &tt);
+    HT_CHECK(tt.cTiles == GPT_MAX_TARGETS);
+    for (DWORD i = 0; i < GPT_MAX_TARGETS / 2; i++)
+    {
+        HT_CHECK(tt.rgTiles[i].sp.bKind == GTK_HFSPLUS && tt.rgTiles[i].sp.dwPartitionNumber == 2 * i + 1);
+        HT_CHECK(tt.rgTiles[GPT_MAX_TARGETS / 2 + i].sp.bKind == GTK_APPLE_BOOT &&
+                 tt.rgTiles[GPT_MAX_TARGETS / 2 + i].sp.dwPartitionNumber == 2 * i + 2);
+    }
+}
+
+static void _TestTileTableDisambiguate()
+{
+    // Two installs with the same name, a third that only differs in case, and the
+    // recovery partitions, which all fall back to the same default name.
+    GPT_INDEX gi = {};
+    _AddTarget(&gi, GTK_HFSPLUS, 0, 2, L"Macintosh HD");
+    _AddTarget(&gi, GTK_APFS, 1, 2, L"Macintosh HD");
+    _AddTarget(&gi, GTK_HFSPLUS, 1, 4, L"MACINTOSH HD");
+    _AddTarget(&gi, GTK_HFSPLUS, 2, 2, L"Data");
+    _AddTarget(&gi, GTK_APPLE_BOOT, 0, 3, L"");
+    _AddTarget(&gi, GTK_APPLE_BOOT, 1, 3, L"");
+
+    TILE_TABLE tt;
+    TileTableBuild(&gi, &tt);
+    HT_CHECK(tt.cTiles == 6);
+    HT_CHECK(_IsTile(tt.rgTiles[0], GTK_HFSPLUS, 0, 2, L"Reboot to Macintosh HD (disk 0, partition 2)"));
+    HT_CHECK(_IsTile(tt.rgTiles[1], GTK_APFS, 1, 2, L"Reboot to Macintosh HD (disk 1, partition 2)"));
+    HT_CHECK(_IsTile(tt.rgTiles[2], GTK_HFSPLUS, 1, 4, L"Reboot to MACINTOSH HD (disk 1, partition 4)"));
+    HT_CHECK(_IsTile(tt.rgTiles[3], GTK_HFSPLUS, 2, 2, L"Reboot to Data"));
+    HT_CHECK(_IsTile(tt.rgTiles[4], GTK_APPLE_BOOT, 0, 3, L"Reboot to Recovery (disk 0, partition 3)"));
+    HT_CHECK(_IsTile(tt.rgTiles[5], GTK_APPLE_BOOT, 1, 3, L"Reboot to Recovery (disk 1, partition 3)"));
+
+    // A name as long as the GPT allows still fits with its disk and partition.
+    WCHAR wszLong[GPT_NAME_CCH + 1];
+    for (DWORD i = 0; i < GPT_NAME_CCH; i++)
+    {
+        wszLong[i] = (WCHAR)(L'A' + i % 26);
+    }
+    wszLong[GPT_NAME_CCH] = L'\0';
+    ZeroMemory(&gi, sizeof(gi));
+    _AddTarget(&gi, GTK_HFSPLUS, 255, 65535, wszLong);
+    _AddTarget(&gi, GTK_HFSPLUS, 254, 65534, wszLong);
+    TileTableBuild(&gi, &tt);
+    WCHAR wszExpected[TILE_LABEL_CCH];
+    StringCchPrintfW(wszExpected, ARRAYSIZE(wszExpected), L"Reboot to %s (disk 255, partition 65535)", wszLong);
+    HT_CHECK(tt.cTiles == 2 && lstrcmpW(tt.rgTiles[0].wszLabel, wszExpected) == 0);
+}
+
+void TestTileTable()
+{
+    _TestTileTableEmpty();
+    _TestTileTableOrder();
+    _TestTileTableDisambiguate();
+}
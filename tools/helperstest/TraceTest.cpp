@@ -0,0 +1,264 @@
+#include "helperstest.h"
+#include "RotatingFile.h"
+#include "../tracedump/TraceDecoder.h"
+
+#define TT_FREQUENCY        1000000     // One tick a microsecond, so durations come out whole.
+#define TT_SESSION_START    1000
+#define TT_PROCESS_ID       100
+#define TT_THREAD_A         7
+#define TT_THREAD_B         8
+
+// What the trace puts at the start of every new file: the header and the current session.
+struct TT_FILE_START
+{
+    TRACE_FILE_HEADER   tfh;
+    TRACE_RECORD        trSession;
+};
+
+static TRACE_RECORD _Call(
+    __in TRACE_METHOD tm,
+    __in BYTE bFlags,
+    __in DWORD dwThreadId,
+    __in DWORD dwFieldID,
+    __in HRESULT hr,
+    __in LONGLONG llStart,
+    __in LONGLONG llDuration
+    )
+{
+    TRACE_RECORD tr;
+    ZeroMemory(&tr, sizeof(tr));
+    tr.bType = TRT_CALL;
+    tr.bFlags = bFlags;
+    tr.usMethod = (USHORT)tm;
+    tr.call.dwThreadId = dwThreadId;
+    tr.call.dwFieldID = dwFieldID;
+    tr.call.hr = hr;
+    tr.call.llStart = llStart;
+    tr.call.llDuration = llDuration;
+    return tr;
+}
+
+static void _InitFileStart(__out TT_FILE_START* ptfs)
+{
+    ZeroMemory(ptfs, sizeof(*ptfs));
+    ptfs->tfh.dwMagic = TRACE_FILE_MAGIC;
+    ptfs->tfh.usVersion = TRACE_FILE_VERSION;
+    ptfs->tfh.cbRecord = sizeof(TRACE_RECORD);
+    ptfs->trSession.bType = TRT_SESSION;
+    ptfs->trSession.session.dwProcessId = TT_PROCESS_ID;
+    ptfs->trSession.session.ullFileTime = 130000000000000000ULL;
+    ptfs->trSession.session.llStart = TT_SESSION_START;
+    ptfs->trSession.session.llFrequency = TT_FREQUENCY;
+}
+
+// The size of the file at pwszPath, or -1 if there isn't one.
+static LONGLONG _FileSize(__in PCWSTR pwszPath)
+{
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExW(pwszPath, GetFileExInfoStandard, &fad))
+    {
+        return -1;
+    }
+    return ((LONGLONG)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+}
+
+// Reads the file at pwszPath into input, the way tracedump does.
+static bool _Decode(__in PCWSTR pwszPath, __inout TRACE_INPUT& input)
+{
+    char szPath[MAX_PATH];
+    if (WideCharToMultiByte(CP_ACP, 0, pwszPath, -1, szPath, ARRAYSIZE(szPath), NULL, NULL) == 0)
+    {
+        return false;
+    }
+    return TraceReadFile(szPath, input);
+}
+
+// Starts the file over with just the cb bytes at pv, and checks the decoder turns it away.
+static BOOL _Rejects(__inout ROTATING_FILE* prf, __in_bcount(cb) const void* pv, __in DWORD cb)
+{
+    RotatingFileClose(prf);
+    DeleteFileW(prf->wszPath);
+    prf->pvHeader = NULL;
+    prf->cbHeader = 0;
+    RotatingFileWrite(prf, pv, cb);
+    RotatingFileClose(prf);
+
+    TRACE_INPUT input;
+    return !_Decode(prf->wszPath, input) && input.rgRecords.empty() && input.rgModules.empty();
+}
+
+void TestTrace()
+{
+    TT_FILE_START tfs;
+    _InitFileStart(&tfs);
+
+    // A file with room for the start and four records.
+    ROTATING_FILE rf;
+    HT_CHECK(SUCCEEDED(RotatingFileInitialize(&rf, L"trace", sizeof(tfs) + 4 * sizeof(TRACE_RECORD), &tfs, sizeof(tfs))));
+    DeleteFileW(rf.wszPath);
+    DeleteFileW(rf.wszOldPath);
+
+    // Two threads of calls. On A, SetSelected calls into the wrapped provider, which calls back
+    // into Advise; then GetFieldState fails. B overlaps them all.
+    TRACE_RECORD rgtr[] =
+    {
+        _Call(TM_CREDENTIAL_SETSELECTED, 0, TT_THREAD_A, TRACE_NO_FIELD, S_OK, 2000, 100),
+        _Call(TM_CREDENTIAL_SETSELECTED, TRF_WRAPPED, TT_THREAD_A, TRACE_NO_FIELD, S_OK, 2010, 60),
+        _Call(TM_CREDENTIAL_ADVISE, 0, TT_THREAD_A, TRACE_NO_FIELD, S_OK, 2020, 10),
+        _Call(TM_CREDENTIAL_GETFIELDSTATE, 0, TT_THREAD_A, 3, E_FAIL, 2200, 30),
+        _Call(TM_PROVIDER_GETCREDENTIALAT, 0, TT_THREAD_B, TRACE_NO_FIELD, S_OK, 2005, 1000),
+    };
+
+    // The first three records fit; the next three don't, so the file is moved aside and a new
+    // one started, with the same start.
+    for (DWORD i = 0; i < 3; i++)
+    {
+        HT_CHECK(SUCCEEDED(RotatingFileWrite(&rf, &rgtr[i], sizeof(rgtr[i]))));
+    }
+    HT_CHECK(_FileSize(rf.wszPath) == sizeof(tfs) + 3 * sizeof(TRACE_RECORD));
+    HT_CHECK(_FileSize(rf.wszOldPath) == -1);
+
+    TRACE_RECORD rgtrTail[3] = { rgtr[3], rgtr[4] };
+    rgtrTail[2].bType = TRT_DROPPED;
+    rgtrTail[2].dropped.cRecords = 5;
+    HT_CHECK(SUCCEEDED(RotatingFileWrite(&rf, rgtrTail, sizeof(rgtrTail))));
+    RotatingFileClose(&rf);
+    HT_CHECK(_FileSize(rf.wszOldPath) == sizeof(tfs) + 3 * sizeof(TRACE_RECORD));
+    HT_CHECK(_FileSize(rf.wszPath) == sizeof(tfs) + 3 * sizeof(TRACE_RECORD));
+
+    // Each file decodes on its own, and the two together make one timeline.
+    TRACE_INPUT input;
+    HT_CHECK(_Decode(rf.wszPath, input));
+    HT_CHECK(input.rgSessions.size() == 1 && input.rgRecords.size() == 2 && input.cDropped == 5);
+    HT_CHECK(_Decode(rf.wszOldPath, input));
+    HT_CHECK(input.rgSessions.size() == 2 && input.rgRecords.size() == 5 && input.cDropped == 5);
+    HT_CHECK(input.rgModules.size() == 2 && input.rgModules[0] == input.rgModules[1]);
+
+    std::vector<TRACE_CALL> rgCalls;
+    TraceBuildTimeline(input, rgCalls);
+    HT_CHECK(rgCalls.size() == 5);
+    if (rgCalls.size() == 5)
+    {
+        // In order of when they started, from the first, each under the call it was made from.
+        static const struct
+        {
+            TRACE_METHOD    tm;
+            double          dStartUs;
+            int             nDepth;
+            double          dChildUs;
+        } s_rgExpected[] =
+        {
+            { TM_CREDENTIAL_SETSELECTED,    0,   0, 60 },
+            { TM_PROVIDER_GETCREDENTIALAT,  5,   0, 0 },
+            { TM_CREDENTIAL_SETSELECTED,    10,  1, 10 },
+            { TM_CREDENTIAL_ADVISE,         20,  2, 0 },
+            { TM_CREDENTIAL_GETFIELDSTATE,  200, 0, 0 },
+        };
+        for (DWORD i = 0; i < ARRAYSIZE(s_rgExpected); i++)
+        {
+            HT_CHECK(rgCalls[i].usMethod == s_rgExpected[i].tm);
+            HT_CHECK(rgCalls[i].dStartUs == s_rgExpected[i].dStartUs);
+            HT_CHECK(rgCalls[i].nDepth == s_rgExpected[i].nDepth);
+            HT_CHECK(rgCalls[i].dChildUs == s_rgExpected[i].dChildUs);
+            HT_CHECK(rgCalls[i].dwProcessId == TT_PROCESS_ID);
+        }
+        HT_CHECK(rgCalls[2].bFlags == TRF_WRAPPED);
+        HT_CHECK(rgCalls[4].dwFieldID == 3 && rgCalls[4].hr == E_FAIL && rgCalls[4].dDurationUs == 30);
+    }
+
+    // A method's own time leaves out what it called, and the wrapped calls have their own row.
+    std::vector<TRACE_METHOD_STATS> rgStats;
+    TraceSummarize(rgCalls, rgStats);
+    HT_CHECK(rgStats.size() == 5);
+    if (rgStats.size() == 5)
+    {
+        // Ordered by module, then the calls into us before the wrapped ones, then by method.
+        HT_CHECK(rgStats[0].usMethod == TM_PROVIDER_GETCREDENTIALAT && rgStats[0].dSelfUs == 1000);
+        HT_CHECK(rgStats[1].usMethod == TM_CREDENTIAL_ADVISE && rgStats[1].dSelfUs == 10);
+        HT_CHECK(rgStats[2].usMethod == TM_CREDENTIAL_SETSELECTED && !rgStats[2].bWrapped);
+        HT_CHECK(rgStats[2].dTotalUs == 100 && rgStats[2].dSelfUs == 40 && rgStats[2].cFailed == 0);
+        HT_CHECK(rgStats[3].usMethod == TM_CREDENTIAL_GETFIELDSTATE && rgStats[3].cFailed == 1);
+        HT_CHECK(rgStats[4].usMethod == TM_CREDENTIAL_SETSELECTED && rgStats[4].bWrapped);
+        HT_CHECK(rgStats[4].dTotalUs == 60 && rgStats[4].dSelfUs == 50);
+    }
+
+    // The percentiles of one method called many times.
+    std::vector<TRACE_CALL> rgRepeated;
+    for (DWORD i = 0; i < 100; i++)
+    {
+        TRACE_CALL call;
+        call.strModule = "BootPicker";
+        call.dwProcessId = TT_PROCESS_ID;
+        call.dwThreadId = TT_THREAD_A;
+        call.usMethod = TM_CREDENTIAL_GETSTRINGVALUE;
+        call.bFlags = 0;
+        call.dwFieldID = 1;
+        call.dStartUs = i * 1000.0;
+        call.dDurationUs = (double)(100 - i);
+        call.dChildUs = 0;
+        call.nDepth = 0;
+        call.hr = (i % 10 == 0) ? E_FAIL : S_OK;
+        rgRepeated.push_back(call);
+    }
+    TraceSummarize(rgRepeated, rgStats);
+    HT_CHECK(rgStats.size() == 1);
+    if (rgStats.size() == 1)
+    {
+        HT_CHECK(rgStats[0].cCalls == 100 && rgStats[0].cFailed == 10);
+        HT_CHECK(rgStats[0].dTotalUs == 5050 && rgStats[0].dMeanUs == 50.5);
+        HT_CHECK(rgStats[0].dP50Us == 51 && rgStats[0].dP95Us == 95 && rgStats[0].dMaxUs == 100);
+    }
+
+    // A file that's reopened is appended to without another start, and a write that's too big
+    // even for a file with nothing but the start in it goes in that file rather than rotating it.
+    DeleteFileW(rf.wszPath);
+    DeleteFileW(rf.wszOldPath);
+    HT_CHECK(SUCCEEDED(RotatingFileWrite(&rf, &rgtr[0], sizeof(rgtr[0]))));
+    RotatingFileClose(&rf);
+    HT_CHECK(SUCCEEDED(RotatingFileWrite(&rf, &rgtr[1], sizeof(rgtr[1]))));
+    RotatingFileClose(&rf);
+    HT_CHECK(_FileSize(rf.wszPath) == sizeof(tfs) + 2 * sizeof(TRACE_RECORD));
+
+    DeleteFileW(rf.wszPath);
+    TRACE_RECORD rgtrBig[6];
+    for (DWORD i = 0; i < ARRAYSIZE(rgtrBig); i++)
+    {
+        rgtrBig[i] = rgtr[i % ARRAYSIZE(rgtr)];
+    }
+    HT_CHECK(SUCCEEDED(RotatingFileWrite(&rf, rgtrBig, sizeof(rgtrBig))));
+    RotatingFileClose(&rf);
+    HT_CHECK(_FileSize(rf.wszPath) == sizeof(tfs) + sizeof(rgtrBig));
+    HT_CHECK(_FileSize(rf.wszOldPath) == -1);
+
+    // Calls before the first session can't be placed, and a record cut off at the end of the
+    // file is left out.
+    RotatingFileClose(&rf);
+    DeleteFileW(rf.wszPath);
+    rf.pvHeader = &tfs.tfh;
+    rf.cbHeader = sizeof(tfs.tfh);
+    HT_CHECK(SUCCEEDED(RotatingFileWrite(&rf, &rgtr[0], sizeof(rgtr[0]))));
+    HT_CHECK(SUCCEEDED(RotatingFileWrite(&rf, &tfs.trSession, sizeof(tfs.trSession))));
+    HT_CHECK(SUCCEEDED(RotatingFileWrite(&rf, &rgtr[1], sizeof(rgtr[1]))));
+    HT_CHECK(SUCCEEDED(RotatingFileWrite(&rf, &rgtr[2], sizeof(rgtr[2]) - 1)));
+    RotatingFileClose(&rf);
+    TRACE_INPUT inputPartial;
+    HT_CHECK(_Decode(rf.wszPath, inputPartial));
+    HT_CHECK(inputPartial.rgRecords.size() == 1 && inputPartial.rgRecords[0].second.call.llStart == 2010);
+
+    // Files that aren't traces, are from a version this decoder doesn't know, or stop partway
+    // through the header are turned away.
+    TT_FILE_START tfsBad = tfs;
+    tfsBad.tfh.dwMagic = 0x52545043;
+    HT_CHECK(_Rejects(&rf, &tfsBad, sizeof(tfsBad)));
+    tfsBad = tfs;
+    tfsBad.tfh.usVersion = TRACE_FILE_VERSION + 1;
+    HT_CHECK(_Rejects(&rf, &tfsBad, sizeof(tfsBad)));
+    tfsBad = tfs;
+    tfsBad.tfh.cbRecord = sizeof(TRACE_RECORD) - 8;
+    HT_CHECK(_Rejects(&rf, &tfsBad, sizeof(tfsBad)));
+    HT_CHECK(_Rejects(&rf, &tfs, sizeof(tfs.tfh) - 1));
+
+    DeleteFileW(rf.wszPath);
+    DeleteFileW(rf.wszOldPath);
+    HT_CHECK(!_Decode(rf.wszPath, input));
+}
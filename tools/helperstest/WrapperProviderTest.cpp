@@ -0,0 +1,546 @@
+#include "helperstest.h"
+#include "../../BootPickerWrapper/Provider.h"
+#include "ProviderCache.h"
+
+#define WPT_CREDENTIALS     2
+#define WPT_MAX_FIELDS      8
+#define WPT_NOT_ASKED       ((DWORD)-2)
+
+HRESULT CSample_CreateInstance(__in REFIID riid, __deref_out void** ppv);
+
+static LONG s_cLivePasswordProviders = 0;
+
+// The password provider's fields at first, and after it shows one more, in front of the
+// password. Its password moves from 2 to 3, and nothing of ours moves past the new field.
+static const CREDENTIAL_PROVIDER_FIELD_TYPE s_rgcpftFive[] =
+{
+    CPFT_TILE_IMAGE,
+    CPFT_LARGE_TEXT,
+    CPFT_PASSWORD_TEXT,
+    CPFT_SUBMIT_BUTTON,
+    CPFT_SMALL_TEXT,
+};
+static const CREDENTIAL_PROVIDER_FIELD_TYPE s_rgcpftSix[] =
+{
+    CPFT_TILE_IMAGE,
+    CPFT_LARGE_TEXT,
+    CPFT_SMALL_TEXT,
+    CPFT_PASSWORD_TEXT,
+    CPFT_SUBMIT_BUTTON,
+    CPFT_SMALL_TEXT,
+};
+
+// A wrapped credential that keeps what it's given for each field, and can raise events
+// on the events object the wrapper advised it with.
+class FakePasswordCredential : public ComObject<FakePasswordCredential, ICredentialProviderCredential>
+{
+  public:
+    FakePasswordCredential() : dwLastID(WPT_NOT_ASKED), pcpce(NULL), cUnAdvise(0)
+    {
+        ZeroMemory(rgwszValues, sizeof(rgwszValues));
+    }
+
+    ~FakePasswordCredential()
+    {
+        if (pcpce != NULL)
+        {
+            pcpce->Release();
+        }
+    }
+
+    IFACEMETHODIMP Advise(__in ICredentialProviderCredentialEvents* pcpceNew)
+    {
+        if (pcpce != NULL)
+        {
+            pcpce->Release();
+        }
+        pcpce = pcpceNew;
+        pcpce->AddRef();
+        return S_OK;
+    }
+
+    IFACEMETHODIMP UnAdvise()
+    {
+        cUnAdvise++;
+        if (pcpce != NULL)
+        {
+            pcpce->Release();
+            pcpce = NULL;
+        }
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetFieldState(__in DWORD dwFieldID, __out CREDENTIAL_PROVIDER_FIELD_STATE* pcpfs, __out CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE* pcpfis)
+    {
+        dwLastID = dwFieldID;
+        *pcpfs = CPFS_DISPLAY_IN_BOTH;
+        *pcpfis = CPFIS_NONE;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetStringValue(__in DWORD dwFieldID, __deref_out PWSTR* ppwsz)
+    {
+        dwLastID = dwFieldID;
+        *ppwsz = NULL;
+        return (dwFieldID < WPT_MAX_FIELDS) ? SHStrDupW(rgwszValues[dwFieldID], ppwsz) : E_INVALIDARG;
+    }
+
+    IFACEMETHODIMP SetStringValue(__in DWORD dwFieldID, __in PCWSTR pwsz)
+    {
+        dwLastID = dwFieldID;
+        return (dwFieldID < WPT_MAX_FIELDS) ? StringCchCopyW(rgwszValues[dwFieldID], ARRAYSIZE(rgwszValues[dwFieldID]), pwsz) : E_INVALIDARG;
+    }
+
+    IFACEMETHODIMP GetSubmitButtonValue(__in DWORD dwFieldID, __out DWORD* pdwAdjacentTo) { dwLastID = dwFieldID; *pdwAdjacentTo = 0; return S_OK; }
+    IFACEMETHODIMP CommandLinkClicked(__in DWORD dwFieldID) { dwLastID = dwFieldID; return S_OK; }
+    IFACEMETHODIMP SetCheckboxValue(__in DWORD dwFieldID, __in BOOL) { dwLastID = dwFieldID; return S_OK; }
+    IFACEMETHODIMP SetComboBoxSelectedValue(__in DWORD dwFieldID, __in DWORD) { dwLastID = dwFieldID; return S_OK; }
+
+    IFACEMETHODIMP SetSelected(__out BOOL* pbAutoLogon) { *pbAutoLogon = FALSE; return S_OK; }
+    IFACEMETHODIMP SetDeselected() { return S_OK; }
+    IFACEMETHODIMP GetBitmapValue(__in DWORD, __out HBITMAP* phbmp) { *phbmp = NULL; return E_NOTIMPL; }
+    IFACEMETHODIMP GetCheckboxValue(__in DWORD, __out BOOL*, __deref_out PWSTR* ppwszLabel) { *ppwszLabel = NULL; return E_NOTIMPL; }
+    IFACEMETHODIMP GetComboBoxValueCount(__in DWORD, __out DWORD*, __out DWORD*) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetComboBoxValueAt(__in DWORD, __in DWORD, __deref_out PWSTR* ppwszItem) { *ppwszItem = NULL; return E_NOTIMPL; }
+    IFACEMETHODIMP GetSerialization(__out CREDENTIAL_PROVIDER_GET_SERIALIZATION_RESPONSE*, __out CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION*,
+                                    __deref_out_opt PWSTR* ppwszOptionalStatusText, __out CREDENTIAL_PROVIDER_STATUS_ICON*)
+    {
+        *ppwszOptionalStatusText = NULL;
+        return E_NOTIMPL;
+    }
+    IFACEMETHODIMP ReportResult(__in NTSTATUS, __in NTSTATUS, __deref_out_opt PWSTR* ppwszOptionalStatusText, __out CREDENTIAL_PROVIDER_STATUS_ICON*)
+    {
+        *ppwszOptionalStatusText = NULL;
+        return E_NOTIMPL;
+    }
+
+    DWORD                                   dwLastID;
+    ICredentialProviderCredentialEvents*    pcpce;      // What the wrapper gave us to raise events on.
+    LONG                                    cUnAdvise;
+    WCHAR                                   rgwszValues[WPT_MAX_FIELDS][64];
+};
+
+// A password provider whose fields, and how many of its credentials it shows, the test can
+// change between enumerations. It hands out the same credentials every time, the way the
+// real one does for the same accounts.
+class FakePasswordProvider : public ComObject<FakePasswordProvider, ICredentialProvider>
+{
+  public:
+    FakePasswordProvider() : cCredentials(WPT_CREDENTIALS), cGetCredentialCount(0)
+    {
+        s_cLivePasswordProviders++;
+        SetFields(ARRAYSIZE(s_rgcpftFive), s_rgcpftFive);
+        for (DWORD i = 0; i < WPT_CREDENTIALS; i++)
+        {
+            rgpfpc[i] = new FakePasswordCredential();
+        }
+    }
+
+    ~FakePasswordProvider()
+    {
+        s_cLivePasswordProviders--;
+        for (DWORD i = 0; i < WPT_CREDENTIALS; i++)
+        {
+            if (rgpfpc[i] != NULL)
+            {
+                rgpfpc[i]->Release();
+            }
+        }
+    }
+
+    void SetFields(__in DWORD cFieldsIn, __in_ecount(cFieldsIn) const CREDENTIAL_PROVIDER_FIELD_TYPE* rgcpftIn)
+    {
+        cFields = cFieldsIn;
+        rgcpft = rgcpftIn;
+    }
+
+    IFACEMETHODIMP SetUsageScenario(__in CREDENTIAL_PROVIDER_USAGE_SCENARIO, __in DWORD) { return S_OK; }
+    IFACEMETHODIMP SetSerialization(__in const CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION*) { return S_OK; }
+    IFACEMETHODIMP Advise(__in ICredentialProviderEvents*, __in UINT_PTR) { return S_OK; }
+    IFACEMETHODIMP UnAdvise() { return S_OK; }
+
+    IFACEMETHODIMP GetFieldDescriptorCount(__out DWORD* pdwCount)
+    {
+        *pdwCount = cFields;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetFieldDescriptorAt(__in DWORD dwIndex, __deref_out CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR** ppcpfd)
+    {
+        *ppcpfd = NULL;
+        if (dwIndex >= cFields)
+        {
+            return E_INVALIDARG;
+        }
+        *ppcpfd = (CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR*)CoTaskMemAlloc(sizeof(**ppcpfd));
+        if (*ppcpfd == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+        ZeroMemory(*ppcpfd, sizeof(**ppcpfd));
+        (*ppcpfd)->dwFieldID = dwIndex;
+        (*ppcpfd)->cpft = rgcpft[dwIndex];
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetCredentialCount(__out DWORD* pdwCount, __out_range(<,*pdwCount) DWORD* pdwDefault, __out BOOL* pbAutoLogonWithDefault)
+    {
+        cGetCredentialCount++;
+        *pdwCount = cCredentials;
+        *pdwDefault = 0;
+        *pbAutoLogonWithDefault = FALSE;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetCredentialAt(__in DWORD dwIndex, __deref_out ICredentialProviderCredential** ppcpc)
+    {
+        *ppcpc = NULL;
+        return (dwIndex < cCredentials) ? rgpfpc[dwIndex]->QueryInterface(IID_PPV_ARGS(ppcpc)) : E_INVALIDARG;
+    }
+
+    DWORD                                   cFields;
+    const CREDENTIAL_PROVIDER_FIELD_TYPE*   rgcpft;
+    DWORD                                   cCredentials;   // At most WPT_CREDENTIALS.
+    LONG                                    cGetCredentialCount;
+    FakePasswordCredential*                 rgpfpc[WPT_CREDENTIALS];
+};
+
+// Stands in for CoCreateInstance in the dll's provider cache, and keeps the last provider
+// it made so the test can change it.
+class FakePasswordFactory : public ProviderFactory
+{
+  public:
+    FakePasswordFactory() : cCreates(0), pfppLast(NULL) {}
+
+    HRESULT Create(__in REFCLSID, __deref_out ICredentialProvider** ppcp)
+    {
+        cCreates++;
+        pfppLast = new FakePasswordProvider();
+        *ppcp = pfppLast;
+        return (pfppLast != NULL) ? S_OK : E_OUTOFMEMORY;
+    }
+
+    LONG                    cCreates;
+    FakePasswordProvider*   pfppLast;       // The cache's reference keeps it alive.
+};
+
+// LogonUI's side of the credentials' events: remembers the last one.
+class LogonUIEvents : public ComObject<LogonUIEvents, ICredentialProviderCredentialEvents>
+{
+  public:
+    LogonUIEvents() : cEvents(0), pcpcLast(NULL), dwFieldIDLast(WPT_NOT_ASKED) {}
+
+    IFACEMETHODIMP SetFieldState(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in CREDENTIAL_PROVIDER_FIELD_STATE) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP SetFieldInteractiveState(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP SetFieldString(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in PCWSTR) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP SetFieldSubmitButton(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in DWORD) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP SetFieldCheckbox(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in BOOL, __in PCWSTR) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP SetFieldBitmap(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in HBITMAP) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP SetFieldComboBoxSelectedItem(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in DWORD) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP DeleteFieldComboBoxItem(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in DWORD) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP AppendFieldComboBoxItem(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID, __in PCWSTR) { return _Record(pcpc, dwFieldID); }
+    IFACEMETHODIMP OnCreatingWindow(__out HWND* phwndOwner) { *phwndOwner = NULL; return E_NOTIMPL; }
+
+    LONG                            cEvents;
+    ICredentialProviderCredential*  pcpcLast;
+    DWORD                           dwFieldIDLast;
+
+  private:
+    HRESULT _Record(__in ICredentialProviderCredential* pcpc, __in DWORD dwFieldID)
+    {
+        cEvents++;
+        pcpcLast = pcpc;
+        dwFieldIDLast = dwFieldID;
+        return S_OK;
+    }
+};
+
+// Where the wrapper should put the wrapped provider's field dwInnerID, worked out the way
+// it works it out, from the wrapped provider's fields.
+static DWORD _OuterID(
+    __in DWORD cFields,
+    __in_ecount(cFields) const CREDENTIAL_PROVIDER_FIELD_TYPE* rgcpft,
+    __in DWORD dwInnerID
+    )
+{
+    FieldMap* pfm;
+    DWORD dwOuterID = FIELD_MAP_NO_FIELD;
+    if (SUCCEEDED(FieldMap::Create(cFields, rgcpft, SFI_NUM_FIELDS, FieldMap::FindInsertBefore(cFields, rgcpft, MY_FIELDS_INSERT_BEFORE), &pfm)))
+    {
+        dwOuterID = pfm->WrappedToOuter(dwInnerID);
+        pfm->Release();
+    }
+    return dwOuterID;
+}
+
+// Enumerates the way LogonUI does: the field count, then the credentials. Returns the
+// field count, and a reference on each credential in rgpcpc, with NULL after the last.
+static DWORD _Enumerate(
+    __in ICredentialProvider* pcp,
+    __out_ecount(WPT_CREDENTIALS) ICredentialProviderCredential** rgpcpc
+    )
+{
+    DWORD cFields = 0;
+    DWORD cCredentials = 0;
+    DWORD dwDefault;
+    BOOL bAutoLogon;
+    HT_CHECK(pcp->GetFieldDescriptorCount(&cFields) == S_OK);
+    HT_CHECK(pcp->GetCredentialCount(&cCredentials, &dwDefault, &bAutoLogon) == S_OK && cCredentials <= WPT_CREDENTIALS);
+    for (DWORD i = 0; i < WPT_CREDENTIALS; i++)
+    {
+        rgpcpc[i] = NULL;
+        if (i < cCredentials)
+        {
+            HT_CHECK(pcp->GetCredentialAt(i, &rgpcpc[i]) == S_OK && rgpcpc[i] != NULL);
+        }
+    }
+    return cFields;
+}
+
+static void _ReleaseAll(__inout_ecount(WPT_CREDENTIALS) ICredentialProviderCredential** rgpcpc)
+{
+    for (DWORD i = 0; i < WPT_CREDENTIALS; i++)
+    {
+        if (rgpcpc[i] != NULL)
+        {
+            rgpcpc[i]->Release();
+            rgpcpc[i] = NULL;
+        }
+    }
+}
+
+// Checks that a credential the wrapper handed out is still advised with pfpc, and that its
+// events and LogonUI's calls go between pcpc and pfpc under the field ids of a wrapped
+// provider showing rgcpft.
+static void _CheckRouting(
+    __in ICredentialProviderCredential* pcpc,
+    __in FakePasswordCredential* pfpc,
+    __in LogonUIEvents* plue,
+    __in DWORD cFields,
+    __in_ecount(cFields) const CREDENTIAL_PROVIDER_FIELD_TYPE* rgcpft
+    )
+{
+    HT_CHECK(pfpc->pcpce != NULL && pfpc->cUnAdvise == 0);
+    if (pfpc->pcpce == NULL)
+    {
+        return;
+    }
+
+    for (DWORD dwInnerID = 0; dwInnerID < cFields; dwInnerID++)
+    {
+        DWORD dwOuterID = _OuterID(cFields, rgcpft, dwInnerID);
+
+        plue->pcpcLast = NULL;
+        HT_CHECK(pfpc->pcpce->SetFieldState(pfpc, dwInnerID, CPFS_HIDDEN) == S_OK);
+        HT_CHECK(plue->pcpcLast == pcpc && plue->dwFieldIDLast == dwOuterID);
+
+        CREDENTIAL_PROVIDER_FIELD_STATE cpfs;
+        CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE cpfis;
+        pfpc->dwLastID = WPT_NOT_ASKED;
+        HT_CHECK(pcpc->GetFieldState(dwOuterID, &cpfs, &cpfis) == S_OK && pfpc->dwLastID == dwInnerID);
+    }
+}
+
+// LogonUI keeps its credentials advised while the password provider's fields change under
+// them, and enumerates again: the wrapper hands back the same credentials, still advised, and
+// routes both ways through the new map. When the fields go back, an event on the field that
+// went away goes nowhere.
+static void _TestWrapperProviderReenumerate()
+{
+    FakePasswordFactory fpf;
+    ProviderCacheSetFactory(&fpf);
+
+    ICredentialProvider* pcp = NULL;
+    LogonUIEvents* plue = new LogonUIEvents();
+    HT_CHECK(SUCCEEDED(CSample_CreateInstance(IID_PPV_ARGS(&pcp))));
+    if (pcp == NULL || plue == NULL)
+    {
+        HT_CHECK(!"out of memory");
+        ProviderCacheSetFactory(NULL);
+        return;
+    }
+    HT_CHECK(pcp->SetUsageScenario(CPUS_LOGON, 0) == S_OK);
+    HT_CHECK(fpf.cCreates == 1 && fpf.pfppLast != NULL);
+    FakePasswordProvider* pfpp = fpf.pfppLast;
+    if (pfpp == NULL)
+    {
+        pcp->Release();
+        plue->Release();
+        ProviderCacheSetFactory(NULL);
+        return;
+    }
+
+    ICredentialProviderCredential* rgpcpcFirst[WPT_CREDENTIALS];
+    HT_CHECK(_Enumerate(pcp, rgpcpcFirst) == ARRAYSIZE(s_rgcpftFive) + SFI_NUM_FIELDS);
+    for (DWORD i = 0; i < WPT_CREDENTIALS; i++)
+    {
+        HT_CHECK(rgpcpcFirst[i] != NULL && SUCCEEDED(rgpcpcFirst[i]->Advise(plue)));
+        if (rgpcpcFirst[i] != NULL)
+        {
+            _CheckRouting(rgpcpcFirst[i], pfpp->rgpfpc[i], plue, ARRAYSIZE(s_rgcpftFive), s_rgcpftFive);
+        }
+    }
+
+    // One more field, in front of the password.
+    pfpp->SetFields(ARRAYSIZE(s_rgcpftSix), s_rgcpftSix);
+    ICredentialProviderCredential* rgpcpc[WPT_CREDENTIALS];
+    HT_CHECK(_Enumerate(pcp, rgpcpc) == ARRAYSIZE(s_rgcpftSix) + SFI_NUM_FIELDS);
+    for (DWORD i = 0; i < WPT_CREDENTIALS; i++)
+    {
+        HT_CHECK(rgpcpc[i] == rgpcpcFirst[i]);
+        if (rgpcpc[i] != NULL)
+        {
+            _CheckRouting(rgpcpc[i], pfpp->rgpfpc[i], plue, ARRAYSIZE(s_rgcpftSix), s_rgcpftSix);
+
+            // The new field's text comes from the wrapped credential.
+            PWSTR pwsz = NULL;
+            StringCchCopyW(pfpp->rgpfpc[i]->rgwszValues[2], ARRAYSIZE(pfpp->rgpfpc[i]->rgwszValues[2]), L"Caps Lock is on");
+            HT_CHECK(rgpcpc[i]->GetStringValue(_OuterID(ARRAYSIZE(s_rgcpftSix), s_rgcpftSix, 2), &pwsz) == S_OK);
+            HT_CHECK(pwsz != NULL && lstrcmpW(pwsz, L"Caps Lock is on") == 0 && pfpp->rgpfpc[i]->dwLastID == 2);
+            CoTaskMemFree(pwsz);
+        }
+    }
+    _ReleaseAll(rgpcpc);
+
+    // And back to five, with the last field gone.
+    pfpp->SetFields(ARRAYSIZE(s_rgcpftFive), s_rgcpftFive);
+    HT_CHECK(_Enumerate(pcp, rgpcpc) == ARRAYSIZE(s_rgcpftFive) + SFI_NUM_FIELDS);
+    for (DWORD i = 0; i < WPT_CREDENTIALS; i++)
+    {
+        HT_CHECK(rgpcpc[i] == rgpcpcFirst[i]);
+        if (rgpcpc[i] != NULL)
+        {
+            _CheckRouting(rgpcpc[i], pfpp->rgpfpc[i], plue, ARRAYSIZE(s_rgcpftFive), s_rgcpftFive);
+
+            FakePasswordCredential* pfpc = pfpp->rgpfpc[i];
+            LONG cEvents = plue->cEvents;
+            HT_CHECK(pfpc->pcpce == NULL || pfpc->pcpce->SetFieldState(pfpc, ARRAYSIZE(s_rgcpftFive), CPFS_HIDDEN) == E_INVALIDARG);
+            HT_CHECK(plue->cEvents == cEvents);
+        }
+    }
+    _ReleaseAll(rgpcpc);
+    HT_CHECK(pfpp->cGetCredentialCount == 3);
+
+    for (DWORD i = 0; i < WPT_CREDENTIALS; i++)
+    {
+        if (rgpcpcFirst[i] != NULL)
+        {
+            HT_CHECK(SUCCEEDED(rgpcpcFirst[i]->UnAdvise()));
+            HT_CHECK(pfpp->rgpfpc[i]->pcpce == NULL);
+        }
+    }
+    _ReleaseAll(rgpcpcFirst);
+    pcp->Release();
+    plue->Release();
+
+    // The cache lets go of the fake before it goes out of scope.
+    ProviderCacheSetFactory(NULL);
+}
+
+// Makes a wrapper set up for cpus, and enumerates its credentials.
+static ICredentialProvider* _CreateWrapper(
+    __in CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    __out_ecount(WPT_CREDENTIALS) ICredentialProviderCredential** rgpcpc
+    )
+{
+    ICredentialProvider* pcp = NULL;
+    HT_CHECK(SUCCEEDED(CSample_CreateInstance(IID_PPV_ARGS(&pcp))));
+    if (pcp != NULL)
+    {
+        HT_CHECK(pcp->SetUsageScenario(cpus, 0) == S_OK);
+        _Enumerate(pcp, rgpcpc);
+    }
+    else
+    {
+        ZeroMemory(rgpcpc, WPT_CREDENTIALS * sizeof(*rgpcpc));
+    }
+    return pcp;
+}
+
+// Checks that none of the fields of any credential the wrapper handed out has anything in it.
+static void _CheckNoValues(
+    __in_ecount(WPT_CREDENTIALS) ICredentialProviderCredential** rgpcpc,
+    __in FakePasswordProvider* pfpp
+    )
+{
+    for (DWORD i = 0; i < WPT_CREDENTIALS; i++)
+    {
+        for (DWORD dwInnerID = 0; dwInnerID < ARRAYSIZE(s_rgcpftFive); dwInnerID++)
+        {
+            PWSTR pwsz = NULL;
+            HT_CHECK(rgpcpc[i] == NULL || rgpcpc[i]->GetStringValue(_OuterID(ARRAYSIZE(s_rgcpftFive), s_rgcpftFive, dwInnerID), &pwsz) == S_OK);
+            HT_CHECK(pwsz == NULL || pwsz[0] == L'\0');
+            HT_CHECK(pfpp->rgpfpc[i]->rgwszValues[dwInnerID][0] == L'\0');
+            CoTaskMemFree(pwsz);
+        }
+    }
+}
+
+// The next wrapper for the same scenario gets the last one's password provider only if
+// LogonUI didn't touch any of its credentials. Once the user has typed a password into
+// one, the provider goes away with the wrapper, and the next wrapper's fields are empty.
+static void _TestWrapperProviderReuse()
+{
+    FakePasswordFactory fpf;
+    ProviderCacheSetFactory(&fpf);
+    const DWORD dwPassword = _OuterID(ARRAYSIZE(s_rgcpftFive), s_rgcpftFive, 2);
+
+    // Enumerated, and even asked for its fields, but not touched: it's kept.
+    ICredentialProviderCredential* rgpcpc[WPT_CREDENTIALS];
+    ICredentialProvider* pcp = _CreateWrapper(CPUS_UNLOCK_WORKSTATION, rgpcpc);
+    FakePasswordProvider* pfppFirst = fpf.pfppLast;
+    HT_CHECK(fpf.cCreates == 1 && pfppFirst != NULL);
+    if (pcp == NULL || pfppFirst == NULL)
+    {
+        ProviderCacheSetFactory(NULL);
+        return;
+    }
+    _CheckNoValues(rgpcpc, pfppFirst);
+    _ReleaseAll(rgpcpc);
+    pcp->Release();
+    HT_CHECK(s_cLivePasswordProviders == 1);
+
+    // The next wrapper gets it, and the user selects a tile and types a password.
+    pcp = _CreateWrapper(CPUS_UNLOCK_WORKSTATION, rgpcpc);
+    HT_CHECK(fpf.cCreates == 1 && fpf.pfppLast == pfppFirst);
+    if (pcp == NULL)
+    {
+        ProviderCacheSetFactory(NULL);
+        return;
+    }
+    BOOL bAutoLogon;
+    HT_CHECK(rgpcpc[1] != NULL && rgpcpc[1]->SetSelected(&bAutoLogon) == S_OK);
+    HT_CHECK(rgpcpc[1] != NULL && rgpcpc[1]->SetStringValue(dwPassword, L"hunter2") == S_OK);
+    HT_CHECK(lstrcmpW(pfppFirst->rgpfpc[1]->rgwszValues[2], L"hunter2") == 0);
+    _ReleaseAll(rgpcpc);
+    pcp->Release();
+    HT_CHECK(s_cLivePasswordProviders == 0);
+
+    // So the one after that starts over, with nothing in any field.
+    pcp = _CreateWrapper(CPUS_UNLOCK_WORKSTATION, rgpcpc);
+    HT_CHECK(fpf.cCreates == 2 && fpf.pfppLast != NULL);
+    if (pcp == NULL || fpf.pfppLast == NULL)
+    {
+        ProviderCacheSetFactory(NULL);
+        return;
+    }
+    _CheckNoValues(rgpcpc, fpf.pfppLast);
+
+    // Touching a credential that the next enumeration drops counts too.
+    HT_CHECK(rgpcpc[1] != NULL && rgpcpc[1]->SetStringValue(dwPassword, L"hunter2") == S_OK);
+    _ReleaseAll(rgpcpc);
+    fpf.pfppLast->cCredentials = 1;
+    _Enumerate(pcp, rgpcpc);
+    HT_CHECK(rgpcpc[0] != NULL && rgpcpc[1] == NULL);
+    _ReleaseAll(rgpcpc);
+    pcp->Release();
+    HT_CHECK(s_cLivePasswordProviders == 0);
+
+    ProviderCacheSetFactory(NULL);
+}
+
+void TestWrapperProvider()
+{
+    _TestWrapperProviderReenumerate();
+    _TestWrapperProviderReuse();
+}
@@ -0,0 +1,118 @@
+// helperstest: runs the helpers' tests, or the ones named on the command line,
+// and exits with 1 if any check failed. With -b it runs their benchmarks instead.
+
+#include <windows.h>
+#include <stdio.h>
+#include "helperstest.h"
+
+// The helpers' class factory expects the dll that links them to supply its
+// class. The wrapper's provider is built in for its tests, and supplies it.
+
+struct HELPERS_TEST
+{
+    PCWSTR  pwszName;
+    void    (*pfnTest)();
+};
+
+static const HELPERS_TEST s_rgTests[] =
+{
+    { L"authpackages",  TestAuthPackageCache },
+    { L"bitmapcache",   TestBitmapCache },
+    { L"bmpdecoder",    TestBmpDecoder },
+    { L"bootswitch",    TestBootSwitch },
+    { L"comobject",     TestComObject },
+    { L"fieldmap",      TestFieldMap },
+    { L"fieldtables",   TestFieldTables },
+    { L"gptscanner",    TestGptScanner },
+    { L"repacknative",  TestKerbLogonRepackNative },
+    { L"serialize",     TestKerbLogonSerialize },
+    { L"packedlogon",   TestPackedLogon },
+    { L"protector",     TestPasswordProtector },
+    { L"providercache", TestProviderCache },
+    { L"recordring",    TestRecordRing },
+    { L"rewriterules",  TestRewriteRules },
+    { L"startupdisk",   TestStartupDisk },
+    { L"stringkernels", TestStringKernels },
+    { L"stringpool",    TestStringPool },
+    { L"tiletable",     TestTileTable },
+    { L"trace",         TestTrace },
+    { L"wrapper",       TestWrapperProvider },
+};
+
+static const HELPERS_TEST s_rgBenchmarks[] =
+{
+    { L"bmpdecoder",    BenchBmpDecoder },
+    { L"rewriterules",  BenchRewriteRules },
+    { L"serialize",     BenchKerbLogonSerialize },
+};
+
+static LONG s_cChecks = 0;
+static LONG s_cFailures = 0;
+
+void HelpersTestCheck(
+    __in BOOL bPassed,
+    __in PCSTR pszExpr,
+    __in PCSTR pszFile,
+    __in int nLine
+    )
+{
+    InterlockedIncrement(&s_cChecks);
+    if (!bPassed)
+    {
+        InterlockedIncrement(&s_cFailures);
+        printf("  %s(%d): %s\n", pszFile, nLine, pszExpr);
+    }
+}
+
+void HelpersTestBenchmark(
+    __in PCSTR pszName,
+    __in DWORD cRounds,
+    __in void (*pfnRound)(__in void* pv),
+    __in void* pv
+    )
+{
+    pfnRound(pv);
+
+    LARGE_INTEGER liFrequency, liStart, liEnd;
+    QueryPerformanceFrequency(&liFrequency);
+    QueryPerformanceCounter(&liStart);
+    for (DWORD i = 0; i < cRounds; i++)
+    {
+        pfnRound(pv);
+    }
+    QueryPerformanceCounter(&liEnd);
+
+    double dNs = (liEnd.QuadPart - liStart.QuadPart) * 1e9 / liFrequency.QuadPart / cRounds;
+    printf("  %-40s %12.1f ns\n", pszName, dNs);
+}
+
+int __cdecl wmain(int argc, __in_ecount(argc) wchar_t* argv[])
+{
+    bool bBenchmarks = (argc > 1 && wcscmp(argv[1], L"-b") == 0);
+    const HELPERS_TEST* rght = bBenchmarks ? s_rgBenchmarks : s_rgTests;
+    int cht = bBenchmarks ? ARRAYSIZE(s_rgBenchmarks) : ARRAYSIZE(s_rgTests);
+    int iFirstName = bBenchmarks ? 2 : 1;
+
+    for (int i = 0; i < cht; i++)
+    {
+        bool bRun = (argc <= iFirstName);
+        for (int j = iFirstName; j < argc && !bRun; j++)
+        {
+            bRun = (_wcsicmp(argv[j], rght[i].pwszName) == 0);
+        }
+        if (bRun && bBenchmarks)
+        {
+            printf("%ls\n", rght[i].pwszName);
+            rght[i].pfnTest();
+        }
+        else if (bRun)
+        {
+            LONG cFailures = s_cFailures;
+            rght[i].pfnTest();
+            printf("%-16ls %s\n", rght[i].pwszName, (s_cFailures == cFailures) ? "passed" : "FAILED");
+        }
+    }
+
+    printf("%ld checks, %ld failed\n", s_cChecks, s_cFailures);
+    return (s_cFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+// helperstest runs the helpers' logic against stand-ins for what they
+// normally talk to: an image source, a disk, the LSA, CredProtect. Each
+// module's tests live in their own file and are listed in helperstest.cpp.
+
+#pragma once
+#include <windows.h>
+
+// Records a check that failed and carries on with the test.
+#define HT_CHECK(expr)  HelpersTestCheck((expr) ? TRUE : FALSE, #expr, __FILE__, __LINE__)
+
+//counts a check, and prints it if it failed
+void HelpersTestCheck(
+    __in BOOL bPassed,
+    __in PCSTR pszExpr,
+    __in PCSTR pszFile,
+    __in int nLine
+    );
+
+//times cRounds calls of pfnRound, after one to warm up, and prints how long a call took
+void HelpersTestBenchmark(
+    __in PCSTR pszName,
+    __in DWORD cRounds,
+    __in void (*pfnRound)(__in void* pv),
+    __in void* pv
+    );
+
+void TestAuthPackageCache();
+void TestBitmapCache();
+void TestBmpDecoder();
+void TestBootSwitch();
+void TestComObject();
+void TestFieldMap();
+void TestFieldTables();
+void TestGptScanner();
+void TestKerbLogonRepackNative();
+void TestKerbLogonSerialize();
+void TestPackedLogon();
+void TestPasswordProtector();
+void TestProviderCache();
+void TestRecordRing();
+void TestRewriteRules();
+void TestStartupDisk();
+void TestStringKernels();
+void TestStringPool();
+void TestTileTable();
+void TestTrace();
+void TestWrapperProvider();
+
+void BenchBmpDecoder();
+void BenchRewriteRules();
+void BenchKerbLogonSerialize();
@@ -0,0 +1,1023 @@
+// logonsim plays LogonUI against BootPicker.dll or BootPickerWrapper.dll. It
+// loads the dll, gets the provider through DllGetClassObject, and makes the
+// calls LogonUI makes, through the same COM interfaces, timing each phase:
+// creating the provider, setting it up, reading the field descriptors,
+// enumerating the tiles, reading every field of every tile, selecting each
+// tile, and tearing everything down. It prints the latency of each phase over
+// all the runs, and how many runs it managed per second.
+//
+// With -a it makes the calls in orders LogonUI doesn't, but could: tiles in a
+// shuffled order, enumerating again in the middle of reading the tiles, field
+// ids and tile indexes that are out of range, getters before Advise, and the
+// provider released before its credentials. Calls that should fail are
+// expected to fail; calls that should succeed and don't are counted.
+//
+// Each phase also counts the CoTaskMem allocations made during it, through an
+// IMallocSpy, which sees SHStrDupW and everything else that goes through the
+// COM allocator, and how much the process heap grew, which covers new,
+// HeapAlloc and LocalAlloc. With -b the numbers are checked against a budgets
+// file, so that an allocation that creeps into a phase, or a leak, fails the run.
+//
+// With -m, the password provider that BootPickerWrapper.dll wraps is replaced,
+// for this process only, by a mock with as many users as asked for (see
+// mockprovider.h), and each tile is also asked for its serialization, the way
+// LogonUI asks when the user submits it.
+
+#include <windows.h>
+#include <initguid.h>
+#include <credentialprovider.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <string>
+#include <vector>
+#include "mockprovider.h"
+
+// The CLSIDs from BootPicker\guid.h and BootPickerWrapper\guid.h.
+DEFINE_GUID(CLSID_BootPicker,        0x0002d0d0, 0xd15e, 0xa5ed, 0xba, 0x11, 0x13, 0x55, 0x0f, 0xf1, 0xc1, 0xa1);
+DEFINE_GUID(CLSID_BootPickerWrapper, 0x0001d0d0, 0xd15e, 0xa5ed, 0xba, 0x11, 0x13, 0x55, 0x0f, 0xf1, 0xc1, 0xa1);
+
+typedef HRESULT (STDAPICALLTYPE *PFN_DLL_GET_CLASS_OBJECT)(REFCLSID, REFIID, void**);
+
+enum PHASE
+{
+    PH_CREATE,
+    PH_SCENARIO,
+    PH_FIELDS,
+    PH_ENUMERATE,
+    PH_TILES,
+    PH_SELECT,
+    PH_SUBMIT,
+    PH_CLICK,
+    PH_TEARDOWN,
+    PH_SESSION,         // The whole run, from creating the provider to tearing it down.
+    PH_COUNT
+};
+
+static const char* s_rgpszPhaseNames[PH_COUNT] =
+{
+    "create",
+    "scenario",
+    "fields",
+    "enumerate",
+    "tiles",
+    "select",
+    "submit",
+    "click",
+    "teardown",
+    "session",
+};
+
+struct OPTIONS
+{
+    const wchar_t*                      pwszDll;
+    CLSID                               clsid;
+    CREDENTIAL_PROVIDER_USAGE_SCENARIO  cpus;
+    unsigned long                       cRuns;
+    bool                                bAdversarial;
+    unsigned long                       ulSeed;
+    bool                                bClick;
+    const wchar_t*                      pwszBudgets;
+    unsigned long                       cMockUsers;     // 0 for the real password provider.
+};
+
+// What a run saw, on top of the phase timings.
+struct COUNTS
+{
+    unsigned long   cTiles;
+    unsigned long   cFieldCalls;
+    unsigned long   cUnexpectedFailures;
+    unsigned long   cUnexpectedSuccesses;
+    LONG            cEvents;        // Events can come from the boot switch's thread.
+};
+
+static LARGE_INTEGER s_liFrequency;
+
+static double _Us(const LARGE_INTEGER& liStart, const LARGE_INTEGER& liEnd)
+{
+    return (double)(liEnd.QuadPart - liStart.QuadPart) * 1000000.0 / (double)s_liFrequency.QuadPart;
+}
+
+// Counts CoTaskMem allocations. Each block gets a header with its size, so that
+// frees can be matched to what was allocated and we know what's still out.
+class AllocationSpy : public IMallocSpy
+{
+  public:
+    AllocationSpy() : _cAllocs(0), _cFrees(0), _cbAllocs(0) {}
+
+    IFACEMETHODIMP_(ULONG) AddRef() { return 2; }
+    IFACEMETHODIMP_(ULONG) Release() { return 1; }
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppv)
+    {
+        if (riid == IID_IUnknown || riid == IID_IMallocSpy)
+        {
+            *ppv = static_cast<IMallocSpy*>(this);
+            return S_OK;
+        }
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    IFACEMETHODIMP_(SIZE_T) PreAlloc(SIZE_T cbRequest)
+    {
+        InterlockedIncrement(&_cAllocs);
+        InterlockedExchangeAdd64(&_cbAllocs, (LONGLONG)cbRequest);
+        return cbRequest + c_cbHeader;
+    }
+    IFACEMETHODIMP_(void*) PostAlloc(void* pActual)
+    {
+        return (pActual != NULL) ? static_cast<BYTE*>(pActual) + c_cbHeader : NULL;
+    }
+    IFACEMETHODIMP_(void*) PreFree(void* pRequest, BOOL fSpyed)
+    {
+        if (pRequest == NULL || !fSpyed)
+        {
+            return pRequest;
+        }
+        InterlockedIncrement(&_cFrees);
+        return static_cast<BYTE*>(pRequest) - c_cbHeader;
+    }
+    IFACEMETHODIMP_(void) PostFree(BOOL) {}
+    IFACEMETHODIMP_(SIZE_T) PreRealloc(void* pRequest, SIZE_T cbRequest, void** ppNewRequest, BOOL fSpyed)
+    {
+        // A realloc is counted as a new allocation, and, if it had one, a free of the old block.
+        if (pRequest != NULL && fSpyed)
+        {
+            InterlockedIncrement(&_cFrees);
+            pRequest = static_cast<BYTE*>(pRequest) - c_cbHeader;
+        }
+        *ppNewRequest = pRequest;
+        if (cbRequest == 0)
+        {
+            return 0;
+        }
+        InterlockedIncrement(&_cAllocs);
+        InterlockedExchangeAdd64(&_cbAllocs, (LONGLONG)cbRequest);
+        return cbRequest + c_cbHeader;
+    }
+    IFACEMETHODIMP_(void*) PostRealloc(void* pActual, BOOL fSpyed)
+    {
+        return (pActual != NULL && fSpyed) ? static_cast<BYTE*>(pActual) + c_cbHeader : pActual;
+    }
+    IFACEMETHODIMP_(void*) PreGetSize(void* pRequest, BOOL fSpyed)
+    {
+        return (pRequest != NULL && fSpyed) ? static_cast<BYTE*>(pRequest) - c_cbHeader : pRequest;
+    }
+    IFACEMETHODIMP_(SIZE_T) PostGetSize(SIZE_T cbActual, BOOL fSpyed)
+    {
+        return (fSpyed && cbActual >= c_cbHeader) ? cbActual - c_cbHeader : cbActual;
+    }
+    IFACEMETHODIMP_(void*) PreDidAlloc(void* pRequest, BOOL fSpyed)
+    {
+        return (pRequest != NULL && fSpyed) ? static_cast<BYTE*>(pRequest) - c_cbHeader : pRequest;
+    }
+    IFACEMETHODIMP_(int) PostDidAlloc(void*, BOOL, int fActual) { return fActual; }
+    IFACEMETHODIMP_(void) PreHeapMinimize() {}
+    IFACEMETHODIMP_(void) PostHeapMinimize() {}
+
+    LONG        _cAllocs;
+    LONG        _cFrees;
+    LONGLONG    _cbAllocs;
+
+  private:
+    static const SIZE_T c_cbHeader = 16;    // Keeps the blocks as aligned as CoTaskMemAlloc's.
+};
+
+static AllocationSpy s_spy;
+
+// Where the counters were when a phase started.
+struct PHASE_SAMPLE
+{
+    LARGE_INTEGER   liStart;
+    LONG            cAllocs;
+    LONG            cFrees;
+    LONGLONG        cbAllocs;
+    SIZE_T          cbHeap;
+};
+
+// What each run of a phase did.
+struct PHASE_STATS
+{
+    std::vector<double>     vecUs;
+    std::vector<LONG>       vecAllocs;          // CoTaskMem allocations.
+    std::vector<LONGLONG>   vecBytes;           // and their bytes.
+    std::vector<LONG>       vecOutstanding;     // Allocations not freed by the end of the phase.
+    std::vector<LONGLONG>   vecHeapGrowth;      // How much more of the process heap was in use.
+};
+
+// The most a phase may do in one run. A phase without a budget isn't checked.
+struct PHASE_BUDGET
+{
+    bool        bSet;
+    LONG        cAllocs;
+    LONG        cOutstanding;
+    LONGLONG    cbHeapGrowth;
+};
+
+static SIZE_T _HeapInUse()
+{
+    HEAP_SUMMARY hs = {};
+    hs.cb = sizeof(hs);
+    return HeapSummary(GetProcessHeap(), 0, &hs) ? hs.cbAllocated : 0;
+}
+
+static void _PhaseBegin(PHASE_SAMPLE& ps)
+{
+    ps.cAllocs = s_spy._cAllocs;
+    ps.cFrees = s_spy._cFrees;
+    ps.cbAllocs = s_spy._cbAllocs;
+    ps.cbHeap = _HeapInUse();
+    QueryPerformanceCounter(&ps.liStart);
+}
+
+static void _PhaseEnd(const PHASE_SAMPLE& ps, PHASE_STATS& stats)
+{
+    LARGE_INTEGER liEnd;
+    QueryPerformanceCounter(&liEnd);
+    stats.vecUs.push_back(_Us(ps.liStart, liEnd));
+
+    LONG cAllocs = s_spy._cAllocs - ps.cAllocs;
+    LONG cFrees = s_spy._cFrees - ps.cFrees;
+    stats.vecAllocs.push_back(cAllocs);
+    stats.vecBytes.push_back(s_spy._cbAllocs - ps.cbAllocs);
+    stats.vecOutstanding.push_back(cAllocs - cFrees);
+    stats.vecHeapGrowth.push_back((LONGLONG)_HeapInUse() - (LONGLONG)ps.cbHeap);
+}
+
+// A small generator of our own, so that a seed gives the same run everywhere.
+static unsigned long _Random(unsigned long& ulState)
+{
+    ulState = ulState * 1103515245 + 12345;
+    return (ulState >> 16) & 0x7fff;
+}
+
+// Checks a call that should have succeeded, or with bExpectFailure, one that should have failed.
+static void _Expect(COUNTS& counts, HRESULT hr, bool bExpectFailure, const char* pszCall)
+{
+    if (bExpectFailure && SUCCEEDED(hr))
+    {
+        counts.cUnexpectedSuccesses++;
+        fprintf(stderr, "%s succeeded, but shouldn't have\n", pszCall);
+    }
+    else if (!bExpectFailure && FAILED(hr))
+    {
+        counts.cUnexpectedFailures++;
+        fprintf(stderr, "%s failed: 0x%08lx\n", pszCall, (unsigned long)hr);
+    }
+}
+
+// Stands in for LogonUI's side of the provider. It only counts what it's told.
+class SimProviderEvents : public ICredentialProviderEvents
+{
+  public:
+    SimProviderEvents(COUNTS* pcounts) : _cRef(1), _pcounts(pcounts) {}
+
+    IFACEMETHODIMP_(ULONG) AddRef() { return InterlockedIncrement(&_cRef); }
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        LONG cRef = InterlockedDecrement(&_cRef);
+        if (!cRef)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppv)
+    {
+        if (riid == IID_IUnknown || riid == IID_ICredentialProviderEvents)
+        {
+            *ppv = static_cast<ICredentialProviderEvents*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    IFACEMETHODIMP CredentialsChanged(UINT_PTR) { InterlockedIncrement(&_pcounts->cEvents); return S_OK; }
+
+  private:
+    LONG    _cRef;
+    COUNTS* _pcounts;
+};
+
+// Stands in for LogonUI's side of each credential.
+class SimCredentialEvents : public ICredentialProviderCredentialEvents
+{
+  public:
+    SimCredentialEvents(COUNTS* pcounts) : _cRef(1), _pcounts(pcounts) {}
+
+    IFACEMETHODIMP_(ULONG) AddRef() { return InterlockedIncrement(&_cRef); }
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        LONG cRef = InterlockedDecrement(&_cRef);
+        if (!cRef)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppv)
+    {
+        if (riid == IID_IUnknown || riid == IID_ICredentialProviderCredentialEvents)
+        {
+            *ppv = static_cast<ICredentialProviderCredentialEvents*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    IFACEMETHODIMP SetFieldState(ICredentialProviderCredential*, DWORD, CREDENTIAL_PROVIDER_FIELD_STATE) { return _Event(); }
+    IFACEMETHODIMP SetFieldInteractiveState(ICredentialProviderCredential*, DWORD, CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE) { return _Event(); }
+    IFACEMETHODIMP SetFieldString(ICredentialProviderCredential*, DWORD, PCWSTR) { return _Event(); }
+    IFACEMETHODIMP SetFieldCheckbox(ICredentialProviderCredential*, DWORD, BOOL, PCWSTR) { return _Event(); }
+    IFACEMETHODIMP SetFieldBitmap(ICredentialProviderCredential*, DWORD, HBITMAP) { return _Event(); }
+    IFACEMETHODIMP SetFieldComboBoxSelectedItem(ICredentialProviderCredential*, DWORD, DWORD) { return _Event(); }
+    IFACEMETHODIMP DeleteFieldComboBoxItem(ICredentialProviderCredential*, DWORD, DWORD) { return _Event(); }
+    IFACEMETHODIMP AppendFieldComboBoxItem(ICredentialProviderCredential*, DWORD, PCWSTR) { return _Event(); }
+    IFACEMETHODIMP SetFieldSubmitButton(ICredentialProviderCredential*, DWORD, DWORD) { return _Event(); }
+    IFACEMETHODIMP OnCreatingWindow(HWND* phwndOwner) { *phwndOwner = GetConsoleWindow(); return S_OK; }
+
+  private:
+    HRESULT _Event()
+    {
+        InterlockedIncrement(&_pcounts->cEvents);
+        return S_OK;
+    }
+
+    LONG    _cRef;
+    COUNTS* _pcounts;
+};
+
+// Reads one field the way LogonUI would for its type, and frees what comes back.
+static HRESULT _ReadField(ICredentialProviderCredential* pcpc, DWORD dwFieldID, CREDENTIAL_PROVIDER_FIELD_TYPE cpft)
+{
+    CREDENTIAL_PROVIDER_FIELD_STATE cpfs;
+    CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE cpfis;
+    HRESULT hr = pcpc->GetFieldState(dwFieldID, &cpfs, &cpfis);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    PWSTR pwsz = NULL;
+    switch (cpft)
+    {
+    case CPFT_TILE_IMAGE:
+        {
+            HBITMAP hbmp = NULL;
+            hr = pcpc->GetBitmapValue(dwFieldID, &hbmp);
+            if (SUCCEEDED(hr) && hbmp != NULL)
+            {
+                DeleteObject(hbmp);
+            }
+        }
+        break;
+
+    case CPFT_LARGE_TEXT:
+    case CPFT_SMALL_TEXT:
+    case CPFT_EDIT_TEXT:
+    case CPFT_PASSWORD_TEXT:
+    case CPFT_COMMAND_LINK:
+        hr = pcpc->GetStringValue(dwFieldID, &pwsz);
+        break;
+
+    case CPFT_CHECKBOX:
+        {
+            BOOL bChecked;
+            hr = pcpc->GetCheckboxValue(dwFieldID, &bChecked, &pwsz);
+        }
+        break;
+
+    case CPFT_COMBOBOX:
+        {
+            DWORD cItems = 0, dwSelected;
+            hr = pcpc->GetComboBoxValueCount(dwFieldID, &cItems, &dwSelected);
+            for (DWORD i = 0; SUCCEEDED(hr) && i < cItems; i++)
+            {
+                PWSTR pwszItem = NULL;
+                hr = pcpc->GetComboBoxValueAt(dwFieldID, i, &pwszItem);
+                CoTaskMemFree(pwszItem);
+            }
+        }
+        break;
+
+    case CPFT_SUBMIT_BUTTON:
+        {
+            DWORD dwAdjacentTo;
+            hr = pcpc->GetSubmitButtonValue(dwFieldID, &dwAdjacentTo);
+        }
+        break;
+
+    default:
+        break;
+    }
+    CoTaskMemFree(pwsz);
+    return hr;
+}
+
+// One LogonUI session: make a provider, show its tiles, select each, and let it all go.
+static HRESULT _Run(
+    const OPTIONS& opt,
+    PFN_DLL_GET_CLASS_OBJECT pfnGetClassObject,
+    unsigned long& ulRandom,
+    PHASE_STATS* rgStats,
+    COUNTS& counts
+    )
+{
+    PHASE_SAMPLE ps, psSession;
+    ICredentialProvider* pcp = NULL;
+    _PhaseBegin(psSession);
+
+    // Create.
+    _PhaseBegin(ps);
+    IClassFactory* pcf;
+    HRESULT hr = pfnGetClassObject(opt.clsid, IID_PPV_ARGS(&pcf));
+    if (SUCCEEDED(hr))
+    {
+        hr = pcf->CreateInstance(NULL, IID_PPV_ARGS(&pcp));
+        pcf->Release();
+    }
+    _PhaseEnd(ps, rgStats[PH_CREATE]);
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "creating the provider failed: 0x%08lx\n", (unsigned long)hr);
+        return hr;
+    }
+
+    // Set up.
+    SimProviderEvents* pspe = new SimProviderEvents(&counts);
+    _PhaseBegin(ps);
+    hr = pcp->SetUsageScenario(opt.cpus, 0);
+    if (SUCCEEDED(hr))
+    {
+        hr = pcp->Advise(pspe, 0);
+    }
+    _PhaseEnd(ps, rgStats[PH_SCENARIO]);
+    if (FAILED(hr))
+    {
+        // E_NOTIMPL is how a provider says it doesn't do this scenario.
+        fprintf(stderr, "setting up the provider failed: 0x%08lx\n", (unsigned long)hr);
+        pcp->Release();
+        pspe->Release();
+        return hr;
+    }
+
+    // Fields.
+    std::vector<CREDENTIAL_PROVIDER_FIELD_TYPE> rgcpft;
+    _PhaseBegin(ps);
+    DWORD cFields = 0;
+    hr = pcp->GetFieldDescriptorCount(&cFields);
+    _Expect(counts, hr, false, "GetFieldDescriptorCount");
+    for (DWORD i = 0; SUCCEEDED(hr) && i < cFields; i++)
+    {
+        CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR* pcpfd = NULL;
+        hr = pcp->GetFieldDescriptorAt(i, &pcpfd);
+        _Expect(counts, hr, false, "GetFieldDescriptorAt");
+        if (SUCCEEDED(hr))
+        {
+            rgcpft.push_back(pcpfd->cpft);
+            CoTaskMemFree(pcpfd->pszLabel);
+            CoTaskMemFree(pcpfd);
+        }
+    }
+    if (opt.bAdversarial)
+    {
+        CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR* pcpfd = NULL;
+        _Expect(counts, pcp->GetFieldDescriptorAt(cFields, &pcpfd), true, "GetFieldDescriptorAt past the end");
+    }
+    _PhaseEnd(ps, rgStats[PH_FIELDS]);
+
+    // Enumerate.
+    std::vector<ICredentialProviderCredential*> rgpcpc;
+    _PhaseBegin(ps);
+    DWORD cCredentials = 0, dwDefault;
+    BOOL bAutoLogon;
+    hr = pcp->GetCredentialCount(&cCredentials, &dwDefault, &bAutoLogon);
+    _Expect(counts, hr, false, "GetCredentialCount");
+    for (DWORD i = 0; SUCCEEDED(hr) && i < cCredentials; i++)
+    {
+        ICredentialProviderCredential* pcpc = NULL;
+        hr = pcp->GetCredentialAt(i, &pcpc);
+        _Expect(counts, hr, false, "GetCredentialAt");
+        if (SUCCEEDED(hr))
+        {
+            rgpcpc.push_back(pcpc);
+        }
+    }
+    if (opt.bAdversarial)
+    {
+        ICredentialProviderCredential* pcpc = NULL;
+        _Expect(counts, pcp->GetCredentialAt(cCredentials, &pcpc), true, "GetCredentialAt past the end");
+    }
+    _PhaseEnd(ps, rgStats[PH_ENUMERATE]);
+    counts.cTiles += (unsigned long)rgpcpc.size();
+
+    std::vector<size_t> rgiOrder(rgpcpc.size());
+    for (size_t i = 0; i < rgiOrder.size(); i++)
+    {
+        rgiOrder[i] = i;
+    }
+    if (opt.bAdversarial)
+    {
+        for (size_t i = rgiOrder.size(); i > 1; i--)
+        {
+            std::swap(rgiOrder[i - 1], rgiOrder[_Random(ulRandom) % i]);
+        }
+    }
+
+    // Tiles.
+    std::vector<SimCredentialEvents*> rgpsce;
+    _PhaseBegin(ps);
+    for (size_t n = 0; n < rgiOrder.size(); n++)
+    {
+        ICredentialProviderCredential* pcpc = rgpcpc[rgiOrder[n]];
+
+        if (opt.bAdversarial && (_Random(ulRandom) % 4) == 0)
+        {
+            // Read a field before Advise. All that matters is that it doesn't fall over.
+            _ReadField(pcpc, 0, rgcpft.empty() ? CPFT_INVALID : rgcpft[0]);
+            counts.cFieldCalls++;
+        }
+
+        SimCredentialEvents* psce = new SimCredentialEvents(&counts);
+        rgpsce.push_back(psce);
+        _Expect(counts, pcpc->Advise(psce), false, "Credential::Advise");
+
+        for (DWORD dwField = 0; dwField < rgcpft.size(); dwField++)
+        {
+            _Expect(counts, _ReadField(pcpc, dwField, rgcpft[dwField]), false, "reading a field");
+            counts.cFieldCalls++;
+        }
+
+        if (opt.bAdversarial)
+        {
+            PWSTR pwsz = NULL;
+            _Expect(counts, pcpc->GetStringValue((DWORD)rgcpft.size(), &pwsz), true, "GetStringValue past the end");
+            CoTaskMemFree(pwsz);
+            _Expect(counts, pcpc->GetStringValue(0xFFFFFFFF, &pwsz), true, "GetStringValue of field -1");
+            CoTaskMemFree(pwsz);
+
+            if (n == rgiOrder.size() / 2)
+            {
+                // LogonUI asks again after CredentialsChanged, while it still holds the old tiles.
+                DWORD cAgain;
+                _Expect(counts, pcp->GetCredentialCount(&cAgain, &dwDefault, &bAutoLogon), false, "GetCredentialCount again");
+            }
+        }
+    }
+    _PhaseEnd(ps, rgStats[PH_TILES]);
+
+    // Select.
+    _PhaseBegin(ps);
+    for (size_t n = 0; n < rgiOrder.size(); n++)
+    {
+        ICredentialProviderCredential* pcpc = rgpcpc[rgiOrder[n]];
+        BOOL bAutoLogonSelected;
+        _Expect(counts, pcpc->SetSelected(&bAutoLogonSelected), false, "SetSelected");
+        _Expect(counts, pcpc->SetDeselected(), false, "SetDeselected");
+    }
+    _PhaseEnd(ps, rgStats[PH_SELECT]);
+
+    // Submit. Only with the mock, whose users nobody can log on with. BootPicker.dll doesn't
+    // serialize anything, so a tile that doesn't isn't counted as a failure.
+    if (opt.cMockUsers != 0)
+    {
+        _PhaseBegin(ps);
+        for (size_t n = 0; n < rgiOrder.size(); n++)
+        {
+            ICredentialProviderCredential* pcpc = rgpcpc[rgiOrder[n]];
+            BOOL bAutoLogonSelected;
+            _Expect(counts, pcpc->SetSelected(&bAutoLogonSelected), false, "SetSelected");
+
+            CREDENTIAL_PROVIDER_GET_SERIALIZATION_RESPONSE cpgsr = CPGSR_NO_CREDENTIAL_NOT_FINISHED;
+            CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION cpcs = {};
+            PWSTR pwszStatus = NULL;
+            CREDENTIAL_PROVIDER_STATUS_ICON cpsi = CPSI_NONE;
+            if (SUCCEEDED(pcpc->GetSerialization(&cpgsr, &cpcs, &pwszStatus, &cpsi)) && cpcs.rgbSerialization != NULL)
+            {
+                SecureZeroMemory(cpcs.rgbSerialization, cpcs.cbSerialization);
+                CoTaskMemFree(cpcs.rgbSerialization);
+            }
+            CoTaskMemFree(pwszStatus);
+
+            _Expect(counts, pcpc->SetDeselected(), false, "SetDeselected");
+        }
+        _PhaseEnd(ps, rgStats[PH_SUBMIT]);
+    }
+
+    // Click. Only with -c, and only once wmain has seen the .dryrun file.
+    if (opt.bClick)
+    {
+        _PhaseBegin(ps);
+        for (size_t n = 0; n < rgiOrder.size(); n++)
+        {
+            ICredentialProviderCredential* pcpc = rgpcpc[rgiOrder[n]];
+            for (DWORD dwField = 0; dwField < rgcpft.size(); dwField++)
+            {
+                if (rgcpft[dwField] == CPFT_COMMAND_LINK)
+                {
+                    pcpc->CommandLinkClicked(dwField);
+                }
+            }
+        }
+        _PhaseEnd(ps, rgStats[PH_CLICK]);
+    }
+
+    // Tear down. Adversarial runs let go of the provider first.
+    _PhaseBegin(ps);
+    if (opt.bAdversarial)
+    {
+        pcp->UnAdvise();
+        pcp->Release();
+        pcp = NULL;
+    }
+    for (size_t n = 0; n < rgpcpc.size(); n++)
+    {
+        rgpcpc[n]->UnAdvise();
+        rgpcpc[n]->Release();
+    }
+    if (pcp != NULL)
+    {
+        pcp->UnAdvise();
+        pcp->Release();
+    }
+    _PhaseEnd(ps, rgStats[PH_TEARDOWN]);
+
+    for (size_t n = 0; n < rgpsce.size(); n++)
+    {
+        rgpsce[n]->Release();
+    }
+    pspe->Release();
+    _PhaseEnd(psSession, rgStats[PH_SESSION]);
+    return S_OK;
+}
+
+static double _Percentile(const std::vector<double>& vec, double d)
+{
+    size_t i = (size_t)(d * (double)vec.size());
+    return vec[(i < vec.size()) ? i : vec.size() - 1];
+}
+
+template <class T>
+static double _Mean(const std::vector<T>& vec, size_t iFirst)
+{
+    double dTotal = 0;
+    for (size_t n = iFirst; n < vec.size(); n++)
+    {
+        dTotal += (double)vec[n];
+    }
+    return (vec.size() > iFirst) ? dTotal / (double)(vec.size() - iFirst) : 0;
+}
+
+template <class T>
+static T _Max(const std::vector<T>& vec, size_t iFirst)
+{
+    T tMax = 0;
+    for (size_t n = iFirst; n < vec.size(); n++)
+    {
+        tMax = (vec[n] > tMax) ? vec[n] : tMax;
+    }
+    return tMax;
+}
+
+// The first run fills the dll's caches, so when there's more than one, the
+// allocation numbers are for the runs after it.
+static size_t _FirstSteadyRun(const PHASE_STATS& stats)
+{
+    return (stats.vecUs.size() > 1) ? 1 : 0;
+}
+
+static void _PrintPhases(PHASE_STATS* rgStats)
+{
+    printf("%-10s %8s %12s %10s %10s %10s %10s\n", "phase", "runs", "total ms", "mean us", "p50 us", "p95 us", "max us");
+    for (int i = 0; i < PH_COUNT; i++)
+    {
+        std::vector<double> vec = rgStats[i].vecUs;
+        if (vec.empty())
+        {
+            continue;
+        }
+        std::sort(vec.begin(), vec.end());
+        double dMean = _Mean(vec, 0);
+        printf("%-10s %8lu %12.3f %10.1f %10.1f %10.1f %10.1f\n", s_rgpszPhaseNames[i], (unsigned long)vec.size(),
+               dMean * (double)vec.size() / 1000, dMean, _Percentile(vec, 0.5), _Percentile(vec, 0.95), vec.back());
+    }
+
+    printf("\n%-10s %12s %12s %12s %12s %12s\n", "phase", "allocs", "max allocs", "bytes", "outstanding", "heap growth");
+    for (int i = 0; i < PH_COUNT; i++)
+    {
+        const PHASE_STATS& stats = rgStats[i];
+        if (stats.vecUs.empty())
+        {
+            continue;
+        }
+        size_t iFirst = _FirstSteadyRun(stats);
+        printf("%-10s %12.1f %12ld %12.0f %12ld %12lld\n", s_rgpszPhaseNames[i], _Mean(stats.vecAllocs, iFirst),
+               _Max(stats.vecAllocs, iFirst), _Mean(stats.vecBytes, iFirst), _Max(stats.vecOutstanding, iFirst),
+               _Max(stats.vecHeapGrowth, iFirst));
+    }
+}
+
+// Reads a budgets file: one line per phase with the most CoTaskMem allocations it
+// may make in a run, how many of them may still be outstanding at its end, and how
+// many bytes the process heap may grow by.
+static bool _ReadBudgets(const wchar_t* pwszPath, PHASE_BUDGET* rgBudgets)
+{
+    FILE* pf = NULL;
+    if (_wfopen_s(&pf, pwszPath, L"r") != 0)
+    {
+        fprintf(stderr, "couldn't open %ls\n", pwszPath);
+        return false;
+    }
+
+    bool bOk = true;
+    char szLine[256];
+    for (int nLine = 1; fgets(szLine, sizeof(szLine), pf) != NULL; nLine++)
+    {
+        char szPhase[32];
+        long cAllocs, cOutstanding;
+        long long cbHeapGrowth;
+        if (szLine[0] == '#' || sscanf_s(szLine, "%31s", szPhase, (unsigned)ARRAYSIZE(szPhase)) != 1)
+        {
+            continue;
+        }
+
+        int i = 0;
+        while (i < PH_COUNT && strcmp(szPhase, s_rgpszPhaseNames[i]) != 0)
+        {
+            i++;
+        }
+        if (i == PH_COUNT || sscanf_s(szLine, "%*s %ld %ld %lld", &cAllocs, &cOutstanding, &cbHeapGrowth) != 3)
+        {
+            fprintf(stderr, "%ls(%d): expected a phase and three numbers\n", pwszPath, nLine);
+            bOk = false;
+            continue;
+        }
+        rgBudgets[i].bSet = true;
+        rgBudgets[i].cAllocs = cAllocs;
+        rgBudgets[i].cOutstanding = cOutstanding;
+        rgBudgets[i].cbHeapGrowth = cbHeapGrowth;
+    }
+    fclose(pf);
+    return bOk;
+}
+
+// Returns the number of phases that went over their budgets.
+static unsigned long _CheckBudgets(PHASE_STATS* rgStats, const PHASE_BUDGET* rgBudgets)
+{
+    unsigned long cOver = 0;
+    for (int i = 0; i < PH_COUNT; i++)
+    {
+        const PHASE_STATS& stats = rgStats[i];
+        if (!rgBudgets[i].bSet || stats.vecUs.empty())
+        {
+            continue;
+        }
+        size_t iFirst = _FirstSteadyRun(stats);
+        LONG cAllocs = _Max(stats.vecAllocs, iFirst);
+        LONG cOutstanding = _Max(stats.vecOutstanding, iFirst);
+        LONGLONG cbHeapGrowth = _Max(stats.vecHeapGrowth, iFirst);
+        if (cAllocs > rgBudgets[i].cAllocs ||
+            cOutstanding > rgBudgets[i].cOutstanding ||
+            cbHeapGrowth > rgBudgets[i].cbHeapGrowth)
+        {
+            fprintf(stderr, "%s is over budget: %ld allocations (%ld), %ld outstanding (%ld), %lld bytes of heap (%lld)\n",
+                    s_rgpszPhaseNames[i], cAllocs, rgBudgets[i].cAllocs, cOutstanding, rgBudgets[i].cOutstanding,
+                    cbHeapGrowth, rgBudgets[i].cbHeapGrowth);
+            cOver++;
+        }
+    }
+    return cOver;
+}
+
+// Whether there's a .dryrun file next to the dll, where the dll looks for it: its own
+// path with the last three characters, normally "dll", replaced.
+static bool _HasDryRunFile(const wchar_t* pwszDll)
+{
+    std::wstring strPath(pwszDll);
+    if (strPath.size() <= 3)
+    {
+        return false;
+    }
+    strPath.replace(strPath.size() - 3, 3, L"dryrun");
+    return GetFileAttributesW(strPath.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+static void _Usage()
+{
+    fprintf(stderr,
+        "usage: logonsim [-n runs] [-s logon|unlock|credui] [-a seed] [-c] [-b budgets.txt] [-m users] [-g {clsid}] provider.dll\n"
+        "  -n  how many times to run through a session (1)\n"
+        "  -s  the usage scenario (credui, which works outside LogonUI)\n"
+        "  -a  make the calls in adversarial orders, shuffled with seed\n"
+        "  -c  click every command link. Only for a debug build with a .dryrun file next to it!\n"
+        "  -b  fail if a phase allocates more than budgets.txt allows\n"
+        "  -m  replace the password provider with a mock that has 1 to %d users\n"
+        "  -g  the provider's CLSID, if the dll isn't BootPicker.dll or BootPickerWrapper.dll\n",
+        MOCK_PROVIDER_MAX_USERS);
+}
+
+static bool _ParseOptions(int argc, wchar_t** argv, OPTIONS& opt)
+{
+    opt.pwszDll = NULL;
+    opt.cpus = CPUS_CREDUI;
+    opt.cRuns = 1;
+    opt.bAdversarial = false;
+    opt.ulSeed = 0;
+    opt.bClick = false;
+    opt.pwszBudgets = NULL;
+    opt.cMockUsers = 0;
+    bool bHaveClsid = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const wchar_t* pwszArg = argv[i];
+        bool bHasValue = (i + 1 < argc);
+        if (wcscmp(pwszArg, L"-n") == 0 && bHasValue)
+        {
+            opt.cRuns = wcstoul(argv[++i], NULL, 10);
+        }
+        else if (wcscmp(pwszArg, L"-s") == 0 && bHasValue)
+        {
+            const wchar_t* pwszScenario = argv[++i];
+            if (_wcsicmp(pwszScenario, L"logon") == 0)
+            {
+                opt.cpus = CPUS_LOGON;
+            }
+            else if (_wcsicmp(pwszScenario, L"unlock") == 0)
+            {
+                opt.cpus = CPUS_UNLOCK_WORKSTATION;
+            }
+            else if (_wcsicmp(pwszScenario, L"credui") == 0)
+            {
+                opt.cpus = CPUS_CREDUI;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (wcscmp(pwszArg, L"-a") == 0 && bHasValue)
+        {
+            opt.bAdversarial = true;
+            opt.ulSeed = wcstoul(argv[++i], NULL, 10);
+        }
+        else if (wcscmp(pwszArg, L"-c") == 0)
+        {
+            opt.bClick = true;
+        }
+        else if (wcscmp(pwszArg, L"-b") == 0 && bHasValue)
+        {
+            opt.pwszBudgets = argv[++i];
+        }
+        else if (wcscmp(pwszArg, L"-m") == 0 && bHasValue)
+        {
+            opt.cMockUsers = wcstoul(argv[++i], NULL, 10);
+            if (opt.cMockUsers == 0 || opt.cMockUsers > MOCK_PROVIDER_MAX_USERS)
+            {
+                return false;
+            }
+        }
+        else if (wcscmp(pwszArg, L"-g") == 0 && bHasValue)
+        {
+            if (FAILED(CLSIDFromString(argv[++i], &opt.clsid)))
+            {
+                return false;
+            }
+            bHaveClsid = true;
+        }
+        else if (pwszArg[0] != L'-' && opt.pwszDll == NULL)
+        {
+            opt.pwszDll = pwszArg;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (opt.pwszDll == NULL || opt.cRuns == 0)
+    {
+        return false;
+    }
+    if (!bHaveClsid)
+    {
+        const wchar_t* pwszName = wcsrchr(opt.pwszDll, L'\\');
+        pwszName = (pwszName != NULL) ? pwszName + 1 : opt.pwszDll;
+        if (_wcsicmp(pwszName, L"BootPickerWrapper.dll") == 0)
+        {
+            opt.clsid = CLSID_BootPickerWrapper;
+        }
+        else if (_wcsicmp(pwszName, L"BootPicker.dll") == 0)
+        {
+            opt.clsid = CLSID_BootPicker;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    OPTIONS opt;
+    if (!_ParseOptions(argc, argv, opt))
+    {
+        _Usage();
+        return 2;
+    }
+
+    // Only a debug build of the dll honours the file, and there's no telling which this is,
+    // but without the file even a debug build would really switch and restart.
+    if (opt.bClick && !_HasDryRunFile(opt.pwszDll))
+    {
+        fprintf(stderr, "-c needs a .dryrun file next to %ls, and a debug build of it\n", opt.pwszDll);
+        return 2;
+    }
+
+    QueryPerformanceFrequency(&s_liFrequency);
+
+    HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "CoInitializeEx failed: 0x%08lx\n", (unsigned long)hr);
+        return 1;
+    }
+
+    PHASE_BUDGET rgBudgets[PH_COUNT] = {};
+    if (opt.pwszBudgets != NULL && !_ReadBudgets(opt.pwszBudgets, rgBudgets))
+    {
+        CoUninitialize();
+        return 2;
+    }
+
+    // Before the dll is loaded, so that the wrapper never sees the real password provider.
+    DWORD dwMockCookie = 0;
+    if (opt.cMockUsers != 0)
+    {
+        hr = MockProviderRegister(opt.cMockUsers, &dwMockCookie);
+        if (FAILED(hr))
+        {
+            fprintf(stderr, "registering the mock password provider failed: 0x%08lx\n", (unsigned long)hr);
+            CoUninitialize();
+            return 1;
+        }
+    }
+
+    // Before the dll is loaded, so that everything it allocates goes through the spy.
+    hr = CoRegisterMallocSpy(&s_spy);
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "CoRegisterMallocSpy failed: 0x%08lx\n", (unsigned long)hr);
+    }
+
+    int nExit = 1;
+    HMODULE hmod = LoadLibraryW(opt.pwszDll);
+    PFN_DLL_GET_CLASS_OBJECT pfnGetClassObject = (hmod != NULL) ?
+        reinterpret_cast<PFN_DLL_GET_CLASS_OBJECT>(GetProcAddress(hmod, "DllGetClassObject")) : NULL;
+    if (pfnGetClassObject != NULL)
+    {
+        PHASE_STATS rgStats[PH_COUNT];
+        COUNTS counts = {};
+        unsigned long ulRandom = opt.ulSeed;
+
+        LARGE_INTEGER liStart, liEnd;
+        QueryPerformanceCounter(&liStart);
+        unsigned long cRuns = 0;
+        hr = S_OK;
+        for (; SUCCEEDED(hr) && cRuns < opt.cRuns; cRuns++)
+        {
+            hr = _Run(opt, pfnGetClassObject, ulRandom, rgStats, counts);
+        }
+        QueryPerformanceCounter(&liEnd);
+
+        _PrintPhases(rgStats);
+        double dSeconds = _Us(liStart, liEnd) / 1000000;
+        printf("\n%lu runs in %.3f s, %.1f runs/s\n", cRuns, dSeconds, (dSeconds > 0) ? cRuns / dSeconds : 0.0);
+        printf("%lu tiles, %lu field reads, %ld events\n", counts.cTiles, counts.cFieldCalls, counts.cEvents);
+        printf("%lu calls failed that shouldn't have, %lu succeeded that shouldn't have\n",
+               counts.cUnexpectedFailures, counts.cUnexpectedSuccesses);
+
+        unsigned long cOverBudget = _CheckBudgets(rgStats, rgBudgets);
+        nExit = (SUCCEEDED(hr) && counts.cUnexpectedFailures == 0 && counts.cUnexpectedSuccesses == 0 && cOverBudget == 0) ? 0 : 1;
+    }
+    else
+    {
+        fprintf(stderr, "couldn't load DllGetClassObject from %ls: %lu\n", opt.pwszDll, GetLastError());
+    }
+
+    // The dll is left loaded: LogonUI doesn't unload it between sessions either. The
+    // spy can't be revoked while the dll still has blocks it allocated, so it stays too.
+    if (opt.cMockUsers != 0)
+    {
+        MockProviderUnregister(dwMockCookie);
+    }
+    CoUninitialize();
+    return nExit;
+}
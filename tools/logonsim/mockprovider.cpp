@@ -0,0 +1,426 @@
+// The mock password provider. Each tile has the password provider's fields:
+// the tile image, the user name, the password and the submit button. Values are
+// handed out the way a real provider hands them out, from CoTaskMem and GDI,
+// so logonsim's allocation counts see what they would with the real one, and a
+// tile serializes its user and password through the helpers' serializer.
+
+#include <windows.h>
+#include <credentialprovider.h>
+#include <cstdio>
+#include <cwchar>
+#include <vector>
+#include <helpers.h>
+#include "mockprovider.h"
+
+enum MOCK_FIELD
+{
+    MF_TILE_IMAGE,
+    MF_USERNAME,
+    MF_PASSWORD,
+    MF_SUBMIT_BUTTON,
+    MF_COUNT
+};
+
+static const CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR s_rgFieldDescriptors[MF_COUNT] =
+{
+    { MF_TILE_IMAGE,    CPFT_TILE_IMAGE,    L"Image" },
+    { MF_USERNAME,      CPFT_LARGE_TEXT,    L"User name" },
+    { MF_PASSWORD,      CPFT_PASSWORD_TEXT, L"Password" },
+    { MF_SUBMIT_BUTTON, CPFT_SUBMIT_BUTTON, L"Submit" },
+};
+
+#define MOCK_TILE_SIZE  128
+
+// The helpers' class factory expects the dll that links them to supply its
+// class. There isn't one here.
+EXTERN_C GUID CLSID_CSample = { 0 };
+HRESULT CSample_CreateInstance(__in REFIID, __deref_out void** ppv)
+{
+    *ppv = NULL;
+    return CLASS_E_CLASSNOTAVAILABLE;
+}
+
+static HRESULT _CoAllocString(const wchar_t* pwsz, PWSTR* ppwsz)
+{
+    size_t cch = wcslen(pwsz) + 1;
+    *ppwsz = static_cast<PWSTR>(CoTaskMemAlloc(cch * sizeof(wchar_t)));
+    if (*ppwsz == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+    memcpy(*ppwsz, pwsz, cch * sizeof(wchar_t));
+    return S_OK;
+}
+
+class MockCredential : public ICredentialProviderCredential
+{
+  public:
+    MockCredential(CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus, unsigned long iUser) : _cRef(1), _pcpce(NULL), _cpus(cpus)
+    {
+        swprintf_s(_wszUserName, ARRAYSIZE(_wszUserName), L"mockuser%05lu", iUser);
+        _wszPassword[0] = L'\0';
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef() { return InterlockedIncrement(&_cRef); }
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        LONG cRef = InterlockedDecrement(&_cRef);
+        if (!cRef)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppv)
+    {
+        if (riid == IID_IUnknown || riid == IID_ICredentialProviderCredential)
+        {
+            *ppv = static_cast<ICredentialProviderCredential*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    IFACEMETHODIMP Advise(ICredentialProviderCredentialEvents* pcpce)
+    {
+        UnAdvise();
+        _pcpce = pcpce;
+        _pcpce->AddRef();
+        return S_OK;
+    }
+    IFACEMETHODIMP UnAdvise()
+    {
+        if (_pcpce != NULL)
+        {
+            _pcpce->Release();
+            _pcpce = NULL;
+        }
+        return S_OK;
+    }
+
+    IFACEMETHODIMP SetSelected(BOOL* pbAutoLogon) { *pbAutoLogon = FALSE; return S_OK; }
+    IFACEMETHODIMP SetDeselected()
+    {
+        _wszPassword[0] = L'\0';
+        return (_pcpce != NULL) ? _pcpce->SetFieldString(this, MF_PASSWORD, _wszPassword) : S_OK;
+    }
+
+    IFACEMETHODIMP GetFieldState(DWORD dwFieldID, CREDENTIAL_PROVIDER_FIELD_STATE* pcpfs, CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE* pcpfis)
+    {
+        if (dwFieldID >= MF_COUNT)
+        {
+            return E_INVALIDARG;
+        }
+        *pcpfs = (dwFieldID == MF_TILE_IMAGE || dwFieldID == MF_USERNAME) ? CPFS_DISPLAY_IN_BOTH : CPFS_DISPLAY_IN_SELECTED_TILE;
+        *pcpfis = (dwFieldID == MF_PASSWORD) ? CPFIS_FOCUSED : CPFIS_NONE;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetStringValue(DWORD dwFieldID, PWSTR* ppwsz)
+    {
+        *ppwsz = NULL;
+        switch (dwFieldID)
+        {
+        case MF_USERNAME:
+            return _CoAllocString(_wszUserName, ppwsz);
+        case MF_PASSWORD:
+            return _CoAllocString(_wszPassword, ppwsz);
+        default:
+            return E_INVALIDARG;
+        }
+    }
+
+    IFACEMETHODIMP GetBitmapValue(DWORD dwFieldID, HBITMAP* phbmp)
+    {
+        *phbmp = NULL;
+        if (dwFieldID != MF_TILE_IMAGE)
+        {
+            return E_INVALIDARG;
+        }
+
+        BITMAPINFO bmi = {};
+        bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+        bmi.bmiHeader.biWidth = MOCK_TILE_SIZE;
+        bmi.bmiHeader.biHeight = -MOCK_TILE_SIZE;
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+        void* pvBits;
+        *phbmp = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &pvBits, NULL, 0);
+        return (*phbmp != NULL) ? S_OK : E_OUTOFMEMORY;
+    }
+
+    IFACEMETHODIMP GetSubmitButtonValue(DWORD dwFieldID, DWORD* pdwAdjacentTo)
+    {
+        if (dwFieldID != MF_SUBMIT_BUTTON)
+        {
+            return E_INVALIDARG;
+        }
+        *pdwAdjacentTo = MF_PASSWORD;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP SetStringValue(DWORD dwFieldID, PCWSTR pwsz)
+    {
+        if (dwFieldID != MF_PASSWORD)
+        {
+            return E_INVALIDARG;
+        }
+        wcsncpy_s(_wszPassword, ARRAYSIZE(_wszPassword), pwsz, _TRUNCATE);
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetCheckboxValue(DWORD, BOOL*, PWSTR* ppwszLabel) { *ppwszLabel = NULL; return E_INVALIDARG; }
+    IFACEMETHODIMP GetComboBoxValueCount(DWORD, DWORD*, DWORD*) { return E_INVALIDARG; }
+    IFACEMETHODIMP GetComboBoxValueAt(DWORD, DWORD, PWSTR* ppwszItem) { *ppwszItem = NULL; return E_INVALIDARG; }
+    IFACEMETHODIMP SetCheckboxValue(DWORD, BOOL) { return E_INVALIDARG; }
+    IFACEMETHODIMP SetComboBoxSelectedValue(DWORD, DWORD) { return E_INVALIDARG; }
+    IFACEMETHODIMP CommandLinkClicked(DWORD) { return E_INVALIDARG; }
+
+    // Serializes the tile the way the password provider does. There's no account behind it, so
+    // the LSA would turn it down, but logonsim never hands it to the LSA.
+    IFACEMETHODIMP GetSerialization(
+        CREDENTIAL_PROVIDER_GET_SERIALIZATION_RESPONSE* pcpgsr,
+        CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION* pcpcs,
+        PWSTR* ppwszOptionalStatusText,
+        CREDENTIAL_PROVIDER_STATUS_ICON* pcpsiOptionalStatusIcon
+        )
+    {
+        *pcpgsr = CPGSR_NO_CREDENTIAL_NOT_FINISHED;
+        *ppwszOptionalStatusText = NULL;
+        *pcpsiOptionalStatusIcon = CPSI_NONE;
+        ZeroMemory(pcpcs, sizeof(*pcpcs));
+
+        PWSTR pwszProtected;
+        HRESULT hr = ProtectIfNecessaryAndCopyPassword(_wszPassword, _cpus, &pwszProtected);
+        if (SUCCEEDED(hr))
+        {
+            hr = KerbInteractiveUnlockLogonSerialize(L".", _wszUserName, pwszProtected, _cpus, &pcpcs->rgbSerialization, &pcpcs->cbSerialization);
+            SecureZeroMemory(pwszProtected, wcslen(pwszProtected) * sizeof(wchar_t));
+            CoTaskMemFree(pwszProtected);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = RetrieveNegotiateAuthPackage(&pcpcs->ulAuthenticationPackage);
+            if (FAILED(hr))
+            {
+                CoTaskMemFree(pcpcs->rgbSerialization);
+                pcpcs->rgbSerialization = NULL;
+                pcpcs->cbSerialization = 0;
+            }
+        }
+        if (SUCCEEDED(hr))
+        {
+            pcpcs->clsidCredentialProvider = CLSID_PasswordCredentialProvider;
+            *pcpgsr = CPGSR_RETURN_CREDENTIAL_FINISHED;
+        }
+        return hr;
+    }
+    IFACEMETHODIMP ReportResult(NTSTATUS, NTSTATUS, PWSTR* ppwszOptionalStatusText, CREDENTIAL_PROVIDER_STATUS_ICON* pcpsiOptionalStatusIcon)
+    {
+        *ppwszOptionalStatusText = NULL;
+        *pcpsiOptionalStatusIcon = CPSI_NONE;
+        return S_OK;
+    }
+
+  private:
+    ~MockCredential()
+    {
+        UnAdvise();
+    }
+
+    LONG                                    _cRef;
+    ICredentialProviderCredentialEvents*    _pcpce;
+    CREDENTIAL_PROVIDER_USAGE_SCENARIO      _cpus;
+    wchar_t                                 _wszUserName[16];
+    wchar_t                                 _wszPassword[128];
+};
+
+class MockProvider : public ICredentialProvider
+{
+  public:
+    MockProvider(unsigned long cUsers) : _cRef(1), _cUsers(cUsers), _pcpe(NULL) {}
+
+    IFACEMETHODIMP_(ULONG) AddRef() { return InterlockedIncrement(&_cRef); }
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        LONG cRef = InterlockedDecrement(&_cRef);
+        if (!cRef)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppv)
+    {
+        if (riid == IID_IUnknown || riid == IID_ICredentialProvider)
+        {
+            *ppv = static_cast<ICredentialProvider*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    // The users are made up front, the way the password provider enumerates them when it's set up.
+    IFACEMETHODIMP SetUsageScenario(CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus, DWORD)
+    {
+        if (cpus != CPUS_LOGON && cpus != CPUS_UNLOCK_WORKSTATION && cpus != CPUS_CREDUI)
+        {
+            return E_NOTIMPL;
+        }
+
+        _ReleaseCredentials();
+        _rgpcpc.reserve(_cUsers);
+        for (unsigned long i = 0; i < _cUsers; i++)
+        {
+            _rgpcpc.push_back(new MockCredential(cpus, i));
+        }
+        return S_OK;
+    }
+
+    IFACEMETHODIMP SetSerialization(const CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION*) { return E_NOTIMPL; }
+
+    IFACEMETHODIMP Advise(ICredentialProviderEvents* pcpe, UINT_PTR)
+    {
+        UnAdvise();
+        _pcpe = pcpe;
+        _pcpe->AddRef();
+        return S_OK;
+    }
+    IFACEMETHODIMP UnAdvise()
+    {
+        if (_pcpe != NULL)
+        {
+            _pcpe->Release();
+            _pcpe = NULL;
+        }
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetFieldDescriptorCount(DWORD* pdwCount)
+    {
+        *pdwCount = MF_COUNT;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetFieldDescriptorAt(DWORD dwIndex, CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR** ppcpfd)
+    {
+        *ppcpfd = NULL;
+        if (dwIndex >= MF_COUNT)
+        {
+            return E_INVALIDARG;
+        }
+
+        CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR* pcpfd = static_cast<CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR*>(CoTaskMemAlloc(sizeof(*pcpfd)));
+        if (pcpfd == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+        *pcpfd = s_rgFieldDescriptors[dwIndex];
+        HRESULT hr = _CoAllocString(s_rgFieldDescriptors[dwIndex].pszLabel, &pcpfd->pszLabel);
+        if (FAILED(hr))
+        {
+            CoTaskMemFree(pcpfd);
+            return hr;
+        }
+        *ppcpfd = pcpfd;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetCredentialCount(DWORD* pdwCount, DWORD* pdwDefault, BOOL* pbAutoLogonWithDefault)
+    {
+        *pdwCount = (DWORD)_rgpcpc.size();
+        *pdwDefault = CREDENTIAL_PROVIDER_NO_DEFAULT;
+        *pbAutoLogonWithDefault = FALSE;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetCredentialAt(DWORD dwIndex, ICredentialProviderCredential** ppcpc)
+    {
+        if (dwIndex >= _rgpcpc.size())
+        {
+            *ppcpc = NULL;
+            return E_INVALIDARG;
+        }
+        *ppcpc = _rgpcpc[dwIndex];
+        (*ppcpc)->AddRef();
+        return S_OK;
+    }
+
+  private:
+    ~MockProvider()
+    {
+        UnAdvise();
+        _ReleaseCredentials();
+    }
+
+    void _ReleaseCredentials()
+    {
+        for (size_t i = 0; i < _rgpcpc.size(); i++)
+        {
+            _rgpcpc[i]->Release();
+        }
+        _rgpcpc.clear();
+    }
+
+    LONG                                        _cRef;
+    unsigned long                               _cUsers;
+    ICredentialProviderEvents*                  _pcpe;
+    std::vector<ICredentialProviderCredential*> _rgpcpc;
+};
+
+// Makes a MockProvider for every CoCreateInstance of the password provider in this process.
+class MockProviderFactory : public IClassFactory
+{
+  public:
+    MockProviderFactory() : _cUsers(0) {}
+
+    IFACEMETHODIMP_(ULONG) AddRef() { return 2; }
+    IFACEMETHODIMP_(ULONG) Release() { return 1; }
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppv)
+    {
+        if (riid == IID_IUnknown || riid == IID_IClassFactory)
+        {
+            *ppv = static_cast<IClassFactory*>(this);
+            return S_OK;
+        }
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    IFACEMETHODIMP CreateInstance(IUnknown* pUnkOuter, REFIID riid, void** ppv)
+    {
+        *ppv = NULL;
+        if (pUnkOuter != NULL)
+        {
+            return CLASS_E_NOAGGREGATION;
+        }
+        MockProvider* pmp = new MockProvider(_cUsers);
+        HRESULT hr = pmp->QueryInterface(riid, ppv);
+        pmp->Release();
+        return hr;
+    }
+    IFACEMETHODIMP LockServer(BOOL) { return S_OK; }
+
+    void SetUsers(unsigned long cUsers) { _cUsers = cUsers; }
+
+  private:
+    unsigned long   _cUsers;
+};
+
+static MockProviderFactory s_mpf;
+
+HRESULT MockProviderRegister(unsigned long cUsers, DWORD* pdwCookie)
+{
+    s_mpf.SetUsers(cUsers);
+    return CoRegisterClassObject(CLSID_PasswordCredentialProvider, &s_mpf, CLSCTX_INPROC_SERVER, REGCLS_MULTIPLEUSE, pdwCookie);
+}
+
+void MockProviderUnregister(DWORD dwCookie)
+{
+    CoRevokeClassObject(dwCookie);
+}
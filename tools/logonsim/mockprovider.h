@@ -0,0 +1,18 @@
+// A stand-in for the Windows password provider, which BootPickerWrapper.dll
+// wraps. It shows a tile for each of a given number of made-up users, with the
+// fields the password provider has, and never logs anyone on. Registered with
+// CoRegisterClassObject under CLSID_PasswordCredentialProvider, it's what the
+// wrapper gets from CoCreateInstance in this process, so the wrapper can be
+// tried with any number of accounts, in any scenario, on any machine.
+
+#pragma once
+#include <windows.h>
+
+#define MOCK_PROVIDER_MAX_USERS     10000
+
+// Registers the stand-in for this process, showing cUsers tiles. *pdwCookie is for
+// MockProviderUnregister.
+HRESULT MockProviderRegister(unsigned long cUsers, DWORD* pdwCookie);
+
+// Stops CoCreateInstance handing out the stand-in. Providers already made carry on.
+void MockProviderUnregister(DWORD dwCookie);
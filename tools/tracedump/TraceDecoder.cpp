@@ -0,0 +1,248 @@
+// fopen is what the standard library has; the CRT's _s versions aren't portable.
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "TraceDecoder.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+static const char* s_rgpszMethodNames[] =
+{
+    "(none)",
+#define TRACE_METHOD_NAME(id, name)     name,
+    TRACE_METHOD_LIST(TRACE_METHOD_NAME)
+#undef TRACE_METHOD_NAME
+};
+
+const char* TraceMethodName(uint16_t usMethod)
+{
+    return (usMethod < sizeof(s_rgpszMethodNames) / sizeof(s_rgpszMethodNames[0])) ? s_rgpszMethodNames[usMethod] : "(unknown)";
+}
+
+static std::string _ModuleName(const char* pszPath)
+{
+    std::string str(pszPath);
+    size_t i = str.find_last_of("/\\");
+    if (i != std::string::npos)
+    {
+        str.erase(0, i + 1);
+    }
+    i = str.find(".trace");
+    if (i != std::string::npos)
+    {
+        str.erase(i);
+    }
+    return str;
+}
+
+bool TraceReadFile(const char* pszPath, TRACE_INPUT& input)
+{
+    FILE* pf = fopen(pszPath, "rb");
+    if (pf == NULL)
+    {
+        fprintf(stderr, "%s: can't open the file\n", pszPath);
+        return false;
+    }
+
+    bool bOk = false;
+    TRACE_FILE_HEADER tfh;
+    if ((fread(&tfh, sizeof(tfh), 1, pf) != 1) || (tfh.dwMagic != TRACE_FILE_MAGIC))
+    {
+        fprintf(stderr, "%s: not a trace file\n", pszPath);
+    }
+    else if ((tfh.usVersion != TRACE_FILE_VERSION) || (tfh.cbRecord != sizeof(TRACE_RECORD)))
+    {
+        fprintf(stderr, "%s: trace version %u with %u byte records isn't supported\n",
+                pszPath, tfh.usVersion, tfh.cbRecord);
+    }
+    else
+    {
+        size_t iModule = input.rgModules.size();
+        input.rgModules.push_back(_ModuleName(pszPath));
+
+        size_t iSession = (size_t)-1;
+        TRACE_RECORD tr;
+        while (fread(&tr, sizeof(tr), 1, pf) == 1)
+        {
+            switch (tr.bType)
+            {
+            case TRT_SESSION:
+                if (tr.session.llFrequency > 0)
+                {
+                    TRACE_SESSION session = { tr.session.ullFileTime, tr.session.llStart, tr.session.llFrequency, tr.session.dwProcessId };
+                    iSession = input.rgSessions.size();
+                    input.rgSessions.push_back(session);
+                }
+                break;
+
+            case TRT_CALL:
+                // Calls before the first session can't be placed in time.
+                if (iSession != (size_t)-1)
+                {
+                    tr.dwReserved = (uint32_t)iModule;
+                    input.rgRecords.push_back(std::make_pair(iSession, tr));
+                }
+                break;
+
+            case TRT_DROPPED:
+                input.cDropped += tr.dropped.cRecords;
+                break;
+            }
+        }
+        bOk = true;
+    }
+
+    fclose(pf);
+    return bOk;
+}
+
+// Works out how deep each call is nested in the other calls on its thread, and how
+// much of each call's time was spent in the calls nested in it.
+static void _Nest(std::vector<TRACE_CALL>& rgCalls)
+{
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<size_t> > mapStacks;
+    for (size_t i = 0; i < rgCalls.size(); i++)
+    {
+        TRACE_CALL& call = rgCalls[i];
+        std::vector<size_t>& stack = mapStacks[std::make_pair(call.dwProcessId, call.dwThreadId)];
+        while (!stack.empty())
+        {
+            const TRACE_CALL& outer = rgCalls[stack.back()];
+            if (call.dStartUs < outer.dStartUs + outer.dDurationUs)
+            {
+                break;
+            }
+            stack.pop_back();
+        }
+
+        call.nDepth = (int)stack.size();
+        if (!stack.empty())
+        {
+            rgCalls[stack.back()].dChildUs += call.dDurationUs;
+        }
+        stack.push_back(i);
+    }
+}
+
+static bool _CompareStart(const TRACE_CALL& a, const TRACE_CALL& b)
+{
+    if (a.dStartUs != b.dStartUs)
+    {
+        return a.dStartUs < b.dStartUs;
+    }
+    // An outer call and the first call nested in it can start on the same tick.
+    return a.dDurationUs > b.dDurationUs;
+}
+
+void TraceBuildTimeline(const TRACE_INPUT& input, std::vector<TRACE_CALL>& rgCalls)
+{
+    rgCalls.clear();
+    if (input.rgSessions.empty())
+    {
+        return;
+    }
+
+    // Every session is anchored to the wall clock, which is what lets calls from
+    // different processes and files share one timeline.
+    uint64_t ullOrigin = input.rgSessions[0].ullFileTime;
+    for (size_t i = 1; i < input.rgSessions.size(); i++)
+    {
+        ullOrigin = std::min(ullOrigin, input.rgSessions[i].ullFileTime);
+    }
+
+    rgCalls.reserve(input.rgRecords.size());
+    for (size_t i = 0; i < input.rgRecords.size(); i++)
+    {
+        const TRACE_SESSION& session = input.rgSessions[input.rgRecords[i].first];
+        const TRACE_RECORD& tr = input.rgRecords[i].second;
+
+        TRACE_CALL call;
+        call.strModule = input.rgModules[tr.dwReserved];
+        call.dwProcessId = session.dwProcessId;
+        call.dwThreadId = tr.call.dwThreadId;
+        call.usMethod = tr.usMethod;
+        call.bFlags = tr.bFlags;
+        call.dwFieldID = tr.call.dwFieldID;
+        call.hr = tr.call.hr;
+        call.dStartUs = (session.ullFileTime - ullOrigin) / 10.0 +
+                        (double)(tr.call.llStart - session.llStart) * 1e6 / session.llFrequency;
+        call.dDurationUs = (double)tr.call.llDuration * 1e6 / session.llFrequency;
+        call.dChildUs = 0;
+        call.nDepth = 0;
+        rgCalls.push_back(call);
+    }
+
+    std::stable_sort(rgCalls.begin(), rgCalls.end(), _CompareStart);
+    _Nest(rgCalls);
+
+    // The session is written when the dll first flushes, which can be after its first
+    // calls started, so the timeline starts at the first call instead.
+    if (!rgCalls.empty())
+    {
+        double dFirstUs = rgCalls[0].dStartUs;
+        for (size_t i = 0; i < rgCalls.size(); i++)
+        {
+            rgCalls[i].dStartUs -= dFirstUs;
+        }
+    }
+}
+
+static double _Percentile(const std::vector<double>& rgSorted, double dPercent)
+{
+    size_t i = (size_t)(dPercent / 100.0 * (rgSorted.size() - 1) + 0.5);
+    return rgSorted[i];
+}
+
+struct METHOD_TOTALS
+{
+    std::vector<double> rgDurations;
+    double dTotalUs;
+    double dSelfUs;
+    unsigned long cFailed;
+};
+
+void TraceSummarize(const std::vector<TRACE_CALL>& rgCalls, std::vector<TRACE_METHOD_STATS>& rgStats)
+{
+    // Calls into us and calls we made into the wrapped provider are kept apart, so the
+    // difference between the two is our own overhead.
+    typedef std::map<std::pair<std::string, std::pair<int, uint16_t> >, METHOD_TOTALS> TOTALS_MAP;
+    TOTALS_MAP mapTotals;
+    for (size_t i = 0; i < rgCalls.size(); i++)
+    {
+        const TRACE_CALL& call = rgCalls[i];
+        METHOD_TOTALS& totals = mapTotals[std::make_pair(call.strModule, std::make_pair((int)(call.bFlags & TRF_WRAPPED), call.usMethod))];
+        if (totals.rgDurations.empty())
+        {
+            totals.dTotalUs = totals.dSelfUs = 0;
+            totals.cFailed = 0;
+        }
+        totals.rgDurations.push_back(call.dDurationUs);
+        totals.dTotalUs += call.dDurationUs;
+        totals.dSelfUs += std::max(0.0, call.dDurationUs - call.dChildUs);
+        if (call.hr < 0)
+        {
+            totals.cFailed++;
+        }
+    }
+
+    rgStats.clear();
+    for (TOTALS_MAP::iterator it = mapTotals.begin(); it != mapTotals.end(); ++it)
+    {
+        METHOD_TOTALS& totals = it->second;
+        std::sort(totals.rgDurations.begin(), totals.rgDurations.end());
+
+        TRACE_METHOD_STATS stats;
+        stats.strModule = it->first.first;
+        stats.bWrapped = (it->first.second.first != 0);
+        stats.usMethod = it->first.second.second;
+        stats.cCalls = (unsigned long)totals.rgDurations.size();
+        stats.dTotalUs = totals.dTotalUs;
+        stats.dMeanUs = stats.dTotalUs / stats.cCalls;
+        stats.dP50Us = _Percentile(totals.rgDurations, 50);
+        stats.dP95Us = _Percentile(totals.rgDurations, 95);
+        stats.dMaxUs = totals.rgDurations.back();
+        stats.dSelfUs = totals.dSelfUs;
+        stats.cFailed = totals.cFailed;
+        rgStats.push_back(stats);
+    }
+}
@@ -0,0 +1,77 @@
+// The trace decoder reads .trace files and turns their records into calls on
+// one timeline, nested by thread, and into latency statistics per method.
+// tracedump prints what it works out; helperstest checks it against traces
+// it writes itself.
+//
+// It only uses the standard library so that a trace copied off a machine can
+// be read anywhere.
+
+#pragma once
+#include "../../helpers/TraceFormat.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+struct TRACE_CALL
+{
+    std::string strModule;      // The trace file's name, which is the dll's name.
+    uint32_t    dwProcessId;
+    uint32_t    dwThreadId;
+    uint16_t    usMethod;
+    uint8_t     bFlags;
+    uint32_t    dwFieldID;
+    int32_t     hr;
+    double      dStartUs;       // Since the first call in any of the files.
+    double      dDurationUs;
+    double      dChildUs;       // Time spent in calls nested inside this one, on the same thread.
+    int         nDepth;
+};
+
+struct TRACE_SESSION
+{
+    uint64_t    ullFileTime;
+    int64_t     llStart;
+    int64_t     llFrequency;
+    uint32_t    dwProcessId;
+};
+
+// What has been read from the trace files so far. Call records are kept with the session
+// that precedes them and converted to wall clock time once every file has been read.
+struct TRACE_INPUT
+{
+    std::vector<TRACE_SESSION>                      rgSessions;
+    std::vector<std::pair<size_t, TRACE_RECORD> >   rgRecords;
+    std::vector<std::string>                        rgModules;
+    unsigned long                                   cDropped;
+
+    TRACE_INPUT() : cDropped(0) {}
+};
+
+// The calls into one method of one module, or the calls a module made into the wrapped
+// provider's method.
+struct TRACE_METHOD_STATS
+{
+    std::string     strModule;
+    uint16_t        usMethod;
+    bool            bWrapped;
+    unsigned long   cCalls;
+    double          dTotalUs;
+    double          dMeanUs;
+    double          dP50Us;
+    double          dP95Us;
+    double          dMaxUs;
+    double          dSelfUs;    // Time spent in the method itself rather than in calls nested in it.
+    unsigned long   cFailed;
+};
+
+//the name of a TM_ method id
+const char* TraceMethodName(uint16_t usMethod);
+
+//adds the records in the file at pszPath to input, or says on stderr why it can't
+bool TraceReadFile(const char* pszPath, TRACE_INPUT& input);
+
+//places every call read into input on one timeline, nested by thread, starting at the first call
+void TraceBuildTimeline(const TRACE_INPUT& input, std::vector<TRACE_CALL>& rgCalls);
+
+//works out the statistics of each module's methods, ordered by module, then wrapped, then method
+void TraceSummarize(const std::vector<TRACE_CALL>& rgCalls, std::vector<TRACE_METHOD_STATS>& rgStats);
@@ -0,0 +1,115 @@
+// tracedump turns the .trace files written by BootPicker.dll and
+// BootPickerWrapper.dll into something readable. By default it prints a
+// timeline of every call, nested by thread; -s prints a table of latencies per
+// method instead.
+//
+// Reading the files and working out the nesting and the statistics is done by
+// TraceDecoder.cpp; this file just prints what it finds.
+
+#include "TraceDecoder.h"
+#include <cstdio>
+#include <cstring>
+
+static void _PrintTimeline(const std::vector<TRACE_CALL>& rgCalls)
+{
+    printf("%12s %10s %6s %6s  %-24s %s\n", "start ms", "us", "pid", "tid", "module", "call");
+    for (size_t i = 0; i < rgCalls.size(); i++)
+    {
+        const TRACE_CALL& call = rgCalls[i];
+        printf("%12.3f %10.1f %6u %6u  %-24s %*s%s", call.dStartUs / 1000.0, call.dDurationUs,
+               call.dwProcessId, call.dwThreadId, call.strModule.c_str(), call.nDepth * 2, "",
+               TraceMethodName(call.usMethod));
+        if (call.dwFieldID != TRACE_NO_FIELD)
+        {
+            printf(" field=%u", call.dwFieldID);
+        }
+        if (call.hr != 0)
+        {
+            printf(" hr=0x%08x", (uint32_t)call.hr);
+        }
+        if (call.bFlags & TRF_WRAPPED)
+        {
+            printf(" [wrapped]");
+        }
+        printf("\n");
+    }
+}
+
+static void _PrintSummary(const std::vector<TRACE_CALL>& rgCalls)
+{
+    std::vector<TRACE_METHOD_STATS> rgStats;
+    TraceSummarize(rgCalls, rgStats);
+
+    printf("%-24s %-48s %7s %11s %9s %9s %9s %9s %11s %6s\n", "module", "method", "calls", "total us",
+           "mean us", "p50 us", "p95 us", "max us", "self us", "failed");
+    for (size_t i = 0; i < rgStats.size(); i++)
+    {
+        const TRACE_METHOD_STATS& stats = rgStats[i];
+        std::string strMethod = TraceMethodName(stats.usMethod);
+        if (stats.bWrapped)
+        {
+            strMethod += " [wrapped]";
+        }
+
+        printf("%-24s %-48s %7lu %11.1f %9.1f %9.1f %9.1f %9.1f %11.1f %6lu\n", stats.strModule.c_str(),
+               strMethod.c_str(), stats.cCalls, stats.dTotalUs, stats.dMeanUs, stats.dP50Us, stats.dP95Us,
+               stats.dMaxUs, stats.dSelfUs, stats.cFailed);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool bSummary = false;
+    std::vector<const char*> rgpszFiles;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0)
+        {
+            bSummary = true;
+        }
+        else
+        {
+            rgpszFiles.push_back(argv[i]);
+        }
+    }
+
+    if (rgpszFiles.empty())
+    {
+        fprintf(stderr, "usage: tracedump [-s] file.trace [file.trace ...]\n"
+                        "  -s  print per-method latencies instead of the timeline\n");
+        return 2;
+    }
+
+    TRACE_INPUT input;
+    for (size_t i = 0; i < rgpszFiles.size(); i++)
+    {
+        if (!TraceReadFile(rgpszFiles[i], input))
+        {
+            return 1;
+        }
+    }
+
+    if (input.rgSessions.empty())
+    {
+        printf("no calls were traced\n");
+        return 0;
+    }
+
+    std::vector<TRACE_CALL> rgCalls;
+    TraceBuildTimeline(input, rgCalls);
+
+    if (bSummary)
+    {
+        _PrintSummary(rgCalls);
+    }
+    else
+    {
+        _PrintTimeline(rgCalls);
+    }
+
+    if (input.cDropped > 0)
+    {
+        printf("\n%lu records were dropped because the trace buffer was full\n", input.cDropped);
+    }
+    return 0;
+}